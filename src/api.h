@@ -5,8 +5,12 @@
 #define MPRIS_SCROBBLER_API_H
 
 #include "md5.h"
+#include "http_buffer.h"
+#include "http_arena.h"
 
+#include <ctype.h>
 #include <json-c/json.h>
+#include <strings.h>
 
 #define MIN_TRACK_LENGTH                30.0 // seconds
 #define NOW_PLAYING_DELAY               65.0 //seconds
@@ -30,6 +34,13 @@ enum api_return_status {
     status_ok           // ok == bool true
 };
 
+enum api_track_status {
+    track_accepted = 0,
+    track_ignored,  // the service won't ever accept the track
+    track_deferred, // the service can accept the track at a later time
+    track_unknown,  // the response doesn't tell, the track is submitted again a limited number of times
+};
+
 struct api_response {
     struct api_error *error;
     enum api_return_status status;
@@ -55,42 +66,97 @@ struct api_endpoint {
 #include "listenbrainz_api.h"
 
 #define HTTP_HEADER_CONTENT_TYPE "Content-Type"
+#define HTTP_HEADER_RETRY_AFTER "Retry-After"
 
-static char *http_response_headers_content_type(const struct http_response *res)
+static char *http_response_header_value(const struct http_response *res, const char *name)
 {
     assert(res->headers);
     const size_t headers_count = arrlen(res->headers);
     for (size_t i = 0; i < headers_count; i++) {
         struct http_header *current = res->headers[i];
 
-        if(strncmp(current->name, HTTP_HEADER_CONTENT_TYPE, strlen(HTTP_HEADER_CONTENT_TYPE)) == 0) {
+        // NOTE(marius): header names are case insensitive, and HTTP/2 sends them in lower case
+        if(strncasecmp(current->name, name, strlen(name)) == 0) {
              return current->value;
         }
     }
     return NULL;
 }
 
-#if 0
-static void http_response_parse_json_body(struct http_response *res)
+static char *http_response_headers_content_type(const struct http_response *res)
 {
-    if (NULL == res) { return; }
-    if (res->code >= 500) { return; }
+    return http_response_header_value(res, HTTP_HEADER_CONTENT_TYPE);
+}
+
+/*
+ * Returns the seconds the service asked us to wait before the next request, or 0 if it didn't.
+ * Retry-After holds either a number of seconds or an HTTP date.
+ */
+static long http_response_retry_after(const struct http_response *res, const time_t now)
+{
+    if (NULL == res->headers) { return 0; }
+    const char *value = http_response_header_value(res, HTTP_HEADER_RETRY_AFTER);
+    if (NULL == value) { return 0; }
+
+    char *end = NULL;
+    const long seconds = strtol(value, &end, 10);
+    if (end != value && (*end == '\0' || isspace((unsigned char)*end))) {
+        return seconds > 0 ? seconds : 0;
+    }
+    const time_t date = curl_getdate(value, NULL);
+    if (date <= now) { return 0; }
+    return (long)(date - now);
+}
+
+static bool http_response_may_be_json(const struct http_response *res)
+{
+    if (NULL == res->headers) { return true; }
+    const char *content_type = http_response_headers_content_type(res);
+    if (NULL == content_type) { return true; }
+    return strncasecmp(content_type, CONTENT_TYPE_JSON, strlen(CONTENT_TYPE_JSON)) == 0;
+}
 
-    json_object *obj = json_tokener_parse(res->body);
-    if (NULL == obj) {
-        _warn("json::parse_error");
+/*
+ * The tokener of a response that belongs to a connection is kept for its next response.
+ */
+static void http_response_release_tokener(struct http_response *res)
+{
+    if (NULL == res->tokener) { return; }
+    if (NULL != res->arena) {
+        json_tokener_reset(res->tokener);
+        return;
     }
-    if (json_object_array_length(obj) < 1) {
-        _warn("json::invalid_json_message");
+    json_tokener_free(res->tokener);
+    res->tokener = NULL;
+}
+
+/*
+ * Feeds a chunk of the response body to the JSON tokener, so the document is ready once the transfer is done.
+ * Parsing stops at the first error, the raw body is still available for logging.
+ */
+static void http_response_parse_json_chunk(struct http_response *res, const char *data, const size_t length)
+{
+    if (NULL != res->json || res->json_failed) { return; }
+    if (!http_response_may_be_json(res)) { return; }
+
+    if (NULL == res->tokener) {
+        res->tokener = json_tokener_new();
+        if (NULL == res->tokener) {
+            res->json_failed = true;
+            return;
+        }
     }
-    _trace("json::obj_cnt: %d", json_object_array_length(obj));
-#if 0
-    if (json_object_type(object, json_type_object)) {
-        json_object_object_get_ex();
+    res->json = json_tokener_parse_ex(res->tokener, data, (int)length);
+
+    const enum json_tokener_error err = json_tokener_get_error(res->tokener);
+    if (NULL == res->json && err != json_tokener_continue) {
+        _debug("json::parse_error: %s", json_tokener_error_desc(err));
+        res->json_failed = true;
+    }
+    if (NULL != res->json || res->json_failed) {
+        http_response_release_tokener(res);
     }
-#endif
 }
-#endif
 
 static void api_endpoint_free(struct api_endpoint *api)
 {
@@ -306,11 +372,17 @@ static size_t endpoint_get_path(char *result, const enum api_type type, const en
     return path_len;
 }
 
-static struct api_endpoint *endpoint_new(const struct api_credentials *creds, const enum end_point_type api_endpoint)
+static struct api_endpoint *endpoint_new(struct http_arena *arena, const struct api_credentials *creds, const enum end_point_type api_endpoint)
 {
     if (NULL == creds) { return NULL; }
 
-    struct api_endpoint *result = calloc(1, sizeof(struct api_endpoint));
+    struct api_endpoint *result = NULL;
+    if (NULL != arena) {
+        result = http_arena_alloc(arena, sizeof(struct api_endpoint));
+    } else {
+        result = calloc(1, sizeof(struct api_endpoint));
+    }
+    if (NULL == result) { return NULL; }
 
     const enum api_type type = creds->end_point;
     endpoint_get_scheme(result->scheme, creds->url);
@@ -322,12 +394,12 @@ static struct api_endpoint *endpoint_new(const struct api_credentials *creds, co
 
 static struct api_endpoint *auth_endpoint_new(const struct api_credentials *creds)
 {
-    return endpoint_new(creds, authorization_endpoint);
+    return endpoint_new(NULL, creds, authorization_endpoint);
 }
 
-struct api_endpoint *api_endpoint_new(const struct api_credentials *creds)
+struct api_endpoint *api_endpoint_new(struct http_arena *arena, const struct api_credentials *creds)
 {
-    return endpoint_new(creds, scrobble_endpoint);
+    return endpoint_new(arena, creds, scrobble_endpoint);
 }
 
 #if 0
@@ -379,40 +451,57 @@ static void http_header_free(struct http_header *header)
 static void http_headers_free(struct http_header **headers)
 {
     if (NULL == headers) { return; }
-    if (NULL == *headers) { return; }
     const size_t headers_count = arrlen(headers);
-    if (headers_count > 0) {
-        for (int i = (int)headers_count - 1; i >= 0 ; i--) {
-            if (NULL != headers[i]) {
-                struct http_header *header = arrpop(headers);
-                http_header_free(header);
-            }
-        }
-        assert(arrlen(headers) == 0);
-        arrfree(headers);
+    for (int i = (int)headers_count - 1; i >= 0 ; i--) {
+        struct http_header *header = arrpop(headers);
+        http_header_free(header);
     }
+    assert(arrlen(headers) == 0);
+    arrfree(headers);
+}
+
+/*
+ * The headers that were allocated in an arena are released with it, their array keeps its capacity for the next
+ * request of the connection.
+ */
+static struct http_header **http_headers_clean(struct http_header **headers, const struct http_arena *arena)
+{
+    if (NULL == headers) { return NULL; }
+    if (NULL == arena) {
+        http_headers_free(headers);
+        return NULL;
+    }
+    arrdeln(headers, 0, arrlen(headers));
+    return headers;
 }
 
 static void http_request_clean(struct http_request *req)
 {
     if (NULL == req) { return; }
     if (NULL != req->url) { curl_url_cleanup(req->url); }
+    req->url = NULL;
 
-    api_endpoint_free(req->end_point);
-    http_headers_free(req->headers);
+    if (NULL == req->arena) {
+        api_endpoint_free(req->end_point);
+    }
+    req->end_point = NULL;
+    req->headers = http_headers_clean(req->headers, req->arena);
+    http_buffer_clean(&req->body);
 }
 
+/*
+ * NOTE(marius): the arena and the headers array are left alone, the connection that owns the request sets them
+ */
 static void http_request_init(struct http_request *req)
 {
     req->url         = curl_url();
-    memset(&req->body, 0x0, MAX_BODY_SIZE);
-    req->body_length = 0;
+    http_buffer_init(&req->body);
     req->end_point   = NULL;
-    req->headers     = NULL;
+    req->request_type = http_get;
     time(&req->time);
 }
 
-static void print_http_request(const struct http_request *req)
+static void print_http_request(struct http_request *req)
 {
     char *url;
     curl_url_get(req->url, CURLUPART_URL, &url, MPRIS_CURLU_FLAGS);
@@ -427,7 +516,7 @@ static void print_http_request(const struct http_request *req)
         }
     }
     if (req->request_type != http_get) {
-        _trace("http::req[%zu]: %s", req->body_length, req->body);
+        _trace("http::req[%zu]: %s", req->body.length, http_buffer_data(&req->body));
     }
 }
 
@@ -518,8 +607,8 @@ static void api_get_auth_url(CURLU *auth_url, const struct api_credentials *cred
            break;
     }
     const char *api_key = api_get_application_key(type);
-    append_api_key_query_param(auth_url, api_key, NULL, NULL);
-    append_token_query_param(auth_url, token, NULL);
+    append_query_param(auth_url, "api_key", api_key);
+    append_query_param(auth_url, "token", token);
 
     api_endpoint_free(auth_endpoint);
 }
@@ -533,7 +622,7 @@ static void api_build_request_get_token(struct scrobbler_connection *conn)
             break;
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_build_request_get_token(req, &auth, conn->handle);
+            audioscrobbler_api_build_request_get_token(req, &auth);
             break;
         case api_unknown:
         default:
@@ -550,7 +639,7 @@ static void api_build_request_get_session(struct scrobbler_connection *conn)
             break;
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_build_request_get_session(req, &auth, conn->handle);
+            audioscrobbler_api_build_request_get_session(req, &auth);
             break;
         case api_unknown:
         default:
@@ -569,7 +658,7 @@ static void api_build_request_now_playing(struct scrobbler_connection *conn, con
             break;
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_build_request_now_playing(req, tracks, track_count, auth, conn->handle);
+            audioscrobbler_api_build_request_now_playing(req, tracks, track_count, auth);
             break;
         case api_unknown:
         default:
@@ -577,7 +666,7 @@ static void api_build_request_now_playing(struct scrobbler_connection *conn, con
     }
 }
 
-static void api_build_request_scrobble(struct scrobbler_connection *conn, const struct scrobble *tracks[MAX_QUEUE_LENGTH],
+static void api_build_request_scrobble(struct scrobbler_connection *conn, const struct scrobble *tracks[MAX_SCROBBLE_BATCH],
     const unsigned track_count)
 {
     struct http_request *req = &conn->request;
@@ -589,7 +678,7 @@ static void api_build_request_scrobble(struct scrobbler_connection *conn, const
             break;
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_build_request_scrobble(req, tracks, track_count, auth, conn->handle);
+            audioscrobbler_api_build_request_scrobble(req, tracks, track_count, auth);
             break;
         case api_unknown:
         default:
@@ -597,24 +686,27 @@ static void api_build_request_scrobble(struct scrobbler_connection *conn, const
     }
 }
 
-static struct http_header *http_header_new(void)
+static struct http_header *http_header_new(struct http_arena *arena)
 {
+    if (NULL != arena) {
+        return http_arena_alloc(arena, sizeof(struct http_header));
+    }
     struct http_header *header = calloc(1, sizeof(struct http_header));
     return header;
 }
 
-struct http_header *http_content_type_header_new (void)
+struct http_header *http_content_type_header_new (struct http_arena *arena)
 {
-    struct http_header *header = http_header_new();
+    struct http_header *header = http_header_new(arena);
     strncpy(header->name, HTTP_HEADER_CONTENT_TYPE, (MAX_HEADER_NAME_LENGTH - 1));
     strncpy(header->value, CONTENT_TYPE_JSON, (MAX_HEADER_VALUE_LENGTH - 1));
 
     return header;
 }
 
-struct http_header *http_authorization_header_new (const char *token)
+struct http_header *http_authorization_header_new (struct http_arena *arena, const char *token)
 {
-    struct http_header *header = http_header_new();
+    struct http_header *header = http_header_new(arena);
     strncpy(header->name, API_HEADER_AUTHORIZATION_NAME, (MAX_HEADER_NAME_LENGTH - 1));
     snprintf(header->value, MAX_HEADER_VALUE_LENGTH, API_HEADER_AUTHORIZATION_VALUE_TOKENIZED, token);
 
@@ -625,16 +717,18 @@ static void http_response_clean(struct http_response *res)
 {
     if (NULL == res) { return; }
 
-    memset(res->body, 0x0, MAX_BODY_SIZE);
-    res->body_length = 0;
-    if (NULL != res->headers) {
-        http_headers_free(res->headers);
+    http_buffer_clean(&res->body);
+    http_response_release_tokener(res);
+    if (NULL != res->json) {
+        json_object_put(res->json);
     }
-    res->headers = NULL;
+    res->json = NULL;
+    res->json_failed = false;
+    res->headers = http_headers_clean(res->headers, res->arena);
     res->code = -1;
 }
 
-static void http_request_print(const struct http_request *req, const enum log_levels log)
+static void http_request_print(struct http_request *req, const enum log_levels log)
 {
     assert(req->url);
     char *url;
@@ -642,9 +736,8 @@ static void http_request_print(const struct http_request *req, const enum log_le
     _log(log, "  request[%s]: %s", (req->request_type == http_get ? "GET" : "POST"), url);
     curl_free(url);
 
-    assert(req->body);
-    if (req->body_length > 0) {
-        _log(log, "    request::body(%zu): %s", req->body_length, req->body);
+    if (req->body.length > 0) {
+        _log(log, "    request::body(%zu): %s", req->body.length, http_buffer_data(&req->body));
     }
     if (log != log_tracing2) { return; }
 
@@ -659,15 +752,15 @@ static void http_request_print(const struct http_request *req, const enum log_le
     }
 }
 
-static void http_response_print(const struct http_response *res, const enum log_levels log)
+static void http_response_print(struct http_response *res, const enum log_levels log)
 {
     if (NULL == res) { return; }
 
     _log(log, "  response::status: %zd ", res->code);
     if (res->code < 100) { return; }
 
-    if (res->body_length > 0) {
-        _log(log, "    response(%p:%lu): %s", res, res->body_length, res->body);
+    if (res->body.length > 0) {
+        _log(log, "    response(%p:%lu): %s", res, res->body.length, http_buffer_data(&res->body));
     }
     if (log != log_tracing2) { return; }
 
@@ -683,18 +776,22 @@ static void http_response_print(const struct http_response *res, const enum log_
     }
 }
 
+/*
+ * NOTE(marius): the arena, the headers array and the tokener are left alone, the connection that owns the response
+ * sets them
+ */
 static void http_response_init(struct http_response *res)
 {
-    memset(res->body, 0x0, sizeof(res->body));
+    http_buffer_init(&res->body);
     res->code = -1;
-    res->body_length = 0;
-    res->headers = NULL;
+    res->json = NULL;
+    res->json_failed = false;
 }
 
 static struct http_response *http_response_new(void)
 {
-    struct http_response *res = malloc(sizeof(struct http_response));
-    http_response_clean(res);
+    struct http_response *res = calloc(1, sizeof(struct http_response));
+    http_response_init(res);
     return res;
 }
 
@@ -716,15 +813,15 @@ static void http_header_load(const char *data, const size_t length, struct http_
     strncpy(h->value, scol_pos + 2, value_length - 2); // skip : and space
 }
 
-static bool json_document_is_error(const char *buffer, const size_t length, enum api_type type)
+static bool json_document_is_error(json_object *root, enum api_type type)
 {
     switch (type) {
         case api_lastfm:
         case api_librefm:
-            return audioscrobbler_json_document_is_error(buffer, length);
+            return audioscrobbler_json_document_is_error(root);
             break;
         case api_listenbrainz:
-            return listenbrainz_json_document_is_error(buffer, length);
+            return listenbrainz_json_document_is_error(root);
             break;
         case api_unknown:
         default:
@@ -733,12 +830,29 @@ static bool json_document_is_error(const char *buffer, const size_t length, enum
     return false;
 }
 
-static void api_response_get_token_json(const char *buffer, const size_t length, struct api_credentials *credentials)
+/*
+ * ListenBrainz accepts or rejects a submission as a whole, Last.fm reports the status of each track.
+ */
+static enum api_track_status api_response_track_status(json_object *root, const size_t index, const enum api_type type)
+{
+    switch (type) {
+        case api_lastfm:
+        case api_librefm:
+            return audioscrobbler_api_response_track_status(root, index);
+        case api_listenbrainz:
+        case api_unknown:
+        default:
+            break;
+    }
+    return track_accepted;
+}
+
+static void api_response_get_token_json(json_object *root, struct api_credentials *credentials)
 {
     switch (credentials->end_point) {
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_response_get_token_json(buffer, length, credentials);
+            audioscrobbler_api_response_get_token_json(root, credentials);
             break;
         case api_listenbrainz:
         case api_unknown:
@@ -747,12 +861,12 @@ static void api_response_get_token_json(const char *buffer, const size_t length,
     }
 }
 
-static void api_response_get_session_key_json(const char *buffer, const size_t length, struct api_credentials *credentials)
+static void api_response_get_session_key_json(json_object *root, struct api_credentials *credentials)
 {
     switch (credentials->end_point) {
         case api_lastfm:
         case api_librefm:
-            audioscrobbler_api_response_get_session_key_json(buffer, length, credentials);
+            audioscrobbler_api_response_get_session_key_json(root, credentials);
             break;
         case api_listenbrainz:
         case api_unknown:
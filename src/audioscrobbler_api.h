@@ -44,6 +44,11 @@
 #define API_ERROR_NODE_NAME             "error"
 #define API_ERROR_MESSAGE_NAME          "message"
 #define API_ERROR_CODE_ATTR_NAME        "code"
+#define API_ATTRIBUTES_NODE_NAME        "@attr"
+#define API_ACCEPTED_ATTR_NAME          "accepted"
+#define API_TEXT_NODE_NAME              "#text"
+
+#define API_IGNORED_DAILY_LIMIT         5
 
 #define API_METHOD_NOW_PLAYING          "track.updateNowPlaying"
 #define API_METHOD_SCROBBLE             "track.scrobble"
@@ -143,39 +148,33 @@ static bool audioscrobbler_scrobble_is_valid(const struct scrobble *s)
     return result;
 }
 
-static void audioscrobbler_api_response_get_session_key_json(const char *buffer, const size_t length, struct api_credentials *credentials)
+static void audioscrobbler_api_response_get_session_key_json(json_object *root, struct api_credentials *credentials)
 {
-    if (NULL == buffer) { return; }
-    if (length == 0) { return; }
-
-    struct json_tokener *tokener = json_tokener_new();
-    if (NULL == tokener) { return; }
-    json_object *root = json_tokener_parse_ex(tokener, buffer, (int)length);
     if (NULL == root) {
         _warn("json::invalid_json_message");
-        goto _exit;
+        return;
     }
-    if (json_object_object_length(root) < 1) {
+    if (!json_object_is_type(root, json_type_object) || json_object_object_length(root) < 1) {
         _warn("json::no_root_object");
-        goto _exit;
+        return;
     }
     json_object *sess_object = NULL;
     if (!json_object_object_get_ex(root, API_SESSION_NODE_NAME, &sess_object) || NULL == sess_object) {
         _warn("json:missing_session_object");
-        goto _exit;
+        return;
     }
     if (!json_object_is_type(sess_object, json_type_object)) {
         _warn("json::session_is_not_object");
-        goto _exit;
+        return;
     }
     json_object *key_object = NULL;
     if (!json_object_object_get_ex(sess_object, API_KEY_NODE_NAME, &key_object) || NULL == key_object) {
         _warn("json:missing_key");
-        goto _exit;
+        return;
     }
     if (!json_object_is_type(key_object, json_type_string)) {
         _warn("json::key_is_not_string");
-        goto _exit;
+        return;
     }
     const char *session_key = json_object_get_string(key_object);
     memcpy((char*)credentials->session_key, session_key, strlen(session_key));
@@ -183,85 +182,104 @@ static void audioscrobbler_api_response_get_session_key_json(const char *buffer,
 
     json_object *name_object = NULL;
     if (!json_object_object_get_ex(sess_object, API_NAME_NODE_NAME, &name_object) || NULL == name_object) {
-        goto _exit;
+        return;
     }
     if (!json_object_is_type(name_object, json_type_string)) {
-        goto _exit;
+        return;
     }
     const char *name = json_object_get_string(name_object);
     memcpy((char*)credentials->user_name, name, min(USER_NAME_MAX, strlen(name)));
     _info("json::loaded_session_user: %s", name);
-
-_exit:
-    if (NULL != root) { json_object_put(root); }
-    json_tokener_free(tokener);
 }
 
-static void audioscrobbler_api_response_get_token_json(const char *buffer, const size_t length, struct api_credentials *credentials)
+static void audioscrobbler_api_response_get_token_json(json_object *root, struct api_credentials *credentials)
 {
-    if (NULL == buffer) { return; }
-    if (length == 0) { return; }
-
-    struct json_tokener *tokener = json_tokener_new();
-    json_object *root = json_tokener_parse_ex(tokener, buffer, (int)length);
     if (NULL == root) {
         _warn("json::invalid_json_message");
-        goto _exit;
+        return;
     }
-    if (json_object_object_length(root) < 1) {
+    if (!json_object_is_type(root, json_type_object) || json_object_object_length(root) < 1) {
         _warn("json::no_root_object");
-        goto _exit;
+        return;
     }
     json_object *tok_object = NULL;
     if (!json_object_object_get_ex(root, API_TOKEN_NODE_NAME, &tok_object) || NULL == tok_object) {
         _warn("json:missing_token_key");
-        goto _exit;
+        return;
     }
     if (!json_object_is_type(tok_object, json_type_string)) {
         _warn("json::token_is_not_string");
-        goto _exit;
+        return;
     }
     const char *value = json_object_get_string(tok_object);
     memcpy((char*)credentials->token, value, min(MAX_SECRET_LENGTH, strlen(value)));
     _info("json::loaded_token: %s", value);
-
-_exit:
-    if (NULL != root) { json_object_put(root); }
-    json_tokener_free(tokener);
 }
 
-static bool audioscrobbler_json_document_is_error(const char *buffer, const size_t length)
+static bool audioscrobbler_json_document_is_error(json_object *root)
 {
     // {"error":14,"message":"This token has not yet been authorised"}
-    bool result = false;
-
-    if (NULL == buffer) { return result; }
-    if (length == 0) { return result; }
+    if (NULL == root || !json_object_is_type(root, json_type_object)) { return false; }
+    if (json_object_object_length(root) < 1) { return false; }
 
     json_object *err_object = NULL;
     json_object *msg_object = NULL;
-
-    struct json_tokener *tokener = json_tokener_new();
-    if (NULL == tokener) { return result; }
-    json_object *root = json_tokener_parse_ex(tokener, buffer, (int)length);
-
-    if (NULL == root || json_object_object_length(root) < 1) {
-        goto _exit;
-    }
     json_object_object_get_ex(root, API_ERROR_NODE_NAME, &err_object);
     json_object_object_get_ex(root, API_ERROR_MESSAGE_NAME, &msg_object);
     if (NULL == err_object || !json_object_is_type(err_object, json_type_int)) {
-        goto _exit;
+        return false;
     }
     if (NULL == msg_object || !json_object_is_type(msg_object, json_type_string)) {
-        goto _exit;
+        return false;
     }
-    result = true;
+    return true;
+}
 
-_exit:
-    if (NULL != root) { json_object_put(root); }
-    json_tokener_free(tokener);
-    return result;
+/*
+ * The scrobble response lists the tracks in the order of their index in the request:
+ * {"scrobbles":{"scrobble":[{..., "ignoredMessage":{"code":"0","#text":""}}],"@attr":{"accepted":1,"ignored":0}}}
+ * When a single track was submitted "scrobble" is an object instead of an array.
+ * NOTE(marius): a response that doesn't have the status of the track doesn't count as accepting it
+ */
+static enum api_track_status audioscrobbler_api_response_track_status(json_object *root, const size_t index)
+{
+    if (NULL == root || !json_object_is_type(root, json_type_object)) { return track_unknown; }
+
+    json_object *scrobbles = NULL;
+    if (!json_object_object_get_ex(root, API_SCROBBLES_NODE_NAME, &scrobbles) || !json_object_is_type(scrobbles, json_type_object)) {
+        return track_unknown;
+    }
+    json_object *scrobble = NULL;
+    if (!json_object_object_get_ex(scrobbles, API_SCROBBLE_NODE_NAME, &scrobble) || NULL == scrobble) {
+        return track_unknown;
+    }
+    if (json_object_is_type(scrobble, json_type_array)) {
+        if (index >= json_object_array_length(scrobble)) { return track_unknown; }
+        scrobble = json_object_array_get_idx(scrobble, index);
+    } else if (index > 0) {
+        return track_unknown;
+    }
+
+    json_object *ignored = NULL;
+    if (NULL == scrobble || !json_object_is_type(scrobble, json_type_object) ||
+        !json_object_object_get_ex(scrobble, API_IGNORED_NODE_NAME, &ignored) || !json_object_is_type(ignored, json_type_object)) {
+        return track_unknown;
+    }
+    json_object *code = NULL;
+    if (!json_object_object_get_ex(ignored, API_ERROR_CODE_ATTR_NAME, &code) || NULL == code) {
+        return track_unknown;
+    }
+    // NOTE(marius): the code is sent as a string, json_object_get_int parses it
+    const int ignored_code = json_object_get_int(code);
+    if (ignored_code == 0) {
+        return track_accepted;
+    }
+
+    json_object *message = NULL;
+    json_object_object_get_ex(ignored, API_TEXT_NODE_NAME, &message);
+    _info("scrobbler::track_ignored[%zu]: (%d) %s", index, ignored_code, NULL != message ? json_object_get_string(message) : "");
+
+    return ignored_code == API_IGNORED_DAILY_LIMIT ? track_deferred : track_ignored;
 }
 
 static bool audioscrobbler_valid_api_credentials(const struct api_credentials *auth)
@@ -281,103 +299,172 @@ static bool audioscrobbler_valid_credentials(const struct api_credentials *auth)
 
 #define MD5_DIGEST_LENGTH 16
 #define MD5_HEX_LENGTH (2 * MD5_DIGEST_LENGTH + 2)
+static void api_signature_hex(const uint8_t *digest, char *result)
+{
+    static const char hex[] = "0123456789abcdef";
+    for (size_t n = 0; n < MD5_DIGEST_LENGTH; n++) {
+        result[2 * n] = hex[digest[n] >> 4];
+        result[2 * n + 1] = hex[digest[n] & 0x0f];
+    }
+    result[2 * MD5_DIGEST_LENGTH] = '\0';
+}
+
 static void api_get_signature(const char *string, const char *secret, char *result)
 {
     if (NULL == string) { return; }
     if (NULL == secret) { return; }
     if (NULL == result) { return; }
-    const size_t string_len = strlen(string);
-    const size_t secret_len = strlen(secret);
-    const size_t len = string_len + secret_len;
-    char sig[MAX_BODY_SIZE+1] = {0};
 
-    // TODO(marius): this needs to change to memcpy or strncpy
-    strncat(sig, string, MAX_BODY_SIZE);
-    strncat(sig, secret, MAX_PROPERTY_LENGTH/2);
+    struct md5_context ctx;
+    md5_init(&ctx);
+    md5_update(&ctx, (const uint8_t*)string, strlen(string));
+    md5_update(&ctx, (const uint8_t*)secret, strnlen(secret, MAX_PROPERTY_LENGTH/2));
+
+    uint8_t sig_hash[MD5_DIGEST_LENGTH] = {0};
+    md5_final(&ctx, sig_hash);
+    api_signature_hex(sig_hash, result);
+}
 
-    unsigned char sig_hash[MD5_DIGEST_LENGTH] = {0};
+/*
+ * Builds the form encoded body of a request together with its method signature.
+ * The signature is the MD5 hash of the parameter names and values, sorted by name, followed by the secret. The
+ * parameters can be appended in any order: they go to the body right away, and their names and raw values are kept
+ * on the side, one after the other, until they get sorted for the signature.
+ */
+// NOTE(marius): five parameters for every track of a batch, and the ones of the request
+#define API_SIGNED_FORM_MAX_PARAMS (5 * MAX_SCROBBLE_BATCH + 4)
+
+struct api_signed_form {
+    struct http_buffer *body;
+    struct http_buffer params;
+    size_t offsets[API_SIGNED_FORM_MAX_PARAMS];
+    size_t count;
+};
 
-    md5((uint8_t*)sig, len, sig_hash);
+static void api_signed_form_init(struct api_signed_form *form, struct http_buffer *body)
+{
+    form->body = body;
+    http_buffer_init(&form->params);
+    form->count = 0;
+}
 
-    for (size_t n = 0; n < MD5_DIGEST_LENGTH; n++) {
-        snprintf(result + 2 * n, 3, "%02x", sig_hash[n]);
-    }
+static void api_signed_form_append(struct api_signed_form *form, const char *name, const char *value)
+{
+    assert(name);
+    assert(value);
+
+    assert(form->count < API_SIGNED_FORM_MAX_PARAMS);
+    if (form->count >= API_SIGNED_FORM_MAX_PARAMS) { return; }
+
+    http_buffer_append_string(form->body, name);
+    http_buffer_append(form->body, "=", 1);
+    http_buffer_append_escaped(form->body, value);
+    http_buffer_append(form->body, "&", 1);
+
+    // NOTE(marius): the name and the value are kept with their NUL bytes, so the value follows right after the name
+    form->offsets[form->count] = form->params.length;
+    form->count++;
+    http_buffer_append(&form->params, name, strlen(name) + 1);
+    http_buffer_append(&form->params, value, strlen(value) + 1);
 }
 
-static void append_method_query_param(CURL *url, const char *method, char *sig_base)
+static void api_signed_form_append_indexed(struct api_signed_form *form, const char *name, const size_t index, const char *value)
 {
-    char query_param[MAX_URL_LENGTH + 1] = {0};
-    snprintf(query_param, MAX_URL_LENGTH, "method=%s", method);
-    curl_url_set(url, CURLUPART_QUERY, query_param, CURLU_APPENDQUERY);
+    char indexed_name[MAX_PROPERTY_LENGTH + 1] = {0};
+    snprintf(indexed_name, MAX_PROPERTY_LENGTH, "%s[%zu]", name, index);
+    api_signed_form_append(form, indexed_name, value);
+}
 
-    strncat(sig_base, "method", 7);
-    // NOTE(marius): 22 is the length of the longest method: API_METHOD_NOW_PLAYING
-    strncat(sig_base, method, 22);
+static int api_signed_param_compare(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
 }
 
-static void append_api_key_query_param(CURL *url, const char *api_key, CURL *handle, char *sig_base)
+static void api_signed_form_sign(struct api_signed_form *form, const char *secret)
 {
-    char query_param[MAX_URL_LENGTH + 1] = {0};
-    snprintf(query_param, MAX_URL_LENGTH, "api_key=%s", api_key);
-    curl_url_set(url, CURLUPART_QUERY, query_param, CURLU_APPENDQUERY|CURLU_URLENCODE);
+    const char *data = http_buffer_data(&form->params);
+    const char *names[API_SIGNED_FORM_MAX_PARAMS];
+    for (size_t i = 0; i < form->count; i++) {
+        names[i] = data + form->offsets[i];
+    }
+    // NOTE(marius): the names sort byte by byte, so "album[10]" comes before "album[2]"
+    qsort(names, form->count, sizeof(names[0]), api_signed_param_compare);
+
+    struct md5_context signature;
+    md5_init(&signature);
+    for (size_t i = 0; i < form->count; i++) {
+        const size_t name_length = strlen(names[i]);
+        const char *value = names[i] + name_length + 1;
+        md5_update(&signature, (const uint8_t*)names[i], name_length);
+        md5_update(&signature, (const uint8_t*)value, strlen(value));
+    }
+    md5_update(&signature, (const uint8_t*)secret, strnlen(secret, MAX_PROPERTY_LENGTH/2));
+    http_buffer_clean(&form->params);
 
-    if (NULL != sig_base && NULL != handle) {
-        char *escaped_api_key = curl_easy_escape(handle, api_key, (int)strlen(api_key));
-        const size_t escaped_key_len = strlen(escaped_api_key);
+    uint8_t sig_hash[MD5_DIGEST_LENGTH] = {0};
+    md5_final(&signature, sig_hash);
 
-        strncat(sig_base, "api_key", 8);
-        strncat(sig_base, escaped_api_key, escaped_key_len + 1);
-        curl_free(escaped_api_key);
-    }
+    char sig[MD5_HEX_LENGTH] = {0};
+    api_signature_hex(sig_hash, sig);
+
+    http_buffer_append_string(form->body, "api_sig=");
+    http_buffer_append_string(form->body, sig);
 }
 
-static void append_signature_query_param(CURL *url, const char *sig_base, const char *secret)
+static size_t audioscrobbler_full_artist(const struct scrobble *track, char *result, const size_t size)
 {
-    char sig[MD5_HEX_LENGTH] = {0};
-    api_get_signature(sig_base, secret, sig);
+    size_t length = 0;
+    for (size_t i = 0; i < array_count(track->artist); i++) {
+        const char *artist = track->artist[i];
+        const size_t artist_len = strlen(artist);
+        if (artist_len == 0) { continue; }
+
+        const size_t sep_len = length > 0 ? strlen(VALUE_SEPARATOR) : 0;
+        if (length + sep_len + artist_len >= size) { break; }
+
+        memcpy(result + length, VALUE_SEPARATOR, sep_len);
+        length += sep_len;
+        memcpy(result + length, artist, artist_len);
+        length += artist_len;
+    }
+    result[length] = '\0';
+    return length;
+}
 
+/*
+ * Appends a parameter to the query of an URL that doesn't need to be signed.
+ */
+static void append_query_param(CURLU *url, const char *name, const char *value)
+{
     char query_param[MAX_URL_LENGTH + 1] = {0};
-    snprintf(query_param, MAX_URL_LENGTH, "api_sig=%s", sig);
-    curl_url_set(url, CURLUPART_QUERY, query_param, CURLU_APPENDQUERY);
+    snprintf(query_param, MAX_URL_LENGTH, "%s=%s", name, value);
+    curl_url_set(url, CURLUPART_QUERY, query_param, CURLU_APPENDQUERY|CURLU_URLENCODE);
 }
 
 static void api_get_url(CURLU*, const struct api_endpoint*);
-struct api_endpoint *api_endpoint_new(const struct api_credentials*);
+struct api_endpoint *api_endpoint_new(struct http_arena*, const struct api_credentials*);
 struct http_request *http_request_new(void);
 /*
  * api_key (Required) : A Last.fm API key.
  * api_sig (Required) : A Last.fm method signature. See [authentication](https://www.last.fm/api/authentication) for more information.
 */
-static void audioscrobbler_api_build_request_get_token(struct http_request *request, const struct api_credentials *auth, CURL *handle)
+static void audioscrobbler_api_build_request_get_token(struct http_request *request, const struct api_credentials *auth)
 {
     if (!audioscrobbler_valid_api_credentials(auth)) { return; }
 
-    char sig_base[MAX_BODY_SIZE+1] = {0};
-
-    append_api_key_query_param(request->url, auth->api_key, handle, sig_base);
-    append_method_query_param(request->url, API_METHOD_GET_TOKEN, sig_base);
-    append_signature_query_param(request->url, sig_base, auth->secret);
+    struct api_signed_form form;
+    api_signed_form_init(&form, &request->body);
+    api_signed_form_append(&form, "api_key", auth->api_key);
+    api_signed_form_append(&form, "method", API_METHOD_GET_TOKEN);
+    api_signed_form_sign(&form, auth->secret);
 
     curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
 
     request->request_type = http_post;
-    request->end_point = api_endpoint_new(auth);
+    request->end_point = api_endpoint_new(request->arena, auth);
     api_get_url(request->url, request->end_point);
 }
 
-static void append_token_query_param(CURL *url, const char *token, char *sig_base)
-{
-    const size_t token_len = strlen(token);
-    char query_param[MAX_URL_LENGTH + 1] = {0};
-    snprintf(query_param, MAX_URL_LENGTH, "token=%s", token);
-    curl_url_set(url, CURLUPART_QUERY, query_param, CURLU_APPENDQUERY);
-
-    if (NULL != sig_base) {
-        strncat(sig_base, "token", 6);
-        strncat(sig_base, token, token_len + 1);
-    }
-}
-
 /*
  * token (Required) : A 32-character ASCII hexadecimal MD5 hash returned by step 1 of the authentication process (following the granting of permissions to the application by the user)
  * api_key (Required) : A Last.fm API key.
@@ -401,20 +488,21 @@ static void append_token_query_param(CURL *url, const char *token, char *sig_bas
  * 26 : Suspended API key - Access for your account has been suspended, please contact Last.fm
  * 29 : Rate limit exceeded - Your IP has made too many requests in a short period*
  */
-static void audioscrobbler_api_build_request_get_session(struct http_request *request, const struct api_credentials *auth, CURL *handle)
+static void audioscrobbler_api_build_request_get_session(struct http_request *request, const struct api_credentials *auth)
 {
     if (!audioscrobbler_valid_api_credentials(auth)) { return; }
 
     request->request_type = http_post;
-    request->end_point = api_endpoint_new(auth);
+    request->end_point = api_endpoint_new(request->arena, auth);
     api_get_url(request->url, request->end_point);
 
-    char sig_base[MAX_BODY_SIZE] = {0};
+    struct api_signed_form form;
+    api_signed_form_init(&form, &request->body);
+    api_signed_form_append(&form, "api_key", auth->api_key);
+    api_signed_form_append(&form, "method", API_METHOD_GET_SESSION);
+    api_signed_form_append(&form, "token", auth->token);
+    api_signed_form_sign(&form, auth->secret);
 
-    append_api_key_query_param(request->url, auth->api_key, handle, sig_base);
-    append_method_query_param(request->url, API_METHOD_GET_SESSION, sig_base);
-    append_token_query_param(request->url, auth->token, sig_base);
-    append_signature_query_param(request->url, sig_base, auth->secret);
     curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
 }
 
@@ -431,7 +519,7 @@ static void audioscrobbler_api_build_request_get_session(struct http_request *re
  * api_sig (Required) : A Last.fm method signature. See authentication for more information.
  * sk (Required) : A session key generated by authenticating a user via the authentication protocol.
  */
-static void audioscrobbler_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+static void audioscrobbler_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth)
 {
     if (!audioscrobbler_valid_credentials(auth)) { return; }
 
@@ -439,297 +527,98 @@ static void audioscrobbler_api_build_request_now_playing(struct http_request *re
     assert(track_count == 1);
 
     const struct scrobble *track = tracks[0];
-    const char *api_key = auth->api_key;
-    const char *secret = auth->secret;
-    const char *sk = auth->session_key;
 
-    char sig_base[MAX_BODY_SIZE+1] = {0};
-    char body[MAX_BODY_SIZE+1] = {0};
+    struct api_signed_form form;
+    api_signed_form_init(&form, &request->body);
 
     assert(track->album);
-    const size_t album_len = strlen(track->album);
-    char *esc_album = curl_easy_escape(handle, track->album, (int)album_len);
-
-    strncat(body, "album=", 7);
-    strncat(body, esc_album, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "album", 6);
-    strncat(sig_base, track->album, MAX_BODY_SIZE);
-    curl_free(esc_album);
-
-    assert(api_key);
-    const size_t api_key_len = strlen(api_key);
-    char *esc_api_key = curl_easy_escape(handle, api_key, (int)api_key_len);
-
-    strncat(body, "api_key=", 9);
-    strncat(body, esc_api_key, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
+    api_signed_form_append(&form, API_ALBUM_NODE_NAME, track->album);
 
-    strncat(sig_base, "api_key", 8);
-    strncat(sig_base, api_key, MAX_BODY_SIZE);
-    curl_free(esc_api_key);
+    assert(auth->api_key);
+    api_signed_form_append(&form, "api_key", auth->api_key);
 
     char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 1] = {0};
-    size_t full_artist_len = 0;
-    for (size_t i = 0; i < array_count(track->artist); i++) {
-        const char *artist = track->artist[i];
-        const size_t artist_len = strlen(artist);
-        if (NULL == artist || artist_len == 0) { continue; }
-
-        if (full_artist_len > 0) {
-            size_t l_val_sep = strlen(VALUE_SEPARATOR);
-            strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
-            full_artist_len += l_val_sep;
-        }
-        strncat(full_artist, artist, artist_len + 1);
-        full_artist_len += artist_len;
+    if (audioscrobbler_full_artist(track, full_artist, sizeof(full_artist)) > 0) {
+        api_signed_form_append(&form, API_ARTIST_NODE_NAME, full_artist);
     }
-    if (full_artist_len > 0) {
-        char *esc_full_artist = curl_easy_escape(handle, full_artist, (int)full_artist_len);
-        const size_t artist_label_len = strlen(API_ARTIST_NODE_NAME);
-
-        strncat(body, API_ARTIST_NODE_NAME "=", artist_label_len + 2);
-        strncat(body, esc_full_artist, MAX_BODY_SIZE);
-        strncat(body, "&", 2);
 
-        strncat(sig_base, API_ARTIST_NODE_NAME, artist_label_len + 1);
-        strncat(sig_base, full_artist, MAX_BODY_SIZE);
-        curl_free(esc_full_artist);
+    const char *mb_track_id = track->mb_track_id[0];
+    if (strlen(mb_track_id) > 0) {
+        api_signed_form_append(&form, API_MUSICBRAINZ_MBID_NODE_NAME, mb_track_id);
     }
 
-    const char *mb_track_id = (char *) track->mb_track_id[0];
-    const size_t mbid_len = strlen(mb_track_id);
-    if (mbid_len > 0) {
-        char *esc_mbid = curl_easy_escape(handle, mb_track_id, (int)mbid_len);
-
-        const size_t mbid_label_len = strlen(API_MUSICBRAINZ_MBID_NODE_NAME);
-
-        strncat(body, API_MUSICBRAINZ_MBID_NODE_NAME "=", mbid_label_len + 2);
-        strncat(body, esc_mbid, MAX_BODY_SIZE);
-        strncat(body, "&", 2);
-
-        strncat(sig_base, API_MUSICBRAINZ_MBID_NODE_NAME, mbid_label_len + 1);
-        strncat(sig_base, mb_track_id, MAX_BODY_SIZE);
-        curl_free(esc_mbid);
-    }
-
-    const char *method = API_METHOD_NOW_PLAYING;
-
-    assert(method);
-    const size_t method_len = strlen(method);
-    strncat(body, "method=", 8);
-    strncat(body, method, method_len + 1);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "method", 7);
-    strncat(sig_base, method, method_len + 1);
-
-    strncat(body, "sk=", 4);
-    strncat(body, sk, MAX_PROPERTY_LENGTH);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "sk", 3);
-    strncat(sig_base, sk, MAX_SECRET_LENGTH);
+    api_signed_form_append(&form, "method", API_METHOD_NOW_PLAYING);
+    api_signed_form_append(&form, "sk", auth->session_key);
 
     assert(track->title);
-    const size_t title_len = strlen(track->title);
-    char *esc_title = curl_easy_escape(handle, track->title, (int)title_len);
-
-    strncat(body, "track=", 7);
-    strncat(body, esc_title, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
+    api_signed_form_append(&form, API_TRACK_NODE_NAME, track->title);
 
-    strncat(sig_base, "track", 6);
-    strncat(sig_base, track->title, title_len + 1);
-    curl_free(esc_title);
-
-    char sig[MD5_HEX_LENGTH] = {0};
-    api_get_signature(sig_base, secret, sig);
-    strncat(body, "api_sig=", 9);
-    strncat(body, sig, MAX_PROPERTY_LENGTH);
+    api_signed_form_sign(&form, auth->secret);
 
     curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
 
     request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
+    request->end_point = api_endpoint_new(request->arena, auth);
     api_get_url(request->url, request->end_point);
 }
 
 static bool scrobble_is_empty(const struct scrobble*);
-static void audioscrobbler_api_build_request_scrobble(struct http_request *request, const struct scrobble *tracks[MAX_QUEUE_LENGTH], const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+static void audioscrobbler_api_build_request_scrobble(struct http_request *request, const struct scrobble *tracks[MAX_SCROBBLE_BATCH], const unsigned track_count, const struct api_credentials *auth)
 {
     if (!audioscrobbler_valid_credentials(auth)) { return; }
 
-    const char *api_key = auth->api_key;
-    const char *secret = auth->secret;
-    const char *sk = auth->session_key;
-
-    const char *method = API_METHOD_SCROBBLE;
-
-    char sig_base[MAX_BODY_SIZE+1] = {0};
-    char body[MAX_BODY_SIZE+1] = {0};
+    struct api_signed_form form;
+    api_signed_form_init(&form, &request->body);
 
     for (size_t i = 0; i < track_count; i++) {
         const struct scrobble *track = tracks[i];
+        if (scrobble_is_empty(track)) { continue; }
 
-        if (scrobble_is_empty(track)) {
-            continue;
-        }
-        const size_t album_len = strlen(track->album);
-
-        char *esc_album = curl_easy_escape(handle, track->album, (int)album_len);
-        char album_body[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(album_body, MAX_PROPERTY_LENGTH, API_ALBUM_NODE_NAME "[%lu]=%s&", i, esc_album);
-        strncat(body, album_body, MAX_PROPERTY_LENGTH);
-
-        char album_sig[MAX_PROPERTY_LENGTH + 19] = {0};
-        snprintf(album_sig, MAX_PROPERTY_LENGTH + 18, API_ALBUM_NODE_NAME "[%lu]%s", i, track->album);
-
-        assert(strlen(sig_base) + strlen(album_sig)<MAX_BODY_SIZE);
-        strncat(sig_base, album_sig, MAX_PROPERTY_LENGTH + 19);
-
-        curl_free(esc_album);
+        api_signed_form_append_indexed(&form, API_ALBUM_NODE_NAME, i, track->album);
     }
 
-    assert(api_key);
-    const size_t api_key_len = strlen(api_key);
-    char *esc_api_key = curl_easy_escape(handle, api_key, (int)api_key_len);
-
-    strncat(body, "api_key=", 9);
-    strncat(body, esc_api_key, MAX_BODY_SIZE);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "api_key", 8);
-    strncat(sig_base, api_key, MAX_BODY_SIZE);
-    curl_free(esc_api_key);
+    assert(auth->api_key);
+    api_signed_form_append(&form, "api_key", auth->api_key);
 
+    char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 1];
     for (size_t i = 0; i < track_count; i++) {
-        const struct scrobble *track = tracks[i];
-
-        char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT] = {0};
-        size_t full_artist_len = 0;
-        for (unsigned j = 0; j < array_count(track->artist); j++) {
-            const char *artist = track->artist[j];
-            const size_t artist_len = strlen(artist);
-            if (NULL == artist || artist_len == 0) { continue; }
-
-            if (full_artist_len > 0) {
-                const size_t l_val_sep = strlen(VALUE_SEPARATOR);
-                strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
-                full_artist_len += l_val_sep;
-            }
-            strncat(full_artist, artist, artist_len + 1);
-            full_artist_len += artist_len;
-        }
-        if (full_artist_len > 0) {
-            char *esc_full_artist = curl_easy_escape(handle, full_artist, (int)full_artist_len);
-
-            const char fmt_full_artist[] = API_ARTIST_NODE_NAME "[%zu]=%s&";
-
-            char artist_body[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11] = {0};
-            snprintf(artist_body, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11, fmt_full_artist, i, esc_full_artist);
-
-            strncat(body, artist_body, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11);
-
-            const char fmt_artist_sig[] = API_ARTIST_NODE_NAME "[%zu]%s";
-            char artist_sig[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9] = {0};
-            snprintf(artist_sig, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9, fmt_artist_sig, i, full_artist);
-
-            assert(strlen(sig_base) + strlen(artist_sig) < MAX_BODY_SIZE);
-            strncat(sig_base, artist_sig, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9);
-            curl_free(esc_full_artist);
+        if (scrobble_is_empty(tracks[i])) { continue; }
+        if (audioscrobbler_full_artist(tracks[i], full_artist, sizeof(full_artist)) > 0) {
+            api_signed_form_append_indexed(&form, API_ARTIST_NODE_NAME, i, full_artist);
         }
     }
 
     for (size_t i = 0; i < track_count; i++) {
-        const struct scrobble *track = tracks[i];
-
-        char *mb_track_id = (char*)track->mb_track_id[0];
-        const size_t mbid_len = strlen(mb_track_id);
-        if (mbid_len > 0) {
-            char *esc_mbid = curl_easy_escape(handle, mb_track_id, (int)mbid_len);
-
-            char mbid_body[MAX_PROPERTY_LENGTH] = {0};
-            snprintf(mbid_body, MAX_PROPERTY_LENGTH, API_MUSICBRAINZ_MBID_NODE_NAME "[%lu]=%s&", i, esc_mbid);
-            strncat(body, mbid_body, MAX_PROPERTY_LENGTH);
-
-            char mbid_sig[MAX_PROPERTY_LENGTH + 18] = {0};
-            snprintf(mbid_sig, MAX_PROPERTY_LENGTH + 17, API_MUSICBRAINZ_MBID_NODE_NAME "[%lu]%s", i, mb_track_id);
-
-            assert(strlen(sig_base) + strlen(mbid_sig) < MAX_BODY_SIZE);
-            strncat(sig_base, mbid_sig, MAX_PROPERTY_LENGTH + 18);
-
-            curl_free(esc_mbid);
+        if (scrobble_is_empty(tracks[i])) { continue; }
+        const char *mb_track_id = tracks[i]->mb_track_id[0];
+        if (strlen(mb_track_id) > 0) {
+            api_signed_form_append_indexed(&form, API_MUSICBRAINZ_MBID_NODE_NAME, i, mb_track_id);
         }
     }
 
-    assert(method);
-    const size_t method_len = strlen(method);
-    strncat(body, "method=", 8);
-    strncat(body, method, method_len + 1);
-    strncat(body, "&", 2);
+    api_signed_form_append(&form, "method", API_METHOD_SCROBBLE);
 
-    strncat(sig_base, "method", 7);
-    assert(strlen(sig_base) + strlen(method) < MAX_BODY_SIZE);
-    strncat(sig_base, method, method_len + 1);
+    assert(auth->session_key);
+    api_signed_form_append(&form, "sk", auth->session_key);
 
-    assert(sk);
-    strncat(body, "sk=", 4);
-    strncat(body, sk, MAX_SECRET_LENGTH+1);
-    strncat(body, "&", 2);
-
-    strncat(sig_base, "sk", 3);
-    assert(strlen(sig_base) + strlen(sk) < MAX_BODY_SIZE);
-    strncat(sig_base, sk, MAX_SECRET_LENGTH+1);
-
-    for (int i = (int)track_count - 1; i >= 0; i--) {
-        const struct scrobble *track = tracks[i];
-
-        char tstamp_body[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(tstamp_body, MAX_PROPERTY_LENGTH, API_TIMESTAMP_NODE_NAME "[%d]=%ld&", i, track->start_time);
-        strncat(body, tstamp_body, MAX_PROPERTY_LENGTH);
-
-        char tstamp_sig[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(tstamp_sig, MAX_PROPERTY_LENGTH, API_TIMESTAMP_NODE_NAME "[%d]%ld", i, track->start_time);
-
-        assert(strlen(sig_base) + strlen(tstamp_sig) < MAX_BODY_SIZE);
-        strncat(sig_base, tstamp_sig, MAX_PROPERTY_LENGTH);
+    for (size_t i = 0; i < track_count; i++) {
+        if (scrobble_is_empty(tracks[i])) { continue; }
+        char timestamp[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(timestamp, MAX_PROPERTY_LENGTH, "%ld", tracks[i]->start_time);
+        api_signed_form_append_indexed(&form, API_TIMESTAMP_NODE_NAME, i, timestamp);
     }
 
-    for (int i = (int)track_count - 1; i >= 0; i--) {
-        const struct scrobble *track = tracks[i];
-
-        const size_t title_len = strlen(track->title);
-
-        char *esc_title = curl_easy_escape(handle, track->title, (int)title_len);
-
-        char title_body[MAX_PROPERTY_LENGTH] = {0};
-        snprintf(title_body, MAX_PROPERTY_LENGTH, API_TRACK_NODE_NAME "[%d]=%s&", i, esc_title);
-        strncat(body, title_body, MAX_PROPERTY_LENGTH);
-
-        char title_sig[MAX_PROPERTY_LENGTH + 19] = {0};
-        snprintf(title_sig, MAX_PROPERTY_LENGTH + 18, API_TRACK_NODE_NAME "[%d]%s", i, track->title);
-
-        assert(strlen(sig_base) + strlen(title_sig) < MAX_BODY_SIZE);
-        strncat(sig_base, title_sig, MAX_PROPERTY_LENGTH + 19);
-
-        curl_free(esc_title);
+    for (size_t i = 0; i < track_count; i++) {
+        if (scrobble_is_empty(tracks[i])) { continue; }
+        api_signed_form_append_indexed(&form, API_TRACK_NODE_NAME, i, tracks[i]->title);
     }
 
-    char sig[MD5_HEX_LENGTH] = {0};
-    api_get_signature(sig_base, secret, sig);
-    strncat(body, "api_sig=", 9);
-    strncat(body, sig, MAX_PROPERTY_LENGTH);
+    api_signed_form_sign(&form, auth->secret);
 
     curl_url_set(request->url, CURLUPART_QUERY, "format=json", CURLU_APPENDQUERY);
 
     request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
+    request->end_point = api_endpoint_new(request->arena, auth);
     api_get_url(request->url, request->end_point);
 }
 
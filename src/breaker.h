@@ -0,0 +1,181 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_BREAKER_H
+#define MPRIS_SCROBBLER_BREAKER_H
+
+/*
+ * Every service has a circuit breaker, so an outage doesn't cost us a request for every scrobble and now playing.
+ * A failed request opens the breaker, and no more requests are sent to the service until its backoff timer expires.
+ * After that the breaker is half-open: a single request goes through as a probe, and if it succeeds the breaker closes
+ * and the backlog gets drained, if it fails the breaker opens again for twice as long.
+ * A service can also be paused from the control socket, which keeps its requests back regardless of the state of the breaker.
+ */
+
+#define BREAKER_BACKOFF_BASE_SECONDS 5
+#define BREAKER_BACKOFF_MAX_SECONDS 1800
+#define BREAKER_RETRY_AFTER_MAX_SECONDS 86400
+
+static void scrobbler_schedule_drain(struct scrobbler *);
+
+static const char *api_breaker_state_label(const enum api_breaker_state state)
+{
+    switch (state) {
+        case breaker_open:
+            return "open";
+        case breaker_half_open:
+            return "half-open";
+        case breaker_closed:
+        default:
+            return "closed";
+    }
+}
+
+static long api_breaker_backoff_seconds(const unsigned failures)
+{
+    if (failures == 0) { return 0; }
+
+    long delay = BREAKER_BACKOFF_BASE_SECONDS;
+    for (unsigned i = 1; i < failures && delay < BREAKER_BACKOFF_MAX_SECONDS; i++) {
+        delay *= 2;
+    }
+    return delay < BREAKER_BACKOFF_MAX_SECONDS ? delay : BREAKER_BACKOFF_MAX_SECONDS;
+}
+
+/*
+ * Half of the delay is fixed and the other half is random, so the clients that lost the service at the same time
+ * don't all come back at the same time.
+ */
+static struct timeval api_breaker_jitter(const long seconds)
+{
+    uint32_t random = 0;
+    evutil_secure_rng_get_bytes(&random, sizeof(random));
+
+    const uint64_t half_us = (uint64_t)seconds * 500000;
+    const uint64_t delay_us = half_us + (half_us > 0 ? random % (half_us + 1) : 0);
+    const struct timeval delay = {
+        .tv_sec = (time_t)(delay_us / 1000000),
+        .tv_usec = (suseconds_t)(delay_us % 1000000),
+    };
+    return delay;
+}
+
+/*
+ * Connection errors, timeouts, throttling and server errors are worth retrying later.
+ * NOTE(marius): the other 4XX errors mean that there's something wrong with our request, the service itself is fine.
+ */
+static bool api_breaker_is_failure(const CURLcode res, const long code)
+{
+    return res != CURLE_OK || code <= 0 || code == 408 || code == 429 || code >= 500;
+}
+
+static bool api_breaker_allows(const struct api_breaker *breaker)
+{
+    switch (breaker->state) {
+        case breaker_closed:
+            return true;
+        case breaker_half_open:
+            return !breaker->probing;
+        case breaker_open:
+        default:
+            return false;
+    }
+}
+
+static void api_breaker_request_started(struct api_breaker *breaker)
+{
+    if (breaker->state != breaker_half_open) { return; }
+    breaker->probing = true;
+}
+
+static void api_breaker_retry_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    struct api_breaker *breaker = data;
+
+    breaker->state = breaker_half_open;
+    breaker->probing = false;
+    _info("scrobbler::breaker_half_open[%s]: retrying after %u failures", get_api_type_label(breaker->end_point), breaker->failures);
+
+    scrobbler_schedule_drain(breaker->parent);
+}
+
+/*
+ * Lets a probe through right away, instead of waiting for the backoff timer.
+ */
+static void api_breaker_retry_now(struct api_breaker *breaker)
+{
+    if (breaker->state != breaker_open) { return; }
+    if (evtimer_initialized(&breaker->retry_event) && evtimer_pending(&breaker->retry_event, NULL)) {
+        evtimer_del(&breaker->retry_event);
+    }
+    api_breaker_retry_cb(-1, EV_TIMEOUT, breaker);
+}
+
+static void api_breaker_success(struct api_breaker *breaker)
+{
+    if (breaker->state != breaker_closed) {
+        _info("scrobbler::breaker_closed[%s]: after %u failures", get_api_type_label(breaker->end_point), breaker->failures);
+    }
+    breaker->state = breaker_closed;
+    breaker->failures = 0;
+    breaker->probing = false;
+    if (evtimer_initialized(&breaker->retry_event) && evtimer_pending(&breaker->retry_event, NULL)) {
+        evtimer_del(&breaker->retry_event);
+    }
+}
+
+/*
+ * Opens the breaker for the backoff of its consecutive failures, or for as long as the service asked in Retry-After.
+ */
+static void api_breaker_failure(struct api_breaker *breaker, const long retry_after)
+{
+    const char *api_label = get_api_type_label(breaker->end_point);
+    if (breaker->state == breaker_open) {
+        // NOTE(marius): the requests that were in flight when the breaker opened don't push the retry further away
+        _debug("scrobbler::breaker_open[%s]: request failed", api_label);
+        return;
+    }
+
+    breaker->failures++;
+    breaker->state = breaker_open;
+    breaker->probing = false;
+    metrics_breaker_opened(breaker->end_point);
+
+    struct timeval delay = api_breaker_jitter(api_breaker_backoff_seconds(breaker->failures));
+    if (retry_after > delay.tv_sec) {
+        delay.tv_sec = retry_after < BREAKER_RETRY_AFTER_MAX_SECONDS ? retry_after : BREAKER_RETRY_AFTER_MAX_SECONDS;
+        delay.tv_usec = 0;
+    }
+    if (evtimer_initialized(&breaker->retry_event)) {
+        evtimer_del(&breaker->retry_event);
+        evtimer_add(&breaker->retry_event, &delay);
+    }
+    _warn("scrobbler::breaker_open[%s]: %u failures, retrying in %2.2lfs", api_label, breaker->failures, timeval_to_seconds(delay));
+}
+
+static void api_breakers_init(struct scrobbler *s)
+{
+    for (int i = 0; i < API_TYPE_COUNT; i++) {
+        struct api_breaker *breaker = &s->breakers[i];
+        breaker->parent = s;
+        breaker->end_point = (enum api_type)i;
+        breaker->state = breaker_closed;
+        breaker->failures = 0;
+        breaker->probing = false;
+        breaker->paused = false;
+        evtimer_assign(&breaker->retry_event, s->evbase, api_breaker_retry_cb, breaker);
+    }
+}
+
+static void api_breakers_clean(struct scrobbler *s)
+{
+    for (int i = 0; i < API_TYPE_COUNT; i++) {
+        struct api_breaker *breaker = &s->breakers[i];
+        if (evtimer_initialized(&breaker->retry_event) && evtimer_pending(&breaker->retry_event, NULL)) {
+            evtimer_del(&breaker->retry_event);
+        }
+    }
+}
+
+#endif // MPRIS_SCROBBLER_BREAKER_H
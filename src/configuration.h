@@ -14,6 +14,8 @@
 #endif
 
 #define PID_SUFFIX                  ".pid"
+#define METRICS_SUFFIX              "-metrics.sock"
+#define CONTROL_SUFFIX              "-control.sock"
 #define CREDENTIALS_FILE_NAME       "credentials"
 #define CACHE_FILE_NAME             "queue"
 #define CONFIG_FILE_NAME            "config"
@@ -51,6 +53,7 @@
 #define SERVICE_LABEL_LIBREFM       "librefm"
 #define SERVICE_LABEL_LISTENBRAINZ  "listenbrainz"
 #define CONFIG_KEY_IGNORE           "ignore"
+#define CONFIG_KEY_DEBOUNCE         "debounce"
 
 static const char *get_api_type_group(enum api_type end_point)
 {
@@ -273,6 +276,23 @@ static int load_pid_path(const struct configuration *config)
     return snprintf((char*)config->pid_path, FILE_PATH_MAX-5, TOKENIZED_PID_PATH, config->env.xdg_runtime_dir, config->name, PID_SUFFIX);
 }
 
+static int load_metrics_path(const struct configuration *config)
+{
+    if (NULL == config) { return 0; }
+    // NOTE(marius): without a runtime directory the socket would end up in /, so the metrics are not served
+    if (_is_zero(config->env.xdg_runtime_dir)) { return 0; }
+
+    return snprintf((char*)config->metrics_path, FILE_PATH_MAX, TOKENIZED_PID_PATH, config->env.xdg_runtime_dir, config->name, METRICS_SUFFIX);
+}
+
+static int load_control_path(const struct configuration *config)
+{
+    if (NULL == config) { return 0; }
+    if (_is_zero(config->env.xdg_runtime_dir)) { return 0; }
+
+    return snprintf((char*)config->control_path, FILE_PATH_MAX, TOKENIZED_PID_PATH, config->env.xdg_runtime_dir, config->name, CONTROL_SUFFIX);
+}
+
 static bool load_credentials_from_ini_group (struct ini_group *group, struct api_credentials *credentials)
 {
     if (NULL == credentials) { return false; }
@@ -396,7 +416,10 @@ static bool load_config_from_file(struct configuration *config, const char* path
 {
     if (NULL == config) { return false; }
     if (NULL == path) { return false; }
+    // NOTE(marius): the names are copied without their NUL, so the ones of a previous load would leave their tails behind
+    memset((char*)config->ignore_players, 0, sizeof(config->ignore_players));
     config->ignore_players_count = 0;
+    config->debounce_ms = DEFAULT_DEBOUNCE_MS;
 
     struct ini_config ini = {0};
     load_ini_from_file(&ini, path);
@@ -410,10 +433,25 @@ static bool load_config_from_file(struct configuration *config, const char* path
         const size_t value_count = arrlen(group->values);
         for (size_t j = 0; j < value_count; j++) {
             const struct ini_value *val = group->values[j];
+            if (strncmp(val->key->data, CONFIG_KEY_DEBOUNCE, val->key->len) == 0) {
+                char *end = NULL;
+                const unsigned long debounce_ms = strtoul(val->value->data, &end, 10);
+                if (end == val->value->data || *end != '\0' || debounce_ms > MAX_DEBOUNCE_MS) {
+                    _warn("config::debounce: invalid value %s, expected milliseconds between 0 and %d", val->value->data, MAX_DEBOUNCE_MS);
+                    continue;
+                }
+                _trace("config::debounce: %lums", debounce_ms);
+                config->debounce_ms = (unsigned)debounce_ms;
+                continue;
+            }
             if (strncmp(val->key->data, CONFIG_KEY_IGNORE, val->key->len) != 0) {
                 break;
             }
             const short cnt = config->ignore_players_count;
+            if (cnt >= MAX_IGNORED_PLAYERS) {
+                _warn("config::ignore_player: exceeded max ignored player count %d", MAX_IGNORED_PLAYERS);
+                break;
+            }
             _trace("config::ignore_player[%d]: %s", cnt, val->value->data);
             memcpy((char*)config->ignore_players[cnt], val->value->data, val->value->len);
             config->ignore_players_count++;
@@ -491,6 +529,58 @@ static void load_credentials (struct configuration *config)
     }
 }
 
+static const struct api_credentials *configuration_find_credentials(const struct api_credentials credentials[], const size_t count, const enum api_type end_point)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (credentials[i].end_point == end_point) { return &credentials[i]; }
+    }
+    return NULL;
+}
+
+/*
+ * Reads the credentials file again, and returns a mask of the services whose credentials changed.
+ * NOTE(marius): the requests in flight keep the copy of the credentials they were started with
+ */
+static unsigned reload_credentials(struct configuration *config)
+{
+    struct api_credentials previous[MAX_CREDENTIALS] = {0};
+    const size_t previous_count = config->credentials_count;
+    memcpy(previous, config->credentials, sizeof(previous));
+
+    load_credentials(config);
+
+    unsigned changed = 0;
+    for (int end_point = api_lastfm; end_point < API_TYPE_COUNT; end_point++) {
+        const struct api_credentials *old = configuration_find_credentials(previous, previous_count, (enum api_type)end_point);
+        const struct api_credentials *current = configuration_find_credentials(config->credentials, config->credentials_count, (enum api_type)end_point);
+        if (NULL == old && NULL == current) { continue; }
+        if (NULL != old && NULL != current && memcmp(old, current, sizeof(*old)) == 0) { continue; }
+        changed |= 1U << (unsigned)end_point;
+    }
+    return changed;
+}
+
+/*
+ * Reads the configuration and the credentials again, and returns what changed compared to what was loaded before.
+ */
+static struct configuration_diff reload_configuration(struct configuration *config)
+{
+    struct configuration_diff diff = {0};
+
+    const short previous_ignore_count = config->ignore_players_count;
+    char previous_ignore[MAX_IGNORED_PLAYERS][MAX_PROPERTY_LENGTH+1] = {0};
+    memcpy(previous_ignore, config->ignore_players, sizeof(previous_ignore));
+    const unsigned previous_debounce_ms = config->debounce_ms;
+
+    load_config(config);
+    diff.services = reload_credentials(config);
+
+    diff.debounce = config->debounce_ms != previous_debounce_ms;
+    diff.ignore_players = config->ignore_players_count != previous_ignore_count ||
+        memcmp(previous_ignore, config->ignore_players, sizeof(previous_ignore)) != 0;
+    return diff;
+}
+
 static void configuration_clean(struct configuration *config)
 {
     if (NULL == config) { return; }
@@ -0,0 +1,254 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_CONTROL_H
+#define MPRIS_SCROBBLER_CONTROL_H
+
+/*
+ * The daemon takes commands on a unix socket in $XDG_RUNTIME_DIR, one per connection:
+ *      echo status | socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/mpris-scrobbler-control.sock
+ * The first line of the reply is "ok" or "error: <reason>", and the connection gets closed after the reply.
+ *
+ *  status              the state of the queue, of every service and of every player
+ *  flush               submits the backlog now, even to the services waiting for their breaker to retry
+ *  pause <service>     keeps the requests to the service back until it's resumed, the scrobbles wait in the journal
+ *  resume <service>    sends the requests to the service again
+ *  reload              reads the configuration and the credentials again, the same as SIGHUP
+ *  metrics             the metrics, the same as the metrics socket serves
+ *  profile             toggles the timing of the event loop callbacks, the same as SIGUSR1
+ */
+
+#define CONTROL_MAX_REQUEST_SIZE 512
+#define CONTROL_CLIENT_TIMEOUT_SECONDS 5
+#define CONTROL_REPLY_OK "ok\n"
+
+#define CONTROL_COMMAND_STATUS "status"
+#define CONTROL_COMMAND_FLUSH "flush"
+#define CONTROL_COMMAND_PAUSE "pause"
+#define CONTROL_COMMAND_RESUME "resume"
+#define CONTROL_COMMAND_RELOAD "reload"
+#define CONTROL_COMMAND_METRICS "metrics"
+#define CONTROL_COMMAND_PROFILE "profile"
+
+static enum api_type control_parse_service(const char *name)
+{
+    if (NULL == name) { return api_unknown; }
+    if (strcmp(name, ARG_LASTFM) == 0) { return api_lastfm; }
+    if (strcmp(name, ARG_LIBREFM) == 0) { return api_librefm; }
+    if (strcmp(name, ARG_LISTENBRAINZ) == 0) { return api_listenbrainz; }
+    for (int end_point = api_lastfm; end_point < API_TYPE_COUNT; end_point++) {
+        if (strcmp(name, get_api_type_label((enum api_type)end_point)) == 0) { return (enum api_type)end_point; }
+    }
+    return api_unknown;
+}
+
+static void control_status(struct evbuffer *out, struct state *state)
+{
+    const struct scrobbler *s = &state->scrobbler;
+    evbuffer_add_printf(out, CONTROL_REPLY_OK);
+    evbuffer_add_printf(out, "queue %d\n", s->queue.length);
+    evbuffer_add_printf(out, "backlog %zu\n", scrobbler_backlog_length(s));
+    evbuffer_add_printf(out, "connections %d\n", s->connections.length);
+    for (int end_point = api_lastfm; end_point < API_TYPE_COUNT; end_point++) {
+        const struct api_credentials *creds = configuration_find_credentials(state->config->credentials,
+                                                                             state->config->credentials_count,
+                                                                             (enum api_type)end_point);
+        if (NULL == creds) { continue; }
+        const struct api_breaker *breaker = &s->breakers[end_point];
+        const char *status = "disabled";
+        if (creds->enabled && credentials_valid(creds)) {
+            status = breaker->paused ? "paused" : "enabled";
+        }
+        evbuffer_add_printf(out, "service %s %s breaker=%s failures=%u\n", get_api_type_label(creds->end_point), status,
+                            api_breaker_state_label(breaker->state), breaker->failures);
+    }
+    for (size_t i = 0; i < mpris_players_count(&state->players); i++) {
+        const struct mpris_player *player = state->players.entries[i];
+        const char *status = player->ignored ? "ignored" : player->properties.playback_status;
+        evbuffer_add_printf(out, "player %s %s\n", player->mpris_name, status[0] == '\0' ? "unknown" : status);
+    }
+}
+
+static void control_flush(struct evbuffer *out, struct state *state)
+{
+    struct scrobbler *s = &state->scrobbler;
+    for (int end_point = api_lastfm; end_point < API_TYPE_COUNT; end_point++) {
+        struct api_breaker *breaker = &s->breakers[end_point];
+        if (breaker->paused) { continue; }
+        api_breaker_retry_now(breaker);
+    }
+    _info("control::flush: %zu scrobbles", scrobbler_backlog_length(s));
+    scrobbler_schedule_drain(s);
+    evbuffer_add_printf(out, CONTROL_REPLY_OK "backlog %zu\n", scrobbler_backlog_length(s));
+}
+
+static void control_pause(struct evbuffer *out, struct state *state, const char *service, const bool pause)
+{
+    const enum api_type end_point = control_parse_service(service);
+    if (end_point == api_unknown) {
+        evbuffer_add_printf(out, "error: unknown service %s\n", NULL == service ? "" : service);
+        return;
+    }
+    struct scrobbler *s = &state->scrobbler;
+    struct api_breaker *breaker = &s->breakers[end_point];
+    if (breaker->paused != pause) {
+        breaker->paused = pause;
+        _info("control::%s[%s]", pause ? "pause" : "resume", get_api_type_label(end_point));
+        if (!pause) {
+            scrobbler_schedule_drain(s);
+        }
+    }
+    evbuffer_add_printf(out, CONTROL_REPLY_OK);
+}
+
+static void control_reload(struct evbuffer *out, struct state *state)
+{
+    const struct configuration_diff diff = reload_state(state);
+
+    evbuffer_add_printf(out, CONTROL_REPLY_OK);
+    for (int end_point = api_lastfm; end_point < API_TYPE_COUNT; end_point++) {
+        if ((diff.services & (1U << (unsigned)end_point)) == 0) { continue; }
+        evbuffer_add_printf(out, "changed %s\n", get_api_type_label((enum api_type)end_point));
+    }
+    if (diff.ignore_players) {
+        evbuffer_add_printf(out, "changed ignore\n");
+    }
+    if (diff.debounce) {
+        evbuffer_add_printf(out, "changed debounce\n");
+    }
+}
+
+static void control_handle(struct evbuffer *out, struct state *state, char *line)
+{
+    char *argument = strchr(line, ' ');
+    if (NULL != argument) {
+        *argument = '\0';
+        argument++;
+        while (*argument == ' ') { argument++; }
+    }
+    _debug("control::command: %s %s", line, NULL == argument ? "" : argument);
+
+    if (strcmp(line, CONTROL_COMMAND_STATUS) == 0) {
+        control_status(out, state);
+    } else if (strcmp(line, CONTROL_COMMAND_FLUSH) == 0) {
+        control_flush(out, state);
+    } else if (strcmp(line, CONTROL_COMMAND_PAUSE) == 0) {
+        control_pause(out, state, argument, true);
+    } else if (strcmp(line, CONTROL_COMMAND_RESUME) == 0) {
+        control_pause(out, state, argument, false);
+    } else if (strcmp(line, CONTROL_COMMAND_RELOAD) == 0) {
+        control_reload(out, state);
+    } else if (strcmp(line, CONTROL_COMMAND_METRICS) == 0) {
+        evbuffer_add_printf(out, CONTROL_REPLY_OK);
+        metrics_render(out, &metrics_registry, state);
+    } else if (strcmp(line, CONTROL_COMMAND_PROFILE) == 0) {
+        loop_profiler_toggle(-1, 0, NULL);
+        evbuffer_add_printf(out, CONTROL_REPLY_OK "profiling %s\n", loop_profiler_enabled() ? "on" : "off");
+    } else {
+        evbuffer_add_printf(out, "error: unknown command %s\n", line);
+    }
+}
+
+static void control_client_reply(struct bufferevent *bev, struct state *state, char *line)
+{
+    bufferevent_disable(bev, EV_READ);
+    control_handle(bufferevent_get_output(bev), state, line);
+    bufferevent_setcb(bev, NULL, metrics_client_written, metrics_client_event, state);
+}
+
+static void control_client_read(struct bufferevent *bev, void *data)
+{
+    struct evbuffer *input = bufferevent_get_input(bev);
+
+    char *line = evbuffer_readln(input, NULL, EVBUFFER_EOL_CRLF);
+    if (NULL == line) {
+        if (evbuffer_get_length(input) < CONTROL_MAX_REQUEST_SIZE) { return; }
+        _warn("control::invalid_request: longer than %d bytes", CONTROL_MAX_REQUEST_SIZE);
+        bufferevent_free(bev);
+        return;
+    }
+    control_client_reply(bev, data, line);
+    free(line);
+}
+
+/*
+ * A client that closed its end before sending the end of the line still gets its reply.
+ */
+static void control_client_event(struct bufferevent *bev, short events, void *data)
+{
+    struct evbuffer *input = bufferevent_get_input(bev);
+    const size_t length = evbuffer_get_length(input);
+    if ((events & BEV_EVENT_EOF) && length > 0 && length < CONTROL_MAX_REQUEST_SIZE) {
+        char line[CONTROL_MAX_REQUEST_SIZE] = {0};
+        evbuffer_remove(input, line, length);
+        control_client_reply(bev, data, line);
+        return;
+    }
+    metrics_client_event(bev, events, data);
+}
+
+static void control_client_accepted(struct evconnlistener *listener, evutil_socket_t fd, struct sockaddr *address, int length, void *data)
+{
+    struct event_base *base = evconnlistener_get_base(listener);
+    struct bufferevent *bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (NULL == bev) {
+        _warn("control::accept: unable to create the client buffer");
+        evutil_closesocket(fd);
+        return;
+    }
+    const struct timeval timeout = { .tv_sec = CONTROL_CLIENT_TIMEOUT_SECONDS, };
+    bufferevent_set_timeouts(bev, &timeout, &timeout);
+    bufferevent_setcb(bev, control_client_read, NULL, control_client_event, data);
+    bufferevent_enable(bev, EV_READ);
+}
+
+static bool control_server_init(struct socket_server *server, struct state *state)
+{
+    const char *path = state->config->control_path;
+    if (NULL == state->events.base || _is_zero(path)) {
+        _debug("control::disabled: no runtime directory");
+        return false;
+    }
+    return socket_server_listen(server, state->events.base, path, control_client_accepted, state);
+}
+
+/*
+ * Sends a command to the daemon and waits for the whole reply, returns false if the daemon couldn't be reached.
+ */
+static bool control_request(const char *path, const char *command, char *reply, const size_t reply_size)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX, };
+    if (path[0] == '\0' || strlen(path) >= sizeof(address.sun_path)) { return false; }
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return false; }
+    const struct timeval timeout = { .tv_sec = CONTROL_CLIENT_TIMEOUT_SECONDS, };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    bool status = false;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        _debug("control::connect[%s]: %s", path, strerror(errno));
+        goto _exit;
+    }
+    char request[CONTROL_MAX_REQUEST_SIZE] = {0};
+    const int request_length = snprintf(request, sizeof(request), "%s\n", command);
+    if (send(fd, request, (size_t)request_length, MSG_NOSIGNAL) != request_length) { goto _exit; }
+
+    size_t length = 0;
+    while (length + 1 < reply_size) {
+        const ssize_t received = recv(fd, reply + length, reply_size - length - 1, 0);
+        if (received < 0) { goto _exit; }
+        if (received == 0) { break; }
+        length += (size_t)received;
+    }
+    reply[length] = '\0';
+    status = length > 0;
+
+_exit:
+    close(fd);
+    return status;
+}
+
+#endif // MPRIS_SCROBBLER_CONTROL_H
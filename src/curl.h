@@ -7,52 +7,32 @@
 
 #include <curl/curl.h>
 
-#ifdef RETRY_ENABLED
+#include "breaker.h"
 
-#define MAX_RETRIES 5
-
-static void retry_cb(int fd, short kind, void *data)
-{
-    assert(data);
-
-    const struct scrobbler_connection *conn = data;
-    assert(conn->parent);
-    assert(conn->parent->handle);
-    assert(conn->handle);
-    curl_multi_add_handle(conn->parent->handle, conn->handle);
-}
+static bool connection_was_fulfilled(const struct scrobbler_connection *);
+static unsigned scrobbler_connection_acknowledge(struct scrobbler_connection *);
+static unsigned scrobbler_connection_refused(struct scrobbler_connection *);
 
-static void connection_retry(struct scrobbler_connection *conn)
+/*
+ * A transfer that didn't open any new connection reused a warm one, and skipped the TCP and TLS handshakes.
+ */
+static void http_stats_update(struct http_stats *stats, CURL *easy, const CURLcode res, const enum api_type end_point)
 {
-    const struct timeval retry_timeout = { .tv_sec = 3 + conn->retries, .tv_usec = 0, };
-    http_response_clean(&conn->response);
+    if (res != CURLE_OK) { return; }
 
-    const struct scrobbler *s = conn->parent;
-    curl_multi_remove_handle(conn->parent->handle, conn->handle);
+    long connects = 0;
+    curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
 
-    if (conn->retries == 0) {
-        evtimer_assign(&conn->retry_event, s->evbase, retry_cb, conn);
+    stats->requests++;
+    if (connects > 0) {
+        stats->connections_created += (size_t)connects;
     } else {
-        evtimer_del(&conn->retry_event);
-    }
-    evtimer_add(&conn->retry_event, &retry_timeout);
-    conn->retries++;
-    _debug("curl::retrying[%zd]: in %2.2lfs", conn->retries, timeval_to_seconds(retry_timeout));
-}
-
-static bool connection_should_retry(const struct scrobbler_connection *conn)
-{
-    const int code = (int)conn->response.code;
-    if (code >= 400 && code < 500) {
-        // NOTE(marius): 4XX errors mean that there's something wrong with our request
-        // so we shouldn't retry.
-        return false;
+        stats->connections_reused++;
     }
-    return conn->retries < MAX_RETRIES;
+    _debug("curl::connection[%s]: %s, %zu of %zu requests skipped the handshake", get_api_type_label(end_point),
+           connects > 0 ? "new" : "reused", stats->connections_reused, stats->requests);
 }
-#endif
 
-static bool connection_was_fulfilled(const struct scrobbler_connection *);
 /*
  * Based on https://curl.se/libcurl/c/hiperfifo.html
  * Check for completed transfers, and remove their easy handles
@@ -78,6 +58,7 @@ static void check_multi_info(struct scrobbler *s)
         curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
 
         assert(conn);
+        log_context_request(get_api_type_label(conn->credentials.end_point), conn->request_id);
 
         if (strlen(conn->error) != 0) {
             _warn("curl::transfer::done[%zd]: %s => (%d) %s", conn->idx, eff_url, res, conn->error);
@@ -100,18 +81,39 @@ static void check_multi_info(struct scrobbler *s)
         http_response_print(&conn->response, log_tracing2);
 
         _info(" %s::%s: %s", action, get_api_type_label(conn->credentials.end_point), (conn->response.code == 200 ? "ok" : "nok"));
+        http_stats_update(&s->stats, easy, res, conn->credentials.end_point);
+        metrics_http_times(conn->credentials.end_point, easy);
+        metrics_request_done(conn->credentials.end_point, conn->type, res == CURLE_OK && conn->response.code >= 200 && conn->response.code < 300);
 
         if(evtimer_pending(&s->timer_event, NULL)) {
             _trace2("curl::multi_timer_remove(%p)", &s->timer_event);
             evtimer_del(&s->timer_event);
         }
-#ifdef RETRY_ENABLED
-        if (!connection_was_fulfilled(conn) && connection_should_retry(conn)) {
-            connection_retry(conn);
-            return
-        }
-#endif
         conn->should_free = connection_was_fulfilled(conn);
+
+        // NOTE(marius): the tracks of a failed batch are not acknowledged, so they stay in the journal until the
+        // breaker of the service lets the backlog through again
+        struct api_breaker *breaker = &s->breakers[conn->credentials.end_point];
+        if (api_breaker_is_failure(res, conn->response.code)) {
+            api_breaker_failure(breaker, http_response_retry_after(&conn->response, time(NULL)));
+        } else {
+            api_breaker_success(breaker);
+        }
+        if (conn->type == request_now_playing && (res != CURLE_OK || conn->response.code < 200 || conn->response.code >= 300)) {
+            // NOTE(marius): the service might not show what's playing, so the next now playing request goes out
+            now_playing_cache_clear(&s->now_playing[conn->credentials.end_point]);
+        }
+        if (conn->type == request_scrobble && conn->response.code >= 200 && conn->response.code < 300) {
+            // NOTE(marius): the deferred tracks would be submitted again right away, so the backlog waits for the next scrobble
+            if (scrobbler_connection_acknowledge(conn) == 0) {
+                scrobbler_schedule_drain(s);
+            }
+        } else if (conn->type == request_scrobble && !api_breaker_is_failure(res, conn->response.code)) {
+            // NOTE(marius): same for the tracks of a refused request, they wait for the next scrobble, and they are
+            //  dropped once they get refused too many times
+            scrobbler_connection_refused(conn);
+        }
+        log_context_clear();
     }
 }
 
@@ -127,6 +129,7 @@ static void timer_cb(int fd, short kind, void *data)
 
     struct scrobbler *s = data;
 
+    const double start = loop_profiler_start();
     const CURLMcode rc = curl_multi_socket_action(s->handle, CURL_SOCKET_TIMEOUT, 0, &s->still_running);
     const char *res;
     switch(rc) {
@@ -153,6 +156,7 @@ static void timer_cb(int fd, short kind, void *data)
         break;
     case CURLM_BAD_SOCKET:
         _warn("curl::multi_socket_activation:error: %s", curl_multi_strerror(rc));
+        loop_profiler_end(loop_probe_curl_timer, start);
         return;
     default:
         res = "unknown";
@@ -162,6 +166,7 @@ static void timer_cb(int fd, short kind, void *data)
     check_multi_info(s);
 
     scrobbler_connections_clean(&s->connections, false);
+    loop_profiler_end(loop_probe_curl_timer, start);
 }
 
 /* Called by libevent when we get action on a multi socket */
@@ -174,9 +179,11 @@ static void event_cb(int fd, short kind, void *data)
 
     const int action = ((kind & EV_READ) ? CURL_CSELECT_IN : 0) | ((kind & EV_WRITE) ? CURL_CSELECT_OUT : 0);
 
+    const double start = loop_profiler_start();
     const CURLMcode rc = curl_multi_socket_action(s->handle, fd, action, &s->still_running);
     if (rc != CURLM_OK) {
         _warn("curl::transfer::error: %s", curl_multi_strerror(rc));
+        loop_profiler_end(loop_probe_curl_socket, start);
         return;
     }
 
@@ -185,6 +192,7 @@ static void event_cb(int fd, short kind, void *data)
     check_multi_info(s);
 
     scrobbler_connections_clean(&s->connections, false);
+    loop_profiler_end(loop_probe_curl_socket, start);
 }
 
 struct sock_info {
@@ -322,11 +330,11 @@ static size_t http_response_write_body(void *buffer, size_t size, size_t nmemb,
 
     const size_t new_size = size * nmemb;
 
-    strncat(res->body, buffer, new_size);
-    res->body_length += new_size;
-
-    assert (res->body_length < MAX_BODY_SIZE);
-    memset(res->body + res->body_length, 0x0, MAX_BODY_SIZE - res->body_length);
+    if (!http_buffer_append(&res->body, buffer, new_size)) {
+        _warn("curl::response_body: unable to store %zu bytes", new_size);
+        return 0;
+    }
+    http_response_parse_json_chunk(res, buffer, new_size);
 
     return new_size;
 }
@@ -343,17 +351,17 @@ static size_t http_response_write_headers(char *buffer, size_t size, size_t nite
 
     const size_t new_size = size * nitems;
 
-    struct http_header *h = http_header_new();
+    // NOTE(marius): the status line and the empty line at the end of the headers are skipped before allocating
+    struct http_header header = {0};
+    http_header_load(buffer, nitems, &header);
+    if (_is_zero(header.name)) { return new_size; }
 
-    http_header_load(buffer, nitems, h);
-    if (_is_zero(h->name)) { goto _err_exit; }
+    struct http_header *h = http_header_new(res->arena);
+    if (NULL == h) { return new_size; }
+    memcpy(h, &header, sizeof(header));
 
     arrput(res->headers, h);
     return new_size;
-
-_err_exit:
-    http_header_free(h);
-    return new_size;
 }
 
 #if defined(LIBCURL_DEBUG) && LIBCURL_DEBUG
@@ -403,9 +411,72 @@ static int curl_debug(CURL *handle, curl_infotype type, char *data, size_t size,
 }
 #endif
 
+/*
+ * Returns an easy handle for a request to end_point, an idle one from the pool if there is any.
+ * The reset keeps the live connections, the DNS cache and the TLS sessions of the handle, but it clears its options,
+ * the share included, so that's set again on every handle.
+ */
+static CURL *curl_handle_acquire(struct scrobbler *s, const enum api_type end_point)
+{
+    CURL *handle = NULL;
+    struct http_handle_pool *pool = &s->pool;
+    if (pool->idle_count[end_point] > 0) {
+        pool->idle_count[end_point]--;
+        handle = pool->idle[end_point][pool->idle_count[end_point]];
+        pool->idle[end_point][pool->idle_count[end_point]] = NULL;
+        curl_easy_reset(handle);
+        s->stats.handles_reused++;
+        _trace2("curl::handle_reused[%s]: %p", get_api_type_label(end_point), handle);
+    } else {
+        handle = curl_easy_init();
+        if (NULL == handle) { return NULL; }
+        s->stats.handles_created++;
+        _trace2("curl::handle_created[%s]: %p", get_api_type_label(end_point), handle);
+    }
+    if (NULL != s->share) {
+        curl_easy_setopt(handle, CURLOPT_SHARE, s->share);
+    }
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 30L);
+
+    return handle;
+}
+
+static void curl_handle_release(struct scrobbler *s, const enum api_type end_point, CURL *handle)
+{
+    if (NULL == handle) { return; }
+    if (NULL != s->handle) {
+        curl_multi_remove_handle(s->handle, handle);
+    }
+
+    struct http_handle_pool *pool = &s->pool;
+    if (pool->idle_count[end_point] >= MAX_IDLE_HANDLES) {
+        curl_easy_cleanup(handle);
+        return;
+    }
+    pool->idle[end_point][pool->idle_count[end_point]] = handle;
+    pool->idle_count[end_point]++;
+}
+
+static void curl_handle_pool_clean(struct http_handle_pool *pool)
+{
+    for (int i = 0; i < API_TYPE_COUNT; i++) {
+        for (unsigned j = 0; j < pool->idle_count[i]; j++) {
+            curl_easy_cleanup(pool->idle[i][j]);
+            pool->idle[i][j] = NULL;
+        }
+        pool->idle_count[i] = 0;
+    }
+}
+
 static void curl_easy_handle_init(struct scrobbler_connection *conn)
 {
-    conn->handle = curl_easy_init();
+    if (NULL == conn->parent) {
+        conn->handle = curl_easy_init();
+        return;
+    }
+    conn->handle = curl_handle_acquire(conn->parent, conn->credentials.end_point);
 }
 
 static void curl_easy_handle_cleanup(struct scrobbler_connection *conn)
@@ -414,16 +485,46 @@ static void curl_easy_handle_cleanup(struct scrobbler_connection *conn)
 
     if (NULL != conn->handle) {
         _trace2("scrobbler::connection_free:curl_easy_handle[%p]", conn->handle);
-        if (NULL != conn->parent && NULL != conn->parent->handle) {
-            curl_multi_remove_handle(conn->parent->handle, conn->handle);
+        if (NULL != conn->parent) {
+            curl_handle_release(conn->parent, conn->credentials.end_point, conn->handle);
+        } else {
+            curl_easy_cleanup(conn->handle);
         }
-
-        curl_easy_cleanup(conn->handle);
     };
 
     conn->handle = NULL;
 }
 
+/*
+ * Builds the list of headers curl sends in the arena of the connection, instead of using curl_slist_append(), so
+ * it gets released with the rest of the request.
+ */
+static struct curl_slist *curl_headers_build(struct http_arena *arena, struct http_header **headers)
+{
+    struct curl_slist *result = NULL;
+    struct curl_slist *last = NULL;
+    const size_t headers_count = arrlen(headers);
+    for (size_t i = 0; i < headers_count; i++) {
+        const struct http_header *header = headers[i];
+        char full_header[MAX_URL_LENGTH] = {0};
+        const int length = snprintf(full_header, MAX_URL_LENGTH, "%s: %s", header->name, header->value);
+        if (length < 0) { continue; }
+
+        struct curl_slist *item = http_arena_alloc(arena, sizeof(struct curl_slist));
+        if (NULL == item) { break; }
+        item->data = http_arena_strndup(arena, full_header, min((size_t)length, MAX_URL_LENGTH - 1));
+        if (NULL == item->data) { break; }
+
+        if (NULL == last) {
+            result = item;
+        } else {
+            last->next = item;
+        }
+        last = item;
+    }
+    return result;
+}
+
 static void build_curl_request(struct scrobbler_connection *conn)
 {
     assert (NULL != conn);
@@ -437,16 +538,15 @@ static void build_curl_request(struct scrobbler_connection *conn)
     }
 #endif
 
-    const struct http_request *req = &conn->request;
-    struct curl_slist ***req_headers = &conn->headers;
+    struct http_request *req = &conn->request;
 
     if (NULL == handle) { return; }
     const enum http_request_types t = req->request_type;
 
     if (t == http_post) {
         curl_easy_setopt(handle, CURLOPT_POST, 1L);
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, req->body);
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long)req->body_length);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, http_buffer_data(&req->body));
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)req->body.length);
     }
 
     http_request_print(req, log_tracing2);
@@ -455,22 +555,14 @@ static void build_curl_request(struct scrobbler_connection *conn)
     curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, conn->error);
     curl_easy_setopt(handle, CURLOPT_TIMEOUT, (long)MAX_WAIT_SECONDS);
     curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    // NOTE(marius): the batches for the same service wait to be multiplexed over its HTTP/2 connection instead of
+    // opening new ones
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
     curl_easy_setopt(handle, CURLOPT_CURLU, req->url);
     curl_easy_setopt(handle, CURLOPT_HEADER, 0L);
-    const size_t headers_count = arrlen(req->headers);
-    if (headers_count > 0) {
-        struct curl_slist *headers = NULL;
-
-        for (size_t i = 0; i < headers_count; i++) {
-            struct http_header *header = req->headers[i];
-            char full_header[MAX_URL_LENGTH] = {0};
-            snprintf(full_header, MAX_URL_LENGTH, "%s: %s", header->name, header->value);
-
-            headers = curl_slist_append(headers, full_header);
-        }
-        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
-        arrput(*req_headers, headers);
-    }
+    conn->headers = curl_headers_build(&conn->arena, req->headers);
+    // NOTE(marius): a reused handle would otherwise keep pointing at the headers of its previous request
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, conn->headers);
 
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, http_response_write_body);
     curl_easy_setopt(handle, CURLOPT_WRITEDATA, conn);
@@ -483,6 +575,18 @@ static void curl_handler_init(struct scrobbler *s)
     curl_global_init(CURL_GLOBAL_DEFAULT);
     s->handle = curl_multi_init();
 
+    curl_multi_setopt(s->handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    // NOTE(marius): the event loop is single threaded, so the share doesn't need locking
+    s->share = curl_share_init();
+    if (NULL != s->share) {
+        curl_share_setopt(s->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(s->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(s->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+
     curl_multi_setopt(s->handle, CURLMOPT_SOCKETFUNCTION, curl_request_has_data);
     curl_multi_setopt(s->handle, CURLMOPT_SOCKETDATA, s);
     curl_multi_setopt(s->handle, CURLMOPT_TIMERFUNCTION, curl_request_wait_timeout);
@@ -491,9 +595,21 @@ static void curl_handler_init(struct scrobbler *s)
 
 static void curl_handler_cleanup(struct scrobbler *s)
 {
+    const struct http_stats *stats = &s->stats;
+    _debug("curl::stats: %zu requests, %zu connections opened, %zu reused, %zu handles created, %zu reused",
+           stats->requests, stats->connections_created, stats->connections_reused, stats->handles_created, stats->handles_reused);
+
+    curl_handle_pool_clean(&s->pool);
+    http_buffer_pool_clean();
+
     curl_multi_cleanup(s->handle);
     s->handle = NULL;
 
+    if (NULL != s->share) {
+        curl_share_cleanup(s->share);
+        s->share = NULL;
+    }
+
     curl_global_cleanup();
 }
 
@@ -16,13 +16,24 @@
 #include "sstrings.h"
 #include "structs.h"
 #include "utils.h"
+#include "metrics.h"
+#include "profiler.h"
 #include "api.h"
 #include "smpris.h"
+#include "mpris_players.h"
+#include "scrobble_arena.h"
+#include "journal.h"
+#include "ledger.h"
+#include "now_playing_cache.h"
 #include "scrobbler.h"
+#include "playback_clock.h"
+#include "timer_wheel.h"
 #include "scrobble.h"
 #include "sdbus.h"
 #include "sevents.h"
 #include "configuration.h"
+#include "watcher.h"
+#include "control.h"
 
 #define HELP_MESSAGE        "MPRIS scrobbler daemon, version %s\n" \
 "Usage:\n  %s\t\tStart daemon\n" \
@@ -43,6 +54,7 @@ int main (const int argc, char *argv[])
     // TODO(marius): make this asynchronous to be requested when submitting stuff
     struct parsed_arguments arguments = {0};
     parse_command_line(&arguments, daemon_bin, argc, argv);
+    log_open(get_application_name());
     if (arguments.has_help) {
         print_help(arguments.name);
         status = EXIT_SUCCESS;
@@ -53,6 +65,8 @@ int main (const int argc, char *argv[])
     load_pid_path(&config);
     _trace("main::writing_pid: %s", config.pid_path);
     config.wrote_pid = write_pid(config.pid_path);
+    load_metrics_path(&config);
+    load_control_path(&config);
 
 #if 0
     print_application_config(&config);
@@ -75,6 +89,7 @@ _free_state:
     state_destroy(&state);
     configuration_clean(&config);
 _exit:
+    log_close();
 
     return status;
 }
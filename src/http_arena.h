@@ -0,0 +1,100 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_HTTP_ARENA_H
+#define MPRIS_SCROBBLER_HTTP_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The small objects that live as long as a request are allocated from the arena of its connection: the headers of the
+ * request and of the response, the endpoint and the list of headers given to curl.
+ * They are never freed one by one, resetting the arena releases all of them at once. The first block of the arena is
+ * kept by the reset, so the next request of a recycled connection doesn't allocate anything for them.
+ */
+
+#define HTTP_ARENA_ALIGNMENT _Alignof(max_align_t)
+
+static size_t http_arena_align(const size_t size)
+{
+    return (size + HTTP_ARENA_ALIGNMENT - 1) & ~(HTTP_ARENA_ALIGNMENT - 1);
+}
+
+static struct http_arena_block *http_arena_block_new(const size_t size)
+{
+    const size_t capacity = size > HTTP_ARENA_BLOCK_SIZE ? size : HTTP_ARENA_BLOCK_SIZE;
+    struct http_arena_block *block = malloc(sizeof(struct http_arena_block) + capacity);
+    if (NULL == block) { return NULL; }
+
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+/*
+ * Returns zeroed memory that stays valid until the arena is reset.
+ */
+static void *http_arena_alloc(struct http_arena *arena, const size_t size)
+{
+    if (NULL == arena) { return NULL; }
+
+    const size_t aligned = http_arena_align(size);
+    struct http_arena_block *block = arena->current;
+    if (NULL == block || block->used + aligned > block->capacity) {
+        block = http_arena_block_new(aligned);
+        if (NULL == block) { return NULL; }
+
+        if (NULL == arena->current) {
+            arena->head = block;
+        } else {
+            arena->current->next = block;
+        }
+        arena->current = block;
+    }
+
+    void *result = (char*)block->data + block->used;
+    block->used += aligned;
+    memset(result, 0, size);
+    return result;
+}
+
+static char *http_arena_strndup(struct http_arena *arena, const char *value, const size_t length)
+{
+    char *result = http_arena_alloc(arena, length + 1);
+    if (NULL == result) { return NULL; }
+
+    memcpy(result, value, length);
+    result[length] = '\0';
+    return result;
+}
+
+static void http_arena_reset(struct http_arena *arena)
+{
+    if (NULL == arena || NULL == arena->head) { return; }
+
+    struct http_arena_block *block = arena->head->next;
+    while (NULL != block) {
+        struct http_arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+    arena->current = arena->head;
+}
+
+static void http_arena_free(struct http_arena *arena)
+{
+    if (NULL == arena) { return; }
+
+    http_arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+#endif // MPRIS_SCROBBLER_HTTP_ARENA_H
@@ -0,0 +1,175 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_HTTP_BUFFER_H
+#define MPRIS_SCROBBLER_HTTP_BUFFER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The bodies of the HTTP requests and responses are stored in a list of chunks, so appending to them
+ * doesn't need to copy what was already written and they have no upper size limit.
+ * Every chunk keeps a NUL byte after its data, so a body that fits in one chunk can be used as a string directly.
+ * The chunks of the buffers that get cleaned are kept in a pool to be reused by the next request.
+ */
+
+#define HTTP_BUFFER_POOL_MAX_CHUNKS 32
+
+static struct http_buffer_chunk *http_buffer_pool = NULL;
+static size_t http_buffer_pool_count = 0;
+
+static struct http_buffer_chunk *http_buffer_chunk_new(const size_t capacity)
+{
+    struct http_buffer_chunk *chunk = NULL;
+    if (capacity <= HTTP_BUFFER_CHUNK_SIZE && NULL != http_buffer_pool) {
+        chunk = http_buffer_pool;
+        http_buffer_pool = chunk->next;
+        http_buffer_pool_count--;
+    } else {
+        const size_t size = capacity > HTTP_BUFFER_CHUNK_SIZE ? capacity : HTTP_BUFFER_CHUNK_SIZE;
+        chunk = malloc(sizeof(struct http_buffer_chunk) + size + 1);
+        if (NULL == chunk) { return NULL; }
+        chunk->capacity = size;
+    }
+    chunk->next = NULL;
+    chunk->length = 0;
+    chunk->data[0] = '\0';
+    return chunk;
+}
+
+static void http_buffer_chunk_release(struct http_buffer_chunk *chunk)
+{
+    if (chunk->capacity != HTTP_BUFFER_CHUNK_SIZE || http_buffer_pool_count >= HTTP_BUFFER_POOL_MAX_CHUNKS) {
+        free(chunk);
+        return;
+    }
+    chunk->next = http_buffer_pool;
+    http_buffer_pool = chunk;
+    http_buffer_pool_count++;
+}
+
+static void http_buffer_pool_clean(void)
+{
+    while (NULL != http_buffer_pool) {
+        struct http_buffer_chunk *next = http_buffer_pool->next;
+        free(http_buffer_pool);
+        http_buffer_pool = next;
+    }
+    http_buffer_pool_count = 0;
+}
+
+static void http_buffer_init(struct http_buffer *buf)
+{
+    buf->head = NULL;
+    buf->tail = NULL;
+    buf->length = 0;
+}
+
+static void http_buffer_clean(struct http_buffer *buf)
+{
+    if (NULL == buf) { return; }
+
+    struct http_buffer_chunk *chunk = buf->head;
+    while (NULL != chunk) {
+        struct http_buffer_chunk *next = chunk->next;
+        http_buffer_chunk_release(chunk);
+        chunk = next;
+    }
+    http_buffer_init(buf);
+}
+
+static bool http_buffer_append(struct http_buffer *buf, const char *data, size_t length)
+{
+    if (NULL == data) { return false; }
+
+    while (length > 0) {
+        struct http_buffer_chunk *tail = buf->tail;
+        if (NULL == tail || tail->length == tail->capacity) {
+            tail = http_buffer_chunk_new(HTTP_BUFFER_CHUNK_SIZE);
+            if (NULL == tail) { return false; }
+            if (NULL == buf->head) {
+                buf->head = tail;
+            } else {
+                buf->tail->next = tail;
+            }
+            buf->tail = tail;
+        }
+
+        const size_t available = tail->capacity - tail->length;
+        const size_t written = length < available ? length : available;
+        memcpy(tail->data + tail->length, data, written);
+        tail->length += written;
+        tail->data[tail->length] = '\0';
+
+        buf->length += written;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool http_buffer_append_string(struct http_buffer *buf, const char *str)
+{
+    if (NULL == str) { return false; }
+    return http_buffer_append(buf, str, strlen(str));
+}
+
+/*
+ * Appends str percent encoded, the same way curl_easy_escape() does: everything except the unreserved characters
+ * of RFC 3986 gets escaped.
+ */
+static bool http_buffer_append_escaped(struct http_buffer *buf, const char *str)
+{
+    if (NULL == str) { return false; }
+
+    static const char hex[] = "0123456789ABCDEF";
+    char escaped[256];
+    size_t length = 0;
+    for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; c++) {
+        if (length + 3 > sizeof(escaped)) {
+            if (!http_buffer_append(buf, escaped, length)) { return false; }
+            length = 0;
+        }
+        const bool unreserved = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ||
+            *c == '-' || *c == '.' || *c == '_' || *c == '~';
+        if (unreserved) {
+            escaped[length++] = (char)*c;
+        } else {
+            escaped[length++] = '%';
+            escaped[length++] = hex[*c >> 4];
+            escaped[length++] = hex[*c & 0x0f];
+        }
+    }
+    return http_buffer_append(buf, escaped, length);
+}
+
+/*
+ * Returns the contents of the buffer as a NUL terminated string.
+ * If the buffer spans more than one chunk they get merged into a single one first.
+ */
+static const char *http_buffer_data(struct http_buffer *buf)
+{
+    if (NULL == buf->head) { return ""; }
+    if (buf->head == buf->tail) { return buf->head->data; }
+
+    struct http_buffer_chunk *merged = http_buffer_chunk_new(buf->length);
+    if (NULL == merged) { return NULL; }
+
+    struct http_buffer_chunk *chunk = buf->head;
+    while (NULL != chunk) {
+        struct http_buffer_chunk *next = chunk->next;
+        memcpy(merged->data + merged->length, chunk->data, chunk->length);
+        merged->length += chunk->length;
+        http_buffer_chunk_release(chunk);
+        chunk = next;
+    }
+    merged->data[merged->length] = '\0';
+
+    buf->head = merged;
+    buf->tail = merged;
+    return merged->data;
+}
+
+#endif // MPRIS_SCROBBLER_HTTP_BUFFER_H
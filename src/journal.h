@@ -0,0 +1,941 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_JOURNAL_H
+#define MPRIS_SCROBBLER_JOURNAL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The journal is an append-only file living at the cache path.
+ * Every scrobble that gets queued is written as an append record, and every service that accepted it
+ * writes a tombstone record for its id. The journal also acts as the backlog for the scrobbles that don't
+ * fit in the in-memory queue: only a small index entry is kept for them, and their records get loaded
+ * back in batches once the queue drains, for every service the ones it didn't accept yet.
+ * The index is sorted by id, so finding an entry takes a binary search, and the count of the spilled entries is kept
+ * as they change. It holds at most JOURNAL_MAX_INDEXED of the oldest scrobbles, the ones after them are only counted,
+ * and they get indexed from the file once the services accepted half of the ones before them. So the memory stays
+ * the same however long an outage lasts.
+ * NOTE(marius): while a service is down, the scrobbles the others accepted stay indexed until it accepts them too,
+ *  once those fill up the index, the others wait for it as well.
+ *
+ * The file starts with a magic number and a version, followed by records in the form:
+ *   uint32_t length    - the length of the payload
+ *   uint32_t checksum  - the CRC-32 of the payload
+ *   uint8_t  type      - first byte of the payload, one of enum journal_record_type
+ *   ...                - the rest of the payload
+ *
+ * Values are stored in host byte order, as the file is not meant to be shared between machines.
+ */
+#define JOURNAL_MAGIC                   0x4a53504dU // "MPSJ"
+#define JOURNAL_VERSION                 1U
+#define JOURNAL_HEADER_SIZE             (2 * sizeof(uint32_t))
+#define JOURNAL_RECORD_HEADER_SIZE      (2 * sizeof(uint32_t))
+#define JOURNAL_MAX_RECORD_SIZE         32768
+#define JOURNAL_SYNC_BATCH              16
+#define JOURNAL_SYNC_SECONDS            1
+#define JOURNAL_COMPACT_DELAY_SECONDS   5
+#define JOURNAL_COMPACT_MIN_RECORDS     64
+#define JOURNAL_TMP_SUFFIX              ".tmp"
+#define JOURNAL_MAX_REJECTIONS          5
+#ifndef JOURNAL_MAX_INDEXED
+#define JOURNAL_MAX_INDEXED             16384
+#endif
+#define JOURNAL_TOMBSTONE_SIZE          (JOURNAL_RECORD_HEADER_SIZE + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint8_t))
+
+enum journal_record_type {
+    journal_record_unknown = 0,
+    journal_record_append,
+    journal_record_tombstone,
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, const size_t len)
+{
+    static uint32_t table[256] = {0};
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1U) ? (0xedb88320U ^ (c >> 1U)) : (c >> 1U);
+            }
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xffU] ^ (crc >> 8U);
+    }
+    return ~crc;
+}
+
+struct journal_cursor {
+    const uint8_t *data;
+    size_t length;
+    size_t offset;
+    bool valid;
+};
+
+static size_t journal_put(uint8_t *buf, size_t off, const void *src, const size_t len)
+{
+    assert(off + len <= JOURNAL_MAX_RECORD_SIZE);
+    memcpy(buf + off, src, len);
+    return off + len;
+}
+
+static size_t journal_put_string(uint8_t *buf, size_t off, const char *s)
+{
+    const uint16_t len = (NULL == s) ? 0 : (uint16_t)strnlen(s, MAX_PROPERTY_LENGTH);
+    off = journal_put(buf, off, &len, sizeof(len));
+    return journal_put(buf, off, s, len);
+}
+
+static size_t journal_put_strings(uint8_t *buf, size_t off, const char *const s[MAX_PROPERTY_COUNT])
+{
+    uint8_t count = 0;
+    while (count < MAX_PROPERTY_COUNT && NULL != s[count] && strlen(s[count]) > 0) { count++; }
+
+    off = journal_put(buf, off, &count, sizeof(count));
+    for (uint8_t i = 0; i < count; i++) {
+        off = journal_put_string(buf, off, s[i]);
+    }
+    return off;
+}
+
+static void journal_get(struct journal_cursor *c, void *dst, const size_t len)
+{
+    if (!c->valid || c->offset + len > c->length) {
+        c->valid = false;
+        return;
+    }
+    memcpy(dst, c->data + c->offset, len);
+    c->offset += len;
+}
+
+static void journal_get_string(struct journal_cursor *c, char *dst)
+{
+    uint16_t len = 0;
+    journal_get(c, &len, sizeof(len));
+    if (len > MAX_PROPERTY_LENGTH) {
+        c->valid = false;
+    }
+    journal_get(c, dst, len);
+    if (c->valid) {
+        dst[len] = '\0';
+    }
+}
+
+static void journal_get_strings(struct journal_cursor *c, char dst[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1])
+{
+    uint8_t count = 0;
+    journal_get(c, &count, sizeof(count));
+    if (count > MAX_PROPERTY_COUNT) {
+        c->valid = false;
+    }
+    for (uint8_t i = 0; i < count && c->valid; i++) {
+        journal_get_string(c, dst[i]);
+    }
+}
+
+/*
+ * The strings are written in the order of scrobble::strings, the single values followed by the lists
+ * which are prefixed with their number of non-empty elements.
+ */
+static size_t journal_encode_scrobble(uint8_t *buf, size_t off, const struct scrobble *s)
+{
+    const int64_t start_time = (int64_t)s->start_time;
+    const uint8_t scrobbled = s->scrobbled;
+
+    off = journal_put(buf, off, &s->play_time, sizeof(s->play_time));
+    off = journal_put(buf, off, &s->position, sizeof(s->position));
+    off = journal_put(buf, off, &s->length, sizeof(s->length));
+    off = journal_put(buf, off, &start_time, sizeof(start_time));
+    off = journal_put(buf, off, &s->track_number, sizeof(s->track_number));
+    off = journal_put(buf, off, &scrobbled, sizeof(scrobbled));
+    for (int i = 0; i < SCROBBLE_STRING_FIELDS; i++) {
+        off = journal_put_string(buf, off, s->strings[i]);
+    }
+    for (int i = 0; i < SCROBBLE_STRING_LISTS; i++) {
+        off = journal_put_strings(buf, off, &s->strings[SCROBBLE_STRING_FIELDS + i * MAX_PROPERTY_COUNT]);
+    }
+    return off;
+}
+
+static bool journal_decode_scrobble(struct journal_cursor *c, struct scrobble *s)
+{
+    int64_t start_time = 0;
+    uint8_t scrobbled = 0;
+    char values[SCROBBLE_STRING_COUNT][MAX_PROPERTY_LENGTH+1] = {0};
+
+    scrobble_clean(s);
+    memset(s, 0, sizeof(*s));
+    journal_get(c, &s->play_time, sizeof(s->play_time));
+    journal_get(c, &s->position, sizeof(s->position));
+    journal_get(c, &s->length, sizeof(s->length));
+    journal_get(c, &start_time, sizeof(start_time));
+    journal_get(c, &s->track_number, sizeof(s->track_number));
+    journal_get(c, &scrobbled, sizeof(scrobbled));
+    for (int i = 0; i < SCROBBLE_STRING_FIELDS; i++) {
+        journal_get_string(c, values[i]);
+    }
+    for (int i = 0; i < SCROBBLE_STRING_LISTS; i++) {
+        journal_get_strings(c, &values[SCROBBLE_STRING_FIELDS + i * MAX_PROPERTY_COUNT]);
+    }
+    if (!c->valid) { return false; }
+
+    const char *strings[SCROBBLE_STRING_COUNT] = {0};
+    for (int i = 0; i < SCROBBLE_STRING_COUNT; i++) {
+        strings[i] = values[i];
+    }
+
+    s->start_time = (time_t)start_time;
+    s->scrobbled = scrobbled > 0;
+    return scrobble_load_strings(s, strings);
+}
+
+static bool journal_write_all(const int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        const ssize_t wrote = write(fd, buf, len);
+        if (wrote < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        buf += wrote;
+        len -= (size_t)wrote;
+    }
+    return true;
+}
+
+static bool journal_read_at(const int fd, uint8_t *buf, const size_t len, const off_t offset)
+{
+    size_t read_bytes = 0;
+    while (read_bytes < len) {
+        const ssize_t r = pread(fd, buf + read_bytes, len - read_bytes, offset + (off_t)read_bytes);
+        if (r < 0 && errno == EINTR) { continue; }
+        if (r <= 0) { return false; }
+        read_bytes += (size_t)r;
+    }
+    return true;
+}
+
+static bool journal_header_is_valid(const int fd)
+{
+    uint32_t header[2] = {0};
+    if (!journal_read_at(fd, (uint8_t*)header, sizeof(header), 0)) { return false; }
+
+    return header[0] == JOURNAL_MAGIC && header[1] == JOURNAL_VERSION;
+}
+
+/*
+ * Reads the complete record found at offset into buf, which must hold JOURNAL_MAX_RECORD_SIZE bytes.
+ * Returns false when the record is either truncated or fails the checksum.
+ */
+static bool journal_read_record(const int fd, const off_t offset, uint8_t *buf, struct journal_cursor *record)
+{
+    uint32_t header[2] = {0};
+    if (!journal_read_at(fd, (uint8_t*)header, sizeof(header), offset)) { return false; }
+
+    const size_t payload_length = header[0];
+    if (payload_length == 0 || payload_length > JOURNAL_MAX_RECORD_SIZE) { return false; }
+
+    if (!journal_read_at(fd, buf, payload_length, offset + (off_t)JOURNAL_RECORD_HEADER_SIZE)) { return false; }
+    if (crc32_update(0, buf, payload_length) != header[1]) { return false; }
+
+    record->data = buf;
+    record->length = payload_length;
+    record->offset = 0;
+    record->valid = true;
+    return true;
+}
+
+static void journal_sync(struct scrobble_journal *j)
+{
+    if (j->fd < 0 || j->unsynced == 0) { return; }
+
+    if (fdatasync(j->fd) != 0) {
+        _warn("journal::sync_failed[%s]: %s", j->path, strerror(errno));
+        return;
+    }
+    _trace2("journal::synced[%s]: %u records", j->path, j->unsynced);
+    j->unsynced = 0;
+
+    if (evtimer_initialized(&j->sync_event) && evtimer_pending(&j->sync_event, NULL)) {
+        evtimer_del(&j->sync_event);
+    }
+}
+
+static void journal_sync_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    journal_sync(data);
+}
+
+/*
+ * Fills in the record header for the payload that was written after it in buf.
+ */
+static size_t journal_seal_record(uint8_t *buf, const size_t length)
+{
+    assert(length > JOURNAL_RECORD_HEADER_SIZE);
+
+    const uint32_t header[2] = {
+        (uint32_t)(length - JOURNAL_RECORD_HEADER_SIZE),
+        crc32_update(0, buf + JOURNAL_RECORD_HEADER_SIZE, length - JOURNAL_RECORD_HEADER_SIZE),
+    };
+    memcpy(buf, header, sizeof(header));
+    return length;
+}
+
+static size_t journal_tombstone_record(uint8_t buf[JOURNAL_TOMBSTONE_SIZE], const uint64_t id, const enum api_type end_point)
+{
+    const uint8_t type = journal_record_tombstone;
+    const uint8_t api = (uint8_t)end_point;
+
+    size_t off = JOURNAL_RECORD_HEADER_SIZE;
+    off = journal_put(buf, off, &type, sizeof(type));
+    off = journal_put(buf, off, &id, sizeof(id));
+    off = journal_put(buf, off, &api, sizeof(api));
+    return journal_seal_record(buf, off);
+}
+
+static bool journal_write_record(struct scrobble_journal *j, const uint8_t *buf, const size_t length)
+{
+    if (j->fd < 0) { return false; }
+
+    if (!journal_write_all(j->fd, buf, length)) {
+        j->error = errno;
+        _warn("journal::write_failed[%s]: %s", j->path, strerror(j->error));
+        // NOTE(marius): a partial write leaves a torn record behind, and the replay stops at the first one, dropping
+        //  every record after it, so it gets cut off before anything else is appended
+        if (ftruncate(j->fd, j->size) != 0) {
+            _error("journal::truncate_failed[%s]: %s", j->path, strerror(errno));
+            close(j->fd);
+            j->fd = -1;
+        }
+        return false;
+    }
+    j->error = 0;
+    j->size += (off_t)length;
+    j->record_count++;
+    j->unsynced++;
+
+    // NOTE(marius): fdatasync is batched, we either wait for enough records to accumulate
+    // or for the timer to expire, whichever comes first
+    if (j->unsynced >= JOURNAL_SYNC_BATCH) {
+        journal_sync(j);
+    } else if (evtimer_initialized(&j->sync_event) && !evtimer_pending(&j->sync_event, NULL)) {
+        const struct timeval timeout = { .tv_sec = JOURNAL_SYNC_SECONDS };
+        evtimer_add(&j->sync_event, &timeout);
+    }
+    return true;
+}
+
+/*
+ * The ids only ever grow, and the entries are added in the order of their ids, so the index is searched by halves.
+ * Returns the position of the first entry with an id that's not lower than id.
+ */
+static size_t journal_entry_position(const struct scrobble_journal *j, const uint64_t id)
+{
+    size_t low = 0;
+    size_t high = arrlen(j->live);
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (j->live[middle].id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static struct journal_entry *journal_find_entry(const struct scrobble_journal *j, const uint64_t id)
+{
+    if (id == 0) { return NULL; }
+
+    const size_t position = journal_entry_position(j, id);
+    if (position >= (size_t)arrlen(j->live)) { return NULL; }
+
+    struct journal_entry *entry = &j->live[position];
+    if (entry->id != id || entry->removed) { return NULL; }
+    return entry;
+}
+
+static size_t journal_live_count(const struct scrobble_journal *j)
+{
+    return arrlen(j->live) - j->removed + j->cold;
+}
+
+static bool journal_entry_is_done(const struct journal_entry *e, const unsigned required)
+{
+    // NOTE(marius): when no service is enabled we keep everything around until one gets enabled
+    return required > 0 && (e->acked & required) == required;
+}
+
+/*
+ * A spilled entry is a scrobble that lives only on disk: it's neither in the in-memory queue nor being submitted.
+ */
+static bool journal_entry_is_spilled(const struct journal_entry *e)
+{
+    return !e->removed && !e->queued && e->in_flight == 0;
+}
+
+static size_t journal_spilled_count(const struct scrobble_journal *j)
+{
+    return j->spilled + j->cold;
+}
+
+/*
+ * Describes why the last append didn't make it into the journal.
+ */
+static const char *journal_error(const struct scrobble_journal *j)
+{
+    if (j->fd < 0) { return "journal is closed"; }
+    return strerror(j->error);
+}
+
+/*
+ * A scrobble is pending for a service until the service accepts it, while it's neither in the in-memory queue nor
+ * being submitted to the service.
+ */
+static bool journal_entry_is_pending(const struct journal_entry *e, const enum api_type end_point)
+{
+    const unsigned bit = 1U << (unsigned)end_point;
+    return !e->removed && !e->queued && !(e->in_flight & bit) && !(e->acked & bit);
+}
+
+/*
+ * Collects the oldest entries pending for the service, up to count of them.
+ * Every service keeps a cursor at its oldest entry it didn't accept yet, so the ones before it are not looked at again.
+ */
+static size_t journal_pending(struct scrobble_journal *j, const enum api_type end_point, const struct journal_entry *pending[], const size_t count)
+{
+    const unsigned bit = 1U << (unsigned)end_point;
+    uint64_t *cursor = &j->cursors[end_point];
+
+    size_t found = 0;
+    bool advancing = true;
+    for (size_t i = journal_entry_position(j, *cursor); i < (size_t)arrlen(j->live) && found < count; i++) {
+        const struct journal_entry *entry = &j->live[i];
+        const bool accepted = entry->removed || (entry->acked & bit);
+        if (advancing && accepted) {
+            *cursor = entry->id + 1;
+            continue;
+        }
+        advancing = false;
+        if (!journal_entry_is_pending(entry, end_point)) { continue; }
+        pending[found] = entry;
+        found++;
+    }
+    return found;
+}
+
+/*
+ * Every change to an entry goes through here, to keep the count of the spilled ones.
+ */
+static void journal_entry_update(struct scrobble_journal *j, struct journal_entry *e, const bool queued, const unsigned in_flight, const bool removed)
+{
+    const bool was_spilled = journal_entry_is_spilled(e);
+    e->queued = queued;
+    e->in_flight = in_flight;
+    if (removed && !e->removed) {
+        e->removed = true;
+        j->removed++;
+    }
+    const bool is_spilled = journal_entry_is_spilled(e);
+    if (was_spilled && !is_spilled) {
+        j->spilled--;
+    } else if (!was_spilled && is_spilled) {
+        j->spilled++;
+    }
+}
+
+static void journal_add_entry(struct scrobble_journal *j, const uint64_t id, const off_t offset)
+{
+    const struct journal_entry entry = { .id = id, .offset = offset, };
+    arrput(j->live, entry);
+    j->spilled++;
+}
+
+/*
+ * Drops the removed entries from the index, once they make up half of it, so removing an entry doesn't have to move
+ * all the ones after it every time.
+ */
+static void journal_prune_index(struct scrobble_journal *j, const bool force)
+{
+    if (j->removed == 0 || (!force && j->removed * 2 < (size_t)arrlen(j->live))) { return; }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < arrlen(j->live); i++) {
+        if (j->live[i].removed) { continue; }
+        j->live[kept] = j->live[i];
+        kept++;
+    }
+    arrsetlen(j->live, kept);
+    j->removed = 0;
+}
+
+/*
+ * Indexes the append record at offset, unless the index is full or older scrobbles are already waiting on disk, in
+ * which case it only gets counted. Returns false for that.
+ */
+static bool journal_index_append(struct scrobble_journal *j, const uint64_t id, const off_t offset)
+{
+    if (j->cold == 0 && (size_t)arrlen(j->live) >= JOURNAL_MAX_INDEXED) {
+        journal_prune_index(j, true);
+    }
+    if (j->cold > 0 || (size_t)arrlen(j->live) >= JOURNAL_MAX_INDEXED) {
+        if (j->cold == 0) {
+            j->cold_offset = offset;
+        }
+        j->cold++;
+        return false;
+    }
+    journal_add_entry(j, id, offset);
+    return true;
+}
+
+static bool journal_is_acked(const struct scrobble_journal *j, const uint64_t id, const enum api_type end_point)
+{
+    const struct journal_entry *entry = journal_find_entry(j, id);
+    return NULL != entry && (entry->acked & (1U << (unsigned)end_point));
+}
+
+/*
+ * Counts a response of the service that didn't accept the scrobble, and tells if it reached the limit of those.
+ * NOTE(marius): the count lives only in memory, so after a restart the scrobble gets its attempts again
+ */
+static bool journal_reject(struct scrobble_journal *j, const uint64_t id, const enum api_type end_point)
+{
+    struct journal_entry *entry = journal_find_entry(j, id);
+    if (NULL == entry) { return false; }
+
+    if (entry->rejections[end_point] < JOURNAL_MAX_REJECTIONS) {
+        entry->rejections[end_point]++;
+    }
+    return entry->rejections[end_point] >= JOURNAL_MAX_REJECTIONS;
+}
+
+static void journal_set_queued(struct scrobble_journal *j, const uint64_t id, const bool queued)
+{
+    struct journal_entry *entry = journal_find_entry(j, id);
+    if (NULL == entry) { return; }
+    journal_entry_update(j, entry, queued, entry->in_flight, false);
+}
+
+static void journal_hold(struct scrobble_journal *j, const uint64_t id, const enum api_type end_point)
+{
+    struct journal_entry *entry = journal_find_entry(j, id);
+    if (NULL == entry) { return; }
+    journal_entry_update(j, entry, entry->queued, entry->in_flight | (1U << (unsigned)end_point), false);
+}
+
+static void journal_release(struct scrobble_journal *j, const uint64_t id, const enum api_type end_point)
+{
+    struct journal_entry *entry = journal_find_entry(j, id);
+    if (NULL == entry) { return; }
+    journal_entry_update(j, entry, entry->queued, entry->in_flight & ~(1U << (unsigned)end_point), false);
+}
+
+/*
+ * Loads the scrobble from the append record of the entry.
+ */
+static bool journal_load(const struct scrobble_journal *j, const struct journal_entry *entry, struct scrobble *s)
+{
+    static uint8_t buf[JOURNAL_MAX_RECORD_SIZE];
+    struct journal_cursor record = {0};
+
+    if (j->fd < 0 || !journal_read_record(j->fd, entry->offset, buf, &record)) {
+        _warn("journal::invalid_record[%" PRIu64 "]", entry->id);
+        return false;
+    }
+
+    uint8_t type = 0;
+    uint64_t id = 0;
+    journal_get(&record, &type, sizeof(type));
+    journal_get(&record, &id, sizeof(id));
+    if (type != journal_record_append || id != entry->id || !journal_decode_scrobble(&record, s)) {
+        _warn("journal::invalid_record[%" PRIu64 "]", entry->id);
+        scrobble_clean(s);
+        return false;
+    }
+    s->journal_id = id;
+    return true;
+}
+
+static uint64_t journal_append(struct scrobble_journal *j, const struct scrobble *s)
+{
+    if (j->fd < 0) { return 0; }
+
+    static uint8_t buf[JOURNAL_MAX_RECORD_SIZE];
+    const uint8_t type = journal_record_append;
+    const uint64_t id = j->next_id;
+    const off_t offset = j->size;
+
+    size_t off = JOURNAL_RECORD_HEADER_SIZE;
+    off = journal_put(buf, off, &type, sizeof(type));
+    off = journal_put(buf, off, &id, sizeof(id));
+    off = journal_encode_scrobble(buf, off, s);
+
+    if (!journal_write_record(j, buf, journal_seal_record(buf, off))) { return 0; }
+
+    j->next_id++;
+    if (!journal_index_append(j, id, offset)) {
+        _trace("journal::append_cold[%" PRIu64 "]: %zu scrobbles waiting on disk", id, j->cold);
+    }
+
+    _trace("journal::append[%" PRIu64 "]: %zu bytes", id, off);
+    return id;
+}
+
+/*
+ * Reads the records from offset to the end of the journal, indexing the scrobbles that fit, and applying the
+ * acknowledgements to the indexed ones. Returns the offset where the valid records end.
+ * NOTE(marius): the acknowledgements of a scrobble always come after it, so reading to the end finds all of them
+ */
+static off_t journal_index_records(struct scrobble_journal *j, off_t offset, const unsigned required, const bool replaying)
+{
+    static uint8_t buf[JOURNAL_MAX_RECORD_SIZE];
+
+    struct journal_cursor record = {0};
+    while (offset < j->size && journal_read_record(j->fd, offset, buf, &record)) {
+        uint8_t type = 0;
+        uint64_t id = 0;
+        journal_get(&record, &type, sizeof(type));
+        journal_get(&record, &id, sizeof(id));
+        if (replaying) {
+            j->record_count++;
+            if (id >= j->next_id) {
+                j->next_id = id + 1;
+            }
+        }
+        if (type == journal_record_append && arrlen(j->live) > 0 && id <= arrlast(j->live).id) {
+            // NOTE(marius): the index needs the ids in order, a record that breaks it can only come from a corrupted file
+            _warn("journal::invalid_record[%" PRIu64 "]: out of order, skipping", id);
+        } else if (type == journal_record_append) {
+            journal_index_append(j, id, offset);
+        } else if (type == journal_record_tombstone) {
+            uint8_t api = 0;
+            journal_get(&record, &api, sizeof(api));
+            struct journal_entry *entry = journal_find_entry(j, id);
+            if (api >= API_TYPE_COUNT) {
+                // NOTE(marius): a service we don't know about, from a newer version or a corrupted record
+                if (replaying) {
+                    _warn("journal::invalid_tombstone[%" PRIu64 "]: unknown service %u", id, api);
+                }
+            } else if (NULL != entry && record.valid) {
+                entry->acked |= 1U << api;
+                if (journal_entry_is_done(entry, required)) {
+                    journal_entry_update(j, entry, entry->queued, entry->in_flight, true);
+                }
+            }
+        }
+        offset += (off_t)(JOURNAL_RECORD_HEADER_SIZE + record.length);
+    }
+    return offset;
+}
+
+/*
+ * Indexes the scrobbles that were left on disk, once the index is down to half of what it can hold.
+ */
+static void journal_refill(struct scrobble_journal *j, const unsigned required)
+{
+    while (j->cold > 0 && (size_t)arrlen(j->live) - j->removed <= JOURNAL_MAX_INDEXED / 2) {
+        const size_t cold = j->cold;
+        journal_prune_index(j, true);
+        j->cold = 0;
+        const off_t end = journal_index_records(j, j->cold_offset, required, false);
+        if (end < j->size) {
+            // NOTE(marius): the scrobbles after the record we can't read are still on disk, and still need to be copied
+            //  when compacting, so they are kept as waiting
+            _warn("journal::invalid_record[%s]: unable to index past offset %jd", j->path, (intmax_t)end);
+            if (j->cold == 0) {
+                j->cold_offset = end;
+            }
+            j->cold++;
+            break;
+        }
+        _debug("journal::indexed[%s]: %zu scrobbles from disk, %zu left", j->path, cold - j->cold, j->cold);
+        if (j->cold >= cold) { break; }
+    }
+}
+
+static void journal_schedule_compaction(struct scrobble_journal *);
+static void journal_ack(struct scrobble_journal *j, const uint64_t id, const enum api_type end_point, const unsigned required)
+{
+    if (j->fd < 0 || id == 0) { return; }
+
+    struct journal_entry *entry = journal_find_entry(j, id);
+    if (NULL == entry) { return; }
+
+    const unsigned bit = 1U << (unsigned)end_point;
+    if (entry->acked & bit) { return; }
+
+    uint8_t buf[JOURNAL_TOMBSTONE_SIZE];
+    if (!journal_write_record(j, buf, journal_tombstone_record(buf, id, end_point))) { return; }
+
+    entry->acked |= bit;
+    _trace("journal::ack[%" PRIu64 "]: %s", id, get_api_type_label(end_point));
+    if (journal_entry_is_done(entry, required)) {
+        journal_entry_update(j, entry, entry->queued, entry->in_flight, true);
+        journal_prune_index(j, false);
+        journal_refill(j, required);
+    }
+    journal_schedule_compaction(j);
+}
+
+static bool journal_write_header(const int fd)
+{
+    const uint32_t header[2] = { JOURNAL_MAGIC, JOURNAL_VERSION };
+    return journal_write_all(fd, (const uint8_t*)header, sizeof(header));
+}
+
+/*
+ * Writes a record that was read from the journal to fd, returns its size on disk, or 0 on failure.
+ */
+static size_t journal_copy_record(const int fd, const struct journal_cursor *record)
+{
+    const uint32_t header[2] = { (uint32_t)record->length, crc32_update(0, record->data, record->length) };
+    if (!journal_write_all(fd, (const uint8_t*)header, sizeof(header)) || !journal_write_all(fd, record->data, record->length)) {
+        return 0;
+    }
+    return JOURNAL_RECORD_HEADER_SIZE + record->length;
+}
+
+/*
+ * Rewrites the journal keeping only the records for scrobbles that are still waiting on acknowledgements: the indexed
+ * ones with their acknowledgements, followed by the ones left on disk.
+ * The records are copied one at a time, and the new file is atomically renamed over the old one.
+ */
+static bool journal_compact(struct scrobble_journal *j)
+{
+    if (j->fd < 0) { return false; }
+
+    static uint8_t buf[JOURNAL_MAX_RECORD_SIZE];
+
+    journal_prune_index(j, true);
+
+    char tmp_path[FILE_PATH_MAX+1] = {0};
+    snprintf(tmp_path, FILE_PATH_MAX, "%s%s", j->path, JOURNAL_TMP_SUFFIX);
+
+    // NOTE(marius): the new file is opened the way the journal is, so after the rename it takes over without being
+    //  opened again, which could fail and leave us writing to the old file
+    const int fd = open(tmp_path, O_RDWR | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        _warn("journal::compact_failed[%s]: %s", tmp_path, strerror(errno));
+        return false;
+    }
+
+    const size_t live_count = arrlen(j->live);
+    off_t *offsets = calloc(live_count + 1, sizeof(off_t));
+    size_t record_count = 0;
+    off_t size = JOURNAL_HEADER_SIZE;
+    bool wrote = (NULL != offsets) && journal_write_header(fd);
+    for (size_t i = 0; wrote && i < live_count; i++) {
+        const struct journal_entry *entry = &j->live[i];
+        struct journal_cursor record = {0};
+        if (!journal_read_record(j->fd, entry->offset, buf, &record)) {
+            wrote = false;
+            break;
+        }
+
+        const size_t length = journal_copy_record(fd, &record);
+        wrote = length > 0;
+        offsets[i] = size;
+        size += (off_t)length;
+        record_count++;
+
+        // NOTE(marius): carry over the acknowledgements from services that already accepted the scrobble
+        for (unsigned api = api_lastfm; wrote && api <= api_listenbrainz; api++) {
+            if (!(entry->acked & (1U << api))) { continue; }
+
+            uint8_t tombstone[JOURNAL_TOMBSTONE_SIZE];
+            const size_t length = journal_tombstone_record(tombstone, entry->id, (enum api_type)api);
+            wrote = journal_write_all(fd, tombstone, length);
+            size += (off_t)length;
+            record_count++;
+        }
+    }
+
+    // NOTE(marius): the scrobbles left on disk are copied as they are, with the acknowledgements they got before a
+    //  restart, which are all newer than the first of them
+    uint64_t cold_id = 0;
+    off_t cold_offset = 0;
+    for (off_t offset = j->cold_offset; wrote && j->cold > 0 && offset < j->size; ) {
+        struct journal_cursor record = {0};
+        if (!journal_read_record(j->fd, offset, buf, &record)) {
+            wrote = false;
+            break;
+        }
+        offset += (off_t)(JOURNAL_RECORD_HEADER_SIZE + record.length);
+
+        uint8_t type = 0;
+        uint64_t id = 0;
+        journal_get(&record, &type, sizeof(type));
+        journal_get(&record, &id, sizeof(id));
+        if (cold_id == 0) {
+            cold_id = id;
+            cold_offset = size;
+        }
+        if (id < cold_id) { continue; }
+
+        const size_t length = journal_copy_record(fd, &record);
+        wrote = length > 0;
+        size += (off_t)length;
+        record_count++;
+    }
+
+    if (!wrote || fdatasync(fd) != 0) {
+        _warn("journal::compact_failed[%s]: %s", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        free(offsets);
+        return false;
+    }
+
+    if (rename(tmp_path, j->path) != 0) {
+        _warn("journal::compact_failed[%s]: %s", j->path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        free(offsets);
+        return false;
+    }
+
+    _debug("journal::compacted[%s]: %zu -> %zu records", j->path, j->record_count, record_count);
+    close(j->fd);
+    j->fd = fd;
+    j->size = size;
+    j->record_count = record_count;
+    j->unsynced = 0;
+    j->cold_offset = cold_offset;
+    for (size_t i = 0; i < live_count; i++) {
+        j->live[i].offset = offsets[i];
+    }
+    free(offsets);
+
+    return true;
+}
+
+static void journal_compact_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    struct scrobble_journal *j = data;
+    journal_sync(j);
+    journal_compact(j);
+}
+
+static void journal_schedule_compaction(struct scrobble_journal *j)
+{
+    if (j->record_count < JOURNAL_COMPACT_MIN_RECORDS) { return; }
+    // NOTE(marius): we compact only when most of the file is made of records we don't need anymore
+    if (journal_live_count(j) * 4 >= j->record_count) { return; }
+    if (!evtimer_initialized(&j->compact_event) || evtimer_pending(&j->compact_event, NULL)) { return; }
+
+    const struct timeval timeout = { .tv_sec = JOURNAL_COMPACT_DELAY_SECONDS };
+    _trace("journal::compaction_scheduled[%s]: %zu records, %zu live", j->path, j->record_count, journal_live_count(j));
+    evtimer_add(&j->compact_event, &timeout);
+}
+
+/*
+ * Rebuilds the index of the scrobbles that are still missing acknowledgements, reading one record at a time.
+ * A torn or corrupted tail, from a crash during write, gets truncated.
+ */
+static size_t journal_replay(struct scrobble_journal *j, const unsigned required)
+{
+    struct stat st;
+    if (fstat(j->fd, &st) != 0) {
+        _warn("journal::stat_failed[%s]: %s", j->path, strerror(errno));
+        return 0;
+    }
+    j->size = st.st_size;
+
+    if (j->size == 0 || !journal_header_is_valid(j->fd)) {
+        if (j->size > 0) {
+            _warn("journal::invalid_file[%s]: discarding", j->path);
+        }
+        if (ftruncate(j->fd, 0) != 0 || !journal_write_header(j->fd)) {
+            _warn("journal::write_failed[%s]: %s", j->path, strerror(errno));
+        }
+        j->size = JOURNAL_HEADER_SIZE;
+        return 0;
+    }
+
+    const off_t offset = journal_index_records(j, JOURNAL_HEADER_SIZE, required, true);
+    if (offset < j->size) {
+        _warn("journal::truncating[%s]: %zu bytes of incomplete records", j->path, (size_t)(j->size - offset));
+        if (ftruncate(j->fd, offset) != 0) {
+            _warn("journal::truncate_failed[%s]: %s", j->path, strerror(errno));
+        }
+        j->size = offset;
+    }
+
+    journal_prune_index(j, true);
+    journal_refill(j, required);
+    const size_t pending = journal_live_count(j);
+    _debug("journal::replayed[%s]: %zu records, %zu scrobbles pending", j->path, j->record_count, pending);
+
+    journal_schedule_compaction(j);
+
+    return pending;
+}
+
+bool configuration_folder_create(const char *);
+bool configuration_folder_exists(const char *);
+static bool journal_open(struct scrobble_journal *j, const char *path, struct event_base *evbase)
+{
+    j->fd = -1;
+    j->next_id = 1;
+    if (NULL == path || strlen(path) == 0) { return false; }
+
+    strncpy(j->path, path, FILE_PATH_MAX);
+
+    char folder_path[FILE_PATH_MAX+1] = {0};
+    strncpy(folder_path, path, FILE_PATH_MAX);
+    dirname(folder_path);
+    if (!configuration_folder_exists(folder_path) && !configuration_folder_create(folder_path)) {
+        _error("journal::cache: unable to create cache folder %s", folder_path);
+        return false;
+    }
+
+    j->fd = open(j->path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (j->fd < 0) {
+        _warn("journal::open_failed[%s]: %s", j->path, strerror(errno));
+        return false;
+    }
+
+    evtimer_assign(&j->sync_event, evbase, journal_sync_cb, j);
+    evtimer_assign(&j->compact_event, evbase, journal_compact_cb, j);
+
+    _trace("journal::opened[%s]", j->path);
+    return true;
+}
+
+static void journal_close(struct scrobble_journal *j)
+{
+    if (evtimer_initialized(&j->compact_event) && evtimer_pending(&j->compact_event, NULL)) {
+        evtimer_del(&j->compact_event);
+    }
+    journal_sync(j);
+    if (evtimer_initialized(&j->sync_event) && evtimer_pending(&j->sync_event, NULL)) {
+        evtimer_del(&j->sync_event);
+    }
+    if (j->fd >= 0) {
+        _trace("journal::closed[%s]", j->path);
+        close(j->fd);
+    }
+    j->fd = -1;
+    arrfree(j->live);
+    j->live = NULL;
+    j->removed = 0;
+    j->spilled = 0;
+    j->cold = 0;
+    j->cold_offset = 0;
+    j->error = 0;
+    memset(j->cursors, 0, sizeof(j->cursors));
+}
+
+#endif // MPRIS_SCROBBLER_JOURNAL_H
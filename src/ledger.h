@@ -0,0 +1,353 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_LEDGER_H
+#define MPRIS_SCROBBLER_LEDGER_H
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Every service has a ledger of the listens it accepted, so the same listen is never submitted to it twice: not after
+ * a retry, a restart, nor when two instances of the same player report it.
+ * A listen is identified by a 64-bit fingerprint of its artists, title and album, compared without case and extra
+ * whitespace, and of the LEDGER_BUCKET_SECONDS long interval it started in. The listens that started in the interval
+ * before or after are the same one too, so two reports of it that started a few seconds apart match, and a track
+ * played again doesn't, as it's longer than two intervals.
+ *
+ * The fingerprints are kept in an open addressing hash set in memory. The ledger is saved next to the journal, a
+ * short while after it changed, as a file that starts with a magic number, a version and the number of entries,
+ * followed by the entries sorted by fingerprint. It's read back with mmap when the scrobbler starts.
+ * The listens older than LEDGER_RETENTION_SECONDS are forgotten, the services don't accept them anymore.
+ *
+ * Values are stored in host byte order, as the file is not meant to be shared between machines.
+ */
+#define LEDGER_MAGIC                    0x4c53504dU // "MPSL"
+#define LEDGER_VERSION                  1U
+#define LEDGER_SUFFIX                   ".ledger"
+#define LEDGER_TMP_SUFFIX               ".tmp"
+// NOTE(marius): two intervals have to be shorter than MIN_TRACK_LENGTH
+#define LEDGER_BUCKET_SECONDS           10
+#define LEDGER_RETENTION_SECONDS        (14 * 24 * 3600)
+#define LEDGER_SAVE_DELAY_SECONDS       5
+#define LEDGER_MIN_CAPACITY             64
+
+struct ledger_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+#define LEDGER_FNV_PRIME                0x100000001b3ULL
+
+static uint64_t ledger_hash_byte(const uint64_t hash, const unsigned char c)
+{
+    return (hash ^ c) * LEDGER_FNV_PRIME;
+}
+
+/*
+ * Adds the value without its leading and trailing whitespace, with the whitespace inside it collapsed to one space
+ * and in lower case.
+ */
+static uint64_t ledger_hash_normalized(uint64_t hash, const char *value)
+{
+    if (NULL != value) {
+        bool started = false;
+        bool space = false;
+        for (const char *c = value; *c != '\0'; c++) {
+            const unsigned char ch = (unsigned char)*c;
+            if (isspace(ch)) {
+                space = started;
+                continue;
+            }
+            if (space) {
+                hash = ledger_hash_byte(hash, ' ');
+                space = false;
+            }
+            hash = ledger_hash_byte(hash, (unsigned char)tolower(ch));
+            started = true;
+        }
+    }
+    // NOTE(marius): the separator keeps "ab" + "c" apart from "a" + "bc"
+    return ledger_hash_byte(hash, 0xffU);
+}
+
+static uint64_t scrobble_fingerprint_at(const struct scrobble *track, const int64_t bucket)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < MAX_PROPERTY_COUNT && NULL != track->artist[i] && track->artist[i][0] != '\0'; i++) {
+        hash = ledger_hash_normalized(hash, track->artist[i]);
+    }
+    hash = ledger_hash_normalized(hash, track->title);
+    hash = ledger_hash_normalized(hash, track->album);
+    for (size_t i = 0; i < sizeof(bucket); i++) {
+        hash = ledger_hash_byte(hash, (unsigned char)((uint64_t)bucket >> (i * 8)));
+    }
+    // NOTE(marius): zero marks the empty slots of the hash set
+    return hash != 0 ? hash : 1;
+}
+
+static int64_t scrobble_bucket(const struct scrobble *track)
+{
+    return (int64_t)track->start_time / LEDGER_BUCKET_SECONDS;
+}
+
+static uint64_t scrobble_fingerprint(const struct scrobble *track)
+{
+    return scrobble_fingerprint_at(track, scrobble_bucket(track));
+}
+
+/*
+ * Returns true if one of the tracks before it in the batch is the same listen, two instances of a player report it
+ * twice.
+ */
+static bool scrobble_batch_contains(const struct scrobble *tracks[], const size_t count, const struct scrobble *track)
+{
+    const int64_t bucket = scrobble_bucket(track);
+    for (size_t i = 0; i < count; i++) {
+        const int64_t other = scrobble_bucket(tracks[i]);
+        if (other < bucket - 1 || other > bucket + 1) { continue; }
+        if (scrobble_fingerprint_at(track, other) == scrobble_fingerprint(tracks[i])) { return true; }
+    }
+    return false;
+}
+
+static size_t ledger_slot(const struct scrobble_ledger *l, const uint64_t fingerprint)
+{
+    return (size_t)(fingerprint ^ (fingerprint >> 32U)) & (l->capacity - 1);
+}
+
+static bool ledger_has(const struct scrobble_ledger *l, const uint64_t fingerprint)
+{
+    if (l->count == 0) { return false; }
+
+    for (size_t i = ledger_slot(l, fingerprint); l->slots[i].fingerprint != 0; i = (i + 1) & (l->capacity - 1)) {
+        if (l->slots[i].fingerprint == fingerprint) { return true; }
+    }
+    return false;
+}
+
+static bool ledger_resize(struct scrobble_ledger *, size_t);
+static bool ledger_insert(struct scrobble_ledger *l, const uint64_t fingerprint, const int64_t played)
+{
+    // NOTE(marius): the set is kept at most half full, so the probes stay short
+    if ((l->count + 1) * 2 > l->capacity && !ledger_resize(l, l->capacity > 0 ? l->capacity * 2 : LEDGER_MIN_CAPACITY)) {
+        return false;
+    }
+
+    size_t i = ledger_slot(l, fingerprint);
+    for (; l->slots[i].fingerprint != 0; i = (i + 1) & (l->capacity - 1)) {
+        if (l->slots[i].fingerprint == fingerprint) {
+            if (played > l->slots[i].played) {
+                l->slots[i].played = played;
+            }
+            return true;
+        }
+    }
+    l->slots[i].fingerprint = fingerprint;
+    l->slots[i].played = played;
+    l->count++;
+    return true;
+}
+
+static bool ledger_resize(struct scrobble_ledger *l, const size_t capacity)
+{
+    struct ledger_entry *slots = calloc(capacity, sizeof(struct ledger_entry));
+    if (NULL == slots) {
+        _warn("ledger::resize_failed[%s]: %zu entries", l->path, capacity);
+        return false;
+    }
+
+    struct ledger_entry *previous = l->slots;
+    const size_t previous_capacity = l->capacity;
+    l->slots = slots;
+    l->capacity = capacity;
+    l->count = 0;
+    for (size_t i = 0; i < previous_capacity; i++) {
+        if (previous[i].fingerprint == 0) { continue; }
+        ledger_insert(l, previous[i].fingerprint, previous[i].played);
+    }
+    free(previous);
+    return true;
+}
+
+/*
+ * Returns true if the service accepted the listen of the track already.
+ */
+static bool ledger_contains(const struct scrobble_ledger *l, const struct scrobble *track)
+{
+    const int64_t bucket = scrobble_bucket(track);
+    for (int64_t b = bucket - 1; b <= bucket + 1; b++) {
+        if (ledger_has(l, scrobble_fingerprint_at(track, b))) { return true; }
+    }
+    return false;
+}
+
+static void ledger_add(struct scrobble_ledger *l, const uint64_t fingerprint, const int64_t played)
+{
+    if (!ledger_insert(l, fingerprint, played)) { return; }
+    l->dirty = true;
+
+    if (evtimer_initialized(&l->save_event) && !evtimer_pending(&l->save_event, NULL)) {
+        const struct timeval timeout = { .tv_sec = LEDGER_SAVE_DELAY_SECONDS };
+        evtimer_add(&l->save_event, &timeout);
+    }
+}
+
+static int ledger_entry_compare(const void *a, const void *b)
+{
+    const uint64_t left = ((const struct ledger_entry*)a)->fingerprint;
+    const uint64_t right = ((const struct ledger_entry*)b)->fingerprint;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Writes the entries that are not too old to a new file, sorted, and renames it over the old one.
+ */
+static bool ledger_save(struct scrobble_ledger *l, const time_t now)
+{
+    if (!l->dirty || strlen(l->path) == 0) { return false; }
+
+    struct ledger_entry *entries = calloc(l->count + 1, sizeof(struct ledger_entry));
+    if (NULL == entries) { return false; }
+
+    const int64_t oldest = (int64_t)now - LEDGER_RETENTION_SECONDS;
+    size_t count = 0;
+    for (size_t i = 0; i < l->capacity; i++) {
+        if (l->slots[i].fingerprint == 0 || l->slots[i].played < oldest) { continue; }
+        entries[count] = l->slots[i];
+        count++;
+    }
+    if (count < l->count) {
+        _debug("ledger::expired[%s]: %zu entries", l->path, l->count - count);
+        memset(l->slots, 0, l->capacity * sizeof(struct ledger_entry));
+        l->count = 0;
+        for (size_t i = 0; i < count; i++) {
+            ledger_insert(l, entries[i].fingerprint, entries[i].played);
+        }
+    }
+    qsort(entries, count, sizeof(struct ledger_entry), ledger_entry_compare);
+
+    char tmp_path[FILE_PATH_MAX+1] = {0};
+    snprintf(tmp_path, FILE_PATH_MAX, "%s%s", l->path, LEDGER_TMP_SUFFIX);
+
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        _warn("ledger::save_failed[%s]: %s", tmp_path, strerror(errno));
+        free(entries);
+        return false;
+    }
+
+    const struct ledger_header header = { .magic = LEDGER_MAGIC, .version = LEDGER_VERSION, .count = count, };
+    const bool wrote = journal_write_all(fd, (const uint8_t*)&header, sizeof(header)) &&
+        journal_write_all(fd, (const uint8_t*)entries, count * sizeof(struct ledger_entry));
+    free(entries);
+    if (!wrote || fdatasync(fd) != 0) {
+        _warn("ledger::save_failed[%s]: %s", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+    close(fd);
+
+    if (rename(tmp_path, l->path) != 0) {
+        _warn("ledger::save_failed[%s]: %s", l->path, strerror(errno));
+        unlink(tmp_path);
+        return false;
+    }
+    l->dirty = false;
+    _trace("ledger::saved[%s]: %zu entries", l->path, count);
+    return true;
+}
+
+static void ledger_save_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    ledger_save(data, time(NULL));
+}
+
+/*
+ * Loads the entries of the file that are not too old. An invalid file is ignored, and replaced on the next save.
+ */
+static size_t ledger_load(struct scrobble_ledger *l, const time_t now)
+{
+    const int fd = open(l->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            _warn("ledger::open_failed[%s]: %s", l->path, strerror(errno));
+        }
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct ledger_header)) {
+        _warn("ledger::invalid_file[%s]: discarding", l->path);
+        close(fd);
+        return 0;
+    }
+    const size_t size = (size_t)st.st_size;
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        _warn("ledger::mmap_failed[%s]: %s", l->path, strerror(errno));
+        return 0;
+    }
+
+    struct ledger_header header = {0};
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != LEDGER_MAGIC || header.version != LEDGER_VERSION ||
+        header.count != (size - sizeof(header)) / sizeof(struct ledger_entry) ||
+        (size - sizeof(header)) % sizeof(struct ledger_entry) != 0) {
+        _warn("ledger::invalid_file[%s]: discarding", l->path);
+        munmap((void*)data, size);
+        return 0;
+    }
+
+    const int64_t oldest = (int64_t)now - LEDGER_RETENTION_SECONDS;
+    size_t loaded = 0;
+    for (uint64_t i = 0; i < header.count; i++) {
+        struct ledger_entry entry = {0};
+        memcpy(&entry, data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+        if (entry.fingerprint == 0 || entry.played < oldest) { continue; }
+        if (!ledger_insert(l, entry.fingerprint, entry.played)) { break; }
+        loaded++;
+    }
+    munmap((void*)data, size);
+
+    // NOTE(marius): the expired entries get dropped from the file on the next save
+    _debug("ledger::loaded[%s]: %zu entries", l->path, loaded);
+    return loaded;
+}
+
+/*
+ * The ledger lives next to the journal, so it needs to be opened after it, which creates their folder.
+ */
+static void ledger_open(struct scrobble_ledger *l, const char *journal_path, const enum api_type end_point, struct event_base *evbase)
+{
+    if (NULL == journal_path || strlen(journal_path) == 0) { return; }
+
+    snprintf(l->path, FILE_PATH_MAX, "%s.%s%s", journal_path, get_api_type_label(end_point), LEDGER_SUFFIX);
+    if (NULL != evbase) {
+        evtimer_assign(&l->save_event, evbase, ledger_save_cb, l);
+    }
+    ledger_load(l, time(NULL));
+}
+
+static void ledger_close(struct scrobble_ledger *l)
+{
+    if (evtimer_initialized(&l->save_event) && evtimer_pending(&l->save_event, NULL)) {
+        evtimer_del(&l->save_event);
+    }
+    ledger_save(l, time(NULL));
+    free(l->slots);
+    l->slots = NULL;
+    l->capacity = 0;
+    l->count = 0;
+    l->dirty = false;
+}
+
+#endif // MPRIS_SCROBBLER_LEDGER_H
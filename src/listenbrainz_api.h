@@ -132,8 +132,8 @@ static void listenbrainz_api_append_additional_info(json_object* root,const stru
     json_object_object_add(root, API_ADDITIONAL_INFO_NODE_NAME, additional_info);
 }
 
-struct http_header *http_authorization_header_new (const char*);
-struct http_header *http_content_type_header_new (void);
+struct http_header *http_authorization_header_new (struct http_arena*, const char*);
+struct http_header *http_content_type_header_new (struct http_arena*);
 static void listenbrainz_api_build_request_now_playing(struct http_request *request, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth)
 {
     if (!listenbrainz_valid_credentials(auth)) { return; }
@@ -144,7 +144,6 @@ static void listenbrainz_api_build_request_now_playing(struct http_request *requ
 
     const char *token = auth->token;
 
-    char body[MAX_BODY_SIZE+1] = {0};
 
     json_object *root = json_object_new_object();
     json_object_object_add(root, API_LISTEN_TYPE_NODE_NAME, json_object_new_string(API_LISTEN_TYPE_NOW_PLAYING));
@@ -185,15 +184,13 @@ static void listenbrainz_api_build_request_now_playing(struct http_request *requ
     json_object_object_add(root, API_PAYLOAD_NODE_NAME, payload);
 
     const char *json_str = json_object_to_json_string(root);
-    strncpy(body, json_str, MAX_BODY_SIZE);
 
-    arrput(request->headers, http_authorization_header_new(token));
-    arrput(request->headers, http_content_type_header_new());
+    arrput(request->headers, http_authorization_header_new(request->arena, token));
+    arrput(request->headers, http_content_type_header_new(request->arena));
 
     request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
+    http_buffer_append_string(&request->body, json_str);
+    request->end_point = api_endpoint_new(request->arena, auth);
     api_get_url(request->url, request->end_point);
 
     json_object_put(root);
@@ -207,7 +204,6 @@ static void listenbrainz_api_build_request_scrobble(struct http_request *request
 
     const char *token = auth->token;
 
-    char body[MAX_BODY_SIZE+1] = {0};
 
     json_object *root = json_object_new_object();
     if (track_count > 1) {
@@ -262,52 +258,35 @@ static void listenbrainz_api_build_request_scrobble(struct http_request *request
     json_object_object_add(root, API_PAYLOAD_NODE_NAME, payload);
 
     const char *json_str = json_object_to_json_string(root);
-    strncpy(body, json_str, MAX_BODY_SIZE);
 
-    arrput(request->headers, (http_authorization_header_new(token)));
-    arrput(request->headers, (http_content_type_header_new()));
+    arrput(request->headers, (http_authorization_header_new(request->arena, token)));
+    arrput(request->headers, (http_content_type_header_new(request->arena)));
 
     request->request_type = http_post;
-    memcpy(request->body, body, MAX_BODY_SIZE);
-    request->body_length = strlen(body);
-    request->end_point = api_endpoint_new(auth);
+    http_buffer_append_string(&request->body, json_str);
+    request->end_point = api_endpoint_new(request->arena, auth);
     api_get_url(request->url, request->end_point);
 
     json_object_put(root);
 }
 
-static bool listenbrainz_json_document_is_error(const char *buffer, const size_t length)
+static bool listenbrainz_json_document_is_error(json_object *root)
 {
     // { "code": 401, "error": "You need to provide an Authorization header." }
-    bool result = false;
-
-    if (NULL == buffer) { return result; }
-    if (length == 0) { return result; }
+    if (NULL == root || !json_object_is_type(root, json_type_object)) { return false; }
+    if (json_object_object_length(root) < 1) { return false; }
 
     json_object *code_object = NULL;
     json_object *err_object = NULL;
-
-    struct json_tokener *tokener = json_tokener_new();
-    if (NULL == tokener) { return result; }
-    json_object *root = json_tokener_parse_ex(tokener, buffer, (int)length);
-
-    if (NULL == root || json_object_object_length(root) < 1) {
-        goto _exit;
-    }
     json_object_object_get_ex(root, API_CODE_NODE_NAME, &code_object);
     json_object_object_get_ex(root, API_ERROR_NODE_NAME, &err_object);
-    if (NULL == code_object || !json_object_is_type(code_object, json_type_string)) {
-        goto _exit;
+    if (NULL == code_object || !json_object_is_type(code_object, json_type_int)) {
+        return false;
     }
-    if (NULL == err_object || !json_object_is_type(err_object, json_type_int)) {
-        goto _exit;
+    if (NULL == err_object || !json_object_is_type(err_object, json_type_string)) {
+        return false;
     }
-    result = true;
-
-_exit:
-    if (NULL != root) { json_object_put(root); }
-    json_tokener_free(tokener);
-    return result;
+    return true;
 }
 
 #endif // MPRIS_SCROBBLER_LISTENBRAINZ_API_H
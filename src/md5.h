@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,93 +51,126 @@ static uint32_t to_int32(const uint8_t *bytes)
         | ((uint32_t) bytes[3] << 24);
 }
 
-static void md5(const uint8_t *message, const size_t length, uint8_t *digest)
-{
-    // These vars will contain the hash
+struct md5_context {
     uint32_t a0, b0, c0, d0;
+    uint64_t length;
+    uint8_t block[64];
+    size_t block_length;
+};
 
-    uint8_t *msg = NULL;
-
-    size_t new_len, offset;
+// Process one 512-bit chunk of the message
+static void md5_process_block(struct md5_context *ctx, const uint8_t *block)
+{
+    // break chunk into sixteen 32-bit words w[i], 0 <= i <= 15
     uint32_t w[16] = {0};
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = to_int32(block + i * 4);
+    }
+
+    // Initialize hash value for this chunk:
+    uint32_t a = ctx->a0;
+    uint32_t b = ctx->b0;
+    uint32_t c = ctx->c0;
+    uint32_t d = ctx->d0;
+
+    // Main loop:
+    for(size_t i = 0; i < 64; i++) {
+        uint32_t f, g;
+        if (i < 16) {
+            f = (b & c) | ((~b) & d);
+            g = (uint32_t)i;
+        } else if (i < 32) {
+            f = (d & b) | ((~d) & c);
+            g = (5*i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3*i + 5) % 16;
+        } else {
+            f = c ^ (b | (~d));
+            g = (7*i) % 16;
+        }
+
+        uint32_t temp = d;
+        d = c;
+        c = b;
+        b = b + LEFTROTATE((a + f + k[i] + w[g]), shifts[i]);
+        a = temp;
+    }
 
+    // Add this chunk's hash to result so far:
+    ctx->a0 += a;
+    ctx->b0 += b;
+    ctx->c0 += c;
+    ctx->d0 += d;
+}
+
+static void md5_init(struct md5_context *ctx)
+{
     // Initialize variables - simple count in nibbles:
-    a0 = 0x67452301;
-    b0 = 0xefcdab89;
-    c0 = 0x98badcfe;
-    d0 = 0x10325476;
+    ctx->a0 = 0x67452301;
+    ctx->b0 = 0xefcdab89;
+    ctx->c0 = 0x98badcfe;
+    ctx->d0 = 0x10325476;
+    ctx->length = 0;
+    ctx->block_length = 0;
+}
 
+// Hashes the message as it comes, only the last incomplete chunk is kept around
+static void md5_update(struct md5_context *ctx, const uint8_t *data, size_t length)
+{
+    ctx->length += length;
+
+    if (ctx->block_length > 0) {
+        const size_t missing = sizeof(ctx->block) - ctx->block_length;
+        const size_t copied = length < missing ? length : missing;
+        memcpy(ctx->block + ctx->block_length, data, copied);
+        ctx->block_length += copied;
+        data += copied;
+        length -= copied;
+        if (ctx->block_length < sizeof(ctx->block)) { return; }
+
+        md5_process_block(ctx, ctx->block);
+        ctx->block_length = 0;
+    }
+    while (length >= sizeof(ctx->block)) {
+        md5_process_block(ctx, data);
+        data += sizeof(ctx->block);
+        length -= sizeof(ctx->block);
+    }
+    if (length > 0) {
+        memcpy(ctx->block, data, length);
+        ctx->block_length = length;
+    }
+}
+
+static void md5_final(struct md5_context *ctx, uint8_t *digest)
+{
     //Pre-processing:
     //append "1" bit to message
     //append "0" bits until message length in bits ≡ 448 (mod 512)
     //append length mod (2^64) to message
+    const uint64_t bit_length = ctx->length * 8;
 
-    for (new_len = length + 1; new_len % (512 / 8) != 448 / 8; new_len++);
-
-    msg = (uint8_t*)malloc(new_len + 8);
-    memcpy(msg, message, length);
-    msg[length] = 0x80; // append the "1" bit; most significant bit is "first"
-
-    for (offset = length + 1; offset < new_len; offset++) {
-        msg[offset] = 0x0; // append "0" bits
-    }
+    uint8_t padding[64 + 8] = {0x80};
+    size_t padding_length = (ctx->block_length < 56 ? 56 : 120) - ctx->block_length;
 
     // append the len in bits at the end of the buffer.
-    to_bytes((uint32_t)length * 8, msg + new_len);
-    // length >> 29 == length * 8 >> 32, but avoids overflow.
-    to_bytes((uint32_t)length >> 29, msg + new_len + 4);
-
-    // Process the message in successive 512-bit chunks:
-    //for each 512-bit chunk of message:
-    for (offset = 0; offset < new_len; offset += (512 / 8)) {
-        // break chunk into sixteen 32-bit words w[i], 0 <= i <= 15
-        for (size_t i = 0; i < 16; i++) {
-            w[i] = to_int32(msg + offset + i * 4);
-        }
-
-        // Initialize hash value for this chunk:
-        uint32_t a = a0;
-        uint32_t b = b0;
-        uint32_t c = c0;
-        uint32_t d = d0;
-
-        // Main loop:
-        for(size_t i = 0; i < 64; i++) {
-            uint32_t f, g;
-            if (i < 16) {
-                f = (b & c) | ((~b) & d);
-                g = (uint32_t)i;
-            } else if (i < 32) {
-                f = (d & b) | ((~d) & c);
-                g = (5*i + 1) % 16;
-            } else if (i < 48) {
-                f = b ^ c ^ d;
-                g = (3*i + 5) % 16;
-            } else {
-                f = c ^ (b | (~d));
-                g = (7*i) % 16;
-            }
-
-            uint32_t temp = d;
-            d = c;
-            c = b;
-            b = b + LEFTROTATE((a + f + k[i] + w[g]), shifts[i]);
-            a = temp;
-        }
-
-        // Add this chunk's hash to result so far:
-        a0 += a;
-        b0 += b;
-        c0 += c;
-        d0 += d;
-    }
-
-    // cleanup
-    free(msg);
+    to_bytes((uint32_t)bit_length, padding + padding_length);
+    to_bytes((uint32_t)(bit_length >> 32), padding + padding_length + 4);
+    md5_update(ctx, padding, padding_length + 8);
+    assert(ctx->block_length == 0);
 
     //digest[16] = a0 append b0 append c0 append d0 // (Output is in little-endian)
-    to_bytes(a0, digest);
-    to_bytes(b0, digest + 4);
-    to_bytes(c0, digest + 8);
-    to_bytes(d0, digest + 12);
+    to_bytes(ctx->a0, digest);
+    to_bytes(ctx->b0, digest + 4);
+    to_bytes(ctx->c0, digest + 8);
+    to_bytes(ctx->d0, digest + 12);
+}
+
+static void md5(const uint8_t *message, const size_t length, uint8_t *digest)
+{
+    struct md5_context ctx;
+    md5_init(&ctx);
+    md5_update(&ctx, message, length);
+    md5_final(&ctx, digest);
 }
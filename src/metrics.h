@@ -0,0 +1,365 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_METRICS_H
+#define MPRIS_SCROBBLER_METRICS_H
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+/*
+ * The counters and histograms of the hot paths of the daemon.
+ * They are only updated from the event loop, so they don't need locks or atomics.
+ * The daemon serves them in the OpenMetrics text format on a unix socket in $XDG_RUNTIME_DIR, which can be scraped with:
+ *      curl --unix-socket $XDG_RUNTIME_DIR/mpris-scrobbler-metrics.sock http://localhost/metrics
+ */
+
+#define METRICS_PREFIX "mpris_scrobbler_"
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+#define METRICS_MAX_REQUEST_SIZE 8192
+#define METRICS_CLIENT_TIMEOUT_SECONDS 5
+
+// NOTE(marius): the buckets under 5ms are for the callbacks of the event loop, the HTTP requests rarely get there
+static const double metrics_latency_buckets[METRICS_LATENCY_BUCKETS] = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+};
+
+static struct metrics metrics_registry = {0};
+
+static void metrics_histogram_observe(struct metrics_histogram *h, const double value)
+{
+    size_t bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS && value > metrics_latency_buckets[bucket]) {
+        bucket++;
+    }
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum += value;
+}
+
+static void metrics_player_signal(const char *name)
+{
+    struct metrics *m = &metrics_registry;
+    for (size_t i = 0; i < m->player_count; i++) {
+        if (strncmp(m->players[i].name, name, MAX_PROPERTY_LENGTH) == 0) {
+            m->players[i].signals++;
+            return;
+        }
+    }
+    if (m->player_count == METRICS_MAX_PLAYERS) {
+        m->other_player_signals++;
+        return;
+    }
+    struct metrics_player *player = &m->players[m->player_count];
+    strncpy(player->name, name, MAX_PROPERTY_LENGTH);
+    player->signals = 1;
+    m->player_count++;
+}
+
+static void metrics_loaded_properties(void)
+{
+    metrics_registry.loaded_properties++;
+}
+
+static void metrics_request_done(const enum api_type end_point, const enum request_type type, const bool ok)
+{
+    metrics_registry.requests[end_point][type][ok ? 0 : 1]++;
+}
+
+static void metrics_breaker_opened(const enum api_type end_point)
+{
+    metrics_registry.breaker_opened[end_point]++;
+}
+
+static void metrics_breaker_skipped(const enum api_type end_point)
+{
+    metrics_registry.breaker_skipped[end_point]++;
+}
+
+static void metrics_now_playing_cached(const enum api_type end_point)
+{
+    metrics_registry.now_playing_cached[end_point]++;
+}
+
+static void metrics_scrobble_duplicate(const enum api_type end_point)
+{
+    metrics_registry.scrobbles_duplicate[end_point]++;
+}
+
+/*
+ * The connect and TLS times are zero when the transfer reused a connection, so they only get counted for new ones.
+ */
+static void metrics_http_times(const enum api_type end_point, CURL *easy)
+{
+    struct metrics_histogram *h = metrics_registry.http_duration[end_point];
+
+    double total = 0, connect = 0, tls = 0;
+    if (curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME, &total) == CURLE_OK) {
+        metrics_histogram_observe(&h[metrics_phase_total], total);
+    }
+    if (curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME, &connect) == CURLE_OK && connect > 0) {
+        metrics_histogram_observe(&h[metrics_phase_connect], connect);
+    }
+    if (curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME, &tls) == CURLE_OK && tls > 0) {
+        metrics_histogram_observe(&h[metrics_phase_tls], tls);
+    }
+}
+
+static void metrics_add_label_value(struct evbuffer *out, const char *value)
+{
+    for (const char *c = value; *c != '\0'; c++) {
+        switch (*c) {
+            case '\\':
+                evbuffer_add(out, "\\\\", 2);
+                break;
+            case '"':
+                evbuffer_add(out, "\\\"", 2);
+                break;
+            case '\n':
+                evbuffer_add(out, "\\n", 2);
+                break;
+            default:
+                evbuffer_add(out, c, 1);
+        }
+    }
+}
+
+static void metrics_add_family(struct evbuffer *out, const char *name, const char *type, const char *unit, const char *help)
+{
+    evbuffer_add_printf(out, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+    if (NULL != unit) {
+        evbuffer_add_printf(out, "# UNIT " METRICS_PREFIX "%s %s\n", name, unit);
+    }
+    evbuffer_add_printf(out, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+}
+
+static const char *metrics_request_type_label(const enum request_type type)
+{
+    switch (type) {
+        case request_now_playing:
+            return "now_playing";
+        case request_scrobble:
+            return "scrobble";
+        case request_unknown:
+        default:
+            return "unknown";
+    }
+}
+
+static const char *metrics_http_phase_label(const enum metrics_http_phase phase)
+{
+    switch (phase) {
+        case metrics_phase_connect:
+            return "connect";
+        case metrics_phase_tls:
+            return "tls";
+        case metrics_phase_total:
+        default:
+            return "total";
+    }
+}
+
+static const char *metrics_loop_probe_label(const enum loop_probe probe)
+{
+    switch (probe) {
+        case loop_probe_dbus_dispatch:
+            return "dbus_dispatch";
+        case loop_probe_dbus_filter:
+            return "dbus_filter";
+        case loop_probe_curl_socket:
+            return "curl_socket";
+        case loop_probe_curl_timer:
+            return "curl_timer";
+        case loop_probe_now_playing:
+            return "now_playing";
+        case loop_probe_queue:
+            return "queue";
+        case loop_probe_debounce:
+        default:
+            return "debounce";
+    }
+}
+
+static void metrics_render_histogram(struct evbuffer *out, const char *name, const char *labels, const struct metrics_histogram *h)
+{
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        cumulative += h->buckets[i];
+        evbuffer_add_printf(out, METRICS_PREFIX "%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n", name, labels, metrics_latency_buckets[i], cumulative);
+    }
+    evbuffer_add_printf(out, METRICS_PREFIX "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels, h->count);
+    evbuffer_add_printf(out, METRICS_PREFIX "%s_count{%s} %" PRIu64 "\n", name, labels, h->count);
+    evbuffer_add_printf(out, METRICS_PREFIX "%s_sum{%s} %.6f\n", name, labels, h->sum);
+}
+
+static size_t scrobbler_backlog_length(const struct scrobbler *);
+static size_t mpris_players_count(const struct mpris_players *);
+
+/*
+ * Writes the registry in the OpenMetrics text format, the gauges are read from the state when there is one.
+ */
+static void metrics_render(struct evbuffer *out, const struct metrics *m, const struct state *state)
+{
+    metrics_add_family(out, "dbus_signals", "counter", NULL, "PropertiesChanged signals received from each player.");
+    for (size_t i = 0; i < m->player_count; i++) {
+        evbuffer_add_printf(out, METRICS_PREFIX "dbus_signals_total{player=\"");
+        metrics_add_label_value(out, m->players[i].name);
+        evbuffer_add_printf(out, "\"} %" PRIu64 "\n", m->players[i].signals);
+    }
+    if (m->other_player_signals > 0) {
+        evbuffer_add_printf(out, METRICS_PREFIX "dbus_signals_total{player=\"other\"} %" PRIu64 "\n", m->other_player_signals);
+    }
+
+    metrics_add_family(out, "loaded_properties", "counter", NULL, "Player changes processed by the scrobbler.");
+    evbuffer_add_printf(out, METRICS_PREFIX "loaded_properties_total %" PRIu64 "\n", m->loaded_properties);
+
+    metrics_add_family(out, "requests", "counter", NULL, "Finished requests to each service.");
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        for (int type = request_now_playing; type < REQUEST_TYPE_COUNT; type++) {
+            const char *api_label = get_api_type_label((enum api_type)api);
+            const char *type_label = metrics_request_type_label((enum request_type)type);
+            evbuffer_add_printf(out, METRICS_PREFIX "requests_total{api=\"%s\",type=\"%s\",result=\"ok\"} %" PRIu64 "\n",
+                                api_label, type_label, m->requests[api][type][0]);
+            evbuffer_add_printf(out, METRICS_PREFIX "requests_total{api=\"%s\",type=\"%s\",result=\"failed\"} %" PRIu64 "\n",
+                                api_label, type_label, m->requests[api][type][1]);
+        }
+    }
+
+    metrics_add_family(out, "breaker_opened", "counter", NULL, "Failures that opened the circuit breaker of each service, each one is followed by a retry.");
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        evbuffer_add_printf(out, METRICS_PREFIX "breaker_opened_total{api=\"%s\"} %" PRIu64 "\n", get_api_type_label((enum api_type)api), m->breaker_opened[api]);
+    }
+    metrics_add_family(out, "breaker_skipped", "counter", NULL, "Requests that weren't sent because the circuit breaker of the service was open.");
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        evbuffer_add_printf(out, METRICS_PREFIX "breaker_skipped_total{api=\"%s\"} %" PRIu64 "\n", get_api_type_label((enum api_type)api), m->breaker_skipped[api]);
+    }
+    metrics_add_family(out, "now_playing_cached", "counter", NULL, "Now playing requests that weren't sent because the service already had the track.");
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        evbuffer_add_printf(out, METRICS_PREFIX "now_playing_cached_total{api=\"%s\"} %" PRIu64 "\n", get_api_type_label((enum api_type)api), m->now_playing_cached[api]);
+    }
+    metrics_add_family(out, "scrobbles_duplicate", "counter", NULL, "Scrobbles that weren't sent because the service had already accepted the same listen.");
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        evbuffer_add_printf(out, METRICS_PREFIX "scrobbles_duplicate_total{api=\"%s\"} %" PRIu64 "\n", get_api_type_label((enum api_type)api), m->scrobbles_duplicate[api]);
+    }
+
+    metrics_add_family(out, "http_duration_seconds", "histogram", "seconds", "Time spent by the requests to each service, in total, connecting and in the TLS handshake.");
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        for (int phase = metrics_phase_total; phase < METRICS_HTTP_PHASES; phase++) {
+            char labels[MAX_PROPERTY_LENGTH] = {0};
+            snprintf(labels, sizeof(labels), "api=\"%s\",phase=\"%s\"", get_api_type_label((enum api_type)api),
+                     metrics_http_phase_label((enum metrics_http_phase)phase));
+            metrics_render_histogram(out, "http_duration_seconds", labels, &m->http_duration[api][phase]);
+        }
+    }
+
+    metrics_add_family(out, "loop_profiling", "gauge", NULL, "Whether the callbacks of the event loop are being timed, toggled with SIGUSR1.");
+    evbuffer_add_printf(out, METRICS_PREFIX "loop_profiling %d\n", m->loop_profiling ? 1 : 0);
+    metrics_add_family(out, "loop_callback_duration_seconds", "histogram", "seconds", "Time the event loop was blocked by each callback.");
+    for (int probe = loop_probe_dbus_dispatch; probe < LOOP_PROBE_COUNT; probe++) {
+        char labels[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(labels, sizeof(labels), "probe=\"%s\"", metrics_loop_probe_label((enum loop_probe)probe));
+        metrics_render_histogram(out, "loop_callback_duration_seconds", labels, &m->loop[probe].duration);
+    }
+    metrics_add_family(out, "loop_timer_lateness_seconds", "histogram", "seconds", "How late the timers fired after their deadline.");
+    for (int probe = loop_probe_now_playing; probe <= loop_probe_queue; probe++) {
+        char labels[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(labels, sizeof(labels), "probe=\"%s\"", metrics_loop_probe_label((enum loop_probe)probe));
+        metrics_render_histogram(out, "loop_timer_lateness_seconds", labels, &m->loop[probe].lateness);
+    }
+    metrics_add_family(out, "loop_slow_callbacks", "counter", NULL, "Callbacks that blocked the event loop for longer than the slow threshold.");
+    for (int probe = loop_probe_dbus_dispatch; probe < LOOP_PROBE_COUNT; probe++) {
+        evbuffer_add_printf(out, METRICS_PREFIX "loop_slow_callbacks_total{probe=\"%s\"} %" PRIu64 "\n",
+                            metrics_loop_probe_label((enum loop_probe)probe), m->loop[probe].slow);
+    }
+
+    if (NULL != state) {
+        const struct scrobbler *s = &state->scrobbler;
+        metrics_add_family(out, "queue_length", "gauge", NULL, "Scrobbles waiting in memory to be submitted.");
+        evbuffer_add_printf(out, METRICS_PREFIX "queue_length %d\n", s->queue.length);
+        metrics_add_family(out, "backlog_length", "gauge", NULL, "Scrobbles waiting to be submitted, including the ones in the journal.");
+        evbuffer_add_printf(out, METRICS_PREFIX "backlog_length %zu\n", scrobbler_backlog_length(s));
+        metrics_add_family(out, "connections", "gauge", NULL, "Requests in flight.");
+        evbuffer_add_printf(out, METRICS_PREFIX "connections %d\n", s->connections.length);
+        metrics_add_family(out, "breaker_state", "gauge", NULL, "State of the circuit breaker of each service: 0 closed, 1 open, 2 half-open.");
+        for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+            evbuffer_add_printf(out, METRICS_PREFIX "breaker_state{api=\"%s\"} %d\n", get_api_type_label((enum api_type)api), (int)s->breakers[api].state);
+        }
+        metrics_add_family(out, "players", "gauge", NULL, "MPRIS players on the session bus.");
+        evbuffer_add_printf(out, METRICS_PREFIX "players %zu\n", mpris_players_count(&state->players));
+    }
+    evbuffer_add_printf(out, "# EOF\n");
+}
+
+static void metrics_client_written(struct bufferevent *bev, void *data)
+{
+    if (evbuffer_get_length(bufferevent_get_output(bev)) > 0) { return; }
+    bufferevent_free(bev);
+}
+
+static void metrics_client_event(struct bufferevent *bev, short events, void *data)
+{
+    if (events & BEV_EVENT_ERROR) {
+        _debug("metrics::client_error: %s", evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+    }
+    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) {
+        bufferevent_free(bev);
+    }
+}
+
+/*
+ * Waits for the end of the request headers, then replies with the metrics and closes the connection.
+ * NOTE(marius): the request itself is ignored, every path gets the metrics
+ */
+static void metrics_client_read(struct bufferevent *bev, void *data)
+{
+    const struct state *state = data;
+    struct evbuffer *input = bufferevent_get_input(bev);
+
+    const struct evbuffer_ptr end = evbuffer_search(input, "\r\n\r\n", 4, NULL);
+    const struct evbuffer_ptr bare_end = evbuffer_search(input, "\n\n", 2, NULL);
+    if (end.pos < 0 && bare_end.pos < 0 && evbuffer_get_length(input) < METRICS_MAX_REQUEST_SIZE) { return; }
+    evbuffer_drain(input, evbuffer_get_length(input));
+    bufferevent_disable(bev, EV_READ);
+
+    struct evbuffer *body = evbuffer_new();
+    if (NULL == body) {
+        bufferevent_free(bev);
+        return;
+    }
+    metrics_render(body, &metrics_registry, state);
+
+    struct evbuffer *output = bufferevent_get_output(bev);
+    evbuffer_add_printf(output, "HTTP/1.1 200 OK\r\nContent-Type: " METRICS_CONTENT_TYPE "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                        evbuffer_get_length(body));
+    evbuffer_add_buffer(output, body);
+    evbuffer_free(body);
+
+    bufferevent_setcb(bev, NULL, metrics_client_written, metrics_client_event, data);
+}
+
+static void metrics_client_accepted(struct evconnlistener *listener, evutil_socket_t fd, struct sockaddr *address, int length, void *data)
+{
+    struct event_base *base = evconnlistener_get_base(listener);
+    struct bufferevent *bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (NULL == bev) {
+        _warn("metrics::accept: unable to create the client buffer");
+        evutil_closesocket(fd);
+        return;
+    }
+    const struct timeval timeout = { .tv_sec = METRICS_CLIENT_TIMEOUT_SECONDS, };
+    bufferevent_set_timeouts(bev, &timeout, &timeout);
+    bufferevent_setcb(bev, metrics_client_read, NULL, metrics_client_event, data);
+    bufferevent_enable(bev, EV_READ);
+}
+
+static bool metrics_server_init(struct socket_server *server, struct state *state)
+{
+    const char *path = state->config->metrics_path;
+    if (NULL == state->events.base || _is_zero(path)) {
+        _debug("metrics::disabled: no runtime directory");
+        return false;
+    }
+    return socket_server_listen(server, state->events.base, path, metrics_client_accepted, state);
+}
+
+#endif // MPRIS_SCROBBLER_METRICS_H
@@ -0,0 +1,194 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_MPRIS_PLAYERS_H
+#define MPRIS_SCROBBLER_MPRIS_PLAYERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The registry of the players attached to the bus.
+ * The players are allocated one by one and never move, so the pointers to them, and to the libevent
+ * payloads they contain, stay valid until they get removed. They are indexed by their MPRIS name and,
+ * once known, by the unique bus id the signals are sent from.
+ */
+
+#define PLAYER_INDEX_MIN_CAPACITY 16
+
+static uint32_t player_key_hash(const char *key)
+{
+    // NOTE(marius): FNV-1a
+    uint32_t hash = 2166136261U;
+    for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static bool player_index_put(struct mpris_player_index *, const char *, struct mpris_player *);
+
+static bool player_index_grow(struct mpris_player_index *index)
+{
+    const size_t capacity = index->capacity > 0 ? index->capacity * 2 : PLAYER_INDEX_MIN_CAPACITY;
+    struct mpris_player_slot *slots = calloc(capacity, sizeof(struct mpris_player_slot));
+    if (NULL == slots) { return false; }
+
+    struct mpris_player_index grown = { .capacity = capacity, .count = 0, .slots = slots, };
+    for (size_t i = 0; i < index->capacity; i++) {
+        const struct mpris_player_slot *slot = &index->slots[i];
+        if (NULL == slot->player) { continue; }
+        player_index_put(&grown, slot->key, slot->player);
+    }
+    free(index->slots);
+    *index = grown;
+    return true;
+}
+
+static bool player_index_put(struct mpris_player_index *index, const char *key, struct mpris_player *player)
+{
+    if (NULL == key || strlen(key) == 0) { return false; }
+    // NOTE(marius): keep the load factor under 3/4
+    if ((index->count + 1) * 4 > index->capacity * 3 && !player_index_grow(index)) {
+        return false;
+    }
+
+    const size_t mask = index->capacity - 1;
+    const uint32_t hash = player_key_hash(key);
+    size_t i = hash & mask;
+    while (NULL != index->slots[i].player) {
+        i = (i + 1) & mask;
+    }
+    index->slots[i].hash = hash;
+    index->slots[i].key = key;
+    index->slots[i].player = player;
+    index->count++;
+    return true;
+}
+
+static struct mpris_player *player_index_get(const struct mpris_player_index *index, const char *key)
+{
+    if (NULL == key || index->count == 0) { return NULL; }
+
+    const size_t mask = index->capacity - 1;
+    const uint32_t hash = player_key_hash(key);
+    for (size_t i = hash & mask; NULL != index->slots[i].player; i = (i + 1) & mask) {
+        const struct mpris_player_slot *slot = &index->slots[i];
+        if (slot->hash == hash && strncmp(slot->key, key, MAX_PROPERTY_LENGTH) == 0) {
+            return slot->player;
+        }
+    }
+    return NULL;
+}
+
+static void player_index_del(struct mpris_player_index *index, const char *key, const struct mpris_player *player)
+{
+    if (NULL == key || index->count == 0) { return; }
+
+    const size_t mask = index->capacity - 1;
+    size_t i = player_key_hash(key) & mask;
+    while (NULL != index->slots[i].player && index->slots[i].player != player) {
+        i = (i + 1) & mask;
+    }
+    if (NULL == index->slots[i].player) { return; }
+
+    // NOTE(marius): shift back the entries of the probe sequence that follows, so lookups don't need tombstones
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (NULL == index->slots[j].player) { break; }
+
+        const size_t home = index->slots[j].hash & mask;
+        const bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) { continue; }
+
+        index->slots[i] = index->slots[j];
+        i = j;
+    }
+    memset(&index->slots[i], 0x0, sizeof(struct mpris_player_slot));
+    index->count--;
+}
+
+static void player_index_clean(struct mpris_player_index *index)
+{
+    free(index->slots);
+    memset(index, 0x0, sizeof(*index));
+}
+
+static size_t mpris_players_count(const struct mpris_players *players)
+{
+    return arrlen(players->entries);
+}
+
+static struct mpris_player *mpris_players_find_by_name(const struct mpris_players *players, const char *mpris_name)
+{
+    return player_index_get(&players->by_name, mpris_name);
+}
+
+static struct mpris_player *mpris_players_find_by_bus_id(const struct mpris_players *players, const char *bus_id)
+{
+    return player_index_get(&players->by_bus_id, bus_id);
+}
+
+static void mpris_players_set_bus_id(struct mpris_players *players, struct mpris_player *player, const char *bus_id)
+{
+    if (NULL == bus_id) { return; }
+
+    player_index_del(&players->by_bus_id, player->bus_id, player);
+    memset(player->bus_id, 0x0, sizeof(player->bus_id));
+    strncpy(player->bus_id, bus_id, MAX_PROPERTY_LENGTH);
+    player_index_put(&players->by_bus_id, player->bus_id, player);
+}
+
+/*
+ * Allocates a new player for mpris_name, the bus_id is optional.
+ * Returns NULL if a player with the same name already exists.
+ */
+static struct mpris_player *mpris_players_add(struct mpris_players *players, const char *mpris_name, const char *bus_id)
+{
+    if (NULL == mpris_name || strlen(mpris_name) == 0) { return NULL; }
+    if (NULL != mpris_players_find_by_name(players, mpris_name)) { return NULL; }
+
+    struct mpris_player *player = calloc(1, sizeof(struct mpris_player));
+    if (NULL == player) { return NULL; }
+
+    strncpy(player->mpris_name, mpris_name, MAX_PROPERTY_LENGTH);
+    if (!player_index_put(&players->by_name, player->mpris_name, player)) {
+        free(player);
+        return NULL;
+    }
+    if (NULL != bus_id && strlen(bus_id) > 0) {
+        mpris_players_set_bus_id(players, player, bus_id);
+    }
+    arrput(players->entries, player);
+    return player;
+}
+
+/*
+ * Removes the player from the registry, the caller is responsible for freeing it.
+ */
+static bool mpris_players_remove(struct mpris_players *players, const struct mpris_player *player)
+{
+    const size_t count = mpris_players_count(players);
+    for (size_t i = 0; i < count; i++) {
+        if (players->entries[i] != player) { continue; }
+
+        player_index_del(&players->by_name, player->mpris_name, player);
+        player_index_del(&players->by_bus_id, player->bus_id, player);
+        arrdelswap(players->entries, i);
+        return true;
+    }
+    return false;
+}
+
+static void mpris_players_clean(struct mpris_players *players)
+{
+    arrfree(players->entries);
+    player_index_clean(&players->by_name);
+    player_index_clean(&players->by_bus_id);
+}
+
+#endif // MPRIS_SCROBBLER_MPRIS_PLAYERS_H
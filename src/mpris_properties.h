@@ -0,0 +1,470 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_MPRIS_PROPERTIES_H
+#define MPRIS_SCROBBLER_MPRIS_PROPERTIES_H
+
+#include <dbus/dbus.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define MPRIS_PNAME_PLAYBACKSTATUS "PlaybackStatus"
+#define MPRIS_PNAME_CANCONTROL     "CanControl"
+#define MPRIS_PNAME_CANGONEXT      "CanGoNext"
+#define MPRIS_PNAME_CANGOPREVIOUS  "CanGoPrevious"
+#define MPRIS_PNAME_CANPLAY        "CanPlay"
+#define MPRIS_PNAME_CANPAUSE       "CanPause"
+#define MPRIS_PNAME_CANSEEK        "CanSeek"
+#define MPRIS_PNAME_SHUFFLE        "Shuffle"
+#define MPRIS_PNAME_POSITION       "Position"
+#define MPRIS_PNAME_VOLUME         "Volume"
+#define MPRIS_PNAME_RATE           "Rate"
+#define MPRIS_PNAME_LOOPSTATUS     "LoopStatus"
+#define MPRIS_PNAME_METADATA       "Metadata"
+
+#define MPRIS_METADATA_BITRATE      "bitrate"
+#define MPRIS_METADATA_ART_URL      "mpris:artUrl"
+#define MPRIS_METADATA_LENGTH       "mpris:length"
+#define MPRIS_METADATA_TRACKID      "mpris:trackid"
+#define MPRIS_METADATA_ALBUM        "xesam:album"
+#define MPRIS_METADATA_ALBUM_ARTIST "xesam:albumArtist"
+#define MPRIS_METADATA_ARTIST       "xesam:artist"
+#define MPRIS_METADATA_COMMENT      "xesam:comment"
+#define MPRIS_METADATA_TITLE        "xesam:title"
+#define MPRIS_METADATA_TRACK_NUMBER "xesam:trackNumber"
+#define MPRIS_METADATA_URL          "xesam:url"
+#define MPRIS_METADATA_GENRE        "xesam:genre"
+#define MPRIS_METADATA_YEAR         "year"
+
+#define MPRIS_METADATA_MUSICBRAINZ_TRACK_ID         "xesam:musicBrainzTrackID"
+#define MPRIS_METADATA_MUSICBRAINZ_ALBUM_ID         "xesam:musicBrainzAlbumID"
+#define MPRIS_METADATA_MUSICBRAINZ_ARTIST_ID        "xesam:musicBrainzArtistID"
+#define MPRIS_METADATA_MUSICBRAINZ_ALBUMARTIST_ID   "xesam:musicBrainzAlbumArtistID"
+
+/*
+ * The decoders walk the message once and write the values straight into the properties of the player.
+ * Every load_*_var function returns true only when the stored value was different from the one in the message,
+ * which is what ends up in mpris_event::loaded_state.
+ * The bytes following the terminating NUL of the stored strings are always zero, as the properties
+ * get compared with memcmp.
+ */
+
+static DBusMessageIter dereference_variant_iterator(DBusMessageIter *iter) {
+    if (DBUS_TYPE_VARIANT == dbus_message_iter_get_arg_type(iter)) {
+        DBusMessageIter variantIter;
+        dbus_message_iter_recurse(iter, &variantIter);
+        return variantIter;
+    }
+    return *iter;
+}
+
+static bool store_string(char result[MAX_PROPERTY_LENGTH+1], const char *value, size_t len)
+{
+    // NOTE(marius): values that don't fit are dropped instead of being truncated
+    if (len >= MAX_PROPERTY_LENGTH) { len = 0; }
+
+    const size_t old_len = strnlen(result, MAX_PROPERTY_LENGTH);
+    if (old_len == len && memcmp(result, value, len) == 0) {
+        return false;
+    }
+    memcpy(result, value, len);
+    if (old_len > len) {
+        memset(result + len, 0x0, old_len - len);
+    }
+    return true;
+}
+
+static void extract_string_var(DBusMessageIter *iter, char *result, DBusError *error)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_OBJECT_PATH == type || DBUS_TYPE_STRING == type) {
+        DBusBasicValue temp = {0};
+        dbus_message_iter_get_basic(iter, &temp);
+        size_t l = strlen(temp.str);
+
+        if (l > 0 && l < MAX_PROPERTY_LENGTH) {
+            memcpy(result, temp.str, l);
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+            _trace2("  dbus::loaded_basic_string[%zd//%p]: %s", l, result, result);
+#endif
+        }
+        return;
+    }
+    dbus_set_error(error, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_STRING);
+}
+
+static bool load_string_var(DBusMessageIter *iter, char result[MAX_PROPERTY_LENGTH+1], DBusError *error)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    const int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_OBJECT_PATH != type && DBUS_TYPE_STRING != type) {
+        dbus_set_error(error, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_STRING);
+        return false;
+    }
+    DBusBasicValue temp = {0};
+    dbus_message_iter_get_basic(iter, &temp);
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+    _trace2("  dbus::loaded_basic_string[%p]: %s", result, temp.str);
+#endif
+    return store_string(result, temp.str, strnlen(temp.str, MAX_PROPERTY_LENGTH));
+}
+
+static bool clear_string_array(char result[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1], const int from)
+{
+    bool changed = false;
+    for (int i = from; i < MAX_PROPERTY_COUNT && result[i][0] != '\0'; i++) {
+        changed |= store_string(result[i], "", 0);
+    }
+    return changed;
+}
+
+static bool load_string_array_var(DBusMessageIter *iter, char result[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1], DBusError *err)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    const int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_ARRAY != type) {
+        dbus_set_error(err, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_ARRAY);
+        return false;
+    }
+
+    DBusMessageIter arrayIter = {0};
+    dbus_message_iter_recurse(iter, &arrayIter);
+    const int arrayType = dbus_message_iter_get_arg_type(&arrayIter);
+    if (DBUS_TYPE_INVALID == arrayType) {
+        // NOTE(marius): empty array
+        return clear_string_array(result, 0);
+    }
+    if (DBUS_TYPE_STRING != arrayType) {
+        dbus_set_error(err, "invalid_value", "Invalid array iterator type %c, expected %c", arrayType, DBUS_TYPE_STRING);
+        return false;
+    }
+
+    bool changed = false;
+    int read_count = 0;
+    while (read_count < MAX_PROPERTY_COUNT) {
+        DBusBasicValue temp = {0};
+        dbus_message_iter_get_basic(&arrayIter, &temp);
+        const size_t l = strnlen(temp.str, MAX_PROPERTY_LENGTH);
+
+        if (l == 0 || l >= MAX_PROPERTY_LENGTH) { break; }
+
+        changed |= store_string(result[read_count], temp.str, l);
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+        _trace2("  dbus::loaded_array_of_strings[%4zd//%zd//%p]: %s", l, read_count, result[read_count], result[read_count]);
+#endif
+        read_count++;
+        if (!dbus_message_iter_next(&arrayIter)) {
+            break;
+        }
+    }
+    changed |= clear_string_array(result, read_count);
+    return changed;
+}
+
+static bool load_double_var(DBusMessageIter *iter, double *result, DBusError *error)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    const int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_DOUBLE != type) {
+        dbus_set_error(error, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_DOUBLE);
+        return false;
+    }
+    double value = 0;
+    dbus_message_iter_get_basic(iter, &value);
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+    _trace2("  dbus::loaded_basic_double[%p]: %f", result, value);
+#endif
+    if (_eq(*result, value)) { return false; }
+    *result = value;
+    return true;
+}
+
+static bool load_int64_var(DBusMessageIter *iter, int64_t *result, DBusError *error)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    DBusBasicValue temp = {0};
+    int64_t value = 0;
+    const int type = dbus_message_iter_get_arg_type(iter);
+    switch (type) {
+        case DBUS_TYPE_INT64:
+            dbus_message_iter_get_basic(iter, &temp);
+            value = temp.i64;
+            break;
+        case DBUS_TYPE_UINT64:
+            dbus_message_iter_get_basic(iter, &temp);
+            value = (int64_t)temp.u64;
+            break;
+        case DBUS_TYPE_INT32:
+            dbus_message_iter_get_basic(iter, &temp);
+            value = temp.i32;
+            break;
+        case DBUS_TYPE_UINT32:
+            dbus_message_iter_get_basic(iter, &temp);
+            value = temp.u32;
+            break;
+        default:
+            dbus_set_error(error, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_INT64);
+            return false;
+    }
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+    _trace2("  dbus::loaded_basic_int64[%p]: %" PRId64, result, value);
+#endif
+    if (*result == value) { return false; }
+    *result = value;
+    return true;
+}
+
+static bool load_uint32_var(DBusMessageIter *iter, unsigned *result, DBusError *error)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    const int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_INT32 != type && DBUS_TYPE_UINT32 != type) {
+        dbus_set_error(error, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_INT32);
+        return false;
+    }
+    DBusBasicValue temp = {0};
+    dbus_message_iter_get_basic(iter, &temp);
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+    _trace2("  dbus::loaded_basic_int32[%p]: %" PRIu32, result, temp.u32);
+#endif
+    if (*result == temp.u32) { return false; }
+    *result = temp.u32;
+    return true;
+}
+
+static bool load_boolean_var(DBusMessageIter *iter, bool *result, DBusError *error)
+{
+    *iter = dereference_variant_iterator(iter);
+
+    const int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_BOOLEAN != type) {
+        dbus_set_error(error, "invalid_value", "Invalid message iterator type %c, expected %c", type, DBUS_TYPE_BOOLEAN);
+        return false;
+    }
+    dbus_bool_t res = false;
+    dbus_message_iter_get_basic(iter, &res);
+#if defined(LIBDBUS_DEBUG) && LIBDBUS_DEBUG
+    _trace2("  dbus::loaded_basic_bool[%p]: %s", result, res ? "true" : "false");
+#endif
+    if (*result == (res == 1)) { return false; }
+    *result = (res == 1);
+    return true;
+}
+
+#define _load_if_changed(loader, iter, dest, err, changes, bitflag) \
+    if (loader(iter, dest, err)) { \
+        (changes)->loaded_state |= (bitflag); \
+    }
+
+static void load_metadata(DBusMessageIter *iter, struct mpris_metadata *track, struct mpris_event *changes)
+{
+    if (NULL == track) { return; }
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    int type = dbus_message_iter_get_arg_type(iter);
+    if (DBUS_TYPE_VARIANT != type) {
+        _warn("dbus::value_error: Invalid message iterator type %c, expected %c", type, DBUS_TYPE_VARIANT);
+        return;
+    }
+
+    DBusMessageIter variantIter;
+    dbus_message_iter_recurse(iter, &variantIter);
+    const int variantType = dbus_message_iter_get_arg_type(&variantIter);
+    if (DBUS_TYPE_ARRAY != variantType) {
+        _warn("dbus::value_error: Invalid message iterator type %c, expected %c", variantType, DBUS_TYPE_ARRAY);
+        return;
+    }
+    DBusMessageIter arrayIter;
+    dbus_message_iter_recurse(&variantIter, &arrayIter);
+
+    const long before = changes->loaded_state;
+    // NOTE(marius): the keys that were present in the message, regardless of their values changing
+    unsigned seen = 0;
+    while (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayIter)) {
+        char *key = NULL;
+        DBusMessageIter dictIter;
+        dbus_message_iter_recurse(&arrayIter, &dictIter);
+        if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) {
+            _warn("dbus::value_error: this message iterator doesn't have key");
+            break;
+        }
+        dbus_message_iter_get_basic(&dictIter, &key);
+
+        if (dbus_message_iter_next(&dictIter)) {
+            if (!strcmp(key, MPRIS_METADATA_BITRATE)) {
+                _load_if_changed(load_uint32_var, &dictIter, &track->bitrate, &err, changes, mpris_load_metadata_bitrate);
+                seen |= mpris_load_metadata_bitrate;
+            } else if (!strcmp(key, MPRIS_METADATA_ART_URL)) {
+                _load_if_changed(load_string_var, &dictIter, track->art_url, &err, changes, mpris_load_metadata_art_url);
+                seen |= mpris_load_metadata_art_url;
+            } else if (!strcmp(key, MPRIS_METADATA_LENGTH)) {
+                _load_if_changed(load_int64_var, &dictIter, (int64_t*)&track->length, &err, changes, mpris_load_metadata_length);
+                seen |= mpris_load_metadata_length;
+            } else if (!strcmp(key, MPRIS_METADATA_TRACKID)) {
+                _load_if_changed(load_string_var, &dictIter, track->track_id, &err, changes, mpris_load_metadata_track_id);
+                seen |= mpris_load_metadata_track_id;
+            } else if (!strcmp(key, MPRIS_METADATA_ALBUM_ARTIST)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->album_artist, &err, changes, mpris_load_metadata_album_artist);
+                seen |= mpris_load_metadata_album_artist;
+            } else if (!strcmp(key, MPRIS_METADATA_ALBUM)) {
+                _load_if_changed(load_string_var, &dictIter, track->album, &err, changes, mpris_load_metadata_album);
+                seen |= mpris_load_metadata_album;
+            } else if (!strcmp(key, MPRIS_METADATA_ARTIST)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->artist, &err, changes, mpris_load_metadata_artist);
+                seen |= mpris_load_metadata_artist;
+            } else if (!strcmp(key, MPRIS_METADATA_COMMENT)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->comment, &err, changes, mpris_load_metadata_comment);
+                seen |= mpris_load_metadata_comment;
+            } else if (!strcmp(key, MPRIS_METADATA_TITLE)) {
+                _load_if_changed(load_string_var, &dictIter, track->title, &err, changes, mpris_load_metadata_title);
+                seen |= mpris_load_metadata_title;
+            } else if (!strcmp(key, MPRIS_METADATA_TRACK_NUMBER)) {
+                _load_if_changed(load_uint32_var, &dictIter, &track->track_number, &err, changes, mpris_load_metadata_track_number);
+                seen |= mpris_load_metadata_track_number;
+            } else if (!strcmp(key, MPRIS_METADATA_URL)) {
+                _load_if_changed(load_string_var, &dictIter, track->url, &err, changes, mpris_load_metadata_url);
+                seen |= mpris_load_metadata_url;
+            } else if (!strcmp(key, MPRIS_METADATA_GENRE)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->genre, &err, changes, mpris_load_metadata_genre);
+                seen |= mpris_load_metadata_genre;
+            } else if (!strcmp(key, MPRIS_METADATA_MUSICBRAINZ_TRACK_ID)) {
+                // check for MusicBrainz tags - players supporting this: Rhythmbox
+                _load_if_changed(load_string_array_var, &dictIter, track->mb_track_id, &err, changes, mpris_load_metadata_mb_track_id);
+                seen |= mpris_load_metadata_mb_track_id;
+            } else if (!strcmp(key, MPRIS_METADATA_MUSICBRAINZ_ALBUM_ID)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->mb_album_id, &err, changes, mpris_load_metadata_mb_album_id);
+                seen |= mpris_load_metadata_mb_album_id;
+            } else if (!strcmp(key, MPRIS_METADATA_MUSICBRAINZ_ARTIST_ID)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->mb_artist_id, &err, changes, mpris_load_metadata_mb_artist_id);
+                seen |= mpris_load_metadata_mb_artist_id;
+            } else if (!strcmp(key, MPRIS_METADATA_MUSICBRAINZ_ALBUMARTIST_ID)) {
+                _load_if_changed(load_string_array_var, &dictIter, track->mb_album_artist_id, &err, changes, mpris_load_metadata_mb_album_artist_id);
+                seen |= mpris_load_metadata_mb_album_artist_id;
+            }
+            if (dbus_error_is_set(&err)) {
+                _warn("dbus::value_error: %s, %s", key, err.message);
+                dbus_error_free(&err);
+            }
+        }
+
+        if (!dbus_message_iter_next(&arrayIter)) {
+            break;
+        }
+    }
+    // NOTE(marius): a new track that is missing the MusicBrainz ids must not keep the ones of the previous track
+    if ((seen & mpris_load_metadata_title) && !(seen & mpris_load_metadata_mb_track_id) && clear_string_array(track->mb_track_id, 0)) {
+        changes->loaded_state |= mpris_load_metadata_mb_track_id;
+    }
+    if ((seen & mpris_load_metadata_album) && !(seen & mpris_load_metadata_mb_album_id) && clear_string_array(track->mb_album_id, 0)) {
+        changes->loaded_state |= mpris_load_metadata_mb_album_id;
+    }
+    if ((seen & mpris_load_metadata_artist) && !(seen & mpris_load_metadata_mb_artist_id) && clear_string_array(track->mb_artist_id, 0)) {
+        changes->loaded_state |= mpris_load_metadata_mb_artist_id;
+    }
+    if ((seen & mpris_load_metadata_album_artist) && !(seen & mpris_load_metadata_mb_album_artist_id) && clear_string_array(track->mb_album_artist_id, 0)) {
+        changes->loaded_state |= mpris_load_metadata_mb_album_artist_id;
+    }
+    if (changes->loaded_state != before) {
+        changes->track_changed = true;
+    }
+}
+
+/*
+ * Loads the properties found in the a{sv} array at rootIter into properties.
+ * Returns true if the message contained any property, even if none of them changed.
+ */
+static bool load_properties(DBusMessageIter *rootIter, struct mpris_properties *properties, struct mpris_event *changes)
+{
+    if (NULL == properties) { return false; }
+    if (NULL == rootIter) { return false; }
+
+    if (DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(rootIter)) {
+        return false;
+    }
+
+    DBusError err = {0};
+    dbus_error_init(&err);
+
+    DBusMessageIter arrayElementIter;
+    dbus_message_iter_recurse(rootIter, &arrayElementIter);
+
+    bool loaded = false;
+    while (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayElementIter)) {
+        DBusMessageIter dictIter;
+        dbus_message_iter_recurse(&arrayElementIter, &dictIter);
+
+        if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) {
+            _warn("dbus::iterator_error: this message iterator doesn't have a key");
+            break;
+        }
+        char *key = NULL;
+        dbus_message_iter_get_basic(&dictIter, &key);
+
+        if (!dbus_message_iter_next(&dictIter)) {
+            break;
+        }
+        loaded = true;
+
+        if (!strcmp(key, MPRIS_PNAME_CANCONTROL)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->can_control, &err, changes, mpris_load_property_can_control);
+        } else if (!strcmp(key, MPRIS_PNAME_CANGONEXT)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->can_go_next, &err, changes, mpris_load_property_can_go_next);
+        } else if (!strcmp(key, MPRIS_PNAME_CANGOPREVIOUS)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->can_go_previous, &err, changes, mpris_load_property_can_go_previous);
+        } else if (!strcmp(key, MPRIS_PNAME_CANPAUSE)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->can_pause, &err, changes, mpris_load_property_can_pause);
+        } else if (!strcmp(key, MPRIS_PNAME_CANPLAY)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->can_play, &err, changes, mpris_load_property_can_play);
+        } else if (!strcmp(key, MPRIS_PNAME_CANSEEK)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->can_seek, &err, changes, mpris_load_property_can_seek);
+        } else if (!strcmp(key, MPRIS_PNAME_LOOPSTATUS)) {
+            _load_if_changed(load_string_var, &dictIter, properties->loop_status, &err, changes, mpris_load_property_loop_status);
+        } else if (!strcmp(key, MPRIS_PNAME_PLAYBACKSTATUS)) {
+            if (load_string_var(&dictIter, properties->playback_status, &err)) {
+                changes->playback_status_changed = true;
+                changes->player_state = get_mpris_playback_status(properties);
+                changes->loaded_state |= mpris_load_property_playback_status;
+            }
+        } else if (!strcmp(key, MPRIS_PNAME_POSITION)) {
+            if (load_int64_var(&dictIter, &properties->position, &err)) {
+                changes->position_changed = true;
+                changes->loaded_state |= mpris_load_property_position;
+            }
+        } else if (!strcmp(key, MPRIS_PNAME_SHUFFLE)) {
+            _load_if_changed(load_boolean_var, &dictIter, &properties->shuffle, &err, changes, mpris_load_property_shuffle);
+        } else if (!strcmp(key, MPRIS_PNAME_VOLUME)) {
+            if (load_double_var(&dictIter, &properties->volume, &err)) {
+                changes->volume_changed = true;
+                changes->loaded_state |= mpris_load_property_volume;
+            }
+        } else if (!strcmp(key, MPRIS_PNAME_RATE)) {
+            if (load_double_var(&dictIter, &properties->rate, &err)) {
+                changes->loaded_state |= mpris_load_property_rate;
+            }
+        } else if (!strcmp(key, MPRIS_PNAME_METADATA)) {
+            load_metadata(&dictIter, &properties->metadata, changes);
+        }
+        if (dbus_error_is_set(&err)) {
+            _warn("dbus::value_error: %s, %s", key, err.message);
+            dbus_error_free(&err);
+        }
+        if (!dbus_message_iter_next(&arrayElementIter)) {
+            break;
+        }
+    }
+    if (changes->loaded_state != mpris_load_nothing) {
+        time(&changes->timestamp);
+    }
+    return loaded;
+}
+
+#endif // MPRIS_SCROBBLER_MPRIS_PROPERTIES_H
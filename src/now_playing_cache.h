@@ -0,0 +1,67 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_NOW_PLAYING_CACHE_H
+#define MPRIS_SCROBBLER_NOW_PLAYING_CACHE_H
+
+/*
+ * Every service remembers the last track it was told is playing, by a hash of its title, artists, album and player.
+ * The services show a track as playing for about its length, or until they're told about another one, so a now
+ * playing request for the same track only goes out again when that is about to run out, not for every pause and
+ * resume, nor every NOW_PLAYING_DELAY.
+ * A failed request makes the service forget its track, so the next one goes out.
+ */
+
+// NOTE(marius): for the tracks without a length
+#define NOW_PLAYING_CACHE_DEFAULT_TTL 300
+
+static uint32_t now_playing_hash_add(uint32_t hash, const char *value)
+{
+    if (NULL != value) {
+        for (const char *c = value; *c != '\0'; c++) {
+            hash ^= (unsigned char)*c;
+            hash *= 16777619U;
+        }
+    }
+    // NOTE(marius): the separator keeps "ab" + "c" apart from "a" + "bc"
+    hash ^= 0xffU;
+    hash *= 16777619U;
+    return hash;
+}
+
+static uint32_t now_playing_hash(const struct scrobble *track)
+{
+    uint32_t hash = 2166136261U;
+    hash = now_playing_hash_add(hash, track->title);
+    for (int i = 0; i < MAX_PROPERTY_COUNT && NULL != track->artist[i]; i++) {
+        hash = now_playing_hash_add(hash, track->artist[i]);
+    }
+    hash = now_playing_hash_add(hash, track->album);
+    hash = now_playing_hash_add(hash, track->player_name);
+    return hash;
+}
+
+/*
+ * Returns true if the service still shows the track as playing, and will do so until the next now playing request
+ * for it would be sent.
+ */
+static bool now_playing_cache_fresh(const struct now_playing_cache *cache, const struct scrobble *track, const time_t now)
+{
+    if (cache->expires == 0 || cache->hash != now_playing_hash(track)) { return false; }
+    return (double)now + NOW_PLAYING_DELAY < (double)cache->expires;
+}
+
+static void now_playing_cache_put(struct now_playing_cache *cache, const struct scrobble *track, const time_t now)
+{
+    const time_t ttl = track->length > 0 ? (time_t)track->length : NOW_PLAYING_CACHE_DEFAULT_TTL;
+    cache->hash = now_playing_hash(track);
+    cache->expires = now + ttl;
+}
+
+static void now_playing_cache_clear(struct now_playing_cache *cache)
+{
+    cache->hash = 0;
+    cache->expires = 0;
+}
+
+#endif // MPRIS_SCROBBLER_NOW_PLAYING_CACHE_H
@@ -0,0 +1,117 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_PLAYBACK_CLOCK_H
+#define MPRIS_SCROBBLER_PLAYBACK_CLOCK_H
+
+#include <time.h>
+
+/*
+ * Every player keeps a clock of how long its current track was actually listened to, on the monotonic clock, so the
+ * scrobble gets queued once the track played for half its length or four minutes, not before and not twice.
+ * The time only runs while the player is playing, at the playback rate of the player. Seeking moves the position
+ * of the track without adding to the listened time, and jumping back to the start of a track that was already
+ * queued starts a new play of it.
+ * The position is never polled, it's computed from the last one the player told us, with its Seeked signal or with
+ * the properties we load.
+ */
+
+// NOTE(marius): a seek to before this position is the start of the track
+#define PLAYBACK_CLOCK_RESTART_SECONDS 2.0
+// NOTE(marius): how much earlier than the clock a timer can fire, libevent rounds the timeouts to the millisecond
+#define PLAYBACK_CLOCK_TOLERANCE_SECONDS 0.005
+
+static double playback_clock_now(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+static double playback_clock_rate(const struct playback_clock *clock)
+{
+    // NOTE(marius): the players that don't have a Rate property play at normal speed
+    return clock->rate > 0 ? clock->rate : 1.0;
+}
+
+static double playback_clock_elapsed(const struct playback_clock *clock, const double now)
+{
+    if (!clock->running || now <= clock->updated) { return 0; }
+    return (now - clock->updated) * playback_clock_rate(clock);
+}
+
+static void playback_clock_advance(struct playback_clock *clock, const double now)
+{
+    const double elapsed = playback_clock_elapsed(clock, now);
+    clock->listened += elapsed;
+    clock->position += elapsed;
+    clock->updated = now;
+}
+
+/*
+ * The time the player was already in the track when we first see it counts as listened, like for a daemon that
+ * starts while the player is playing.
+ */
+static void playback_clock_start_track(struct playback_clock *clock, const double position, const bool running, const double now)
+{
+    clock->listened = position > 0 ? position : 0;
+    clock->position = clock->listened;
+    clock->updated = now;
+    clock->running = running;
+    clock->queued = false;
+    clock->started = time(NULL) - (time_t)clock->position;
+}
+
+static void playback_clock_set_running(struct playback_clock *clock, const bool running, const double now)
+{
+    playback_clock_advance(clock, now);
+    clock->running = running;
+}
+
+static void playback_clock_set_rate(struct playback_clock *clock, const double rate, const double now)
+{
+    playback_clock_advance(clock, now);
+    clock->rate = rate;
+}
+
+/*
+ * Returns true if the seek restarted a track that was already queued, the new play of the track starts then.
+ */
+static bool playback_clock_seek(struct playback_clock *clock, const double position, const double now)
+{
+    playback_clock_advance(clock, now);
+    const bool restarted = clock->queued && position < PLAYBACK_CLOCK_RESTART_SECONDS &&
+        clock->position > position + PLAYBACK_CLOCK_RESTART_SECONDS;
+    if (restarted) {
+        playback_clock_start_track(clock, position, clock->running, now);
+        return true;
+    }
+    clock->position = position > 0 ? position : 0;
+    return false;
+}
+
+static double playback_clock_listened(const struct playback_clock *clock, const double now)
+{
+    return clock->listened + playback_clock_elapsed(clock, now);
+}
+
+static double playback_clock_position(const struct playback_clock *clock, const double now)
+{
+    return clock->position + playback_clock_elapsed(clock, now);
+}
+
+/*
+ * Returns the seconds until the track is listened to for the threshold, or a negative value if that never happens
+ * because the player is not playing, or the track was already queued.
+ */
+static double playback_clock_until(const struct playback_clock *clock, const double threshold, const double now)
+{
+    if (clock->queued) { return -1; }
+
+    const double remaining = threshold - playback_clock_listened(clock, now);
+    if (remaining <= 0) { return 0; }
+    if (!clock->running) { return -1; }
+    return remaining / playback_clock_rate(clock);
+}
+
+#endif // MPRIS_SCROBBLER_PLAYBACK_CLOCK_H
@@ -0,0 +1,105 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_PROFILER_H
+#define MPRIS_SCROBBLER_PROFILER_H
+
+#include <time.h>
+
+/*
+ * Times the callbacks of the event loop and how late the now playing and queue timers fire, so we can tell which
+ * part of the daemon is keeping the loop from running the others.
+ * It's off by default, and sending SIGUSR1 to the daemon toggles it. When it gets turned off a summary of what was
+ * measured gets logged, the histograms themselves are in the metrics.
+ */
+
+// NOTE(marius): a callback that takes longer than this gets logged as a warning
+#define LOOP_PROFILER_SLOW_SECONDS 0.05
+
+static double loop_profiler_now(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+static bool loop_profiler_enabled(void)
+{
+    return metrics_registry.loop_profiling;
+}
+
+/*
+ * Returns the time when the callback started, or 0 if the profiler is off, so the callbacks don't read the clock
+ * when nobody is looking.
+ */
+static double loop_profiler_start(void)
+{
+    if (!loop_profiler_enabled()) { return 0; }
+    return loop_profiler_now();
+}
+
+static void loop_profiler_end(const enum loop_probe probe, const double start)
+{
+    if (start <= 0 || !loop_profiler_enabled()) { return; }
+
+    const double duration = loop_profiler_now() - start;
+    struct loop_probe_stats *stats = &metrics_registry.loop[probe];
+    metrics_histogram_observe(&stats->duration, duration);
+    if (duration > stats->max_duration) {
+        stats->max_duration = duration;
+    }
+    if (duration > LOOP_PROFILER_SLOW_SECONDS) {
+        stats->slow++;
+        _warn("loop::slow_callback[%s]: %2.2lfms", metrics_loop_probe_label(probe), duration * 1000);
+    }
+}
+
+/*
+ * Stores the moment a timer should fire, it's read back by loop_profiler_timer_fired() when it does.
+ * NOTE(marius): the deadline is set even when the profiler is off, so a timer armed before it was turned on
+ * doesn't look late
+ */
+static void loop_profiler_arm(double *deadline, const struct timeval timeout)
+{
+    *deadline = loop_profiler_now() + timeval_to_seconds(timeout);
+}
+
+static void loop_profiler_timer_fired(const enum loop_probe probe, const double deadline)
+{
+    if (!loop_profiler_enabled() || deadline <= 0) { return; }
+
+    double lateness = loop_profiler_now() - deadline;
+    if (lateness < 0) { lateness = 0; }
+    metrics_histogram_observe(&metrics_registry.loop[probe].lateness, lateness);
+    if (lateness > LOOP_PROFILER_SLOW_SECONDS) {
+        _warn("loop::late_timer[%s]: %2.2lfms", metrics_loop_probe_label(probe), lateness * 1000);
+    }
+}
+
+static void loop_profiler_log_summary(void)
+{
+    for (int probe = loop_probe_dbus_dispatch; probe < LOOP_PROBE_COUNT; probe++) {
+        const struct loop_probe_stats *stats = &metrics_registry.loop[probe];
+        if (stats->duration.count == 0) { continue; }
+
+        const char *label = metrics_loop_probe_label((enum loop_probe)probe);
+        _info("loop::profile[%s]: calls %" PRIu64 ", avg %2.3lfms, max %2.3lfms, slow %" PRIu64, label, stats->duration.count,
+              stats->duration.sum * 1000 / (double)stats->duration.count, stats->max_duration * 1000, stats->slow);
+        if (stats->lateness.count > 0) {
+            _info("loop::profile[%s]: avg lateness %2.3lfms", label, stats->lateness.sum * 1000 / (double)stats->lateness.count);
+        }
+    }
+}
+
+static void loop_profiler_toggle(const evutil_socket_t signum, short events, void *data)
+{
+    metrics_registry.loop_profiling = !metrics_registry.loop_profiling;
+    if (loop_profiler_enabled()) {
+        _info("loop::profiler: enabled, slow callbacks take longer than %2.2lfms", LOOP_PROFILER_SLOW_SECONDS * 1000);
+        return;
+    }
+    _info("loop::profiler: disabled");
+    loop_profiler_log_summary();
+}
+
+#endif // MPRIS_SCROBBLER_PROFILER_H
@@ -9,8 +9,8 @@
 
 #define MPRIS_SPOTIFY_TRACK_ID_PREFIX   "spotify:track:"
 
-short load_player_namespaces(DBusConnection *, struct mpris_player *, short);
-void load_player_mpris_properties(DBusConnection*, struct mpris_player*);
+void load_player_namespaces(struct state *);
+void load_player_mpris_properties(struct state *, const struct mpris_player *);
 
 struct dbus *dbus_connection_init(struct state*);
 
@@ -51,6 +51,9 @@ static void debug_event(const struct mpris_event *e)
     if (whats_loaded & mpris_load_property_shuffle) {
         _log(level, "changed::shuffle:                  %s", "yes");
     }
+    if (whats_loaded & mpris_load_property_rate) {
+        _log(level, "changed::rate:                     %s", "yes");
+    }
     if (whats_loaded & mpris_load_metadata_bitrate) {
         _log(level, "changed::metadata::bitrate:        %s", "yes");
     }
@@ -146,13 +149,16 @@ const char *get_api_status_label (api_return_codes code)
 }
 #endif
 
+/*
+ * Returns how long the track needs to be listened to before it gets scrobbled, the play time it already has doesn't
+ * count, see playback_clock_until()
+ */
 static double min_scrobble_delay_seconds(const struct scrobble *s)
 {
     if (s->length <= 0.1) {
         return 0L;
     }
-    const double result = (double)min(MIN_SCROBBLE_DELAY_SECONDS, (long)s->length / 2.0L) - s->play_time + 1.0;
-    return max(result, 0L);
+    return (double)min(MIN_SCROBBLE_DELAY_SECONDS, s->length / 2.0L);
 }
 
 static void scrobble_init(struct scrobble *s)
@@ -171,6 +177,18 @@ static struct scrobble *scrobble_new(void)
     return result;
 }
 
+/*
+ * Stops the timers of the player, the track it was playing doesn't get scrobbled.
+ */
+static void mpris_player_detach(struct mpris_player *player)
+{
+    timer_wheel_remove(player->timers, &player->now_playing.timer);
+    timer_wheel_remove(player->timers, &player->queue.timer);
+    if (event_initialized(&player->debounce_event) && event_pending(&player->debounce_event, EV_TIMEOUT, NULL)) {
+        event_del(&player->debounce_event);
+    }
+}
+
 static void mpris_player_free(struct mpris_player *player)
 {
     if (NULL == player) { return; }
@@ -181,26 +199,31 @@ static void mpris_player_free(struct mpris_player *player)
             free(player->history[i]);
         }
     }
-    if (event_initialized(&player->now_playing.event) && event_pending(&player->now_playing.event, EV_TIMEOUT, NULL)) {
-        event_del(&player->now_playing.event);
-    }
-    if (event_initialized(&player->queue.event) && event_pending(&player->queue.event, EV_TIMEOUT, NULL)) {
-        event_del(&player->queue.event);
-    }
+    mpris_player_detach(player);
+    scrobble_clean(&player->now_playing.scrobble);
+    scrobble_clean(&player->queue.scrobble);
     memset(player, 0x0, sizeof(*player));
 }
 
 void dbus_close(struct dbus*);
 void events_free(const struct events*);
+static void config_watch_clean(struct config_watch *);
 static void state_destroy(struct state *s)
 {
     dbus_close(s->dbus);
 
-    for (int i = 0; i < s->player_count; i++) {
-        mpris_player_free(&s->players[i]);
+    for (size_t i = 0; i < mpris_players_count(&s->players); i++) {
+        struct mpris_player *player = s->players.entries[i];
+        mpris_player_free(player);
+        free(player);
     }
+    mpris_players_clean(&s->players);
+    timer_wheel_clean(&s->timers);
 
     scrobbler_clean(&s->scrobbler);
+    config_watch_clean(&s->watch);
+    socket_server_clean(&s->control);
+    socket_server_clean(&s->metrics);
     events_free(&s->events);
 }
 
@@ -211,70 +234,78 @@ static struct mpris_player *mpris_player_new(void)
     return (result);
 }
 
-void state_loaded_properties(const DBusConnection *, struct mpris_player *, struct mpris_properties *, const struct mpris_event *);
-void get_player_identity(DBusConnection*, const char*, char*);
-static bool mpris_player_init (const struct dbus *dbus, struct mpris_player *player, const struct events events, struct scrobbler *scrobbler, const char ignored[MAX_PLAYERS][MAX_PROPERTY_LENGTH+1], const short ignored_count)
+void state_loaded_properties(struct mpris_player *, struct mpris_properties *, const struct mpris_event *);
+void dbus_player_add_match(struct dbus *, struct mpris_player *);
+void dbus_player_remove_match(struct dbus *, struct mpris_player *);
+void get_player_identity(struct state *, const struct mpris_player *);
+/*
+ * Starts loading the player, the identity and the properties are requested asynchronously
+ * and the player becomes valid once the replies arrive.
+ */
+static bool mpris_player_init(struct state *state, struct mpris_player *player)
 {
-    if (strlen(player->mpris_name) == 0 || strlen(player->bus_id) == 0) {
+    if (strlen(player->mpris_name) == 0) {
         return false;
     }
-    const char *identity = player->mpris_name;
-    if (strlen(identity) == 0) {
-        identity = player->bus_id;
-    }
-    get_player_identity(dbus->conn, identity, player->name);
+    get_player_identity(state, player);
 
-    for (short j = 0; j < ignored_count; j++) {
-        char *ignored_id = (char*)ignored[j];
+    return true;
+}
+
+static bool mpris_player_is_ignored(const struct configuration *config, const struct mpris_player *player)
+{
+    for (short j = 0; j < config->ignore_players_count; j++) {
+        const char *ignored_id = config->ignore_players[j];
         const size_t len = strlen(ignored_id);
-        player->ignored = (
-            strncmp(player->mpris_name, ignored_id, len) == 0 ||
-            strncmp(player->name, ignored_id, len) == 0
-        );
-        if (player->ignored) {
+        if (strncmp(player->mpris_name, ignored_id, len) == 0 || strncmp(player->name, ignored_id, len) == 0) {
             _debug("mpris_player::ignored: %s on %s", player->name, ignored_id);
             return true;
         }
     }
-    assert(scrobbler);
-    player->scrobbler = scrobbler;
-    assert(events.base);
-    player->evbase = events.base;
+    return false;
+}
+
+static void mpris_player_set_debounce(struct mpris_player *player, const unsigned debounce_ms)
+{
+    player->debounce.tv_sec = debounce_ms / 1000;
+    player->debounce.tv_usec = (debounce_ms % 1000) * 1000;
+}
 
-    load_player_mpris_properties(dbus->conn, player);
+/*
+ * Hooks the player up to the scrobbler and asks it for its properties, the scrobbling starts when they arrive.
+ */
+static void mpris_player_attach(struct state *state, struct mpris_player *player)
+{
+    player->scrobbler = &state->scrobbler;
+    assert(state->events.base);
+    player->evbase = state->events.base;
+    player->timers = &state->timers;
 
     player->now_playing.parent = player;
     player->queue.parent = player;
 
-    return true;
+    mpris_player_set_debounce(player, state->config->debounce_ms);
+
+    // NOTE(marius): the signals need to be matched before the properties are requested, so no change gets lost
+    dbus_player_add_match(state->dbus, player);
+    load_player_mpris_properties(state, player);
 }
 
-void print_mpris_player(struct mpris_player *, enum log_levels, bool);
-static short mpris_players_init(const struct dbus *dbus, struct mpris_player *players, const struct events events, struct scrobbler *scrobbler, const char ignored[MAX_PLAYERS][MAX_PROPERTY_LENGTH+1], const short ignored_count)
+static void mpris_player_identity_loaded(struct state *state, struct mpris_player *player)
 {
-    if (NULL == players){
-        return -1;
-    }
-    if (NULL == dbus){
+    player->ignored = mpris_player_is_ignored(state->config, player);
+    if (player->ignored) { return; }
+
+    mpris_player_attach(state, player);
+}
+
+static void mpris_players_init(struct state *state)
+{
+    if (NULL == state->dbus){
         _error("players::init: failed, unable to load from dbus");
-        return -1;
-    }
-    const short player_count = load_player_namespaces(dbus->conn, players, MAX_PLAYERS);
-    short loaded_player_count = 0;
-    for (short i = 0; i < player_count; i++) {
-        struct mpris_player *player = &players[i];
-        _trace("mpris_player[%d]: %s%s", i, player->mpris_name, player->bus_id);
-        if (!mpris_player_init(dbus, player, events, scrobbler, ignored, ignored_count)) {
-            _trace("mpris_player[%d:%s]: failed to load properties", i, player->mpris_name);
-            continue;
-        }
-        if (!player->ignored) {
-            print_mpris_player(player, log_tracing2, false);
-            loaded_player_count++;
-        }
+        return;
     }
-
-    return loaded_player_count;
+    load_player_namespaces(state);
 }
 
 static void print_scrobble(struct scrobble *s, const enum log_levels log)
@@ -290,7 +321,7 @@ static void print_scrobble(struct scrobble *s, const enum log_levels log)
     strftime(start_time, sizeof(start_time), "%Y-%m-%d %T %p", timeinfo);
 
     char temp[MAX_PROPERTY_LENGTH*MAX_PROPERTY_COUNT+10] = {0};
-    array_log_with_label(temp, s->artist, array_count(s->artist));
+    views_log_with_label(temp, s->artist, array_count(s->artist));
     _log((log << 1U), "scrobbler::loaded_scrobble(%p)", s);
     _log(log, "  scrobble::title: %s", s->title);
     _log(log, "  scrobble::artist: %s", temp);
@@ -301,23 +332,26 @@ static void print_scrobble(struct scrobble *s, const enum log_levels log)
     _log(log, "  scrobble::track_number: %u", s->track_number);
     _log(log, "  scrobble::start_time: %s", start_time);
     _log(log, "  scrobble::play_time[%.3lf]: %.3lf", d, s->play_time);
+    if (!scrobble_has_strings(s)) {
+        return;
+    }
     if (strlen(s->mb_spotify_id) > 0) {
         _log(log, "  scrobble::spotify_id: %s", s->mb_spotify_id);
     }
     if (strlen(s->mb_track_id[0]) > 0) {
-        array_log_with_label(temp, s->mb_track_id, array_count(s->mb_track_id));
+        views_log_with_label(temp, s->mb_track_id, array_count(s->mb_track_id));
         _log(log, "  scrobble::musicbrainz::track_id: %s", temp);
     }
     if (strlen(s->mb_artist_id[0]) > 0) {
-        array_log_with_label(temp, s->mb_artist_id, array_count(s->mb_artist_id));
+        views_log_with_label(temp, s->mb_artist_id, array_count(s->mb_artist_id));
         _log(log, "  scrobble::musicbrainz::artist_id: %s", temp);
     }
     if (strlen(s->mb_album_id[0]) > 0) {
-        array_log_with_label(temp, s->mb_album_id, array_count(s->mb_album_id));
+        views_log_with_label(temp, s->mb_album_id, array_count(s->mb_album_id));
         _log(log, "  scrobble::musicbrainz::album_id: %s", temp);
     }
     if (strlen(s->mb_album_artist_id[0]) > 0) {
-        array_log_with_label(temp, s->mb_album_artist_id, array_count(s->mb_album_artist_id));
+        views_log_with_label(temp, s->mb_album_artist_id, array_count(s->mb_album_artist_id));
         _log(log, "  scrobble::musicbrainz::album_artist_id: %s", temp);
     }
 }
@@ -347,7 +381,7 @@ static void print_scrobble_valid_check(const struct scrobble *s, const enum log_
 
 static bool scrobble_is_empty(const struct scrobble *s)
 {
-    return _is_zero(s);
+    return !scrobble_has_strings(s);
 }
 
 static bool now_playing_is_valid(const struct scrobble *m, const struct api_credentials *cur/*, const time_t current_time, const time_t last_playing_time*/) {
@@ -366,13 +400,6 @@ static bool now_playing_is_valid(const struct scrobble *m, const struct api_cred
     }
 }
 
-static void scrobble_copy (struct scrobble *t, const struct scrobble *s)
-{
-    assert(NULL != t);
-    assert(NULL != s);
-    memcpy(t, s, sizeof(*t));
-}
-
 static bool scrobbles_equal(const struct scrobble *s, const struct scrobble *p)
 {
     if ((NULL == s) && (NULL == p)) { return true; }
@@ -382,22 +409,24 @@ static bool scrobbles_equal(const struct scrobble *s, const struct scrobble *p)
 
     if (s == p) { return true; }
 
-    const bool result = _eq(s, p);
+    const bool result = (
+        s->length == p->length &&
+        s->position == p->position &&
+        s->play_time == p->play_time &&
+        s->start_time == p->start_time &&
+        s->scrobbled == p->scrobbled &&
+        s->track_number == p->track_number &&
+        scrobble_strings_equal(s, p)
+    );
     _trace("scrobbler::check_scrobbles(%p:%p) %s", s, p, result ? "same" : "different");
     return result;
 }
 
-static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p, const struct mpris_event *e)
+static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p)
 {
     assert (NULL != d);
     assert (NULL != p);
 
-    memcpy(d->title, p->metadata.title, min(MAX_PROPERTY_LENGTH, sizeof(p->metadata.title)));
-    memcpy(d->album, p->metadata.album, min(MAX_PROPERTY_LENGTH, sizeof(p->metadata.album)));
-    memcpy(d->artist, p->metadata.artist, min(MAX_PROPERTY_LENGTH, sizeof(p->metadata.artist)));
-    memcpy(d->url, p->metadata.url, min(MAX_PROPERTY_LENGTH, sizeof(p->metadata.url)));
-    memcpy(d->player_name, p->player_name, min(MAX_PROPERTY_LENGTH, sizeof(p->player_name)));
-
     d->length = 0L;
     d->position = 0L;
     if (p->metadata.length > 0) {
@@ -405,52 +434,36 @@ static bool load_scrobble(struct scrobble *d, const struct mpris_properties *p,
     }
     d->scrobbled = false;
     d->track_number = (unsigned short )p->metadata.track_number;
-    if (mpris_event_changed_track(e) && mpris_properties_is_playing(p)) {
-        if (mpris_event_changed_position(e)) {
-            d->position = (double)p->position / (double)1000000L;
-        }
-        if (d->position > 0) {
-            d->play_time = d->position;
-        }
-        // we're checking if it's a newly started track, in order to set the start_time accordingly
-        if (d->play_time > 0) {
-            d->start_time = time(NULL) - (time_t)(d->play_time/1);
-        } else if (e->timestamp > 0) {
-            d->start_time = e->timestamp;
-        }
-    }
 
-    // musicbrainz data
-    memcpy(d->mb_track_id, p->metadata.mb_track_id, sizeof(d->mb_track_id));
-    memcpy(d->mb_album_id, p->metadata.mb_album_id, sizeof(d->mb_album_id));
-    memcpy(d->mb_artist_id, p->metadata.mb_artist_id, sizeof(d->mb_artist_id));
-    memcpy(d->mb_album_artist_id, p->metadata.mb_album_artist_id, sizeof(d->mb_album_artist_id));
+    struct scrobble values = {0};
+    values.title = p->metadata.title;
+    values.album = p->metadata.album;
+    values.url = p->metadata.url;
+    values.player_name = p->player_name;
+    for (int i = 0; i < MAX_PROPERTY_COUNT; i++) {
+        values.artist[i] = p->metadata.artist[i];
+        // musicbrainz data
+        values.mb_track_id[i] = p->metadata.mb_track_id[i];
+        values.mb_album_id[i] = p->metadata.mb_album_id[i];
+        values.mb_artist_id[i] = p->metadata.mb_artist_id[i];
+        values.mb_album_artist_id[i] = p->metadata.mb_album_artist_id[i];
+    }
     // if this is spotify we add the track_id as the spotify_id
     const size_t spotify_prefix_len = strlen(MPRIS_SPOTIFY_TRACK_ID_PREFIX);
     if (strncmp(p->metadata.track_id, MPRIS_SPOTIFY_TRACK_ID_PREFIX, spotify_prefix_len) == 0){
-        memcpy(d->mb_spotify_id, p->metadata.track_id + spotify_prefix_len, sizeof(p->metadata.track_id)-spotify_prefix_len);
+        values.mb_spotify_id = p->metadata.track_id + spotify_prefix_len;
     }
-    return true;
+    return scrobble_load_strings(d, values.strings);
 }
 
 static bool queue_append(struct scrobble_queue *queue, const struct scrobble *track)
 {
-    const int queue_length = queue->length;
+    if (queue->length >= MAX_QUEUE_LENGTH) { return false; }
 
-    struct scrobble *top = &queue->entries[queue_length];
+    struct scrobble *top = &queue->entries[queue->length];
     scrobble_copy(top, track);
 
-    top->play_time = difftime(time(0), top->start_time);
-#if 0
-    if (top->play_time == 0) {
-        // TODO(marius): we need to be able to load the current playing mpris_properties from the track
-        //  This would help with computing current play time based on position
-    }
-    _debug("scrobbler::queue:setting_top_scrobble_playtime(%.3f): %s//%s//%s", top->play_time, top->title, top->artist[0], top->album);
-#endif
-
     queue->length++;
-    assert(queue->length < MAX_QUEUE_LENGTH);
 
     for (int pos = queue->length-2; pos >= 0; pos--) {
         struct scrobble *current = &queue->entries[pos];
@@ -465,52 +478,154 @@ static bool queue_append(struct scrobble_queue *queue, const struct scrobble *tr
     return true;
 }
 
+/*
+ * Removes the first count entries of the queue, moving the ones after them to the front, and filling the free slots
+ * from the overflow.
+ */
+static void queue_shift(struct scrobble_queue *queue, const int count)
+{
+    assert(count <= queue->length);
+
+    const int remaining = queue->length - count;
+    if (remaining > 0) {
+        memmove(&queue->entries[0], &queue->entries[count], (size_t)remaining * sizeof(queue->entries[0]));
+    }
+    memset(&queue->entries[remaining], 0x0, (size_t)count * sizeof(queue->entries[0]));
+    queue->length = remaining;
+
+    int moved = MAX_QUEUE_LENGTH - queue->length;
+    if (moved > (int)arrlen(queue->overflow)) {
+        moved = (int)arrlen(queue->overflow);
+    }
+    if (moved > 0) {
+        memcpy(&queue->entries[queue->length], &queue->overflow[0], (size_t)moved * sizeof(queue->entries[0]));
+        arrdeln(queue->overflow, 0, moved);
+        queue->length += moved;
+    }
+}
+
+/*
+ * Loads the oldest scrobbles that spilled over to the journal, and the service didn't accept yet, into the batch, up
+ * to count of them. They stay in the journal, submitting them marks them as in flight to the service.
+ */
+static unsigned batch_load_spilled(struct scrobble_journal *journal, const enum api_type end_point, struct scrobble batch[], const unsigned count)
+{
+    const struct journal_entry *pending[MAX_SCROBBLE_BATCH] = {0};
+    const size_t found = journal_pending(journal, end_point, pending, count < MAX_SCROBBLE_BATCH ? count : MAX_SCROBBLE_BATCH);
+
+    unsigned loaded = 0;
+    for (size_t i = 0; i < found; i++) {
+        if (!journal_load(journal, pending[i], &batch[loaded])) { continue; }
+        loaded++;
+    }
+    if (loaded > 0) {
+        _debug("scrobbler::batch_load[%s]: %u scrobbles loaded from journal", get_api_type_label(end_point), loaded);
+    }
+    return loaded;
+}
+
 static bool scrobbles_append(struct scrobbler *scrobbler, const struct scrobble *track)
 {
     assert(NULL != scrobbler);
     assert(NULL != track);
 
     struct scrobble_queue *queue = &scrobbler->queue;
+    struct scrobble_journal *journal = &scrobbler->journal;
     _trace("scrobbler::queue_push(%4zu) %s//%s//%s", queue->length, track->title, track->artist[0], track->album);
-    const bool result = queue_append(queue, track);
+
+    struct scrobble current = {0};
+    scrobble_copy(&current, track);
+    current.journal_id = journal_append(journal, &current);
+
+    // NOTE(marius): while older scrobbles are waiting in the journal, the new ones join them there
+    //  so the submission order is kept. The count includes the scrobble we just appended, which might not have made
+    //  it into the index of the journal.
+    const bool spilling = current.journal_id > 0 && (queue->length >= MAX_QUEUE_LENGTH || journal_spilled_count(journal) > 1 ||
+                                                     NULL == journal_find_entry(journal, current.journal_id));
+    if (spilling) {
+        _debug("scrobbler::queue_spill[%" PRIu64 "]: %zu scrobbles waiting in journal", current.journal_id, journal_spilled_count(journal));
+        scrobble_clean(&current);
+        return true;
+    }
+    if (queue->length >= MAX_QUEUE_LENGTH) {
+        // NOTE(marius): with nowhere to spill, the scrobble waits in memory behind the queue, it takes over the
+        //  arena of current
+        _warn("scrobbler::queue_full: keeping %s//%s//%s in memory: %s", current.title, current.artist[0], current.album,
+              journal_error(journal));
+        arrput(queue->overflow, current);
+        return true;
+    }
+
+    const bool result = queue_append(queue, &current);
+    if (result) {
+        journal_set_queued(journal, current.journal_id, true);
+    }
+    scrobble_clean(&current);
     _trace("scrobbler::new_queue_length: %zu", queue->length);
     return result;
 }
 
+/*
+ * Submits the next batch of the backlog to every service: the entries of the queue, followed by the oldest scrobbles
+ * that spilled over to the journal and the service didn't accept yet, up to the size of the service's batches.
+ * The rest of the backlog gets drained once the service accepts the current batch.
+ */
 static unsigned int scrobbler_consume_queue(struct scrobbler *scrobbler)
 {
     assert (NULL != scrobbler);
 
+    if (scrobbler_services_mask(scrobbler->conf) == 0) {
+        _debug("scrobbler::queue: no enabled services, keeping %zu scrobbles", scrobbler_backlog_length(scrobbler));
+        return 0;
+    }
+
     const int queue_length = scrobbler->queue.length;
     _trace("scrobbler::queue_length: %u", queue_length);
 
-    unsigned int consumed = 0;
-    const int top = scrobbler->queue.length - 1;
-    const bool top_scrobble_invalid = false;
-
-    struct scrobble *tracks[MAX_QUEUE_LENGTH] = {0};
-    for (int pos = top; pos >= 0; pos--) {
-        struct scrobble *current = &scrobbler->queue.entries[pos];
-            tracks[pos] = current;
-            _info("scrobbler::scrobble:(%4zu) %s//%s//%s", pos, current->title, current->artist[0], current->album);
-            consumed++;
-    }
-    if (consumed > 0) {
-        api_request_do(scrobbler, (const struct scrobble**)tracks, consumed, scrobble_is_valid, api_build_request_scrobble);
+    const unsigned int queued = (unsigned)(queue_length < MAX_SCROBBLE_BATCH ? queue_length : MAX_SCROBBLE_BATCH);
+
+    struct scrobble batch[MAX_SCROBBLE_BATCH] = {0};
+    const struct scrobble *tracks[MAX_SCROBBLE_BATCH] = {0};
+    for (unsigned pos = 0; pos < queued; pos++) {
+        // NOTE(marius): the batch takes over the arenas of the queue entries
+        memcpy(&batch[pos], &scrobbler->queue.entries[pos], sizeof(batch[pos]));
+        tracks[pos] = &batch[pos];
+        _info("scrobbler::scrobble:(%4zu) %s//%s//%s", pos, batch[pos].title, batch[pos].artist[0], batch[pos].album);
+    }
+
+    unsigned int consumed = queued;
+    for (size_t i = 0; i < scrobbler->conf->credentials_count; i++) {
+        const struct api_credentials *cur = &scrobbler->conf->credentials[i];
+        if (!api_service_allows(scrobbler, cur, queued)) { continue; }
+
+        // NOTE(marius): the queue is shorter than the batches the services take, so the batch is filled up from the
+        //  journal with what this service still needs. The entries of the queue are still marked as queued, so
+        //  they're not loaded a second time.
+        const unsigned batch_size = api_batch_size(cur->end_point);
+        const unsigned spilled = queued < batch_size ? batch_load_spilled(&scrobbler->journal, cur->end_point, &batch[queued], batch_size - queued) : 0;
+        for (unsigned pos = queued; pos < queued + spilled; pos++) {
+            tracks[pos] = &batch[pos];
+            _info("scrobbler::scrobble:(%4zu) %s//%s//%s", pos, batch[pos].title, batch[pos].artist[0], batch[pos].album);
+        }
+        if (queued + spilled > 0) {
+            api_service_request_do(scrobbler, cur, tracks, queued + spilled, request_scrobble, scrobble_is_valid, api_build_request_scrobble);
+        }
+        for (unsigned pos = queued; pos < queued + spilled; pos++) {
+            scrobble_clean(&batch[pos]);
+            tracks[pos] = NULL;
+        }
+        consumed += spilled;
     }
-    int min_scrobble_zero = 0;
-    if (top_scrobble_invalid) {
-        struct scrobble *first = &scrobbler->queue.entries[0];
-        struct scrobble *last = &scrobbler->queue.entries[top];
-        // leave the former top scrobble (which might still be playing) as the only one in the queue
-        memcpy(first, last, sizeof(*first));
-        memset(last, 0x0, sizeof(*last));
-        min_scrobble_zero = 1;
+
+    for (unsigned pos = 0; pos < queued; pos++) {
+        journal_set_queued(&scrobbler->journal, batch[pos].journal_id, false);
+        scrobble_clean(&batch[pos]);
     }
-    for (int pos = top; pos >= min_scrobble_zero; pos--) {
-        memset(&scrobbler->queue.entries[pos], 0x0, sizeof(scrobbler->queue.entries[pos]));
-        scrobbler->queue.length--;
-        assert(scrobbler->queue.length >= 0);
+    queue_shift(&scrobbler->queue, (int)queued);
+
+    const size_t backlog = scrobbler_backlog_length(scrobbler);
+    if (backlog > 0) {
+        _debug("scrobbler::backlog: %zu scrobbles waiting", backlog);
     }
 
     return consumed;
@@ -518,14 +633,50 @@ static unsigned int scrobbler_consume_queue(struct scrobbler *scrobbler)
 
 static bool add_event_now_playing(struct mpris_player *, const struct scrobble *, const time_t);
 static bool add_event_queue(struct mpris_player*, const struct scrobble*);
+static bool mpris_player_schedule_queue(struct mpris_player*);
 static void mpris_event_clear(struct mpris_event *);
-static void print_properties_if_changed(struct mpris_properties*, struct mpris_properties*, struct mpris_event*, enum log_levels);
 
-void state_loaded_properties(const DBusConnection *conn, struct mpris_player *player, struct mpris_properties *properties, const struct mpris_event *what_happened)
+static void mpris_player_stop_events(struct mpris_player *player)
+{
+    if (timer_entry_pending(&player->now_playing.timer)) {
+        _trace("events::removing::now_loading(%p)", &player->now_playing.timer);
+        timer_wheel_remove(player->timers, &player->now_playing.timer);
+    }
+    if (timer_entry_pending(&player->queue.timer)) {
+        _trace("events::removing::queue(%p)", &player->queue.timer);
+        timer_wheel_remove(player->timers, &player->queue.timer);
+    }
+}
+
+/*
+ * Moves the clock of the player along with what the player told us, before the events get scheduled from it.
+ */
+static void mpris_player_update_clock(struct mpris_player *player, const struct mpris_properties *properties, const struct mpris_event *what_happened, const double now)
+{
+    struct playback_clock *clock = &player->clock;
+    const bool playing = mpris_player_is_playing(player);
+    const double position = (double)properties->position / (double)1000000L;
+
+    if (mpris_event_changed_rate(what_happened)) {
+        playback_clock_set_rate(clock, properties->rate, now);
+    }
+    if (mpris_event_changed_track(what_happened)) {
+        playback_clock_start_track(clock, mpris_event_changed_position(what_happened) ? position : 0, playing, now);
+        return;
+    }
+    if (mpris_event_changed_position(what_happened)) {
+        playback_clock_seek(clock, position, now);
+    }
+    if (mpris_event_changed_playback_status(what_happened)) {
+        playback_clock_set_running(clock, playing, now);
+    }
+}
+
+void state_loaded_properties(struct mpris_player *player, struct mpris_properties *properties, const struct mpris_event *what_happened)
 {
-    assert(conn);
     assert(player);
     assert(properties);
+    metrics_loaded_properties();
     if (player->ignored) {
         _trace("events::skipping: player %s is ignored", player->name);
         return;
@@ -537,74 +688,120 @@ void state_loaded_properties(const DBusConnection *conn, struct mpris_player *pl
     }
     debug_event(&player->changed);
 
+    const double now = playback_clock_now();
+    mpris_player_update_clock(player, properties, what_happened, now);
+
     struct scrobble scrobble = {0};
-    load_scrobble(&scrobble, properties, what_happened);
+    load_scrobble(&scrobble, properties);
+    scrobble.start_time = player->clock.started;
+    scrobble.position = playback_clock_position(&player->clock, now);
+    scrobble.play_time = playback_clock_listened(&player->clock, now);
 
     if (scrobble_is_empty(&scrobble)) {
         _warn("events::invalid_scrobble");
+        scrobble_clean(&scrobble);
         return;
     }
 
     if (mpris_player_is_playing(player)) {
         if(mpris_event_changed_track(what_happened) || mpris_event_changed_playback_status(what_happened)) {
-            if (!mpris_event_changed_track(what_happened)) {
-                struct scrobble *prev = &player->queue.scrobble;
-                if (!scrobble_is_empty(prev) && scrobble.play_time < 0.1 && prev->play_time > 0) {
-                    scrobble.play_time = prev->play_time;
-                    scrobble.start_time = time(NULL) - (time_t)scrobble.play_time;
-                }
-            }
             add_event_now_playing(player, &scrobble, 0);
             add_event_queue(player, &scrobble);
+        } else if (mpris_event_changed_rate(what_happened) || mpris_event_changed_position(what_happened)) {
+            // NOTE(marius): the track plays faster or slower now, the time it gets queued moves with it
+            mpris_player_schedule_queue(player);
         }
         if (mpris_event_changed_track(what_happened) && !mpris_event_changed_position(what_happened)) {
             properties->position = 0;
         }
     } else {
-        // remove add_now_event
-        // compute current play_time for properties.metadata
-        if (event_initialized(&player->now_playing.event)) {
-            _trace("events::removing::now_loading(%p)", &player->now_playing.event);
-            event_del(&player->now_playing.event);
-            memset(&player->now_playing.event, 0x0, sizeof(player->now_playing.event));
-        }
-        if (event_initialized(&player->queue.event)) {
-            struct scrobble *prev = &player->queue.scrobble;
-            if (prev->start_time > 0) {
-                prev->play_time = difftime(time(NULL), prev->start_time);
-            }
-            _trace("events::removing::queue(%p)", &player->queue.event);
-            event_del(&player->queue.event);
-            memset(&player->queue.event, 0x0, sizeof(player->queue.event));
-        }
+        // NOTE(marius): the clock of the player doesn't run until it plays again, the queue event gets added back then
+        mpris_player_stop_events(player);
     }
     if (mpris_event_changed_volume(what_happened)) {
         // trigger volume_changed event
     }
-    if (mpris_event_changed_position(what_happened)) {
-        // trigger position event
-        // compute current play_time for properties.metadata
-    }
 
+    scrobble_clean(&scrobble);
     mpris_event_clear(&player->changed);
 }
 
-static void check_player(struct mpris_player* player)
+/*
+ * The player jumped to another position of its track, the time until the track gets queued stays the same, unless
+ * the track got restarted after it was queued, that's a new play of it.
+ */
+static void mpris_player_seeked(struct mpris_player *player, const int64_t position)
 {
-    if (!mpris_player_is_valid(player) || !mpris_player_is_playing(player) || player->ignored) {
+    if (player->ignored) { return; }
+
+    player->properties.position = position;
+    const double seconds = (double)position / (double)1000000L;
+    const double now = playback_clock_now();
+    if (!playback_clock_seek(&player->clock, seconds, now)) {
+        _debug("events::seeked[%s]: %.2lfs", player->name, seconds);
         return;
     }
-    const struct mpris_event all = {.loaded_state = mpris_load_all };
 
-    struct scrobble scrobble = {0};
-    load_scrobble(&scrobble, &player->properties, &all);
+    _debug("events::restarted[%s]: %.2lfs", player->name, seconds);
+    struct scrobble *track = &player->queue.scrobble;
+    if (scrobble_is_empty(track) || !mpris_player_is_playing(player)) { return; }
+
+    track->start_time = player->clock.started;
+    track->position = seconds;
+    track->play_time = playback_clock_listened(&player->clock, now);
+    add_event_now_playing(player, track, 0);
+    mpris_player_schedule_queue(player);
+}
+
+static void mpris_player_debounce_cb(int fd, short event, void *data)
+{
+    assert(data);
+    struct mpris_player *player = data;
 
-    add_event_now_playing(player, &scrobble, 0);
-    add_event_queue(player, &scrobble);
+    log_context_player(player->mpris_name);
+    _trace2("events::triggered(%p:%p): debounce %s, fd=%d ev=%d", player, &player->debounce_event, player->name, fd, event);
+    const double start = loop_profiler_start();
+    if (mpris_player_is_valid(player)) {
+        state_loaded_properties(player, &player->properties, &player->changed);
+    }
+    loop_profiler_end(loop_probe_debounce, start);
+    log_context_clear();
+}
+
+/*
+ * Hands the changes of the player to the state machine once the debounce window elapses.
+ * The window starts with the first change, so the signals a player sends in a burst on a track change
+ * get handled together, with their loaded_state merged in player->changed.
+ */
+static void mpris_player_changed(struct mpris_player *player)
+{
+    if ((player->debounce.tv_sec == 0 && player->debounce.tv_usec == 0) || NULL == player->evbase) {
+        state_loaded_properties(player, &player->properties, &player->changed);
+        return;
+    }
+    if (!event_initialized(&player->debounce_event)) {
+        evtimer_assign(&player->debounce_event, player->evbase, mpris_player_debounce_cb, player);
+    }
+    if (!evtimer_pending(&player->debounce_event, NULL)) {
+        evtimer_add(&player->debounce_event, &player->debounce);
+    }
+}
+
+/*
+ * Hands the changes of the player to the state machine right away, together with the ones waiting for the debounce window.
+ */
+static void mpris_player_changed_now(struct mpris_player *player)
+{
+    if (event_initialized(&player->debounce_event) && evtimer_pending(&player->debounce_event, NULL)) {
+        evtimer_del(&player->debounce_event);
+    }
+    state_loaded_properties(player, &player->properties, &player->changed);
 }
 
 struct events *events_new(void);
 void events_init(struct events*, struct state*);
+static bool control_server_init(struct socket_server *, struct state *);
+static bool config_watch_init(struct config_watch *, struct state *);
 static bool state_init(struct state *s, struct configuration *config)
 {
     _trace2("mem::initing_state(%p)", s);
@@ -613,19 +810,24 @@ static bool state_init(struct state *s, struct configuration *config)
     s->config = config;
 
     events_init(&s->events, s);
+    timer_wheel_init(&s->timers, s->events.base);
 
     s->dbus = dbus_connection_init(s);
     if (NULL == s->dbus) { return false; }
 
     if (NULL == s->events.base) { return false; }
     scrobbler_init(&s->scrobbler, s->config, s->events.base);
+    metrics_server_init(&s->metrics, s);
+    control_server_init(&s->control, s);
+    config_watch_init(&s->watch, s);
+
+    // NOTE(marius): the players get loaded from the event loop, in parallel, as the replies come in
+    mpris_players_init(s);
 
-    s->player_count = mpris_players_init(s->dbus, s->players, s->events, &s->scrobbler, s->config->ignore_players, s->config->ignore_players_count);
-    for (short i = 0; i < s->player_count; i++) {
-        struct mpris_player *player = &s->players[i];
-        check_player(player);
+    if (scrobbler_backlog_length(&s->scrobbler) > 0) {
+        // NOTE(marius): submit the scrobbles that were replayed from the journal
+        scrobbler_consume_queue(&s->scrobbler);
     }
-    _trace2("mem::loaded %zd players", s->player_count);
 
     _trace2("mem::inited_state(%p)", s);
     return true;
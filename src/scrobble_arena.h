@@ -0,0 +1,134 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_SCROBBLE_ARENA_H
+#define MPRIS_SCROBBLER_SCROBBLE_ARENA_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The strings of a scrobble are views into a single allocation, the arena, owned by the scrobble.
+ * Every distinct value is stored once, and the empty values point to the first byte of the arena.
+ * A scrobble that has no arena has all its string views set to NULL.
+ */
+
+static void scrobble_clean(struct scrobble *s)
+{
+    if (NULL == s) { return; }
+
+    free(s->arena);
+    s->arena = NULL;
+    s->arena_size = 0;
+    memset(s->strings, 0, sizeof(s->strings));
+}
+
+static bool scrobble_has_strings(const struct scrobble *s)
+{
+    return NULL != s && NULL != s->arena;
+}
+
+/*
+ * Copies the values into a new arena, replacing the existing one.
+ * The values are allowed to point into the current arena of the scrobble.
+ */
+static bool scrobble_load_strings(struct scrobble *s, const char *values[SCROBBLE_STRING_COUNT])
+{
+    assert(NULL != s);
+
+    size_t lengths[SCROBBLE_STRING_COUNT] = {0};
+    int same_as[SCROBBLE_STRING_COUNT] = {0};
+
+    // NOTE(marius): the first byte is the empty string every empty value points to
+    size_t size = 1;
+    for (int i = 0; i < SCROBBLE_STRING_COUNT; i++) {
+        same_as[i] = -1;
+        if (NULL == values[i]) { continue; }
+
+        lengths[i] = strnlen(values[i], MAX_PROPERTY_LENGTH);
+        if (lengths[i] == 0) { continue; }
+
+        for (int j = 0; j < i; j++) {
+            if (same_as[j] < 0 && lengths[j] == lengths[i] && memcmp(values[j], values[i], lengths[i]) == 0) {
+                same_as[i] = j;
+                break;
+            }
+        }
+        if (same_as[i] < 0) {
+            size += lengths[i] + 1;
+        }
+    }
+
+    char *arena = malloc(size);
+    if (NULL == arena) { return false; }
+
+    const char *strings[SCROBBLE_STRING_COUNT] = {0};
+    arena[0] = '\0';
+    size_t offset = 1;
+    for (int i = 0; i < SCROBBLE_STRING_COUNT; i++) {
+        if (lengths[i] == 0) {
+            strings[i] = arena;
+            continue;
+        }
+        if (same_as[i] >= 0) {
+            strings[i] = strings[same_as[i]];
+            continue;
+        }
+        memcpy(arena + offset, values[i], lengths[i]);
+        arena[offset + lengths[i]] = '\0';
+        strings[i] = arena + offset;
+        offset += lengths[i] + 1;
+    }
+    assert(offset == size);
+
+    free(s->arena);
+    s->arena = arena;
+    s->arena_size = size;
+    memcpy(s->strings, strings, sizeof(s->strings));
+
+    return true;
+}
+
+/*
+ * Deep copies s into t, the views of t get rebased on its own copy of the arena.
+ */
+static void scrobble_copy(struct scrobble *t, const struct scrobble *s)
+{
+    assert(NULL != t);
+    assert(NULL != s);
+    if (t == s) { return; }
+
+    char *old_arena = t->arena;
+    memcpy(t, s, sizeof(*t));
+
+    if (scrobble_has_strings(s)) {
+        t->arena = malloc(s->arena_size);
+        if (NULL == t->arena) {
+            t->arena_size = 0;
+            memset(t->strings, 0, sizeof(t->strings));
+        } else {
+            memcpy(t->arena, s->arena, s->arena_size);
+            for (int i = 0; i < SCROBBLE_STRING_COUNT; i++) {
+                t->strings[i] = t->arena + (s->strings[i] - s->arena);
+            }
+        }
+    }
+    free(old_arena);
+}
+
+static bool scrobble_strings_equal(const struct scrobble *s, const struct scrobble *p)
+{
+    if (!scrobble_has_strings(s) || !scrobble_has_strings(p)) {
+        return scrobble_has_strings(s) == scrobble_has_strings(p);
+    }
+    for (int i = 0; i < SCROBBLE_STRING_COUNT; i++) {
+        if (strcmp(s->strings[i], p->strings[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // MPRIS_SCROBBLER_SCROBBLE_ARENA_H
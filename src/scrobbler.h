@@ -20,6 +20,39 @@ static bool connection_was_fulfilled(const struct scrobbler_connection *conn)
     return fulfilled;
 }
 
+/*
+ * The connections that were freed are kept, with the first block of their arena, the capacity of their arrays and
+ * their JSON tokener, to be used by the next requests.
+ */
+#define MAX_IDLE_CONNECTIONS 4
+
+static struct scrobbler_connection *scrobbler_connection_pool[MAX_IDLE_CONNECTIONS] = {0};
+static size_t scrobbler_connection_pool_count = 0;
+
+static void scrobbler_connection_destroy(struct scrobbler_connection *conn)
+{
+    // NOTE(marius): without the arena, cleaning the request and the response frees what they kept for reuse
+    conn->request.arena = NULL;
+    conn->response.arena = NULL;
+    http_request_clean(&conn->request);
+    http_response_clean(&conn->response);
+    http_arena_free(&conn->arena);
+    arrfree(conn->journal_ids);
+    arrfree(conn->listens);
+
+    _trace2("scrobbler::connection_free:conn[%p]", conn);
+    free(conn);
+}
+
+static void scrobbler_connection_pool_clean(void)
+{
+    for (size_t i = 0; i < scrobbler_connection_pool_count; i++) {
+        scrobbler_connection_destroy(scrobbler_connection_pool[i]);
+        scrobbler_connection_pool[i] = NULL;
+    }
+    scrobbler_connection_pool_count = 0;
+}
+
 static void scrobbler_connection_free (struct scrobbler_connection *conn, const bool force)
 {
     if (NULL == conn) { return; }
@@ -32,25 +65,17 @@ static void scrobbler_connection_free (struct scrobbler_connection *conn, const
         _trace("scrobbler::forced_connection_free[%s]", api_label);
     }
 
-    if (NULL != conn->headers) {
-        const size_t headers_count = arrlen(conn->headers);
-        for (int i = (int)headers_count - 1; i >= 0; i--) {
-            _trace2("scrobbler::connection_free::curl_headers(%zd::%zd:%p)", i, headers_count, conn->headers[i]);
-            curl_slist_free_all(conn->headers[i]);
-            arrdel(conn->headers, (size_t)i);
-            conn->headers[i] = NULL;
+    if (NULL != conn->parent) {
+        for (size_t i = 0; i < arrlen(conn->journal_ids); i++) {
+            journal_release(&conn->parent->journal, conn->journal_ids[i], conn->credentials.end_point);
         }
-        assert(arrlen(conn->headers) == 0);
-        arrfree(conn->headers);
-        conn->headers = NULL;
     }
-
-#ifdef RETRY_ENABLED
-    if (event_initialized(&conn->retry_event)) {
-        _trace2("scrobbler::connection_free::retry_event[%p]", &conn->retry_event);
-        event_del(&conn->retry_event);
+    if (NULL != conn->journal_ids) {
+        arrdeln(conn->journal_ids, 0, arrlen(conn->journal_ids));
+    }
+    if (NULL != conn->listens) {
+        arrdeln(conn->listens, 0, arrlen(conn->listens));
     }
-#endif
 
     _trace2("scrobbler::connection_clean::request[%p]", conn->request);
     http_request_clean(&conn->request);
@@ -59,21 +84,46 @@ static void scrobbler_connection_free (struct scrobbler_connection *conn, const
 
     curl_easy_handle_cleanup(conn);
 
-    _trace2("scrobbler::connection_free:conn[%p]", conn);
-    free(conn);
-    conn = NULL;
+    // NOTE(marius): the headers and the endpoint of the request, the headers of the response and the list of headers
+    // given to curl are all released here
+    conn->headers = NULL;
+    http_arena_reset(&conn->arena);
+
+    if (scrobbler_connection_pool_count >= MAX_IDLE_CONNECTIONS) {
+        scrobbler_connection_destroy(conn);
+        return;
+    }
+    scrobbler_connection_pool[scrobbler_connection_pool_count] = conn;
+    scrobbler_connection_pool_count++;
 }
 
 static struct scrobbler_connection *scrobbler_connection_new(void)
 {
-    struct scrobbler_connection *s = calloc(1, sizeof(struct scrobbler_connection));
+    struct scrobbler_connection *s = NULL;
+    if (scrobbler_connection_pool_count > 0) {
+        scrobbler_connection_pool_count--;
+        s = scrobbler_connection_pool[scrobbler_connection_pool_count];
+        scrobbler_connection_pool[scrobbler_connection_pool_count] = NULL;
+        _trace2("scrobbler::connection_reused:conn[%p]", s);
+    } else {
+        s = calloc(1, sizeof(struct scrobbler_connection));
+        if (NULL == s) { return NULL; }
+        s->request.arena = &s->arena;
+        s->response.arena = &s->arena;
+    }
+    s->parent = NULL;
+    s->should_free = false;
+    s->type = request_unknown;
     s->idx = -1;
     return (s);
 }
 
+static size_t scrobbler_request_count = 0;
+
 static void scrobbler_connection_init(struct scrobbler_connection *connection, struct scrobbler *s, const struct api_credentials credentials, const int idx)
 {
     connection->idx = idx;
+    connection->request_id = ++scrobbler_request_count;
     connection->parent = s;
 
     memcpy(&connection->credentials, &credentials, sizeof(credentials));
@@ -93,7 +143,7 @@ static void scrobbler_connections_clean(struct scrobble_connections *connections
 
     size_t cleaned = 0;
     size_t skipped = 0;
-    for (int i = MAX_QUEUE_LENGTH; i >= 0; i--) {
+    for (int i = MAX_CONNECTIONS - 1; i >= 0; i--) {
         struct scrobbler_connection *conn = connections->entries[i];
         if (NULL == conn) {
             continue;
@@ -111,70 +161,157 @@ static void scrobbler_connections_clean(struct scrobble_connections *connections
     }
 
     int length = 0;
-    for (int i = 0; i < MAX_QUEUE_LENGTH; i++) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
         if (NULL != connections->entries[i]) { length++; }
     }
     connections->length = length;
 }
 
+static int scrobbler_connections_free_slot(const struct scrobble_connections *connections)
+{
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (NULL == connections->entries[i]) { return i; }
+    }
+    return -1;
+}
+
 static bool scrobbler_queue_is_empty(const struct scrobble_queue *queue)
 {
     return (NULL == queue || queue->length == 0);
 }
 
-bool configuration_folder_create(const char *);
-bool configuration_folder_exists(const char *);
-static bool queue_persist_to_file(const struct scrobble_queue *to_persist, const char* path)
+/*
+ * The backlog is made of the scrobbles in the in-memory queue and its overflow, and the ones that spilled over to the
+ * journal.
+ */
+static size_t scrobbler_backlog_length(const struct scrobbler *s)
 {
-    bool status = false;
+    if (NULL == s) { return 0; }
+    return (size_t)s->queue.length + (size_t)arrlen(s->queue.overflow) + journal_spilled_count(&s->journal);
+}
 
-    if (NULL == to_persist || NULL == path) { return status; }
-    if (to_persist->length > 0) { return status; }
+static unsigned scrobbler_services_mask(const struct configuration *conf)
+{
+    unsigned mask = 0;
+    if (NULL == conf) { return mask; }
 
-    char *file_path = (char *)path;
-    char *folder_path = dirname(file_path);
-    if (!configuration_folder_exists(folder_path) && !configuration_folder_create(folder_path)) {
-        _error("main::cache: unable to create cache folder %s", folder_path);
-        goto _exit;
+    for (size_t i = 0; i < conf->credentials_count; i++) {
+        const struct api_credentials *cur = &conf->credentials[i];
+        if (!cur->enabled || !credentials_valid(cur)) { continue; }
+        mask |= 1U << (unsigned)cur->end_point;
     }
+    return mask;
+}
 
-    _debug("saving::queue[%u]: %s", to_persist->length, path);
-    FILE *file = fopen(path, "w+");
-    if (NULL == file) {
-        _warn("saving::queue:failed: %s", path);
-        goto _exit;
-    }
-    const size_t wrote = fwrite(to_persist, sizeof(to_persist), 1, file);
-    status = wrote == sizeof(to_persist);
-    if (!status) {
-        _warn("saving::queue:unable to save full file %zu vs. %zu", wrote, sizeof(to_persist));
-    }
+/*
+ * Counts a rejection for every track of a submission the service didn't accept, the ones that reached the limit of
+ * those are given up on. Returns the number of the tracks that are kept.
+ */
+static unsigned scrobbler_connection_reject(struct scrobbler_connection *conn, const size_t index)
+{
+    assert(conn);
+    struct scrobbler *s = conn->parent;
+    if (NULL == s || index >= (size_t)arrlen(conn->journal_ids)) { return 0; }
 
-    fclose(file);
+    const enum api_type end_point = conn->credentials.end_point;
+    const uint64_t id = conn->journal_ids[index];
+    if (!journal_reject(&s->journal, id, end_point)) { return 1; }
 
-_exit:
-    return status;
+    _warn("scrobbler::rejected[%s]: giving up on track %" PRIu64 " after %d attempts", get_api_type_label(end_point), id, JOURNAL_MAX_REJECTIONS);
+    journal_ack(&s->journal, id, end_point, scrobbler_services_mask(s->conf));
+    return 0;
 }
 
-static bool queue_append(struct scrobble_queue *, const struct scrobble *);
-static bool scrobbler_persist_queue(const struct scrobbler *scrobbler)
+/*
+ * Acknowledges the tracks of a successful submission, except the ones the service asked us to send again later, and
+ * the ones the response doesn't say anything about. Returns the number of the tracks that weren't accepted.
+ */
+static unsigned scrobbler_connection_acknowledge(struct scrobbler_connection *conn)
 {
-    if (NULL == scrobbler || scrobbler_queue_is_empty(&scrobbler->queue)) {
-        return false;
+    assert(conn);
+    struct scrobbler *s = conn->parent;
+    if (NULL == s || NULL == conn->journal_ids) { return 0; }
+
+    const enum api_type end_point = conn->credentials.end_point;
+    const unsigned required = scrobbler_services_mask(s->conf);
+    const size_t track_count = arrlen(conn->journal_ids);
+    if (json_document_is_error(conn->response.json, end_point)) {
+        // NOTE(marius): the service answered with an error for the whole submission, so none of the tracks got in
+        unsigned kept = 0;
+        for (size_t i = 0; i < track_count; i++) {
+            kept += scrobbler_connection_reject(conn, i);
+        }
+        _warn("scrobbler::rejected[%s]: error response, keeping %u of %zu tracks", get_api_type_label(end_point), kept, track_count);
+        return track_count;
     }
 
-    return queue_persist_to_file(&scrobbler->queue, scrobbler->conf->cache_path);
+    unsigned deferred = 0;
+    for (size_t i = 0; i < track_count; i++) {
+        const enum api_track_status status = api_response_track_status(conn->response.json, i, end_point);
+        if (status == track_deferred) {
+            deferred++;
+            continue;
+        }
+        if (status == track_unknown) {
+            scrobbler_connection_reject(conn, i);
+            deferred++;
+            continue;
+        }
+        journal_ack(&s->journal, conn->journal_ids[i], end_point, required);
+        if (i < arrlen(conn->listens)) {
+            ledger_add(&s->ledgers[end_point], conn->listens[i].fingerprint, conn->listens[i].played);
+        }
+    }
+    if (deferred > 0) {
+        _warn("scrobbler::deferred[%s]: %u of %zu tracks", get_api_type_label(end_point), deferred, track_count);
+    }
+    return deferred;
+}
+
+/*
+ * The service refused the submission as a whole, without it being down, so there's something wrong with the request.
+ * The tracks get sent again a limited number of times. Returns the number of the tracks that are kept.
+ */
+static unsigned scrobbler_connection_refused(struct scrobbler_connection *conn)
+{
+    assert(conn);
+    if (NULL == conn->parent || NULL == conn->journal_ids) { return 0; }
+
+    const size_t track_count = arrlen(conn->journal_ids);
+    unsigned kept = 0;
+    for (size_t i = 0; i < track_count; i++) {
+        kept += scrobbler_connection_reject(conn, i);
+    }
+    _warn("scrobbler::refused[%s]: %ld, keeping %u of %zu tracks", get_api_type_label(conn->credentials.end_point), conn->response.code, kept, track_count);
+    return kept;
 }
 
 static void scrobbler_clean(struct scrobbler *s)
 {
     if (NULL == s) { return; }
 
-    scrobbler_persist_queue(s);
-
     _trace("scrobbler::clean[%p]", s);
 
     scrobbler_connections_clean(&s->connections, true);
+    scrobbler_connection_pool_clean();
+
+    for (int i = 0; i < s->queue.length; i++) {
+        scrobble_clean(&s->queue.entries[i]);
+    }
+    for (size_t i = 0; i < arrlen(s->queue.overflow); i++) {
+        scrobble_clean(&s->queue.overflow[i]);
+    }
+    arrfree(s->queue.overflow);
+    journal_close(&s->journal);
+    for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+        ledger_close(&s->ledgers[api]);
+    }
+
+    api_breakers_clean(s);
+
+    if (evtimer_initialized(&s->drain_event) && evtimer_pending(&s->drain_event, NULL)) {
+        evtimer_del(&s->drain_event);
+    }
 
     if(evtimer_initialized(&s->timer_event) && evtimer_pending(&s->timer_event, NULL)) {
         _trace2("curl::multi_timer_remove(%p)", &s->timer_event);
@@ -184,6 +321,25 @@ static void scrobbler_clean(struct scrobbler *s)
     curl_handler_cleanup(s);
 }
 
+static unsigned int scrobbler_consume_queue(struct scrobbler *);
+static void scrobbler_drain_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    scrobbler_consume_queue(data);
+}
+
+/*
+ * Schedules the submission of the next batch from the backlog, once the current iteration of the event loop finishes.
+ */
+static void scrobbler_schedule_drain(struct scrobbler *s)
+{
+    if (NULL == s || !evtimer_initialized(&s->drain_event)) { return; }
+    if (scrobbler_backlog_length(s) == 0 || evtimer_pending(&s->drain_event, NULL)) { return; }
+
+    const struct timeval now = { .tv_sec = 0, };
+    evtimer_add(&s->drain_event, &now);
+}
+
 static void scrobbler_init(struct scrobbler *s, struct configuration *config, struct event_base *evbase)
 {
     s->conf = config;
@@ -194,10 +350,20 @@ static void scrobbler_init(struct scrobbler *s, struct configuration *config, st
     evtimer_assign(&s->timer_event, s->evbase, timer_cb, s);
     _trace2("curl::multi_timer_add(%p:%p)", s->handle, &s->timer_event);
 
+    evtimer_assign(&s->drain_event, s->evbase, scrobbler_drain_cb, s);
+    api_breakers_init(s);
+
     s->connections.length = 0;
+
+    if (journal_open(&s->journal, s->conf->cache_path, s->evbase)) {
+        journal_replay(&s->journal, scrobbler_services_mask(s->conf));
+        for (int api = api_lastfm; api < API_TYPE_COUNT; api++) {
+            ledger_open(&s->ledgers[api], s->conf->cache_path, (enum api_type)api, s->evbase);
+        }
+    }
 }
 
-typedef void(*request_builder_t)(struct scrobbler_connection*, const struct scrobble*[MAX_QUEUE_LENGTH], unsigned);
+typedef void(*request_builder_t)(struct scrobbler_connection*, const struct scrobble*[MAX_SCROBBLE_BATCH], unsigned);
 typedef bool(*request_validation_t)(const struct scrobble*, const struct api_credentials*);
 
 static bool scrobble_is_valid(const struct scrobble *m, const struct api_credentials *cur)
@@ -217,52 +383,195 @@ static bool scrobble_is_valid(const struct scrobble *m, const struct api_credent
     }
 }
 
-static void api_request_do(struct scrobbler *s, const struct scrobble *tracks[], const unsigned track_count, const request_validation_t validate_request, const request_builder_t build_request)
+static unsigned api_batch_size(const enum api_type end_point)
 {
-    if (NULL == s) { return; }
-    if (NULL == s->conf || 0 == s->conf->credentials_count) { return; }
+    switch (end_point) {
+        case api_listenbrainz:
+            return MAX_LISTENBRAINZ_BATCH;
+        case api_librefm:
+        case api_lastfm:
+        case api_unknown:
+        default:
+            return MAX_AUDIOSCROBBLER_BATCH;
+    }
+}
 
-    const size_t credentials_count = s->conf->credentials_count;
+/*
+ * A pessimistic estimate of the bytes a track adds to a request body, assuming every character gets escaped.
+ */
+static size_t scrobble_request_size(const struct scrobble *track)
+{
+    size_t size = 256;
+    size += 3 * (strlen(track->title) + strlen(track->album) + strlen(track->mb_track_id[0]));
+    for (int i = 0; i < MAX_PROPERTY_COUNT; i++) {
+        size += 3 * strlen(track->artist[i]);
+    }
+    return size;
+}
 
-    for (size_t i = 0; i < credentials_count; i++) {
-        const struct api_credentials *cur = &s->conf->credentials[i];
-        if (!cur->enabled) continue;
-        if (!credentials_valid(cur)) {
-            _warn("scrobbler::invalid_service[%s]", get_api_type_label(cur->end_point));
-            continue;
+static bool api_request_start(struct scrobbler *s, const struct api_credentials *cur, const struct scrobble *tracks[], const unsigned track_count, const request_builder_t build_request)
+{
+    struct api_breaker *breaker = &s->breakers[cur->end_point];
+    const int idx = scrobbler_connections_free_slot(&s->connections);
+    if (idx < 0) {
+        _warn("scrobbler::new_connection[%s]: too many connections, skipping %u tracks", get_api_type_label(cur->end_point), track_count);
+        return false;
+    }
+
+    struct scrobbler_connection *conn = scrobbler_connection_new();
+    scrobbler_connection_init(conn, s, *cur, idx);
+    // NOTE(marius): the request can be started while handling the changes of a player, which keep their context
+    const struct log_context previous_context = log_context;
+    log_context_request(get_api_type_label(cur->end_point), conn->request_id);
+    build_request(conn, tracks, track_count);
+    // NOTE(marius): the journal ids follow the order of the tracks in the request, so they can be matched with the
+    // status the service returns for each of them
+    for (unsigned ti = 0; ti < track_count; ti++) {
+        arrput(conn->journal_ids, tracks[ti]->journal_id);
+        journal_hold(&s->journal, tracks[ti]->journal_id, cur->end_point);
+        if (conn->type == request_scrobble) {
+            const struct ledger_entry listen = { .fingerprint = scrobble_fingerprint(tracks[ti]), .played = tracks[ti]->start_time, };
+            arrput(conn->listens, listen);
         }
+    }
+    s->connections.entries[conn->idx] = conn;
+    s->connections.length++;
+    _trace("scrobbler::new_connection[%s]: connections: %zu, tracks: %u", get_api_type_label(cur->end_point), s->connections.length, track_count);
+
+    build_curl_request(conn);
+
+    const CURLMcode rc = curl_multi_add_handle(s->handle, conn->handle);
+    if (rc != CURLM_OK) {
+        _warn("curl::add_handle::error: %s", curl_multi_strerror(rc));
+        // NOTE(marius): the request never started, freeing the connection gives its tracks back to the backlog, and
+        //  the breaker isn't left waiting on a probe that doesn't come
+        s->connections.entries[conn->idx] = NULL;
+        s->connections.length--;
+        scrobbler_connection_free(conn, true);
+        log_context = previous_context;
+        return false;
+    }
+    api_breaker_request_started(breaker);
+    log_context = previous_context;
+    return true;
+}
+
+/*
+ * Remembers the tracks of a now playing request that got started, so they're not announced again too soon.
+ */
+static void api_request_started(struct scrobbler *s, const struct api_credentials *cur, const struct scrobble *tracks[], const unsigned track_count, const enum request_type type)
+{
+    if (type != request_now_playing) { return; }
+
+    const time_t now = time(NULL);
+    for (unsigned ti = 0; ti < track_count; ti++) {
+        now_playing_cache_put(&s->now_playing[cur->end_point], tracks[ti], now);
+    }
+}
+
+/*
+ * Tells if the tracks can be submitted to the service right now. It's the only place that checks the pause and the
+ * breaker of the service, the requests for it get started after it.
+ */
+static bool api_service_allows(const struct scrobbler *s, const struct api_credentials *cur, const unsigned track_count)
+{
+    if (!cur->enabled) { return false; }
+    if (!credentials_valid(cur)) {
+        _warn("scrobbler::invalid_service[%s]", get_api_type_label(cur->end_point));
+        return false;
+    }
+    const struct api_breaker *breaker = &s->breakers[cur->end_point];
+    if (breaker->paused) {
+        _debug("scrobbler::paused[%s]: skipping %u tracks", get_api_type_label(cur->end_point), track_count);
+        return false;
+    }
+    if (!api_breaker_allows(breaker)) {
+        // NOTE(marius): the scrobbles stay in the journal until the service is reachable again
+        _debug("scrobbler::breaker_%s[%s]: skipping %u tracks", api_breaker_state_label(breaker->state), get_api_type_label(cur->end_point), track_count);
+        metrics_breaker_skipped(cur->end_point);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The tracks get split into one request for every batch that fits the service's limits.
+ */
+static void api_service_request_do(struct scrobbler *s, const struct api_credentials *cur, const struct scrobble *tracks[], const unsigned track_count, const enum request_type type, const request_validation_t validate_request, const request_builder_t build_request)
+{
+    const time_t now = time(NULL);
 
-        const struct scrobble *current_api_tracks[MAX_QUEUE_LENGTH] = {0};
-        unsigned current_api_track_count = 0;
-        for (size_t ti = 0; ti < track_count; ti++) {
-            const struct scrobble *track = tracks[ti];
-            if (validate_request(track, cur)) {
-                current_api_tracks[current_api_track_count] = track;
-                current_api_track_count++;
+    const unsigned batch_size = api_batch_size(cur->end_point);
+    const struct scrobble *current_api_tracks[MAX_SCROBBLE_BATCH] = {0};
+    unsigned current_api_track_count = 0;
+    size_t current_api_size = 0;
+    unsigned valid_count = 0;
+    unsigned acked_count = 0;
+    unsigned cached_count = 0;
+    for (size_t ti = 0; ti < track_count; ti++) {
+        const struct scrobble *track = tracks[ti];
+        if (NULL != track && journal_is_acked(&s->journal, track->journal_id, cur->end_point)) {
+            // NOTE(marius): the service accepted this track already, before a restart or a failure on another service
+            acked_count++;
+            continue;
+        }
+        if (!validate_request(track, cur)) {
+            if (NULL != track && track->journal_id > 0) {
+                // NOTE(marius): the service would never accept this track, so we don't keep it around waiting for it
+                journal_ack(&s->journal, track->journal_id, cur->end_point, scrobbler_services_mask(s->conf));
             }
+            continue;
+        }
+        if (type == request_scrobble && (ledger_contains(&s->ledgers[cur->end_point], track) || scrobble_batch_contains(tracks, ti, track))) {
+            _debug("scrobbler::duplicate[%s]: %s//%s//%s", get_api_type_label(cur->end_point), track->title, track->artist[0], track->album);
+            metrics_scrobble_duplicate(cur->end_point);
+            // NOTE(marius): the service has this listen already, so it counts as accepted
+            journal_ack(&s->journal, track->journal_id, cur->end_point, scrobbler_services_mask(s->conf));
+            acked_count++;
+            continue;
         }
-        if (current_api_track_count == 0) {
-            _warn("scrobbler::invalid_now_playing[%s]: no valid tracks", get_api_type_label(cur->end_point));
+        if (type == request_now_playing && now_playing_cache_fresh(&s->now_playing[cur->end_point], track, now)) {
+            _debug("scrobbler::now_playing_cached[%s]: %s//%s//%s", get_api_type_label(cur->end_point), track->title, track->artist[0], track->album);
+            metrics_now_playing_cached(cur->end_point);
+            cached_count++;
             continue;
         }
-        assert(s->connections.length < MAX_QUEUE_LENGTH);
-        if (s->connections.length == MAX_QUEUE_LENGTH) {
-            s->connections.length = 0;
+        const size_t track_size = scrobble_request_size(track);
+        if (current_api_track_count > 0 && (current_api_track_count == batch_size || current_api_size + track_size > MAX_BODY_SIZE)) {
+            if (!api_request_start(s, cur, current_api_tracks, current_api_track_count, build_request)) { break; }
+            api_request_started(s, cur, current_api_tracks, current_api_track_count, type);
+            current_api_track_count = 0;
+            current_api_size = 0;
+            // NOTE(marius): a half-open breaker lets a single request through, the rest wait for its outcome
+            if (s->breakers[cur->end_point].probing) { break; }
         }
+        current_api_tracks[current_api_track_count] = track;
+        current_api_track_count++;
+        current_api_size += track_size;
+        valid_count++;
+    }
+    if (valid_count == 0) {
+        if (acked_count > 0 || cached_count > 0) { return; }
+        _warn("scrobbler::invalid_%s[%s]: no valid tracks", metrics_request_type_label(type), get_api_type_label(cur->end_point));
+        return;
+    }
+    if (current_api_track_count > 0 && api_request_start(s, cur, current_api_tracks, current_api_track_count, build_request)) {
+        api_request_started(s, cur, current_api_tracks, current_api_track_count, type);
+    }
+}
 
-        struct scrobbler_connection *conn = scrobbler_connection_new();
-        scrobbler_connection_init(conn, s, *cur, s->connections.length);
-        build_request(conn, current_api_tracks, current_api_track_count);
-        s->connections.entries[conn->idx] = conn;
-        s->connections.length++;
-        _trace("scrobbler::new_connection[%s]: connections: %zu ", get_api_type_label(cur->end_point), s->connections.length);
-
-        build_curl_request(conn);
+/*
+ * The tracks get submitted to every service that can take them.
+ */
+static void api_request_do(struct scrobbler *s, const struct scrobble *tracks[], const unsigned track_count, const enum request_type type, const request_validation_t validate_request, const request_builder_t build_request)
+{
+    if (NULL == s) { return; }
+    if (NULL == s->conf || 0 == s->conf->credentials_count) { return; }
 
-        const CURLMcode rc = curl_multi_add_handle(s->handle, conn->handle);
-        if (rc != CURLM_OK) {
-            _warn("curl::add_handle::error: %s", curl_multi_strerror(rc));
-        }
+    for (size_t i = 0; i < s->conf->credentials_count; i++) {
+        const struct api_credentials *cur = &s->conf->credentials[i];
+        if (!api_service_allows(s, cur, track_count)) { continue; }
+        api_service_request_do(s, cur, tracks, track_count, type, validate_request, build_request);
     }
 }
 
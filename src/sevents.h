@@ -7,7 +7,7 @@
 #include <pthread.h>
 #include <event2/thread.h>
 
-static void send_now_playing(evutil_socket_t, short, void *);
+static void send_now_playing(void *);
 void events_free(const struct events *ev)
 {
     if (NULL == ev) { return; }
@@ -17,6 +17,9 @@ void events_free(const struct events *ev)
     event_free(ev->sigterm);
     _trace2("mem::free::event(%p):SIGHUP", ev->sighup);
     event_free(ev->sighup);
+    _trace2("mem::free::event(%p):SIGUSR1", ev->sigusr1);
+    event_free(ev->sigusr1);
+    log_stop_deferring_flush();
     _trace2("mem::free::event_base(%p)", ev->base);
     event_base_free(ev->base);
 }
@@ -72,6 +75,7 @@ void events_init(struct events *ev, struct state *s)
     }
 
     _trace2("mem::inited_libevent(%p)", ev->base);
+    log_defer_flush(ev->base);
     ev->sigint = evsignal_new(ev->base, SIGINT, sighandler, s);
     if (NULL == ev->sigint || event_add(ev->sigint, NULL) < 0) {
         _error("mem::add_event(SIGINT): failed");
@@ -87,32 +91,38 @@ void events_init(struct events *ev, struct state *s)
         _error("mem::add_event(SIGHUP): failed");
         return;
     }
+    ev->sigusr1 = evsignal_new(ev->base, SIGUSR1, loop_profiler_toggle, s);
+    if (NULL == ev->sigusr1 || event_add(ev->sigusr1, NULL) < 0) {
+        _error("mem::add_event(SIGUSR1): failed");
+        return;
+    }
 }
 
-static void send_now_playing(evutil_socket_t fd, short event, void *data)
+static void send_now_playing(void *data)
 {
     assert(data);
     struct event_payload *state = data;
 
+    loop_profiler_timer_fired(loop_probe_now_playing, state->deadline);
+    const double start = loop_profiler_start();
+
     struct scrobble *track = &state->scrobble;
     assert(track);
     if (scrobble_is_empty(track)) {
         _debug("events::now_playing: invalid scrobble %p", track);
-        return;
+        goto _exit;
     }
 
     if (track->position > (double)track->length) {
         _trace2("events::now_playing: track position out of bounds %d > %ld", track->position, (double)track->length);
-        event_del(&state->event);
-        return;
+        goto _exit;
     }
 
     struct mpris_player *player = state->parent;
     assert(player);
     if (!mpris_player_is_valid(player)) {
         _debug("events::now_playing: invalid player %s", player->mpris_name);
-        event_del(&state->event);
-        return;
+        goto _exit;
     }
 
     struct scrobbler *scrobbler = player->scrobbler;
@@ -124,11 +134,13 @@ static void send_now_playing(evutil_socket_t fd, short event, void *data)
     const struct scrobble *tracks[1] = {track};
     _info("scrobbler::now_playing[%s]: %s//%s//%s", player->name, track->title, track->artist[0], track->album);
     // TODO(marius): this requires the number of tracks to be passed down, to avoid dependency on arrlen
-    api_request_do(scrobbler, tracks, 1, now_playing_is_valid, api_build_request_now_playing);
+    api_request_do(scrobbler, tracks, 1, request_now_playing, now_playing_is_valid, api_build_request_now_playing);
 
     if (track->position + NOW_PLAYING_DELAY < track->length) {
         add_event_now_playing(player, track, NOW_PLAYING_DELAY);
     }
+_exit:
+    loop_profiler_end(loop_probe_now_playing, start);
 }
 
 static bool add_event_now_playing(struct mpris_player *player, const struct scrobble *track, const time_t delay)
@@ -145,57 +157,95 @@ static bool add_event_now_playing(struct mpris_player *player, const struct scro
         return false;
     }
 
-    const struct timeval now_playing_tv = { .tv_sec = delay };
+    if (NULL == player->timers) {
+        _warn("events::add_event_failed:now_playing[%s]: no timers", player->name);
+        return false;
+    }
 
     struct event_payload *payload = &player->now_playing;
     scrobble_copy(&payload->scrobble, track);
 
-    if (event_initialized(&payload->event)) {
-        event_del(&payload->event);
-    }
-    event_assign(&payload->event, player->evbase, -1, EV_TIMEOUT, send_now_playing, payload);
-    if (!event_initialized(&payload->event)) {
-        _warn("events::add_event_failed(%p):now_playing", &payload->event);
-        return false;
-    }
-
-    _debug("events::add_event:now_playing[%s] in %2.2lfs, elapsed %2.2lfs", player->name, timeval_to_seconds(now_playing_tv), (double)track->position);
-    event_add(&payload->event, &now_playing_tv);
+    _debug("events::add_event:now_playing[%s] in %2.2lfs, elapsed %2.2lfs", player->name, (double)delay, (double)track->position);
+    payload->deadline = timer_wheel_add(player->timers, &payload->timer, (double)delay, send_now_playing, payload, playback_clock_now());
     payload->scrobble.position += (double)delay;
     payload->scrobble.play_time += (double)delay;
 
     return true;
 }
 
-static void queue(evutil_socket_t fd, short event, void *data)
+static void queue(void *data)
 {
     assert (data);
     struct event_payload *state = data;
 
+    loop_profiler_timer_fired(loop_probe_queue, state->deadline);
+    const double start = loop_profiler_start();
+
     struct mpris_player *player = state->parent;
     if (NULL == player) {
         _debug("events::queue: invalid player %p", player);
-        return;
+        goto _exit;
     }
 
     struct scrobbler *scrobbler = player->scrobbler;
     if (NULL == scrobbler) {
         _debug("events::queue: invalid scrobbler %p", scrobbler);
-        return;
+        goto _exit;
     }
 
-    const struct scrobble *scrobble = &state->scrobble;
+    struct scrobble *scrobble = &state->scrobble;
     assert(NULL != scrobble && !scrobble_is_empty(scrobble));
     //print_scrobble(scrobble, log_tracing);
 
+    // NOTE(marius): the timer is only as good as the clock was when it got added, the track needs to be listened to
+    //  for long enough now, and only once per play
+    struct playback_clock *clock = &player->clock;
+    const double now = playback_clock_now();
+    const double remaining = playback_clock_until(clock, min_scrobble_delay_seconds(scrobble), now);
+    if (remaining < 0) {
+        _debug("events::queue[%s]: skipping, the track is %s", player->name, clock->queued ? "already queued" : "not playing");
+        goto _exit;
+    }
+    if (remaining > PLAYBACK_CLOCK_TOLERANCE_SECONDS) {
+        mpris_player_schedule_queue(player);
+        goto _exit;
+    }
+    clock->queued = true;
+    scrobble->play_time = playback_clock_listened(clock, now);
+    scrobble->position = playback_clock_position(clock, now);
+
     _trace("events::triggered(%p:%p):queue", state, scrobbler->queue);
     scrobbles_append(scrobbler, scrobble);
 
-    int queue_count = scrobbler->queue.length;
-    if (queue_count > 0) {
-        queue_count -= (int)scrobbler_consume_queue(scrobbler);
-        _debug("events::new_queue_length: %zu", queue_count);
+    if (scrobbler_backlog_length(scrobbler) > 0) {
+        scrobbler_consume_queue(scrobbler);
+        _debug("events::new_queue_length: %zu", scrobbler_backlog_length(scrobbler));
+    }
+_exit:
+    loop_profiler_end(loop_probe_queue, start);
+}
+
+/*
+ * Adds the event that puts the track of the player in the queue, at the moment its clock reaches the time the track
+ * needs to be listened to. It gets added again every time the clock changes pace, and removed while it's stopped.
+ */
+static bool mpris_player_schedule_queue(struct mpris_player *player)
+{
+    struct event_payload *payload = &player->queue;
+    if (scrobble_is_empty(&payload->scrobble) || NULL == player->timers) { return false; }
+
+    timer_wheel_remove(player->timers, &payload->timer);
+    const double now = playback_clock_now();
+    const double delay = playback_clock_until(&player->clock, min_scrobble_delay_seconds(&payload->scrobble), now);
+    if (delay < 0) {
+        _trace("events::add_event:queue[%s]: skipping, the track is %s", player->name, player->clock.queued ? "already queued" : "not playing");
+        return false;
     }
+
+    _debug("events::add_event:queue[%s] in %2.2lfs", player->name, delay);
+    payload->deadline = timer_wheel_add(player->timers, &payload->timer, delay, queue, payload, now);
+
+    return true;
 }
 
 static bool add_event_queue(struct mpris_player *player, const struct scrobble *track)
@@ -213,24 +263,8 @@ static bool add_event_queue(struct mpris_player *player, const struct scrobble *
 
     assert(!scrobble_is_empty(track));
 
-    if (event_initialized(&payload->event)) {
-        event_del(&payload->event);
-    }
-    event_assign(&payload->event, player->evbase, -1, EV_TIMEOUT, queue, payload);
-    if (!event_initialized(&payload->event)) {
-        _warn("events::add_event_failed(%p):queue", &payload->event);
-    }
-
     // This is the event that adds a scrobble to the queue after the correct amount of time
-    // round to the second
-    const struct timeval timer = {
-        .tv_sec = (time_t)(min_scrobble_delay_seconds(track)/1),
-    };
-
-    _debug("events::add_event:queue[%s] in %2.2lfs", player->name, timeval_to_seconds(timer));
-    event_add(&payload->event, &timer);
-
-    return true;
+    return mpris_player_schedule_queue(player);
 }
 
 #if 0
@@ -288,23 +322,56 @@ static bool state_player_is_valid(struct mpris_player *player)
 static bool state_is_valid(struct state *state) {
     return (
         (NULL != state) &&
-        (state->player_count > 0)/* && state_player_is_valid(state->player)*/ &&
+        (mpris_players_count(&state->players) > 0)/* && state_player_is_valid(state->player)*/ &&
         (NULL != state->dbus) && state_dbus_is_valid(state->dbus)
     );
 }
 
-void resend_now_playing (struct state *state)
+static struct configuration_diff reload_configuration(struct configuration *);
+/*
+ * Loads the configuration again and applies what changed: only the services and the players the changes affect
+ * are touched, the requests in flight and the queued scrobbles carry on.
+ */
+struct configuration_diff reload_state(struct state *state)
 {
-    if (!state_is_valid(state)) {
-        _error("events::invalid_state");
-        return;
+    struct configuration_diff diff = reload_configuration(state->config);
+
+    struct scrobbler *scrobbler = &state->scrobbler;
+    for (int end_point = api_lastfm; end_point < API_TYPE_COUNT; end_point++) {
+        if ((diff.services & (1U << (unsigned)end_point)) == 0) { continue; }
+
+        _info("scrobbler::reload[%s]: credentials changed", get_api_type_label((enum api_type)end_point));
+        // NOTE(marius): the old credentials could have been the reason the breaker opened
+        api_breaker_success(&scrobbler->breakers[end_point]);
+    }
+    if (diff.services > 0) {
+        scrobbler_schedule_drain(scrobbler);
+    }
+
+    for (size_t i = 0; i < mpris_players_count(&state->players); i++) {
+        struct mpris_player *player = state->players.entries[i];
+        if (diff.debounce) {
+            mpris_player_set_debounce(player, state->config->debounce_ms);
+        }
+        if (!diff.ignore_players) { continue; }
+
+        const bool ignored = mpris_player_is_ignored(state->config, player);
+        if (ignored == player->ignored) { continue; }
+
+        player->ignored = ignored;
+        if (ignored) {
+            _info("mpris_player::reload[%s]: ignored", player->mpris_name);
+            dbus_player_remove_match(state->dbus, player);
+            mpris_player_detach(player);
+        } else {
+            _info("mpris_player::reload[%s]: not ignored anymore", player->mpris_name);
+            mpris_player_attach(state, player);
+        }
     }
-    // NOTE(marius): cancel any pending connections
-    scrobbler_connections_clean(&state->scrobbler.connections, true);
-    for (int i = 0; i < state->player_count; i++) {
-        struct mpris_player *player = &state->players[i];
-        check_player(player);
+    if (diff.debounce) {
+        _info("mpris_player::reload: debounce %ums", state->config->debounce_ms);
     }
+    return diff;
 }
 
 #endif // MPRIS_SCROBBLER_SEVENTS_H
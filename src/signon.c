@@ -16,13 +16,24 @@
 #include "structs.h"
 #include "sstrings.h"
 #include "utils.h"
+#include "metrics.h"
+#include "profiler.h"
 #include "api.h"
 #include "smpris.h"
+#include "mpris_players.h"
+#include "scrobble_arena.h"
+#include "journal.h"
+#include "ledger.h"
+#include "now_playing_cache.h"
 #include "scrobbler.h"
+#include "playback_clock.h"
+#include "timer_wheel.h"
 #include "scrobble.h"
 #include "sdbus.h"
 #include "sevents.h"
 #include "configuration.h"
+#include "watcher.h"
+#include "control.h"
 
 #define HELP_MESSAGE        "MPRIS scrobbler user signon, version %s\n\n" \
 "Usage:\n %s COMMAND SERVICE - Execute COMMAND for SERVICE\n\n" \
@@ -52,6 +63,19 @@ static void print_help(const char *name)
 char *get_pid_file(struct configuration *);
 static void reload_daemon(struct configuration *config)
 {
+    load_control_path(config);
+    char reply[MAX_PROPERTY_LENGTH + 1] = {0};
+    if (control_request(config->control_path, CONTROL_COMMAND_RELOAD, reply, sizeof(reply))) {
+        if (strncmp(reply, CONTROL_REPLY_OK, strlen(CONTROL_REPLY_OK)) == 0) {
+            _info("signon::daemon_reload: ok");
+        } else {
+            reply[strcspn(reply, "\n")] = '\0';
+            _warn("signon::daemon_reload: %s", reply);
+        }
+        return;
+    }
+
+    // NOTE(marius): an older daemon, without a control socket
     load_pid_path(config);
     FILE *pid_file = fopen(config->pid_path, "r");
     if (NULL == pid_file) {
@@ -79,7 +103,7 @@ static enum api_return_status request_call(struct scrobbler_connection *conn)
         _error("curl::error: %s", curl_easy_strerror(cres));
     }
     curl_easy_getinfo(conn->handle, CURLINFO_RESPONSE_CODE, &conn->response.code);
-    _trace("curl::response(%lu): %s", conn->response.body_length, &conn->response.body);
+    _trace("curl::response(%lu): %s", conn->response.body.length, http_buffer_data(&conn->response.body));
 
     if (conn->response.code == 200) { ok = status_ok; }
     return ok;
@@ -104,8 +128,8 @@ static void get_session(struct api_credentials *creds)
     build_curl_request(conn);
 
     const enum api_return_status ok = request_call(conn);
-    if (ok == status_ok && !json_document_is_error(conn->response.body, conn->response.body_length, creds->end_point)) {
-        api_response_get_session_key_json(conn->response.body, conn->response.body_length, creds);
+    if (ok == status_ok && !json_document_is_error(conn->response.json, creds->end_point)) {
+        api_response_get_session_key_json(conn->response.json, creds);
         if (strlen(creds->session_key) > 0) {
             _info("api::get_session[%s] %s", get_api_type_label(creds->end_point), "ok");
             creds->enabled = true;
@@ -142,9 +166,9 @@ static bool get_token(struct api_credentials *creds)
 
     const enum api_return_status ok = request_call(conn);
 
-    if (ok == status_ok && !json_document_is_error(conn->response.body, conn->response.body_length, creds->end_point)) {
+    if (ok == status_ok && !json_document_is_error(conn->response.json, creds->end_point)) {
         api_credentials_disable(creds);
-        api_response_get_token_json(conn->response.body, conn->response.body_length, creds);
+        api_response_get_token_json(conn->response.json, creds);
     }
 
     CURLU *auth_url = curl_url();
@@ -326,6 +350,8 @@ int main (const int argc, char *argv[])
     }
 
     configuration_clean(&config);
+    scrobbler_connection_pool_clean();
+    http_buffer_pool_clean();
 
 _exit:
     return status;
@@ -129,4 +129,9 @@ static bool mpris_event_changed_position(const struct mpris_event *ev)
     return ev->loaded_state & mpris_load_property_position;
 }
 
+static bool mpris_event_changed_rate(const struct mpris_event *ev)
+{
+    return ev->loaded_state & mpris_load_property_rate;
+}
+
 #endif // MPRIS_SCROBBLER_SMPRIS_H
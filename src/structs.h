@@ -5,6 +5,7 @@
 #define MPRIS_SCROBBLER_STRUCTS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <curl/multi.h>
 #include <dbus/dbus.h>
 #include <event2/event_struct.h>
@@ -67,6 +68,7 @@ enum api_type {
     api_librefm,
     api_listenbrainz,
 };
+#define API_TYPE_COUNT (api_listenbrainz + 1)
 
 #define MAX_SECRET_LENGTH 128
 #define USER_NAME_MAX 32
@@ -97,19 +99,32 @@ struct env_variables {
     const char user_name[USER_NAME_MAX + 1];
 };
 
-#define MAX_PLAYERS 10
+#define MAX_IGNORED_PLAYERS 10
+// NOTE(marius): the window in which the PropertiesChanged signals of a player get merged, in milliseconds
+#define DEFAULT_DEBOUNCE_MS 100
+#define MAX_DEBOUNCE_MS 1000
 #define MAX_CREDENTIALS 10
 
+// NOTE(marius): what changed between two loads of the configuration, services is a mask of enum api_type bits
+struct configuration_diff {
+    unsigned services;
+    bool ignore_players;
+    bool debounce;
+};
+
 struct configuration {
     const char name[USER_NAME_MAX+1];
     const char pid_path[FILE_PATH_MAX+1];
+    const char metrics_path[FILE_PATH_MAX+1];
+    const char control_path[FILE_PATH_MAX+1];
     const char config_path[FILE_PATH_MAX+1];
     const char credentials_path[FILE_PATH_MAX+1];
     const char cache_path[FILE_PATH_MAX+1];
-    const char ignore_players[MAX_PLAYERS][MAX_PROPERTY_LENGTH+1];
+    const char ignore_players[MAX_IGNORED_PLAYERS][MAX_PROPERTY_LENGTH+1];
     struct api_credentials credentials[MAX_CREDENTIALS];
     struct env_variables env;
     size_t credentials_count;
+    unsigned debounce_ms;
     bool wrote_pid;
     bool env_loaded;
     short ignore_players_count;
@@ -141,6 +156,7 @@ struct mpris_metadata {
 struct mpris_properties {
     struct mpris_metadata metadata;
     double volume;
+    double rate;
     int64_t position;
     bool can_control;
     bool can_go_next;
@@ -159,10 +175,16 @@ struct events {
     struct event *sigint;
     struct event *sigterm;
     struct event *sighup;
+    struct event *sigusr1;
     struct event dispatch;
 };
 
+#define SCROBBLE_STRING_FIELDS 5
+#define SCROBBLE_STRING_LISTS 5
+#define SCROBBLE_STRING_COUNT (SCROBBLE_STRING_FIELDS + SCROBBLE_STRING_LISTS * MAX_PROPERTY_COUNT)
+
 struct scrobble {
+    uint64_t journal_id;
     double play_time;
     double position;
     double length;
@@ -171,17 +193,25 @@ struct scrobble {
     bool scrobbled;
     unsigned short track_number;
 
-    char url[MAX_PROPERTY_LENGTH+1];
-    char title[MAX_PROPERTY_LENGTH+1];
-    char album[MAX_PROPERTY_LENGTH+1];
-    char artist[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
-
-    char mb_track_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1]; //music brainz specific
-    char mb_album_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
-    char mb_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
-    char mb_album_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
-    char player_name[MAX_PROPERTY_LENGTH+1];
-    char mb_spotify_id[MAX_PROPERTY_LENGTH+1]; // spotify id for listenbrainz
+    // NOTE(marius): the strings are views into the arena, see scrobble_arena.h
+    char *arena;
+    size_t arena_size;
+    union {
+        struct {
+            const char *url;
+            const char *title;
+            const char *album;
+            const char *player_name;
+            const char *mb_spotify_id; // spotify id for listenbrainz
+
+            const char *artist[MAX_PROPERTY_COUNT];
+            const char *mb_track_id[MAX_PROPERTY_COUNT]; //music brainz specific
+            const char *mb_album_id[MAX_PROPERTY_COUNT];
+            const char *mb_artist_id[MAX_PROPERTY_COUNT];
+            const char *mb_album_artist_id[MAX_PROPERTY_COUNT];
+        };
+        const char *strings[SCROBBLE_STRING_COUNT];
+    };
 };
 
 enum playback_state {
@@ -221,6 +251,7 @@ enum mpris_load_types {
     mpris_load_metadata_mb_album_id = 1U << 24U,
     mpris_load_metadata_mb_artist_id = 1U << 25U,
     mpris_load_metadata_mb_album_artist_id = 1U << 26U,
+    mpris_load_property_rate = 1U << 27U,
     mpris_load_all = (1U << 31U) - 1, // all bits are set for our max enum val
 };
 
@@ -241,26 +272,89 @@ struct dbus {
     DBusTimeout *timeout;
 };
 
+// NOTE(marius): a deadline on the timer wheel of the state, see timer_wheel.h
+struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry **pprev; // NULL while the entry is not on the wheel
+    uint64_t expires; // in ticks of the wheel
+    void (*callback)(void *);
+    void *data;
+};
+
+#define TIMER_WHEEL_LEVELS 3
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+
+struct timer_wheel {
+    struct event_base *base;
+    struct event event;
+    double origin; // the start of the first tick, on the monotonic clock
+    uint64_t current; // the last tick that ran
+    uint64_t wakeup; // the tick the event was added for, 0 when it's not added
+    size_t count;
+    bool running;
+    struct timer_entry *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
 struct event_payload {
     struct mpris_player *parent;
     struct scrobble scrobble;
-    struct event event;
+    struct timer_entry timer;
+    // NOTE(marius): when the timer should fire, on the monotonic clock
+    double deadline;
 };
 
 #define MAX_HEADER_LENGTH               256
 #define MAX_HEADER_NAME_LENGTH          128
 #define MAX_HEADER_VALUE_LENGTH         512
-#define MAX_BODY_SIZE                   16384
+#define MAX_BODY_SIZE                   65536
+#define HTTP_BUFFER_CHUNK_SIZE          4096
 
 struct http_header {
     char name[MAX_HEADER_NAME_LENGTH];
     char value[MAX_HEADER_VALUE_LENGTH];
 };
 
+struct http_buffer_chunk {
+    struct http_buffer_chunk *next;
+    size_t capacity;
+    size_t length;
+    char data[];
+};
+
+struct http_buffer {
+    struct http_buffer_chunk *head;
+    struct http_buffer_chunk *tail;
+    size_t length;
+};
+
+// NOTE(marius): it fits the endpoint of a request and the headers of a common response
+#define HTTP_ARENA_BLOCK_SIZE           16384
+
+struct http_arena_block {
+    struct http_arena_block *next;
+    size_t capacity;
+    size_t used;
+    max_align_t data[];
+};
+
+struct http_arena {
+    struct http_arena_block *head;
+    struct http_arena_block *current;
+};
+
+struct json_tokener;
+struct json_object;
+
 struct http_response {
-    char body[MAX_BODY_SIZE+1];
+    struct http_buffer body;
     struct http_header **headers;
-    size_t body_length;
+    // NOTE(marius): the arena of the connection the response belongs to, if any, it holds the headers
+    struct http_arena *arena;
+    // NOTE(marius): JSON bodies are parsed as their chunks arrive
+    struct json_tokener *tokener;
+    struct json_object *json;
+    bool json_failed;
     long code;
 };
 
@@ -273,9 +367,10 @@ typedef enum http_request_types {
 } http_request_type;
 
 struct http_request {
-    char body[MAX_BODY_SIZE+1];
+    struct http_buffer body;
     struct http_header **headers;
-    size_t body_length;
+    // NOTE(marius): the arena of the connection the request belongs to, if any, it holds the headers and the endpoint
+    struct http_arena *arena;
     time_t time;
     struct api_endpoint *end_point;
     CURLU *url;
@@ -285,67 +380,270 @@ struct http_request {
 struct scrobbler_connection {
     char error[CURL_ERROR_SIZE+1];
     struct api_credentials credentials;
-#ifdef RETRY_ENABLED
-    struct event retry_event;
-#endif
     struct scrobbler *parent;
-    struct curl_slist **headers;
+    struct curl_slist *headers;
+    struct http_arena arena;
     struct http_request request;
     struct http_response response;
     CURL *handle;
+    uint64_t *journal_ids;
+    struct ledger_entry *listens;
+    size_t request_id;
     bool should_free;
     int idx;
     enum request_type type;
-#ifdef RETRY_ENABLED
-    int retries;
-#endif
 };
 
 #define MAX_QUEUE_LENGTH 32
+#define MAX_CONNECTIONS 32
 #define MAX_WAIT_SECONDS 10
 
+// NOTE(marius): Last.fm and Libre.fm accept at most 50 scrobbles in one request
+#define MAX_AUDIOSCROBBLER_BATCH 50
+#define MAX_LISTENBRAINZ_BATCH 100
+#define MAX_SCROBBLE_BATCH MAX_LISTENBRAINZ_BATCH
+
 struct scrobble_connections {
     int length;
-    struct scrobbler_connection *entries[MAX_QUEUE_LENGTH];
+    struct scrobbler_connection *entries[MAX_CONNECTIONS];
 };
 
 struct scrobble_queue {
     int length;
     struct scrobble entries[MAX_QUEUE_LENGTH];
+    struct scrobble *overflow; // the scrobbles that found the queue full and couldn't be journaled either
+};
+
+struct journal_entry {
+    uint64_t id;
+    off_t offset; // position of the append record in the journal file
+    unsigned acked; // bitmask of the api_types that accepted the scrobble
+    unsigned in_flight; // bitmask of the api_types currently submitting the scrobble
+    uint8_t rejections[API_TYPE_COUNT]; // number of the responses of every api_type that didn't accept the scrobble
+    bool queued; // the scrobble is loaded in the in-memory queue
+    bool removed; // all the services accepted the scrobble, the entry goes away when the index gets pruned
+};
+
+struct scrobble_journal {
+    int fd;
+    unsigned unsynced;
+    uint64_t next_id;
+    off_t size;
+    size_t record_count;
+    struct journal_entry *live; // sorted by id, at most JOURNAL_MAX_INDEXED of them
+    size_t removed; // number of the removed entries still in live
+    size_t spilled; // number of the spilled entries in live
+    size_t cold; // number of the scrobbles left on disk, newer than the ones in live
+    off_t cold_offset; // position of the append record of the oldest one of those
+    int error; // errno of the last failed write
+    uint64_t cursors[API_TYPE_COUNT]; // the id of the oldest entry every api_type might still need
+    struct event sync_event;
+    struct event compact_event;
+    char path[FILE_PATH_MAX+1];
+};
+
+// NOTE(marius): a listen a service accepted, see ledger.h
+struct ledger_entry {
+    uint64_t fingerprint;
+    int64_t played; // the start time of the listen
+};
+
+struct scrobble_ledger {
+    struct ledger_entry *slots;
+    size_t capacity;
+    size_t count;
+    bool dirty;
+    struct event save_event;
+    char path[FILE_PATH_MAX+1];
+};
+
+// NOTE(marius): the easy handles of the finished requests, kept per service so the next request to it can reuse
+// their connection, DNS entries and TLS session
+#define MAX_IDLE_HANDLES 4
+
+struct http_handle_pool {
+    CURL *idle[API_TYPE_COUNT][MAX_IDLE_HANDLES];
+    unsigned idle_count[API_TYPE_COUNT];
+};
+
+struct http_stats {
+    size_t requests;
+    size_t handles_created;
+    size_t handles_reused;
+    size_t connections_created;
+    size_t connections_reused;
+};
+
+enum api_breaker_state {
+    breaker_closed = 0,
+    breaker_open,
+    breaker_half_open,
+};
+
+struct api_breaker {
+    struct event retry_event;
+    struct scrobbler *parent;
+    enum api_type end_point;
+    enum api_breaker_state state;
+    unsigned failures;
+    bool probing;
+    bool paused;
+};
+
+// NOTE(marius): the track a service was last told is playing, see now_playing_cache.h
+struct now_playing_cache {
+    uint32_t hash;
+    time_t expires;
 };
 
 struct scrobbler {
     int still_running;
     CURLM *handle;
+    CURLSH *share;
+    struct http_handle_pool pool;
+    struct http_stats stats;
+    struct api_breaker breakers[API_TYPE_COUNT];
+    struct now_playing_cache now_playing[API_TYPE_COUNT];
     struct event_base *evbase;
     struct configuration *conf;
     struct event timer_event;
+    struct event drain_event;
     struct scrobble_connections connections;
     struct scrobble_queue queue;
+    struct scrobble_journal journal;
+    struct scrobble_ledger ledgers[API_TYPE_COUNT];
+};
+
+// NOTE(marius): how much of its current track the player played, see playback_clock.h
+struct playback_clock {
+    double listened; // seconds, until updated
+    double position; // seconds into the track, at updated
+    double updated; // on the monotonic clock
+    double rate;
+    time_t started;
+    bool running;
+    bool queued; // the current play of the track was already queued
 };
 
 struct mpris_player {
     bool ignored;
     bool deleted;
+    // NOTE(marius): the bus sends us the PropertiesChanged signals of the player, see dbus_player_add_match()
+    bool matched;
     char mpris_name[MAX_PROPERTY_LENGTH + 1];
     char bus_id[MAX_PROPERTY_LENGTH + 1];
     char name[MAX_PROPERTY_LENGTH + 1];
     struct mpris_event changed;
     struct mpris_properties properties;
+    struct playback_clock clock;
     struct event_payload now_playing;
     struct event_payload queue;
+    struct event debounce_event;
+    struct timeval debounce;
     struct scrobbler *scrobbler;
     struct event_base *evbase;
+    struct timer_wheel *timers;
     struct mpris_properties **history;
 };
 
+struct mpris_player_slot {
+    uint32_t hash;
+    const char *key; // points into the player, which doesn't move until it's removed
+    struct mpris_player *player;
+};
+
+// NOTE(marius): open addressing with linear probing, capacity is zero or a power of two
+struct mpris_player_index {
+    size_t capacity;
+    size_t count;
+    struct mpris_player_slot *slots;
+};
+
+struct mpris_players {
+    struct mpris_player **entries; // stb_ds array of heap allocated players
+    struct mpris_player_index by_bus_id;
+    struct mpris_player_index by_name;
+};
+
+#define REQUEST_TYPE_COUNT (request_scrobble + 1)
+#define METRICS_MAX_PLAYERS 32
+#define METRICS_LATENCY_BUCKETS 14
+
+enum metrics_http_phase {
+    metrics_phase_total = 0,
+    metrics_phase_connect,
+    metrics_phase_tls,
+};
+#define METRICS_HTTP_PHASES (metrics_phase_tls + 1)
+
+struct metrics_histogram {
+    // NOTE(marius): the last bucket is +Inf, the counts get accumulated only when they are exposed
+    uint64_t buckets[METRICS_LATENCY_BUCKETS + 1];
+    uint64_t count;
+    double sum;
+};
+
+struct metrics_player {
+    char name[MAX_PROPERTY_LENGTH + 1];
+    uint64_t signals;
+};
+
+enum loop_probe {
+    loop_probe_dbus_dispatch = 0,
+    loop_probe_dbus_filter,
+    loop_probe_curl_socket,
+    loop_probe_curl_timer,
+    loop_probe_now_playing,
+    loop_probe_queue,
+    loop_probe_debounce,
+};
+#define LOOP_PROBE_COUNT (loop_probe_debounce + 1)
+
+struct loop_probe_stats {
+    struct metrics_histogram duration;
+    struct metrics_histogram lateness;
+    double max_duration;
+    uint64_t slow;
+};
+
+struct metrics {
+    struct metrics_player players[METRICS_MAX_PLAYERS];
+    size_t player_count;
+    uint64_t other_player_signals;
+    uint64_t loaded_properties;
+    uint64_t requests[API_TYPE_COUNT][REQUEST_TYPE_COUNT][2];
+    uint64_t breaker_opened[API_TYPE_COUNT];
+    uint64_t breaker_skipped[API_TYPE_COUNT];
+    uint64_t now_playing_cached[API_TYPE_COUNT];
+    uint64_t scrobbles_duplicate[API_TYPE_COUNT];
+    struct metrics_histogram http_duration[API_TYPE_COUNT][METRICS_HTTP_PHASES];
+    struct loop_probe_stats loop[LOOP_PROBE_COUNT];
+    bool loop_profiling;
+};
+
+struct socket_server {
+    struct evconnlistener *listener;
+    char path[FILE_PATH_MAX + 1];
+};
+
+struct config_watch {
+    struct event *read_event;
+    struct event reload_event;
+    int fd;
+    int config_wd;
+    int credentials_wd;
+};
+
 struct state {
     struct dbus *dbus;
     struct configuration *config;
     struct events events;
+    struct timer_wheel timers;
     struct scrobbler scrobbler;
-    short player_count;
-    struct mpris_player players[MAX_PLAYERS];
+    struct mpris_players players;
+    struct socket_server metrics;
+    struct socket_server control;
+    struct config_watch watch;
 };
 
 enum log_levels
@@ -0,0 +1,260 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_TIMER_WHEEL_H
+#define MPRIS_SCROBBLER_TIMER_WHEEL_H
+
+/*
+ * The now playing and queue deadlines of all the players share one libevent timer, through a hierarchical timer wheel
+ * owned by the state.
+ * Time is counted in ticks, and the deadlines that fall in the same tick fire together with one wakeup. A deadline is
+ * rounded up to the end of its tick, so it never fires early. The first level of the wheel has a slot for each of the
+ * next TIMER_WHEEL_SLOTS ticks, every level above it has slots TIMER_WHEEL_SLOTS times as wide, and their entries get
+ * moved down a level when the wheel reaches them. Adding and removing an entry only links or unlinks it from its slot.
+ * The libevent timer is added for the earliest tick that has something to do, it's only touched when an entry is due
+ * before it, and after the wheel ran.
+ */
+
+#define TIMER_WHEEL_TICK_SECONDS 0.1
+// NOTE(marius): libevent rounds its timeouts, a wakeup that comes this early still runs its tick
+#define TIMER_WHEEL_SLACK_SECONDS 0.001
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))
+
+static uint64_t timer_wheel_tick(const struct timer_wheel *wheel, const double now)
+{
+    const double elapsed = now - wheel->origin + TIMER_WHEEL_SLACK_SECONDS;
+    return elapsed > 0 ? (uint64_t)(elapsed / TIMER_WHEEL_TICK_SECONDS) : 0;
+}
+
+static double timer_wheel_tick_time(const struct timer_wheel *wheel, const uint64_t tick)
+{
+    return wheel->origin + (double)tick * TIMER_WHEEL_TICK_SECONDS;
+}
+
+static bool timer_entry_pending(const struct timer_entry *entry)
+{
+    return NULL != entry->pprev;
+}
+
+static void timer_wheel_link(struct timer_wheel *wheel, struct timer_entry *entry)
+{
+    const uint64_t delta = entry->expires > wheel->current ? entry->expires - wheel->current : 0;
+    // NOTE(marius): the entries past the span of the wheel wait in its last slot, and get linked again from there
+    const uint64_t expires = delta < TIMER_WHEEL_SPAN ? wheel->current + delta : wheel->current + TIMER_WHEEL_SPAN - 1;
+
+    unsigned level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TIMER_WHEEL_BITS))) {
+        level++;
+    }
+    struct timer_entry **slot = &wheel->slots[level][(expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+
+    entry->next = *slot;
+    if (NULL != entry->next) {
+        entry->next->pprev = &entry->next;
+    }
+    entry->pprev = slot;
+    *slot = entry;
+}
+
+static void timer_wheel_unlink(struct timer_entry *entry)
+{
+    *entry->pprev = entry->next;
+    if (NULL != entry->next) {
+        entry->next->pprev = entry->pprev;
+    }
+    entry->next = NULL;
+    entry->pprev = NULL;
+}
+
+/*
+ * Returns the earliest tick the wheel has something to do at, or 0 if it's empty.
+ * For the levels above the first one that's the tick when their entries get moved down.
+ */
+static uint64_t timer_wheel_next_tick(const struct timer_wheel *wheel)
+{
+    if (wheel->count == 0) { return 0; }
+
+    uint64_t next = 0;
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        const unsigned shift = level * TIMER_WHEEL_BITS;
+        for (uint64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+            const uint64_t index = (wheel->current >> shift) + i;
+            if (NULL == wheel->slots[level][index & TIMER_WHEEL_MASK]) { continue; }
+
+            const uint64_t tick = index << shift;
+            if (next == 0 || tick < next) {
+                next = tick;
+            }
+            break;
+        }
+    }
+    return next;
+}
+
+static void timer_wheel_arm_at(struct timer_wheel *wheel, const uint64_t tick, const double now)
+{
+    double delay = timer_wheel_tick_time(wheel, tick) - now;
+    if (delay < 0) {
+        delay = 0;
+    }
+    const struct timeval timeout = {
+        .tv_sec = (time_t)delay,
+        .tv_usec = (suseconds_t)((delay - (double)(time_t)delay) * 1000000.0),
+    };
+    evtimer_add(&wheel->event, &timeout);
+    wheel->wakeup = tick;
+}
+
+static void timer_wheel_arm(struct timer_wheel *wheel, const double now)
+{
+    const uint64_t next = timer_wheel_next_tick(wheel);
+    if (NULL == wheel->base) { return; }
+    if (next == 0) {
+        if (wheel->wakeup > 0) {
+            evtimer_del(&wheel->event);
+            wheel->wakeup = 0;
+        }
+        return;
+    }
+    if (next == wheel->wakeup && evtimer_pending(&wheel->event, NULL)) { return; }
+    timer_wheel_arm_at(wheel, next, now);
+}
+
+static void timer_wheel_cascade(struct timer_wheel *wheel, const unsigned level)
+{
+    struct timer_entry **slot = &wheel->slots[level][(wheel->current >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+    struct timer_entry *entry = *slot;
+    *slot = NULL;
+    while (NULL != entry) {
+        struct timer_entry *next = entry->next;
+        entry->next = NULL;
+        entry->pprev = NULL;
+        timer_wheel_link(wheel, entry);
+        entry = next;
+    }
+}
+
+/*
+ * Runs the callbacks of the entries that are due, up to the given tick. A callback can add or remove any entry,
+ * itself included.
+ */
+static unsigned timer_wheel_run(struct timer_wheel *wheel, const uint64_t until)
+{
+    unsigned fired = 0;
+    wheel->running = true;
+    while (wheel->current < until) {
+        if (wheel->count == 0) {
+            wheel->current = until;
+            break;
+        }
+        wheel->current++;
+
+        unsigned level = 1;
+        while (level < TIMER_WHEEL_LEVELS && (wheel->current & (((uint64_t)1 << (level * TIMER_WHEEL_BITS)) - 1)) == 0) {
+            level++;
+        }
+        // NOTE(marius): the higher levels move down first, so their entries reach the first level in the same tick
+        while (--level > 0) {
+            timer_wheel_cascade(wheel, level);
+        }
+
+        struct timer_entry **slot = &wheel->slots[0][wheel->current & TIMER_WHEEL_MASK];
+        while (NULL != *slot) {
+            struct timer_entry *entry = *slot;
+            timer_wheel_unlink(entry);
+            wheel->count--;
+            fired++;
+            entry->callback(entry->data);
+        }
+    }
+    wheel->running = false;
+    return fired;
+}
+
+static void timer_wheel_cb(evutil_socket_t fd, short kind, void *data)
+{
+    assert(data);
+    struct timer_wheel *wheel = data;
+
+    const double now = playback_clock_now();
+    wheel->wakeup = 0;
+    const unsigned fired = timer_wheel_run(wheel, timer_wheel_tick(wheel, now));
+    _trace2("timers::fired: %u, %zu waiting", fired, wheel->count);
+    timer_wheel_arm(wheel, now);
+}
+
+static void timer_wheel_remove(struct timer_wheel *wheel, struct timer_entry *entry)
+{
+    if (NULL == wheel || !timer_entry_pending(entry)) { return; }
+
+    timer_wheel_unlink(entry);
+    wheel->count--;
+    // NOTE(marius): the wakeup for the removed entry is left in place, when it comes the wheel finds the next one
+    if (wheel->count == 0 && wheel->wakeup > 0 && NULL != wheel->base) {
+        evtimer_del(&wheel->event);
+        wheel->wakeup = 0;
+    }
+}
+
+/*
+ * Adds the entry to the wheel, to fire after the delay, or moves it if it was already added.
+ * Returns when the entry is going to fire, on the monotonic clock.
+ */
+static double timer_wheel_add(struct timer_wheel *wheel, struct timer_entry *entry, const double delay, void (*callback)(void *), void *data, const double now)
+{
+    assert(wheel);
+    timer_wheel_remove(wheel, entry);
+    if (wheel->count == 0 && !wheel->running) {
+        // NOTE(marius): an empty wheel doesn't need to catch up on the ticks that passed while it was idle
+        wheel->current = timer_wheel_tick(wheel, now);
+    }
+
+    const double deadline = now + (delay > 0 ? delay : 0) - wheel->origin;
+    uint64_t expires = (uint64_t)(deadline / TIMER_WHEEL_TICK_SECONDS);
+    if ((double)expires * TIMER_WHEEL_TICK_SECONDS < deadline) {
+        expires++;
+    }
+    if (expires <= wheel->current) {
+        expires = wheel->current + 1;
+    }
+
+    entry->expires = expires;
+    entry->callback = callback;
+    entry->data = data;
+    timer_wheel_link(wheel, entry);
+    wheel->count++;
+
+    if (NULL != wheel->base && (wheel->wakeup == 0 || expires < wheel->wakeup)) {
+        timer_wheel_arm_at(wheel, expires, now);
+    }
+    return timer_wheel_tick_time(wheel, expires);
+}
+
+static void timer_wheel_init(struct timer_wheel *wheel, struct event_base *base)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->base = base;
+    wheel->origin = playback_clock_now();
+    if (NULL != base) {
+        evtimer_assign(&wheel->event, base, timer_wheel_cb, wheel);
+    }
+}
+
+static void timer_wheel_clean(struct timer_wheel *wheel)
+{
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (unsigned i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            while (NULL != wheel->slots[level][i]) {
+                timer_wheel_unlink(wheel->slots[level][i]);
+            }
+        }
+    }
+    wheel->count = 0;
+    if (NULL != wheel->base && evtimer_initialized(&wheel->event) && evtimer_pending(&wheel->event, NULL)) {
+        evtimer_del(&wheel->event);
+    }
+    wheel->wakeup = 0;
+}
+
+#endif // MPRIS_SCROBBLER_TIMER_WHEEL_H
@@ -5,7 +5,10 @@
 #ifndef MPRIS_SCROBBLER_UTILS_H
 #define MPRIS_SCROBBLER_UTILS_H
 
+#include <errno.h>
 #include <event.h>
+#include <event2/listener.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <signal.h>
@@ -13,6 +16,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 enum log_levels _log_level;
@@ -57,13 +64,28 @@ static const char *get_log_level (enum log_levels l)
     return LOG_TRACING_LABEL;
 }
 
+/*
+ * The levels above LOG_MAX_LEVEL are compiled out, and the arguments of the enabled ones only get evaluated when the
+ * level was requested on the command line.
+ * NOTE(marius): builds without DEBUG don't log the TRACING messages at all.
+ */
+#ifndef LOG_MAX_LEVEL
+#ifdef DEBUG
+#define LOG_MAX_LEVEL log_tracing2
+#else
+#define LOG_MAX_LEVEL log_debug
+#endif
+#endif
+#define _log_enabled(level) ((level) <= LOG_MAX_LEVEL && level_is(_log_level, (level)))
+#define _log_at(level, ...) do { if (_log_enabled(level)) { _logd(level, __FILE__, __func__, __LINE__, __VA_ARGS__); } } while (0)
+
 #define _log(level, format, ...) _logd(level, "", "", 0, format, __VA_ARGS__)
-#define _error(...) _logd(log_error, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define _warn(...) _logd(log_warning, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define _info(...) _logd(log_info, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define _debug(...) _logd(log_debug, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define _trace(...) _logd(log_tracing, __FILE__, __func__, __LINE__, __VA_ARGS__)
-#define _trace2(...) _logd(log_tracing2, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define _error(...) _log_at(log_error, __VA_ARGS__)
+#define _warn(...) _log_at(log_warning, __VA_ARGS__)
+#define _info(...) _log_at(log_info, __VA_ARGS__)
+#define _debug(...) _log_at(log_debug, __VA_ARGS__)
+#define _trace(...) _log_at(log_tracing, __VA_ARGS__)
+#define _trace2(...) _log_at(log_tracing2, __VA_ARGS__)
 
 static void trim_path(char *destination, const char *path, const int length)
 {
@@ -86,6 +108,202 @@ static void trim_path(char *destination, const char *path, const int length)
 #define GRAY_COLOUR "\033[38;5;240m"
 #define RESET_COLOUR "\033[0m"
 
+/*
+ * Once the event loop is running, the messages written to stdout are flushed together after the callbacks of the
+ * current iteration, instead of after every message. The errors are still flushed right away.
+ */
+static struct event log_flush_event;
+static bool log_flush_is_deferred = false;
+
+static void log_flush(void)
+{
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void log_flush_cb(int fd, short kind, void *data)
+{
+    fflush(stdout);
+}
+
+static void log_defer_flush(struct event_base *base)
+{
+    if (NULL == base) { return; }
+    evtimer_assign(&log_flush_event, base, log_flush_cb, NULL);
+    log_flush_is_deferred = true;
+}
+
+static void log_stop_deferring_flush(void)
+{
+    if (log_flush_is_deferred && evtimer_pending(&log_flush_event, NULL)) {
+        evtimer_del(&log_flush_event);
+    }
+    log_flush_is_deferred = false;
+    log_flush();
+}
+
+static bool log_is_tty(FILE *out)
+{
+    // NOTE(marius): -1 means we didn't check yet
+    static int stdout_is_tty = -1;
+    static int stderr_is_tty = -1;
+
+    int *is_tty = (out == stderr) ? &stderr_is_tty : &stdout_is_tty;
+    if (*is_tty < 0) {
+        *is_tty = isatty(fileno(out));
+    }
+    return *is_tty > 0;
+}
+
+/*
+ * When systemd connects our stdout to the journal, the messages are sent to the journal socket directly, with their
+ * fields in separate entries instead of formatted as text that journald would need to parse again.
+ * The context of the message, the player or the request it refers to, gets added as the PLAYER, API and REQUEST_ID
+ * fields, so the logs can be queried with: journalctl --user -u mpris-scrobbler API=listenbrainz.org
+ */
+#define JOURNAL_SOCKET_PATH "/run/systemd/journal/socket"
+#define JOURNAL_MESSAGE_MAX 8192
+#define JOURNAL_MAX_IOVECS 24
+
+struct log_context {
+    const char *player;
+    const char *api;
+    size_t request_id;
+};
+
+static struct log_context log_context = {0};
+static int log_journal_fd = -1;
+static char log_journal_identifier[MAX_PROPERTY_LENGTH] = {0};
+
+static void log_context_player(const char *player)
+{
+    log_context.player = player;
+}
+
+static void log_context_request(const char *api, const size_t request_id)
+{
+    log_context.api = api;
+    log_context.request_id = request_id;
+}
+
+static void log_context_clear(void)
+{
+    log_context.player = NULL;
+    log_context.api = NULL;
+    log_context.request_id = 0;
+}
+
+/*
+ * systemd puts the device and inode of the stream it connected to our stdout in JOURNAL_STREAM.
+ * NOTE(marius): if they don't match stdout anymore, the output was redirected and the user expects text there
+ */
+static bool log_stdout_is_journal(void)
+{
+    const char *stream = getenv("JOURNAL_STREAM");
+    if (NULL == stream) { return false; }
+
+    unsigned long long device = 0, inode = 0;
+    if (sscanf(stream, "%llu:%llu", &device, &inode) != 2) { return false; }
+
+    struct stat st = {0};
+    if (fstat(STDOUT_FILENO, &st) < 0) { return false; }
+    return (unsigned long long)st.st_dev == device && (unsigned long long)st.st_ino == inode;
+}
+
+static bool log_open(const char *identifier)
+{
+    if (!log_stdout_is_journal()) { return false; }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) { return false; }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct sockaddr_un address = { .sun_family = AF_UNIX, .sun_path = JOURNAL_SOCKET_PATH, };
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return false;
+    }
+    snprintf(log_journal_identifier, sizeof(log_journal_identifier), "SYSLOG_IDENTIFIER=%s\n", identifier);
+    log_journal_fd = fd;
+    return true;
+}
+
+static void log_close(void)
+{
+    if (log_journal_fd < 0) { return; }
+    close(log_journal_fd);
+    log_journal_fd = -1;
+}
+
+static const char *log_journal_priority(const enum log_levels level)
+{
+    if (level_is(level, log_error)) { return "PRIORITY=3\n"; }
+    if (level_is(level, log_warning)) { return "PRIORITY=4\n"; }
+    if (level_is(level, log_info)) { return "PRIORITY=6\n"; }
+    return "PRIORITY=7\n";
+}
+
+#define iov_string(iov, count, str) do { (iov)[(count)].iov_base = (void*)(str); (iov)[(count)].iov_len = strlen(str); (count)++; } while (0)
+
+/*
+ * The message is sent in the binary form of the native protocol, so it can contain new lines.
+ * The other fields point straight to the strings of the call site.
+ */
+static bool log_journal_send(const enum log_levels level, const char *file, const char *function, const int line, const char *format, va_list args)
+{
+    static char message[JOURNAL_MESSAGE_MAX];
+    int length = vsnprintf(message, sizeof(message), format, args);
+    if (length < 0) { return false; }
+    if ((size_t)length >= sizeof(message)) { length = sizeof(message) - 1; }
+
+    uint8_t message_length[8] = {0};
+    for (size_t i = 0; i < sizeof(message_length); i++) {
+        message_length[i] = (uint8_t)(((uint64_t)length >> (8 * i)) & 0xff);
+    }
+
+    struct iovec iov[JOURNAL_MAX_IOVECS];
+    size_t count = 0;
+    iov_string(iov, count, log_journal_priority(level));
+    iov_string(iov, count, log_journal_identifier);
+    iov_string(iov, count, "MESSAGE\n");
+    iov[count].iov_base = message_length;
+    iov[count].iov_len = sizeof(message_length);
+    count++;
+    iov[count].iov_base = message;
+    iov[count].iov_len = (size_t)length;
+    count++;
+    iov_string(iov, count, "\n");
+
+    char code_line[32] = {0};
+    if (line > 0) {
+        snprintf(code_line, sizeof(code_line), "CODE_LINE=%d\n", line);
+        iov_string(iov, count, "CODE_FILE=");
+        iov_string(iov, count, file);
+        iov_string(iov, count, "\n");
+        iov_string(iov, count, code_line);
+        iov_string(iov, count, "CODE_FUNC=");
+        iov_string(iov, count, function);
+        iov_string(iov, count, "\n");
+    }
+    if (NULL != log_context.player) {
+        iov_string(iov, count, "PLAYER=");
+        iov_string(iov, count, log_context.player);
+        iov_string(iov, count, "\n");
+    }
+    char request_id[32] = {0};
+    if (NULL != log_context.api) {
+        snprintf(request_id, sizeof(request_id), "REQUEST_ID=%zu\n", log_context.request_id);
+        iov_string(iov, count, "API=");
+        iov_string(iov, count, log_context.api);
+        iov_string(iov, count, "\n");
+        iov_string(iov, count, request_id);
+    }
+    assert(count <= JOURNAL_MAX_IOVECS);
+
+    const struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count, };
+    return sendmsg(log_journal_fd, &msg, MSG_NOSIGNAL) >= 0;
+}
+
 static int _logd(enum log_levels level, const char *file, const char *function, const int line, const char *format, ...)
 {
 #ifndef DEBUG
@@ -96,51 +314,54 @@ static int _logd(enum log_levels level, const char *file, const char *function,
 #endif
     if (!level_is(_log_level, level)) { return 0; }
 
-    FILE *out = stdout;
-#ifndef DEBUG
-    if (level < log_warning) {
-        out = stderr;
+    va_list args;
+    if (log_journal_fd >= 0) {
+        va_start(args, format);
+        const bool sent = log_journal_send(level, file, function, line, format, args);
+        va_end(args);
+        // NOTE(marius): the messages the journal didn't take get written to stdout
+        if (sent) { return 1; }
     }
-#else
-    bool output_is_tty = isatty(STDOUT_FILENO);
+
+    FILE *out = stdout;
     if (level < log_warning) {
         out = stderr;
-        output_is_tty = isatty(STDERR_FILENO);
     }
-#endif
 
-    va_list args;
     va_start(args, format);
 
-    const char *label = get_log_level(level);
-
-    const size_t f_len = strlen(format);
-    char log_format[10240] = {0};
-    snprintf(log_format, 10240-1, "%-7s ", label);
-
-    strncat(log_format, format, f_len + 1);
-    char suffix[1024] = {"\n"};
+    // NOTE(marius): the message is written straight into the buffer of the stream, the lock keeps the parts together
+    flockfile(out);
+    int result = fprintf(out, "%-7s ", get_log_level(level));
+    result += vfprintf(out, format, args);
 #ifdef DEBUG
     if (level > log_debug && strlen(function) > 0 && strlen(file) > 0 && line > 0) {
         char path[256] = {0};
         trim_path(path, file, 255);
-        if (!output_is_tty) {
-            snprintf(suffix, 1024, " in %s() %s:%d\n", function, path, line);
+        if (!log_is_tty(out)) {
+            result += fprintf(out, " in %s() %s:%d", function, path, line);
         } else {
-            snprintf(suffix, 1024, GRAY_COLOUR " in %s() %s:%d" RESET_COLOUR "\n", function, path, line);
+            result += fprintf(out, GRAY_COLOUR " in %s() %s:%d" RESET_COLOUR, function, path, line);
         }
     }
 #endif
-    strncat(log_format, suffix, 1024);
-
-    const int result = vfprintf(out, log_format, args);
+    putc('\n', out);
+    funlockfile(out);
     va_end(args);
-    fflush(out);
 
-    return result;
+    if (out == stdout && log_flush_is_deferred) {
+        if (!evtimer_pending(&log_flush_event, NULL)) {
+            const struct timeval now = { .tv_sec = 0, };
+            evtimer_add(&log_flush_event, &now);
+        }
+    } else {
+        fflush(out);
+    }
+
+    return result + 1;
 }
 
-static void array_log_with_label(char *output, char arr[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1], const int count)
+static void views_log_with_label(char *output, const char *const arr[MAX_PROPERTY_COUNT], const int count)
 {
     if (count <= 0) { return; }
 
@@ -149,7 +370,7 @@ static void array_log_with_label(char *output, char arr[MAX_PROPERTY_COUNT][MAX_
     char temp[MAX_PROPERTY_COUNT*MAX_PROPERTY_LENGTH+1] = {0};
     unsigned short cnt = 0;
     for (int i = 0; i < count; i++) {
-        if (strlen(arr[i]) == 0) {
+        if (NULL == arr[i] || strlen(arr[i]) == 0) {
             break;
         }
         if (i > 0) {
@@ -165,6 +386,15 @@ static void array_log_with_label(char *output, char arr[MAX_PROPERTY_COUNT][MAX_
     }
 }
 
+static void array_log_with_label(char *output, char arr[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1], const int count)
+{
+    const char *views[MAX_PROPERTY_COUNT] = {0};
+    for (int i = 0; i < count && i < MAX_PROPERTY_COUNT; i++) {
+        views[i] = arr[i];
+    }
+    views_log_with_label(output, views, min(count, MAX_PROPERTY_COUNT));
+}
+
 static const char *get_api_type_label(const enum api_type end_point)
 {
     switch (end_point) {
@@ -180,8 +410,7 @@ static const char *get_api_type_label(const enum api_type end_point)
     }
 }
 
-void resend_now_playing (struct state *);
-bool load_configuration(struct configuration*, const char*);
+struct configuration_diff reload_state(struct state *);
 static void sighandler(const evutil_socket_t signum, short events, void *user_data)
 {
     if (events) { events = 0; }
@@ -205,8 +434,7 @@ static void sighandler(const evutil_socket_t signum, short events, void *user_da
     _info("main::signal_received: %s", signal_name);
 
     if (signum == SIGHUP) {
-        load_configuration(s->config, APPLICATION_NAME);
-        resend_now_playing(s);
+        reload_state(s);
     }
     if (signum == SIGINT || signum == SIGTERM) {
         event_base_loopexit(eb, NULL);
@@ -330,4 +558,68 @@ static const char *get_application_name(void)
     return APPLICATION_NAME;
 }
 
+/*
+ * Tells if there's anyone listening on the socket at the address. A socket file that refuses connections is left over
+ * by an instance that didn't exit cleanly, and it gets removed.
+ */
+static bool socket_server_in_use(const struct sockaddr_un *address)
+{
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        _warn("socket::probe[%s]: %s", address->sun_path, strerror(errno));
+        return false;
+    }
+    const bool in_use = connect(fd, (const struct sockaddr*)address, sizeof(*address)) == 0;
+    const int error = errno;
+    close(fd);
+    if (in_use) { return true; }
+
+    if (error == ECONNREFUSED) {
+        _debug("socket::stale: %s", address->sun_path);
+        unlink(address->sun_path);
+    }
+    return false;
+}
+
+/*
+ * Listens on a unix socket that only the current user can connect to.
+ */
+static bool socket_server_listen(struct socket_server *server, struct event_base *base, const char *path, evconnlistener_cb accepted, void *data)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX, };
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        _warn("socket::invalid_path: %s", path);
+        return false;
+    }
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    // NOTE(marius): the socket of a previous instance that didn't exit cleanly would make the bind fail, but one that
+    //  still accepts connections belongs to a running instance, and unlinking it would take it away from its clients
+    if (socket_server_in_use(&address)) {
+        _warn("socket::in_use: %s", path);
+        return false;
+    }
+
+    const mode_t previous_mask = umask(0077);
+    server->listener = evconnlistener_new_bind(base, accepted, data, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC, -1,
+                                               (struct sockaddr*)&address, sizeof(address));
+    umask(previous_mask);
+    if (NULL == server->listener) {
+        _warn("socket::listen[%s]: %s", path, strerror(errno));
+        return false;
+    }
+    strncpy(server->path, path, FILE_PATH_MAX);
+    _debug("socket::listening: %s", server->path);
+    return true;
+}
+
+static void socket_server_clean(struct socket_server *server)
+{
+    if (NULL == server->listener) { return; }
+
+    evconnlistener_free(server->listener);
+    server->listener = NULL;
+    unlink(server->path);
+    _trace("socket::closed: %s", server->path);
+}
+
 #endif // MPRIS_SCROBBLER_UTILS_H
@@ -0,0 +1,138 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+#ifndef MPRIS_SCROBBLER_WATCHER_H
+#define MPRIS_SCROBBLER_WATCHER_H
+
+#include <sys/inotify.h>
+
+/*
+ * The configuration and the credentials files get reloaded when they change on disk, so the credentials that signon
+ * writes get used right away.
+ * The folders of the files are the ones that get watched, as the files might not exist yet, and editors usually
+ * replace them by renaming a new file over the old one. The reload waits for the writes to settle for a while.
+ */
+
+#define CONFIG_WATCH_DELAY_MS 100
+#define CONFIG_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+static const char *config_watch_file_name(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    return NULL == name ? path : name + 1;
+}
+
+static int config_watch_add(const int fd, const char *path)
+{
+    char folder[FILE_PATH_MAX + 1] = {0};
+    strncpy(folder, path, FILE_PATH_MAX);
+    char *separator = strrchr(folder, '/');
+    if (NULL == separator) { return -1; }
+    *separator = '\0';
+
+    const int wd = inotify_add_watch(fd, folder, CONFIG_WATCH_MASK);
+    if (wd < 0) {
+        _debug("watcher::add[%s]: %s", folder, strerror(errno));
+        return -1;
+    }
+    _trace("watcher::add[%s]: %d", folder, wd);
+    return wd;
+}
+
+static bool config_watch_matches(const struct config_watch *watch, const struct configuration *config, const struct inotify_event *ev)
+{
+    if (ev->mask & IN_Q_OVERFLOW) { return true; }
+    if (ev->len == 0) { return false; }
+
+    if (ev->wd == watch->config_wd && strcmp(ev->name, config_watch_file_name(config->config_path)) == 0) { return true; }
+    if (ev->wd == watch->credentials_wd && strcmp(ev->name, config_watch_file_name(config->credentials_path)) == 0) { return true; }
+    return false;
+}
+
+static void config_watch_reload_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    struct state *state = data;
+
+    _debug("watcher::reload");
+    reload_state(state);
+}
+
+static void config_watch_read_cb(int fd, short kind, void *data)
+{
+    assert(data);
+    struct state *state = data;
+    struct config_watch *watch = &state->watch;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    while (true) {
+        const ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) { break; }
+
+        for (char *cur = buffer; cur < buffer + length; ) {
+            const struct inotify_event *ev = (const struct inotify_event*)cur;
+            if (config_watch_matches(watch, state->config, ev)) {
+                _trace("watcher::changed: %s", ev->len > 0 ? ev->name : "overflow");
+                changed = true;
+            }
+            cur += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (!changed) { return; }
+
+    // NOTE(marius): every change pushes the reload back, so a file that's written in pieces gets read once
+    const struct timeval delay = { .tv_sec = 0, .tv_usec = CONFIG_WATCH_DELAY_MS * 1000, };
+    evtimer_add(&watch->reload_event, &delay);
+}
+
+static bool config_watch_init(struct config_watch *watch, struct state *state)
+{
+    watch->fd = -1;
+    watch->config_wd = -1;
+    watch->credentials_wd = -1;
+    if (NULL == state->events.base) { return false; }
+
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        _warn("watcher::init: %s", strerror(errno));
+        return false;
+    }
+    watch->fd = fd;
+    watch->config_wd = config_watch_add(fd, state->config->config_path);
+    watch->credentials_wd = config_watch_add(fd, state->config->credentials_path);
+    if (watch->config_wd < 0 && watch->credentials_wd < 0) {
+        close(fd);
+        watch->fd = -1;
+        return false;
+    }
+
+    evtimer_assign(&watch->reload_event, state->events.base, config_watch_reload_cb, state);
+    watch->read_event = event_new(state->events.base, fd, EV_READ | EV_PERSIST, config_watch_read_cb, state);
+    if (NULL == watch->read_event) {
+        _warn("watcher::add_event: failed");
+        close(fd);
+        watch->fd = -1;
+        return false;
+    }
+    event_add(watch->read_event, NULL);
+    _debug("watcher::watching: %s %s", state->config->config_path, state->config->credentials_path);
+    return true;
+}
+
+static void config_watch_clean(struct config_watch *watch)
+{
+    // NOTE(marius): the watch is only set up when it has an event, before that its fd could be zeroed memory
+    if (NULL == watch->read_event) { return; }
+
+    event_free(watch->read_event);
+    watch->read_event = NULL;
+    if (evtimer_pending(&watch->reload_event, NULL)) {
+        evtimer_del(&watch->reload_event);
+    }
+    close(watch->fd);
+    watch->fd = -1;
+    _trace("watcher::closed");
+}
+
+#endif // MPRIS_SCROBBLER_WATCHER_H
@@ -0,0 +1,251 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "api.h"
+#include "scrobble_arena.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+#define TRACK_COUNT 12
+#define EMPTY_TRACK 3
+
+static const struct api_credentials auth = {
+    .api_key = "0123456789abcdef0123456789abcdef",
+    .secret = "fedcba9876543210fedcba9876543210",
+    .session_key = "a1b2c3d4e5f6a1b2c3d4e5f6a1b2c3d4",
+    .end_point = api_lastfm,
+    .enabled = true,
+};
+
+static void load_track(struct scrobble *s, const int i)
+{
+    char title[MAX_PROPERTY_LENGTH] = {0};
+    snprintf(title, sizeof(title), "Let Down & Lucky, take %d", i);
+
+    struct scrobble values = {0};
+    values.title = title;
+    values.album = "OK Computer";
+    values.artist[0] = "Radiohead";
+    values.mb_track_id[0] = "8cdc8f4c-4f9a-4c5f-a6f5-e0d5d2a7bf0f";
+
+    s->length = 300.0;
+    s->start_time = 1700000000 + i * 400;
+    scrobble_load_strings(s, values.strings);
+}
+
+struct body_param {
+    char *name;
+    char *value;
+};
+
+static int body_param_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct body_param *)a)->name, ((const struct body_param *)b)->name);
+}
+
+/*
+ * Splits the form encoded body in its unescaped parameters, and sets aside the signature.
+ */
+static size_t body_params_parse(const char *body, struct body_param params[], const size_t size, char *sig)
+{
+    char *copy = strdup(body);
+    size_t count = 0;
+    for (char *param = strtok(copy, "&"); NULL != param && count < size; param = strtok(NULL, "&")) {
+        char *value = strchr(param, '=');
+        if (NULL == value) { continue; }
+        *value++ = '\0';
+
+        char *name = curl_easy_unescape(NULL, param, 0, NULL);
+        char *raw = curl_easy_unescape(NULL, value, 0, NULL);
+        if (strcmp(name, "api_sig") == 0) {
+            strncpy(sig, raw, MD5_HEX_LENGTH - 1);
+            curl_free(name);
+            curl_free(raw);
+            continue;
+        }
+        params[count].name = name;
+        params[count].value = raw;
+        count++;
+    }
+    free(copy);
+    return count;
+}
+
+static void body_params_clean(struct body_param params[], const size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        curl_free(params[i].name);
+        curl_free(params[i].value);
+    }
+}
+
+/*
+ * Signs the parameters by the Last.fm documentation, independently of the request builders.
+ */
+static void body_params_sign(struct body_param params[], const size_t count, char *result)
+{
+    qsort(params, count, sizeof(params[0]), body_param_compare);
+
+    struct http_buffer string = {0};
+    http_buffer_init(&string);
+    for (size_t i = 0; i < count; i++) {
+        http_buffer_append_string(&string, params[i].name);
+        http_buffer_append_string(&string, params[i].value);
+    }
+    api_get_signature(http_buffer_data(&string), auth.secret, result);
+    http_buffer_clean(&string);
+}
+
+static bool body_params_has(const struct body_param params[], const size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(params[i].name, name) == 0) { return true; }
+    }
+    return false;
+}
+
+describe(audioscrobbler_api) {
+    struct scrobble tracks[TRACK_COUNT] = {0};
+    const struct scrobble *batch[MAX_SCROBBLE_BATCH] = {0};
+    for (int i = 0; i < TRACK_COUNT; i++) {
+        if (i != EMPTY_TRACK) {
+            load_track(&tracks[i], i);
+        }
+        batch[i] = &tracks[i];
+    }
+
+    it("Signs the scrobble parameters sorted by name") {
+        struct http_request request = {0};
+        http_request_init(&request);
+        audioscrobbler_api_build_request_scrobble(&request, batch, TRACK_COUNT, &auth);
+
+        struct body_param params[API_SIGNED_FORM_MAX_PARAMS] = {0};
+        char sig[MD5_HEX_LENGTH] = {0};
+        const size_t count = body_params_parse(http_buffer_data(&request.body), params, API_SIGNED_FORM_MAX_PARAMS, sig);
+        asserteq(count, 5 * (TRACK_COUNT - 1) + 3);
+
+        char expected[MD5_HEX_LENGTH] = {0};
+        body_params_sign(params, count, expected);
+        asserteq_str(sig, expected);
+
+        body_params_clean(params, count);
+        http_request_clean(&request);
+    };
+
+    it("Skips the empty tracks in all the parameters of a scrobble") {
+        struct http_request request = {0};
+        http_request_init(&request);
+        audioscrobbler_api_build_request_scrobble(&request, batch, TRACK_COUNT, &auth);
+
+        struct body_param params[API_SIGNED_FORM_MAX_PARAMS] = {0};
+        char sig[MD5_HEX_LENGTH] = {0};
+        const size_t count = body_params_parse(http_buffer_data(&request.body), params, API_SIGNED_FORM_MAX_PARAMS, sig);
+        asserteq(body_params_has(params, count, "album[3]"), false);
+        asserteq(body_params_has(params, count, "artist[3]"), false);
+        asserteq(body_params_has(params, count, "mbid[3]"), false);
+        asserteq(body_params_has(params, count, "timestamp[3]"), false);
+        asserteq(body_params_has(params, count, "track[3]"), false);
+        asserteq(body_params_has(params, count, "track[11]"), true);
+
+        body_params_clean(params, count);
+        http_request_clean(&request);
+    };
+
+    it("Signs the now playing parameters sorted by name") {
+        struct http_request request = {0};
+        http_request_init(&request);
+        audioscrobbler_api_build_request_now_playing(&request, batch, 1, &auth);
+
+        struct body_param params[API_SIGNED_FORM_MAX_PARAMS] = {0};
+        char sig[MD5_HEX_LENGTH] = {0};
+        const size_t count = body_params_parse(http_buffer_data(&request.body), params, API_SIGNED_FORM_MAX_PARAMS, sig);
+        asserteq(count, 7);
+
+        char expected[MD5_HEX_LENGTH] = {0};
+        body_params_sign(params, count, expected);
+        asserteq_str(sig, expected);
+
+        body_params_clean(params, count);
+        http_request_clean(&request);
+    };
+
+    it("Signs the authentication parameters sorted by name") {
+        struct api_credentials signon = auth;
+        strncpy(signon.token, "0f1e2d3c4b5a69780f1e2d3c4b5a6978", MAX_SECRET_LENGTH);
+
+        struct http_request request = {0};
+        http_request_init(&request);
+        audioscrobbler_api_build_request_get_session(&request, &signon);
+
+        struct body_param params[API_SIGNED_FORM_MAX_PARAMS] = {0};
+        char sig[MD5_HEX_LENGTH] = {0};
+        const size_t count = body_params_parse(http_buffer_data(&request.body), params, API_SIGNED_FORM_MAX_PARAMS, sig);
+        asserteq(count, 3);
+        asserteq(body_params_has(params, count, "token"), true);
+
+        char expected[MD5_HEX_LENGTH] = {0};
+        body_params_sign(params, count, expected);
+        asserteq_str(sig, expected);
+
+        body_params_clean(params, count);
+        http_request_clean(&request);
+    };
+
+    it("Only the tracks the response accepts are accepted") {
+        json_object *root = json_tokener_parse("{\"scrobbles\":{\"scrobble\":["
+            "{\"ignoredMessage\":{\"code\":\"0\",\"#text\":\"\"}},"
+            "{\"ignoredMessage\":{\"code\":\"1\",\"#text\":\"Artist was ignored\"}},"
+            "{\"ignoredMessage\":{\"code\":\"5\",\"#text\":\"Daily scrobble limit exceeded\"}},"
+            "{\"track\":{\"#text\":\"Airbag\"}}"
+            "],\"@attr\":{\"accepted\":1,\"ignored\":2}}}");
+        asserteq(audioscrobbler_api_response_track_status(root, 0), track_accepted);
+        asserteq(audioscrobbler_api_response_track_status(root, 1), track_ignored);
+        asserteq(audioscrobbler_api_response_track_status(root, 2), track_deferred);
+        asserteq(audioscrobbler_api_response_track_status(root, 3), track_unknown);
+        asserteq(audioscrobbler_api_response_track_status(root, 4), track_unknown);
+        json_object_put(root);
+    };
+
+    it("A response without the scrobbles doesn't accept any track") {
+        json_object *error = json_tokener_parse("{\"error\":9,\"message\":\"Invalid session key - Please re-authenticate\"}");
+        asserteq(json_document_is_error(error, api_lastfm), true);
+        asserteq(audioscrobbler_api_response_track_status(error, 0), track_unknown);
+        json_object_put(error);
+
+        json_object *empty = json_tokener_parse("{}");
+        asserteq(json_document_is_error(empty, api_lastfm), false);
+        asserteq(audioscrobbler_api_response_track_status(empty, 0), track_unknown);
+        json_object_put(empty);
+
+        asserteq(audioscrobbler_api_response_track_status(NULL, 0), track_unknown);
+    };
+
+    for (int i = 0; i < TRACK_COUNT; i++) {
+        scrobble_clean(&tracks[i]);
+    }
+    http_buffer_pool_clean();
+}
+
+snow_main();
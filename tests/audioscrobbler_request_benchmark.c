@@ -0,0 +1,496 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "api.h"
+#include "scrobble_arena.h"
+
+#define ITERATIONS 2000
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the benchmark doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+static double elapsed_ms(const struct timespec start, const struct timespec end)
+{
+    return (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+// NOTE(marius): the request builders before the signed form encoder, they strncat everything in fixed buffers
+static void legacy_get_signature(const char *string, const char *secret, char *result)
+{
+    if (NULL == string) { return; }
+    if (NULL == secret) { return; }
+    if (NULL == result) { return; }
+    const size_t string_len = strlen(string);
+    const size_t secret_len = strlen(secret);
+    const size_t len = string_len + secret_len;
+    char sig[MAX_BODY_SIZE+1] = {0};
+
+    // TODO(marius): this needs to change to memcpy or strncpy
+    strncat(sig, string, MAX_BODY_SIZE);
+    strncat(sig, secret, MAX_PROPERTY_LENGTH/2);
+
+    unsigned char sig_hash[MD5_DIGEST_LENGTH] = {0};
+
+    md5((uint8_t*)sig, len, sig_hash);
+
+    for (size_t n = 0; n < MD5_DIGEST_LENGTH; n++) {
+        snprintf(result + 2 * n, 3, "%02x", sig_hash[n]);
+    }
+}
+
+static void legacy_build_now_playing(struct http_buffer *result, const struct scrobble *tracks[], const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+{
+    if (!audioscrobbler_valid_credentials(auth)) { return; }
+
+    (void)track_count; // quiet -Wunused-parameter
+    assert(track_count == 1);
+
+    const struct scrobble *track = tracks[0];
+    const char *api_key = auth->api_key;
+    const char *secret = auth->secret;
+    const char *sk = auth->session_key;
+
+    char sig_base[MAX_BODY_SIZE+1] = {0};
+    char body[MAX_BODY_SIZE+1] = {0};
+
+    assert(track->album);
+    const size_t album_len = strlen(track->album);
+    char *esc_album = curl_easy_escape(handle, track->album, (int)album_len);
+
+    strncat(body, "album=", 7);
+    strncat(body, esc_album, MAX_BODY_SIZE);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "album", 6);
+    strncat(sig_base, track->album, MAX_BODY_SIZE);
+    curl_free(esc_album);
+
+    assert(api_key);
+    const size_t api_key_len = strlen(api_key);
+    char *esc_api_key = curl_easy_escape(handle, api_key, (int)api_key_len);
+
+    strncat(body, "api_key=", 9);
+    strncat(body, esc_api_key, MAX_BODY_SIZE);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "api_key", 8);
+    strncat(sig_base, api_key, MAX_BODY_SIZE);
+    curl_free(esc_api_key);
+
+    char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 1] = {0};
+    size_t full_artist_len = 0;
+    for (size_t i = 0; i < array_count(track->artist); i++) {
+        const char *artist = track->artist[i];
+        const size_t artist_len = strlen(artist);
+        if (NULL == artist || artist_len == 0) { continue; }
+
+        if (full_artist_len > 0) {
+            size_t l_val_sep = strlen(VALUE_SEPARATOR);
+            strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
+            full_artist_len += l_val_sep;
+        }
+        strncat(full_artist, artist, artist_len + 1);
+        full_artist_len += artist_len;
+    }
+    if (full_artist_len > 0) {
+        char *esc_full_artist = curl_easy_escape(handle, full_artist, (int)full_artist_len);
+        const size_t artist_label_len = strlen(API_ARTIST_NODE_NAME);
+
+        strncat(body, API_ARTIST_NODE_NAME "=", artist_label_len + 2);
+        strncat(body, esc_full_artist, MAX_BODY_SIZE);
+        strncat(body, "&", 2);
+
+        strncat(sig_base, API_ARTIST_NODE_NAME, artist_label_len + 1);
+        strncat(sig_base, full_artist, MAX_BODY_SIZE);
+        curl_free(esc_full_artist);
+    }
+
+    const char *mb_track_id = (char *) track->mb_track_id[0];
+    const size_t mbid_len = strlen(mb_track_id);
+    if (mbid_len > 0) {
+        char *esc_mbid = curl_easy_escape(handle, mb_track_id, (int)mbid_len);
+
+        const size_t mbid_label_len = strlen(API_MUSICBRAINZ_MBID_NODE_NAME);
+
+        strncat(body, API_MUSICBRAINZ_MBID_NODE_NAME "=", mbid_label_len + 2);
+        strncat(body, esc_mbid, MAX_BODY_SIZE);
+        strncat(body, "&", 2);
+
+        strncat(sig_base, API_MUSICBRAINZ_MBID_NODE_NAME, mbid_label_len + 1);
+        strncat(sig_base, mb_track_id, MAX_BODY_SIZE);
+        curl_free(esc_mbid);
+    }
+
+    const char *method = API_METHOD_NOW_PLAYING;
+
+    assert(method);
+    const size_t method_len = strlen(method);
+    strncat(body, "method=", 8);
+    strncat(body, method, method_len + 1);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "method", 7);
+    strncat(sig_base, method, method_len + 1);
+
+    strncat(body, "sk=", 4);
+    strncat(body, sk, MAX_PROPERTY_LENGTH);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "sk", 3);
+    strncat(sig_base, sk, MAX_SECRET_LENGTH);
+
+    assert(track->title);
+    const size_t title_len = strlen(track->title);
+    char *esc_title = curl_easy_escape(handle, track->title, (int)title_len);
+
+    strncat(body, "track=", 7);
+    strncat(body, esc_title, MAX_BODY_SIZE);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "track", 6);
+    strncat(sig_base, track->title, title_len + 1);
+    curl_free(esc_title);
+
+    char sig[MD5_HEX_LENGTH] = {0};
+    legacy_get_signature(sig_base, secret, sig);
+    strncat(body, "api_sig=", 9);
+    strncat(body, sig, MAX_PROPERTY_LENGTH);
+
+    http_buffer_append_string(result, body);
+}
+
+static void legacy_build_scrobble(struct http_buffer *result, const struct scrobble *tracks[MAX_SCROBBLE_BATCH], const unsigned track_count, const struct api_credentials *auth, CURL *handle)
+{
+    if (!audioscrobbler_valid_credentials(auth)) { return; }
+
+    const char *api_key = auth->api_key;
+    const char *secret = auth->secret;
+    const char *sk = auth->session_key;
+
+    const char *method = API_METHOD_SCROBBLE;
+
+    char sig_base[MAX_BODY_SIZE+1] = {0};
+    char body[MAX_BODY_SIZE+1] = {0};
+
+    for (size_t i = 0; i < track_count; i++) {
+        const struct scrobble *track = tracks[i];
+
+        if (scrobble_is_empty(track)) {
+            continue;
+        }
+        const size_t album_len = strlen(track->album);
+
+        char *esc_album = curl_easy_escape(handle, track->album, (int)album_len);
+        char album_body[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(album_body, MAX_PROPERTY_LENGTH, API_ALBUM_NODE_NAME "[%lu]=%s&", i, esc_album);
+        strncat(body, album_body, MAX_PROPERTY_LENGTH);
+
+        char album_sig[MAX_PROPERTY_LENGTH + 19] = {0};
+        snprintf(album_sig, MAX_PROPERTY_LENGTH + 18, API_ALBUM_NODE_NAME "[%lu]%s", i, track->album);
+
+        assert(strlen(sig_base) + strlen(album_sig)<MAX_BODY_SIZE);
+        strncat(sig_base, album_sig, MAX_PROPERTY_LENGTH + 19);
+
+        curl_free(esc_album);
+    }
+
+    assert(api_key);
+    const size_t api_key_len = strlen(api_key);
+    char *esc_api_key = curl_easy_escape(handle, api_key, (int)api_key_len);
+
+    strncat(body, "api_key=", 9);
+    strncat(body, esc_api_key, MAX_BODY_SIZE);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "api_key", 8);
+    strncat(sig_base, api_key, MAX_BODY_SIZE);
+    curl_free(esc_api_key);
+
+    for (size_t i = 0; i < track_count; i++) {
+        const struct scrobble *track = tracks[i];
+
+        char full_artist[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT] = {0};
+        size_t full_artist_len = 0;
+        for (unsigned j = 0; j < array_count(track->artist); j++) {
+            const char *artist = track->artist[j];
+            const size_t artist_len = strlen(artist);
+            if (NULL == artist || artist_len == 0) { continue; }
+
+            if (full_artist_len > 0) {
+                const size_t l_val_sep = strlen(VALUE_SEPARATOR);
+                strncat(full_artist, VALUE_SEPARATOR, l_val_sep + 1);
+                full_artist_len += l_val_sep;
+            }
+            strncat(full_artist, artist, artist_len + 1);
+            full_artist_len += artist_len;
+        }
+        if (full_artist_len > 0) {
+            char *esc_full_artist = curl_easy_escape(handle, full_artist, (int)full_artist_len);
+
+            const char fmt_full_artist[] = API_ARTIST_NODE_NAME "[%zu]=%s&";
+
+            char artist_body[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11] = {0};
+            snprintf(artist_body, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11, fmt_full_artist, i, esc_full_artist);
+
+            strncat(body, artist_body, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 11);
+
+            const char fmt_artist_sig[] = API_ARTIST_NODE_NAME "[%zu]%s";
+            char artist_sig[MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9] = {0};
+            snprintf(artist_sig, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9, fmt_artist_sig, i, full_artist);
+
+            assert(strlen(sig_base) + strlen(artist_sig) < MAX_BODY_SIZE);
+            strncat(sig_base, artist_sig, MAX_PROPERTY_LENGTH * MAX_PROPERTY_COUNT + 9);
+            curl_free(esc_full_artist);
+        }
+    }
+
+    for (size_t i = 0; i < track_count; i++) {
+        const struct scrobble *track = tracks[i];
+
+        char *mb_track_id = (char*)track->mb_track_id[0];
+        const size_t mbid_len = strlen(mb_track_id);
+        if (mbid_len > 0) {
+            char *esc_mbid = curl_easy_escape(handle, mb_track_id, (int)mbid_len);
+
+            char mbid_body[MAX_PROPERTY_LENGTH] = {0};
+            snprintf(mbid_body, MAX_PROPERTY_LENGTH, API_MUSICBRAINZ_MBID_NODE_NAME "[%lu]=%s&", i, esc_mbid);
+            strncat(body, mbid_body, MAX_PROPERTY_LENGTH);
+
+            char mbid_sig[MAX_PROPERTY_LENGTH + 18] = {0};
+            snprintf(mbid_sig, MAX_PROPERTY_LENGTH + 17, API_MUSICBRAINZ_MBID_NODE_NAME "[%lu]%s", i, mb_track_id);
+
+            assert(strlen(sig_base) + strlen(mbid_sig) < MAX_BODY_SIZE);
+            strncat(sig_base, mbid_sig, MAX_PROPERTY_LENGTH + 18);
+
+            curl_free(esc_mbid);
+        }
+    }
+
+    assert(method);
+    const size_t method_len = strlen(method);
+    strncat(body, "method=", 8);
+    strncat(body, method, method_len + 1);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "method", 7);
+    assert(strlen(sig_base) + strlen(method) < MAX_BODY_SIZE);
+    strncat(sig_base, method, method_len + 1);
+
+    assert(sk);
+    strncat(body, "sk=", 4);
+    strncat(body, sk, MAX_SECRET_LENGTH+1);
+    strncat(body, "&", 2);
+
+    strncat(sig_base, "sk", 3);
+    assert(strlen(sig_base) + strlen(sk) < MAX_BODY_SIZE);
+    strncat(sig_base, sk, MAX_SECRET_LENGTH+1);
+
+    for (int i = (int)track_count - 1; i >= 0; i--) {
+        const struct scrobble *track = tracks[i];
+
+        char tstamp_body[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(tstamp_body, MAX_PROPERTY_LENGTH, API_TIMESTAMP_NODE_NAME "[%d]=%ld&", i, track->start_time);
+        strncat(body, tstamp_body, MAX_PROPERTY_LENGTH);
+
+        char tstamp_sig[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(tstamp_sig, MAX_PROPERTY_LENGTH, API_TIMESTAMP_NODE_NAME "[%d]%ld", i, track->start_time);
+
+        assert(strlen(sig_base) + strlen(tstamp_sig) < MAX_BODY_SIZE);
+        strncat(sig_base, tstamp_sig, MAX_PROPERTY_LENGTH);
+    }
+
+    for (int i = (int)track_count - 1; i >= 0; i--) {
+        const struct scrobble *track = tracks[i];
+
+        const size_t title_len = strlen(track->title);
+
+        char *esc_title = curl_easy_escape(handle, track->title, (int)title_len);
+
+        char title_body[MAX_PROPERTY_LENGTH] = {0};
+        snprintf(title_body, MAX_PROPERTY_LENGTH, API_TRACK_NODE_NAME "[%d]=%s&", i, esc_title);
+        strncat(body, title_body, MAX_PROPERTY_LENGTH);
+
+        char title_sig[MAX_PROPERTY_LENGTH + 19] = {0};
+        snprintf(title_sig, MAX_PROPERTY_LENGTH + 18, API_TRACK_NODE_NAME "[%d]%s", i, track->title);
+
+        assert(strlen(sig_base) + strlen(title_sig) < MAX_BODY_SIZE);
+        strncat(sig_base, title_sig, MAX_PROPERTY_LENGTH + 19);
+
+        curl_free(esc_title);
+    }
+
+    char sig[MD5_HEX_LENGTH] = {0};
+    legacy_get_signature(sig_base, secret, sig);
+    strncat(body, "api_sig=", 9);
+    strncat(body, sig, MAX_PROPERTY_LENGTH);
+
+    http_buffer_append_string(result, body);
+}
+
+static void load_track(struct scrobble *s, const int i)
+{
+    char title[MAX_PROPERTY_LENGTH] = {0};
+    snprintf(title, sizeof(title), "Paranoid Android (Live at the Élysée Montmartre, take %d)", i);
+
+    struct scrobble values = {0};
+    values.title = title;
+    values.album = "OK Computer OKNOTOK 1997 2017";
+    values.url = "file:///music/Radiohead/OK%20Computer/02%20Paranoid%20Android.flac";
+    values.player_name = "mpd";
+    values.artist[0] = "Radiohead";
+    values.artist[1] = "Thom Yorke & Jonny Greenwood";
+    values.mb_track_id[0] = "8cdc8f4c-4f9a-4c5f-a6f5-e0d5d2a7bf0f";
+
+    s->length = 387.0;
+    s->start_time = 1700000000 + i * 400;
+    const bool loaded = scrobble_load_strings(s, values.strings);
+    assert(loaded);
+}
+
+static double build_legacy(const struct scrobble *tracks[], const unsigned count, const struct api_credentials *auth, CURL *handle)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        struct http_buffer body = {0};
+        if (count == 1) {
+            legacy_build_now_playing(&body, tracks, count, auth, handle);
+        } else {
+            legacy_build_scrobble(&body, tracks, count, auth, handle);
+        }
+        http_buffer_clean(&body);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_ms(start, end);
+}
+
+static double build_signed_form(const struct scrobble *tracks[], const unsigned count, const struct api_credentials *auth)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        struct http_request request = {0};
+        http_request_init(&request);
+        if (count == 1) {
+            audioscrobbler_api_build_request_now_playing(&request, tracks, count, auth);
+        } else {
+            audioscrobbler_api_build_request_scrobble(&request, tracks, count, auth);
+        }
+        http_request_clean(&request);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_ms(start, end);
+}
+
+static int compare_params(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Splits the body in its parameters, sorted, leaving out the signature. Returns their number.
+ */
+static size_t body_params(char *body, char *params[], const size_t size)
+{
+    size_t count = 0;
+    for (char *param = strtok(body, "&"); NULL != param && count < size; param = strtok(NULL, "&")) {
+        if (strncmp(param, "api_sig=", 8) == 0) { continue; }
+        params[count] = param;
+        count++;
+    }
+    qsort(params, count, sizeof(params[0]), compare_params);
+    return count;
+}
+
+// NOTE(marius): the signed form needs to produce the same parameters as the old builders, the order of the batches
+//  and their signature changed, as the old one didn't sort the indexed names, see audioscrobbler_api_test.c
+static void check_body(const struct scrobble *tracks[], const unsigned count, const struct api_credentials *auth, CURL *handle)
+{
+    struct http_buffer legacy = {0};
+    struct http_request request = {0};
+    http_request_init(&request);
+    if (count == 1) {
+        legacy_build_now_playing(&legacy, tracks, count, auth, handle);
+        audioscrobbler_api_build_request_now_playing(&request, tracks, count, auth);
+        assert(strcmp(http_buffer_data(&legacy), http_buffer_data(&request.body)) == 0);
+    } else {
+        legacy_build_scrobble(&legacy, tracks, count, auth, handle);
+        audioscrobbler_api_build_request_scrobble(&request, tracks, count, auth);
+    }
+    assert(legacy.length == request.body.length);
+
+    char *legacy_body = strdup(http_buffer_data(&legacy));
+    char *signed_body = strdup(http_buffer_data(&request.body));
+    char *legacy_params[API_SIGNED_FORM_MAX_PARAMS] = {0};
+    char *signed_params[API_SIGNED_FORM_MAX_PARAMS] = {0};
+    const size_t legacy_count = body_params(legacy_body, legacy_params, array_count(legacy_params));
+    const size_t signed_count = body_params(signed_body, signed_params, array_count(signed_params));
+    assert(legacy_count == signed_count);
+    for (size_t i = 0; i < signed_count; i++) {
+        assert(strcmp(legacy_params[i], signed_params[i]) == 0);
+    }
+    free(legacy_body);
+    free(signed_body);
+
+    http_buffer_clean(&legacy);
+    http_request_clean(&request);
+}
+
+int main(void)
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    CURL *handle = curl_easy_init();
+
+    struct api_credentials auth = {
+        .api_key = "0123456789abcdef0123456789abcdef",
+        .secret = "fedcba9876543210fedcba9876543210",
+        .session_key = "a1b2c3d4e5f6a1b2c3d4e5f6a1b2c3d4",
+        .end_point = api_lastfm,
+        .enabled = true,
+    };
+
+    struct scrobble tracks[50] = {0};
+    const struct scrobble *batch[MAX_SCROBBLE_BATCH] = {0};
+    for (int i = 0; i < 50; i++) {
+        load_track(&tracks[i], i);
+        batch[i] = &tracks[i];
+    }
+
+    const unsigned counts[] = {1, 10, 50};
+    for (size_t i = 0; i < array_count(counts); i++) {
+        check_body(batch, counts[i], &auth, handle);
+
+        const double legacy_ms = build_legacy(batch, counts[i], &auth, handle);
+        const double signed_ms = build_signed_form(batch, counts[i], &auth);
+        fprintf(stdout, "%2u tracks requests/s:  legacy %8.0f, signed form %8.0f\n", counts[i],
+                ITERATIONS / legacy_ms * 1000.0, ITERATIONS / signed_ms * 1000.0);
+    }
+
+    for (int i = 0; i < 50; i++) {
+        scrobble_clean(&tracks[i]);
+    }
+    http_buffer_pool_clean();
+    curl_easy_cleanup(handle);
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "api.h"
+#include "scrobble_arena.h"
+#include "metrics.h"
+#include "breaker.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+// NOTE(marius): the gauges of the metrics are read from the daemon state, which the test doesn't have
+static size_t scrobbler_backlog_length(const struct scrobbler *s) { (void)s; return 0; }
+static size_t mpris_players_count(const struct mpris_players *players) { (void)players; return 0; }
+
+static int drains_scheduled = 0;
+static void scrobbler_schedule_drain(struct scrobbler *s)
+{
+    (void)s;
+    drains_scheduled++;
+}
+
+static void response_add_header(struct http_response *res, const char *name, const char *value)
+{
+    struct http_header *h = http_header_new(NULL);
+    strncpy(h->name, name, MAX_HEADER_NAME_LENGTH - 1);
+    strncpy(h->value, value, MAX_HEADER_VALUE_LENGTH - 1);
+    arrput(res->headers, h);
+}
+
+describe(breaker) {
+    it("Backoff doubles with every failure up to the maximum") {
+        asserteq(api_breaker_backoff_seconds(0), 0);
+        asserteq(api_breaker_backoff_seconds(1), BREAKER_BACKOFF_BASE_SECONDS);
+        asserteq(api_breaker_backoff_seconds(2), 2 * BREAKER_BACKOFF_BASE_SECONDS);
+        asserteq(api_breaker_backoff_seconds(3), 4 * BREAKER_BACKOFF_BASE_SECONDS);
+        asserteq(api_breaker_backoff_seconds(100), BREAKER_BACKOFF_MAX_SECONDS);
+    };
+
+    it("Jitter keeps at least half of the delay") {
+        for (int i = 0; i < 1000; i++) {
+            const struct timeval delay = api_breaker_jitter(10);
+            const double seconds = timeval_to_seconds(delay);
+            asserteq(seconds >= 5.0 && seconds <= 10.0, true);
+        }
+        const struct timeval none = api_breaker_jitter(0);
+        asserteq(none.tv_sec, 0);
+        asserteq(none.tv_usec, 0);
+    };
+
+    it("Only transient errors count as failures") {
+        asserteq(api_breaker_is_failure(CURLE_COULDNT_CONNECT, 0), true);
+        asserteq(api_breaker_is_failure(CURLE_OPERATION_TIMEDOUT, 0), true);
+        asserteq(api_breaker_is_failure(CURLE_OK, 503), true);
+        asserteq(api_breaker_is_failure(CURLE_OK, 429), true);
+        asserteq(api_breaker_is_failure(CURLE_OK, 200), false);
+        asserteq(api_breaker_is_failure(CURLE_OK, 400), false);
+        asserteq(api_breaker_is_failure(CURLE_OK, 403), false);
+    };
+
+    it("A failure opens the breaker until the probe succeeds") {
+        struct event_base *evbase = event_base_new();
+        struct scrobbler s = {0};
+        s.evbase = evbase;
+        api_breakers_init(&s);
+        drains_scheduled = 0;
+
+        struct api_breaker *breaker = &s.breakers[api_listenbrainz];
+        asserteq(api_breaker_allows(breaker), true);
+
+        api_breaker_failure(breaker, 0);
+        asserteq(breaker->state, breaker_open);
+        asserteq(breaker->failures, 1);
+        asserteq(api_breaker_allows(breaker), false);
+        asserteq(evtimer_pending(&breaker->retry_event, NULL) != 0, true);
+        // NOTE(marius): the other services are not affected
+        asserteq(api_breaker_allows(&s.breakers[api_lastfm]), true);
+
+        // NOTE(marius): the batches that were already in flight fail too
+        api_breaker_failure(breaker, 0);
+        asserteq(breaker->failures, 1);
+
+        api_breaker_retry_cb(-1, EV_TIMEOUT, breaker);
+        asserteq(breaker->state, breaker_half_open);
+        asserteq(drains_scheduled, 1);
+        asserteq(api_breaker_allows(breaker), true);
+        api_breaker_request_started(breaker);
+        asserteq(api_breaker_allows(breaker), false);
+
+        api_breaker_failure(breaker, 0);
+        asserteq(breaker->state, breaker_open);
+        asserteq(breaker->failures, 2);
+
+        api_breaker_retry_cb(-1, EV_TIMEOUT, breaker);
+        api_breaker_request_started(breaker);
+        api_breaker_success(breaker);
+        asserteq(breaker->state, breaker_closed);
+        asserteq(breaker->failures, 0);
+        asserteq(api_breaker_allows(breaker), true);
+        asserteq(evtimer_pending(&breaker->retry_event, NULL), 0);
+
+        api_breakers_clean(&s);
+        event_base_free(evbase);
+    };
+
+    it("Pausing a service leaves its breaker alone, flushing retries it right away") {
+        struct event_base *evbase = event_base_new();
+        struct scrobbler s = {0};
+        s.evbase = evbase;
+        api_breakers_init(&s);
+        drains_scheduled = 0;
+
+        struct api_breaker *breaker = &s.breakers[api_lastfm];
+        // NOTE(marius): the pause gets checked together with the rest of the service, before its requests are built
+        breaker->paused = true;
+        asserteq(api_breaker_allows(breaker), true);
+        asserteq(breaker->state, breaker_closed);
+        breaker->paused = false;
+
+        // NOTE(marius): flushing doesn't wait for the backoff of an open breaker
+        api_breaker_failure(breaker, 0);
+        api_breaker_retry_now(breaker);
+        asserteq(breaker->state, breaker_half_open);
+        asserteq(evtimer_pending(&breaker->retry_event, NULL), 0);
+        asserteq(drains_scheduled, 1);
+
+        // NOTE(marius): only open breakers get retried
+        api_breaker_retry_now(breaker);
+        asserteq(drains_scheduled, 1);
+
+        api_breakers_clean(&s);
+        event_base_free(evbase);
+    };
+
+    it("Retry-After is read as seconds or as a date") {
+        const time_t now = time(NULL);
+        struct http_response res = {0};
+        http_response_init(&res);
+        asserteq(http_response_retry_after(&res, now), 0);
+
+        response_add_header(&res, "retry-after", "120\r");
+        asserteq(http_response_retry_after(&res, now), 120);
+        http_response_clean(&res);
+
+        http_response_init(&res);
+        response_add_header(&res, "Retry-After", "Wed, 21 Oct 2015 07:28:00 GMT");
+        const time_t date = curl_getdate("Wed, 21 Oct 2015 07:28:00 GMT", NULL);
+        asserteq(http_response_retry_after(&res, date - 90), 90);
+        asserteq(http_response_retry_after(&res, date + 90), 0);
+        http_response_clean(&res);
+    };
+}
+
+snow_main();
@@ -0,0 +1,197 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "api.h"
+#include "smpris.h"
+#include "mpris_players.h"
+#include "scrobble_arena.h"
+#include "journal.h"
+#include "ledger.h"
+#include "now_playing_cache.h"
+#include "scrobbler.h"
+
+#define ITERATIONS 20000
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the benchmark doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+// NOTE(marius): the benchmark doesn't have a queue to drain, nor a journal to open
+static unsigned int scrobbler_consume_queue(struct scrobbler *s) { (void)s; return 0; }
+bool configuration_folder_exists(const char *path) { (void)path; return false; }
+bool configuration_folder_create(const char *path) { (void)path; return false; }
+
+/*
+ * NOTE(marius): every allocation of the process is counted, the ones done by libcurl and json-c included, by
+ * wrapping the allocator of glibc
+ */
+#if defined(__GLIBC__)
+#define ALLOCATIONS_COUNTED true
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+
+static size_t allocations = 0;
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (NULL == ptr) { allocations++; }
+    return __libc_realloc(ptr, size);
+}
+#else
+#define ALLOCATIONS_COUNTED false
+static size_t allocations = 0;
+#endif
+
+static double elapsed_ms(const struct timespec start, const struct timespec end)
+{
+    return (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+static void load_track(struct scrobble *s)
+{
+    struct scrobble values = {0};
+    values.title = "Paranoid Android";
+    values.album = "OK Computer";
+    values.player_name = "mpd";
+    values.artist[0] = "Radiohead";
+    values.mb_track_id[0] = "8cdc8f4c-4f9a-4c5f-a6f5-e0d5d2a7bf0f";
+
+    s->length = 387.0;
+    s->start_time = 1700000000;
+    const bool loaded = scrobble_load_strings(s, values.strings);
+    assert(loaded);
+}
+
+static const char *response_headers[] = {
+    "HTTP/2 200\r\n",
+    "server: nginx\r\n",
+    "date: Wed, 21 Oct 2015 07:28:00 GMT\r\n",
+    "content-type: application/json\r\n",
+    "content-length: 16\r\n",
+    "access-control-allow-origin: *\r\n",
+    "x-ratelimit-limit: 30\r\n",
+    "x-ratelimit-remaining: 29\r\n",
+    "x-ratelimit-reset: 10\r\n",
+    "x-ratelimit-reset-in: 10\r\n",
+    "\r\n",
+};
+
+static const char response_body[] = "{\"status\": \"ok\"}";
+
+// NOTE(marius): what curl would do with the response of the service, without sending the request
+static void receive_response(struct scrobbler_connection *conn)
+{
+    for (size_t i = 0; i < array_count(response_headers); i++) {
+        const char *line = response_headers[i];
+        http_response_write_headers((char*)line, 1, strlen(line), conn);
+    }
+    http_response_write_body((char*)response_body, 1, strlen(response_body), conn);
+    conn->response.code = 200;
+}
+
+static void send_scrobble(struct scrobbler *s, const struct api_credentials *creds, const struct scrobble *tracks[], const bool recycle)
+{
+    struct scrobbler_connection *conn = scrobbler_connection_new();
+    scrobbler_connection_init(conn, s, *creds, 0);
+    api_build_request_scrobble(conn, tracks, 1);
+    build_curl_request(conn);
+    receive_response(conn);
+    assert(NULL != conn->response.json);
+    assert(arrlen(conn->response.headers) == array_count(response_headers) - 2);
+
+    conn->should_free = true;
+    scrobbler_connection_free(conn, false);
+    if (!recycle) {
+        scrobbler_connection_pool_clean();
+    }
+}
+
+struct result {
+    double elapsed_ms;
+    double allocations;
+};
+
+static struct result run(struct scrobbler *s, const struct api_credentials *creds, const struct scrobble *tracks[], const bool recycle)
+{
+    // NOTE(marius): the first request fills the pools of connections, of curl handles and of buffer chunks
+    send_scrobble(s, creds, tracks, recycle);
+
+    struct timespec start, end;
+    const size_t before = allocations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        send_scrobble(s, creds, tracks, recycle);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    struct result result = {
+        .elapsed_ms = elapsed_ms(start, end),
+        .allocations = (double)(allocations - before) / ITERATIONS,
+    };
+    return result;
+}
+
+int main(void)
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    struct scrobble track = {0};
+    load_track(&track);
+    const struct scrobble *tracks[] = { &track };
+
+    struct scrobbler s = {0};
+    struct api_credentials creds = { .end_point = api_listenbrainz, .enabled = true, };
+    strncpy(creds.token, "00000000-0000-0000-0000-000000000000", MAX_SECRET_LENGTH);
+
+    const struct result fresh = run(&s, &creds, tracks, false);
+    const struct result recycled = run(&s, &creds, tracks, true);
+
+    if (ALLOCATIONS_COUNTED) {
+        fprintf(stdout, "allocations per scrobble:  fresh connection %6.1f, recycled connection %6.1f\n",
+                fresh.allocations, recycled.allocations);
+    }
+    fprintf(stdout, "scrobbles/s:               fresh connection %6.0f, recycled connection %6.0f\n",
+            ITERATIONS / fresh.elapsed_ms * 1000, ITERATIONS / recycled.elapsed_ms * 1000);
+
+    scrobbler_connection_pool_clean();
+    curl_handle_pool_clean(&s.pool);
+    http_buffer_pool_clean();
+    scrobble_clean(&track);
+    curl_global_cleanup();
+
+    return 0;
+}
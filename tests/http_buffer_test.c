@@ -0,0 +1,78 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+
+#include "structs.h"
+#include "http_buffer.h"
+
+#include <snow/snow.h>
+
+#define LARGE_BODY_SIZE (4 * MAX_BODY_SIZE)
+
+describe(http_buffer) {
+    it("Appending to an empty buffer") {
+        struct http_buffer buf = {0};
+        http_buffer_init(&buf);
+        asserteq_str(http_buffer_data(&buf), "");
+
+        asserteq(http_buffer_append_string(&buf, "{\"status\":"), true);
+        asserteq(http_buffer_append_string(&buf, "\"ok\"}"), true);
+        asserteq(buf.length, 15);
+        asserteq(buf.head, buf.tail);
+        asserteq_str(http_buffer_data(&buf), "{\"status\":\"ok\"}");
+
+        http_buffer_clean(&buf);
+        asserteq(buf.length, 0);
+        asserteq(buf.head, NULL);
+        http_buffer_pool_clean();
+    };
+
+    it("Appending past the size of a chunk") {
+        struct http_buffer buf = {0};
+        http_buffer_init(&buf);
+
+        char *expected = calloc(LARGE_BODY_SIZE + 1, sizeof(char));
+        char piece[100] = {0};
+        size_t length = 0;
+        for (int i = 0; length + sizeof(piece) < LARGE_BODY_SIZE; i++) {
+            const int written = snprintf(piece, sizeof(piece), "{\"listened_at\":%d},", i);
+            memcpy(expected + length, piece, (size_t)written);
+            length += (size_t)written;
+            asserteq(http_buffer_append(&buf, piece, (size_t)written), true);
+        }
+        asserteq(buf.length, length);
+        assertneq(buf.head, buf.tail);
+
+        const char *data = http_buffer_data(&buf);
+        asserteq(buf.head, buf.tail);
+        asserteq(strlen(data), length);
+        asserteq(memcmp(data, expected, length), 0);
+
+        http_buffer_clean(&buf);
+        free(expected);
+        http_buffer_pool_clean();
+    };
+
+    it("Reusing the chunks of a cleaned buffer") {
+        struct http_buffer buf = {0};
+        http_buffer_init(&buf);
+
+        http_buffer_append_string(&buf, "first");
+        const struct http_buffer_chunk *first = buf.head;
+        http_buffer_clean(&buf);
+        asserteq(http_buffer_pool_count, 1);
+
+        http_buffer_append_string(&buf, "second");
+        asserteq(buf.head, first);
+        asserteq(http_buffer_pool_count, 0);
+        asserteq_str(http_buffer_data(&buf), "second");
+
+        http_buffer_clean(&buf);
+        http_buffer_pool_clean();
+        asserteq(http_buffer_pool_count, 0);
+    };
+}
+
+snow_main();
@@ -0,0 +1,473 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// NOTE(marius): a small index, so the scrobbles that don't fit in it are tested without writing thousands of them
+#define JOURNAL_MAX_INDEXED 128
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "api.h"
+#include "scrobble_arena.h"
+#include "journal.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+bool configuration_folder_exists(const char *path) { (void)path; return true; }
+bool configuration_folder_create(const char *path) { (void)path; return true; }
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+#define ALL_SERVICES ((1U << api_lastfm) | (1U << api_listenbrainz))
+
+static void load_track(struct scrobble *s, const char *title, const time_t start_time)
+{
+    struct scrobble values = {0};
+    values.title = title;
+    values.album = "OK Computer";
+    values.player_name = "mpd";
+    values.artist[0] = "Radiohead";
+
+    s->length = 387.0;
+    s->start_time = start_time;
+    const bool loaded = scrobble_load_strings(s, values.strings);
+    assert(loaded);
+}
+
+static uint64_t append_track(struct scrobble_journal *j, const char *title, const time_t start_time)
+{
+    struct scrobble s = {0};
+    load_track(&s, title, start_time);
+    const uint64_t id = journal_append(j, &s);
+    scrobble_clean(&s);
+    return id;
+}
+
+static void journal_path(char path[FILE_PATH_MAX+1])
+{
+    strncpy(path, "/tmp/mpris-scrobbler-journal-XXXXXX", FILE_PATH_MAX);
+    const int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    unlink(path);
+}
+
+static size_t journal_reopen(struct scrobble_journal *j, const char *path, struct event_base *evbase, const unsigned required)
+{
+    journal_close(j);
+    memset(j, 0, sizeof(*j));
+    const bool opened = journal_open(j, path, evbase);
+    assert(opened);
+    return journal_replay(j, required);
+}
+
+static off_t file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+describe(journal) {
+    it("The scrobbles that weren't accepted everywhere are replayed") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 0);
+        const uint64_t first = append_track(&j, "Airbag", 1700000000);
+        const uint64_t second = append_track(&j, "Paranoid Android", 1700000400);
+        const uint64_t third = append_track(&j, "Subterranean Homesick Alien", 1700000800);
+        asserteq(first > 0 && second > first && third > second, true);
+
+        journal_ack(&j, first, api_lastfm, ALL_SERVICES);
+        journal_ack(&j, first, api_listenbrainz, ALL_SERVICES);
+        journal_ack(&j, second, api_lastfm, ALL_SERVICES);
+        asserteq(journal_live_count(&j), 2);
+
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 2);
+        asserteq(journal_is_acked(&j, second, api_lastfm), true);
+        asserteq(journal_is_acked(&j, second, api_listenbrainz), false);
+        asserteq(journal_find_entry(&j, first) == NULL, true);
+
+        struct scrobble loaded = {0};
+        asserteq(journal_load(&j, journal_find_entry(&j, third), &loaded), true);
+        asserteq(strcmp(loaded.title, "Subterranean Homesick Alien"), 0);
+        asserteq(loaded.start_time, 1700000800);
+        asserteq(loaded.journal_id, third);
+        scrobble_clean(&loaded);
+
+        // NOTE(marius): the ids keep growing after a restart
+        asserteq(append_track(&j, "Exit Music", 1700001200) > third, true);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("A torn tail is truncated") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        append_track(&j, "Airbag", 1700000000);
+        const off_t complete = j.size;
+        append_track(&j, "Paranoid Android", 1700000400);
+        journal_close(&j);
+
+        // NOTE(marius): a crash in the middle of writing the second record
+        asserteq(truncate(path, complete + 10), 0);
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 1);
+        asserteq(file_size(path), complete);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("A failed write doesn't leave a torn record for the next ones to follow") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        append_track(&j, "Airbag", 1700000000);
+        const off_t complete = j.size;
+
+        // NOTE(marius): the file can't grow past the first few bytes of the second record, like on a full disk
+        struct rlimit previous;
+        getrlimit(RLIMIT_FSIZE, &previous);
+        signal(SIGXFSZ, SIG_IGN);
+        const struct rlimit limit = { .rlim_cur = (rlim_t)complete + 10, .rlim_max = previous.rlim_max };
+        setrlimit(RLIMIT_FSIZE, &limit);
+        asserteq(append_track(&j, "Paranoid Android", 1700000400), 0);
+        setrlimit(RLIMIT_FSIZE, &previous);
+        signal(SIGXFSZ, SIG_DFL);
+
+        asserteq(file_size(path), complete);
+        assertneq(append_track(&j, "Subterranean Homesick Alien", 1700000800), 0);
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 2);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("A record that fails its checksum ends the journal") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        append_track(&j, "Airbag", 1700000000);
+        const off_t complete = j.size;
+        append_track(&j, "Paranoid Android", 1700000400);
+        journal_close(&j);
+
+        FILE *f = fopen(path, "r+b");
+        fseek(f, complete + (long)JOURNAL_RECORD_HEADER_SIZE + 20, SEEK_SET);
+        fputc('X', f);
+        fclose(f);
+
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 1);
+        asserteq(file_size(path), complete);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("A file that isn't a journal is started over") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        FILE *f = fopen(path, "wb");
+        fputs("not a journal, not at all", f);
+        fclose(f);
+
+        struct scrobble_journal j = {0};
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 0);
+        asserteq(file_size(path), JOURNAL_HEADER_SIZE);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("Tombstones for services that don't exist are ignored") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        const uint64_t id = append_track(&j, "Airbag", 1700000000);
+        uint8_t buf[JOURNAL_TOMBSTONE_SIZE];
+        asserteq(journal_write_record(&j, buf, journal_tombstone_record(buf, id, (enum api_type)200)), true);
+        asserteq(journal_write_record(&j, buf, journal_tombstone_record(buf, id, API_TYPE_COUNT)), true);
+
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 1);
+        asserteq(journal_find_entry(&j, id)->acked, 0);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("Compaction keeps only the pending scrobbles and their acknowledgements") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        uint64_t ids[100] = {0};
+        for (int i = 0; i < 100; i++) {
+            ids[i] = append_track(&j, "Airbag", 1700000000 + i * 400);
+        }
+        for (int i = 0; i < 90; i++) {
+            journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+            journal_ack(&j, ids[i], api_listenbrainz, ALL_SERVICES);
+        }
+        journal_ack(&j, ids[95], api_lastfm, ALL_SERVICES);
+        const off_t before = j.size;
+
+        asserteq(journal_compact(&j), true);
+        asserteq(j.size < before, true);
+        asserteq(file_size(path), j.size);
+        // NOTE(marius): ten appends and the acknowledgement of the one that's halfway done
+        asserteq(j.record_count, 11);
+
+        struct scrobble loaded = {0};
+        asserteq(journal_load(&j, journal_find_entry(&j, ids[99]), &loaded), true);
+        asserteq(loaded.start_time, 1700000000 + 99 * 400);
+        scrobble_clean(&loaded);
+
+        // NOTE(marius): the journal keeps writing to the compacted file
+        assertneq(append_track(&j, "Lucky", 1700000000 + 100 * 400), 0);
+        asserteq(file_size(path), j.size);
+
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 11);
+        asserteq(journal_is_acked(&j, ids[95], api_lastfm), true);
+        asserteq(journal_is_acked(&j, ids[96], api_lastfm), false);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("The spilled scrobbles are counted as they change") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        uint64_t ids[200] = {0};
+        for (int i = 0; i < 200; i++) {
+            ids[i] = append_track(&j, "Airbag", 1700000000 + i * 400);
+        }
+        asserteq(journal_spilled_count(&j), 200);
+
+        journal_set_queued(&j, ids[0], true);
+        journal_hold(&j, ids[1], api_lastfm);
+        journal_hold(&j, ids[1], api_listenbrainz);
+        asserteq(journal_spilled_count(&j), 198);
+        journal_release(&j, ids[1], api_lastfm);
+        asserteq(journal_spilled_count(&j), 198);
+        journal_release(&j, ids[1], api_listenbrainz);
+        journal_set_queued(&j, ids[0], false);
+        asserteq(journal_spilled_count(&j), 200);
+
+        // NOTE(marius): the index gets pruned along the way, the entries are still found after that
+        for (int i = 0; i < 150; i++) {
+            journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+            journal_ack(&j, ids[i], api_listenbrainz, ALL_SERVICES);
+        }
+        asserteq(journal_spilled_count(&j), 50);
+        asserteq(journal_live_count(&j), 50);
+        asserteq((size_t)arrlen(j.live) < 200, true);
+        for (int i = 0; i < 200; i++) {
+            asserteq(journal_find_entry(&j, ids[i]) != NULL, i >= 150);
+        }
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("A scrobble is rejected a limited number of times by every service") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        const uint64_t id = append_track(&j, "Airbag", 1700000000);
+        for (int i = 1; i < JOURNAL_MAX_REJECTIONS; i++) {
+            asserteq(journal_reject(&j, id, api_lastfm), false);
+        }
+        asserteq(journal_reject(&j, id, api_listenbrainz), false);
+        asserteq(journal_reject(&j, id, api_lastfm), true);
+        asserteq(journal_reject(&j, 0, api_lastfm), false);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("The scrobbles that don't fit in the index wait on disk") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        uint64_t ids[300] = {0};
+        for (int i = 0; i < 300; i++) {
+            ids[i] = append_track(&j, "No Surprises", 1700000000 + i * 400);
+            assertneq(ids[i], 0);
+        }
+        asserteq((size_t)arrlen(j.live), JOURNAL_MAX_INDEXED);
+        asserteq(j.cold, 300 - JOURNAL_MAX_INDEXED);
+        asserteq(journal_spilled_count(&j), 300);
+        asserteq(journal_live_count(&j), 300);
+        asserteq(journal_find_entry(&j, ids[JOURNAL_MAX_INDEXED]), NULL);
+
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 300);
+        asserteq((size_t)arrlen(j.live), JOURNAL_MAX_INDEXED);
+
+        // NOTE(marius): the scrobbles on disk get indexed as the older ones are accepted
+        for (int i = 0; i < 250; i++) {
+            assertneq(journal_find_entry(&j, ids[i]), NULL);
+            journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+            journal_ack(&j, ids[i], api_listenbrainz, ALL_SERVICES);
+        }
+        asserteq(j.cold, 0);
+        asserteq(journal_live_count(&j), 50);
+        assertneq(journal_find_entry(&j, ids[299]), NULL);
+
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 50);
+        assertneq(journal_find_entry(&j, ids[250]), NULL);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("Compaction keeps the scrobbles waiting on disk") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        uint64_t ids[300] = {0};
+        for (int i = 0; i < 300; i++) {
+            ids[i] = append_track(&j, "Exit Music", 1700000000 + i * 400);
+        }
+        // NOTE(marius): listenbrainz is down, so last.fm's acknowledgements stay around
+        for (int i = 0; i < 100; i++) {
+            journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+        }
+        asserteq(journal_compact(&j), true);
+        asserteq(file_size(path), j.size);
+        asserteq(j.record_count, 400);
+
+        struct scrobble loaded = {0};
+        assertneq(append_track(&j, "Lucky", 1700000000 + 300 * 400), 0);
+        asserteq(journal_reopen(&j, path, evbase, ALL_SERVICES), 301);
+        asserteq(journal_is_acked(&j, ids[99], api_lastfm), true);
+        asserteq(journal_is_acked(&j, ids[100], api_lastfm), false);
+
+        for (int i = 0; i < 300; i++) {
+            journal_ack(&j, ids[i], api_listenbrainz, ALL_SERVICES);
+            if (i >= 100) {
+                journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+            }
+        }
+        asserteq(journal_live_count(&j), 1);
+        const struct journal_entry *pending[1] = {0};
+        asserteq(journal_pending(&j, api_lastfm, pending, 1), 1);
+        asserteq(journal_load(&j, pending[0], &loaded), true);
+        asserteq(loaded.start_time, 1700000000 + 300 * 400);
+        scrobble_clean(&loaded);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+
+    it("Every service gets the spilled scrobbles it didn't accept yet") {
+        struct event_base *evbase = event_base_new();
+        char path[FILE_PATH_MAX+1] = {0};
+        journal_path(path);
+
+        struct scrobble_journal j = {0};
+        journal_reopen(&j, path, evbase, ALL_SERVICES);
+        uint64_t ids[120] = {0};
+        for (int i = 0; i < 120; i++) {
+            ids[i] = append_track(&j, "Karma Police", 1700000000 + i * 400);
+        }
+
+        // NOTE(marius): the first batch got accepted by last.fm while listenbrainz was down
+        for (int i = 0; i < 50; i++) {
+            journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+        }
+
+        const struct journal_entry *pending[50] = {0};
+        asserteq(journal_pending(&j, api_lastfm, pending, 50), 50);
+        asserteq(pending[0]->id, ids[50]);
+        asserteq(pending[49]->id, ids[99]);
+        asserteq(j.cursors[api_lastfm], ids[50]);
+
+        asserteq(journal_pending(&j, api_listenbrainz, pending, 50), 50);
+        asserteq(pending[0]->id, ids[0]);
+
+        // NOTE(marius): the scrobbles being submitted to a service are skipped only for that service
+        for (int i = 50; i < 100; i++) {
+            journal_hold(&j, ids[i], api_lastfm);
+        }
+        asserteq(journal_pending(&j, api_lastfm, pending, 50), 20);
+        asserteq(pending[0]->id, ids[100]);
+        asserteq(j.cursors[api_lastfm], ids[50]);
+        asserteq(journal_pending(&j, api_listenbrainz, pending, 50), 50);
+        asserteq(pending[0]->id, ids[0]);
+
+        for (int i = 50; i < 100; i++) {
+            journal_release(&j, ids[i], api_lastfm);
+            journal_ack(&j, ids[i], api_lastfm, ALL_SERVICES);
+        }
+        asserteq(journal_pending(&j, api_lastfm, pending, 50), 20);
+        asserteq(j.cursors[api_lastfm], ids[100]);
+
+        journal_close(&j);
+        unlink(path);
+        event_base_free(evbase);
+    };
+}
+
+snow_main();
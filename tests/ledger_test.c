@@ -0,0 +1,179 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "api.h"
+#include "scrobble_arena.h"
+#include "journal.h"
+#include "ledger.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+bool configuration_folder_exists(const char *path) { (void)path; return true; }
+bool configuration_folder_create(const char *path) { (void)path; return true; }
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+// NOTE(marius): the moments are made up, the ledger only ever gets the time it's given
+#define T0 1700000000
+
+static struct scrobble track(const char *title, const char *artist, const char *album, const time_t start_time)
+{
+    struct scrobble s = {0};
+    s.title = (char*)title;
+    s.album = (char*)album;
+    s.artist[0] = (char*)artist;
+    s.start_time = start_time;
+    return s;
+}
+
+static void ledger_accept(struct scrobble_ledger *l, const struct scrobble *t)
+{
+    ledger_add(l, scrobble_fingerprint(t), t->start_time);
+}
+
+describe(ledger) {
+    it("The fingerprint ignores case and extra whitespace") {
+        const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", T0);
+        const struct scrobble other = track(" paranoid  android", "RADIOHEAD ", "ok computer", T0);
+        asserteq(scrobble_fingerprint(&t) == scrobble_fingerprint(&other), true);
+
+        const struct scrobble another = track("Karma Police", "Radiohead", "OK Computer", T0);
+        asserteq(scrobble_fingerprint(&t) != scrobble_fingerprint(&another), true);
+        const struct scrobble split = track("ParanoidAndroid", "Radiohead", "OK Computer", T0);
+        asserteq(scrobble_fingerprint(&t) != scrobble_fingerprint(&split), true);
+    };
+
+    it("Listens that start a few seconds apart are the same one") {
+        struct scrobble_ledger l = {0};
+        const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", T0);
+        asserteq(ledger_contains(&l, &t), false);
+        ledger_accept(&l, &t);
+        asserteq(ledger_contains(&l, &t), true);
+        asserteq(l.dirty, true);
+
+        const struct scrobble later = track("Paranoid Android", "Radiohead", "OK Computer", T0 + 3);
+        const struct scrobble earlier = track("Paranoid Android", "Radiohead", "OK Computer", T0 - 3);
+        asserteq(ledger_contains(&l, &later), true);
+        asserteq(ledger_contains(&l, &earlier), true);
+
+        // NOTE(marius): playing the track again starts at least MIN_TRACK_LENGTH later
+        const struct scrobble again = track("Paranoid Android", "Radiohead", "OK Computer", T0 + (time_t)MIN_TRACK_LENGTH);
+        asserteq(ledger_contains(&l, &again), false);
+        ledger_close(&l);
+    };
+
+    it("The set grows past its initial capacity") {
+        struct scrobble_ledger l = {0};
+        const size_t count = 10 * LEDGER_MIN_CAPACITY;
+        for (size_t i = 0; i < count; i++) {
+            const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", T0 + (time_t)(i * 60));
+            ledger_accept(&l, &t);
+        }
+        asserteq(l.count, count);
+        asserteq(l.count * 2 <= l.capacity, true);
+        for (size_t i = 0; i < count; i++) {
+            const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", T0 + (time_t)(i * 60));
+            asserteq(ledger_contains(&l, &t), true);
+        }
+        ledger_close(&l);
+    };
+
+    it("Duplicates are found in the same batch") {
+        const struct scrobble first = track("Paranoid Android", "Radiohead", "OK Computer", T0);
+        const struct scrobble second = track("Karma Police", "Radiohead", "OK Computer", T0 + 400);
+        const struct scrobble copy = track("Paranoid Android", "Radiohead", "OK Computer", T0 + 2);
+        const struct scrobble *tracks[] = { &first, &second, &copy };
+        asserteq(scrobble_batch_contains(tracks, 0, &first), false);
+        asserteq(scrobble_batch_contains(tracks, 1, &second), false);
+        asserteq(scrobble_batch_contains(tracks, 2, &copy), true);
+    };
+
+    it("The ledger is saved sorted and loaded back without the expired listens") {
+        char path[] = "/tmp/mpris-scrobbler-ledger-XXXXXX";
+        const int fd = mkstemp(path);
+        asserteq(fd >= 0, true);
+        close(fd);
+        unlink(path);
+
+        const time_t now = T0 + 3600;
+        struct scrobble_ledger l = {0};
+        strncpy(l.path, path, FILE_PATH_MAX);
+        for (int i = 0; i < 100; i++) {
+            const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", T0 + i * 60);
+            ledger_accept(&l, &t);
+        }
+        const struct scrobble old = track("Karma Police", "Radiohead", "OK Computer", now - LEDGER_RETENTION_SECONDS - 1);
+        ledger_accept(&l, &old);
+        asserteq(l.count, 101);
+
+        asserteq(ledger_save(&l, now), true);
+        asserteq(l.dirty, false);
+        asserteq(l.count, 100);
+        asserteq(ledger_contains(&l, &old), false);
+        // NOTE(marius): nothing changed, nothing to write
+        asserteq(ledger_save(&l, now), false);
+
+        FILE *f = fopen(path, "rb");
+        struct ledger_header header = {0};
+        asserteq(fread(&header, sizeof(header), 1, f), 1);
+        asserteq(header.magic, LEDGER_MAGIC);
+        asserteq(header.count, 100);
+        uint64_t previous = 0;
+        for (uint64_t i = 0; i < header.count; i++) {
+            struct ledger_entry entry = {0};
+            asserteq(fread(&entry, sizeof(entry), 1, f), 1);
+            asserteq(entry.fingerprint > previous, true);
+            previous = entry.fingerprint;
+        }
+        fclose(f);
+
+        struct scrobble_ledger loaded = {0};
+        strncpy(loaded.path, path, FILE_PATH_MAX);
+        asserteq(ledger_load(&loaded, now), 100);
+        const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", T0 + 42 * 60);
+        asserteq(ledger_contains(&loaded, &t), true);
+        // NOTE(marius): the listens expire from the file too
+        asserteq(ledger_load(&loaded, T0 + 100 * 60 + LEDGER_RETENTION_SECONDS), 0);
+
+        ledger_close(&l);
+        ledger_close(&loaded);
+        unlink(path);
+    };
+
+    it("An invalid file is ignored") {
+        char path[] = "/tmp/mpris-scrobbler-ledger-XXXXXX";
+        const int fd = mkstemp(path);
+        asserteq(fd >= 0, true);
+        const char garbage[] = "not a ledger, not at all";
+        asserteq(write(fd, garbage, sizeof(garbage)), (ssize_t)sizeof(garbage));
+        close(fd);
+
+        struct scrobble_ledger l = {0};
+        strncpy(l.path, path, FILE_PATH_MAX);
+        asserteq(ledger_load(&l, T0), 0);
+        asserteq(l.count, 0);
+        ledger_close(&l);
+        unlink(path);
+    };
+}
+
+snow_main();
@@ -0,0 +1,125 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "metrics.h"
+#include "profiler.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+// NOTE(marius): the gauges are read from the daemon state, which the test doesn't have
+static size_t scrobbler_backlog_length(const struct scrobbler *s) { (void)s; return 0; }
+static size_t mpris_players_count(const struct mpris_players *players) { (void)players; return 0; }
+
+static char *render(const struct metrics *m)
+{
+    struct evbuffer *out = evbuffer_new();
+    metrics_render(out, m, NULL);
+    const size_t length = evbuffer_get_length(out);
+    char *text = calloc(length + 1, sizeof(char));
+    evbuffer_remove(out, text, length);
+    evbuffer_free(out);
+    return text;
+}
+
+describe(metrics) {
+    it("Observations land in the first bucket that fits them") {
+        struct metrics_histogram h = {0};
+        metrics_histogram_observe(&h, 0.00005);
+        metrics_histogram_observe(&h, 0.001);
+        metrics_histogram_observe(&h, 0.005);
+        metrics_histogram_observe(&h, 0.3);
+        metrics_histogram_observe(&h, 60.0);
+
+        asserteq(h.count, 5);
+        asserteq(h.buckets[0], 1);
+        asserteq(h.buckets[2], 1);
+        asserteq(h.buckets[3], 1);
+        asserteq(h.buckets[9], 1);
+        asserteq(h.buckets[METRICS_LATENCY_BUCKETS], 1);
+    };
+
+    it("Signals are counted per player") {
+        memset(&metrics_registry, 0, sizeof(metrics_registry));
+        metrics_player_signal("org.mpris.MediaPlayer2.mpv");
+        metrics_player_signal("org.mpris.MediaPlayer2.spotify");
+        metrics_player_signal("org.mpris.MediaPlayer2.mpv");
+        asserteq(metrics_registry.player_count, 2);
+        asserteq(metrics_registry.players[0].signals, 2);
+        asserteq(metrics_registry.players[1].signals, 1);
+
+        for (int i = 0; i < 2 * METRICS_MAX_PLAYERS; i++) {
+            char name[MAX_PROPERTY_LENGTH + 1] = {0};
+            snprintf(name, MAX_PROPERTY_LENGTH, "org.mpris.MediaPlayer2.chromium.instance%d", i);
+            metrics_player_signal(name);
+        }
+        asserteq(metrics_registry.player_count, METRICS_MAX_PLAYERS);
+        asserteq(metrics_registry.other_player_signals, METRICS_MAX_PLAYERS + 2);
+    };
+
+    it("Rendering the OpenMetrics text") {
+        memset(&metrics_registry, 0, sizeof(metrics_registry));
+        metrics_player_signal("org.mpris.MediaPlayer2.\"quoted\"");
+        metrics_request_done(api_listenbrainz, request_scrobble, true);
+        metrics_histogram_observe(&metrics_registry.http_duration[api_listenbrainz][metrics_phase_total], 0.2);
+
+        char *text = render(&metrics_registry);
+        assertneq(strstr(text, "mpris_scrobbler_dbus_signals_total{player=\"org.mpris.MediaPlayer2.\\\"quoted\\\"\"} 1\n"), NULL);
+        assertneq(strstr(text, "mpris_scrobbler_requests_total{api=\"listenbrainz.org\",type=\"scrobble\",result=\"ok\"} 1\n"), NULL);
+        assertneq(strstr(text, "mpris_scrobbler_http_duration_seconds_bucket{api=\"listenbrainz.org\",phase=\"total\",le=\"0.1\"} 0\n"), NULL);
+        assertneq(strstr(text, "mpris_scrobbler_http_duration_seconds_bucket{api=\"listenbrainz.org\",phase=\"total\",le=\"0.25\"} 1\n"), NULL);
+        assertneq(strstr(text, "mpris_scrobbler_http_duration_seconds_bucket{api=\"listenbrainz.org\",phase=\"total\",le=\"+Inf\"} 1\n"), NULL);
+        // NOTE(marius): without a state there are no gauges
+        asserteq(strstr(text, "mpris_scrobbler_queue_length"), NULL);
+
+        const size_t length = strlen(text);
+        asserteq(strcmp(text + length - strlen("# EOF\n"), "# EOF\n"), 0);
+        free(text);
+    };
+
+    it("The loop profiler only measures while it's enabled") {
+        memset(&metrics_registry, 0, sizeof(metrics_registry));
+        asserteq(loop_profiler_start(), 0);
+        loop_profiler_end(loop_probe_dbus_filter, loop_profiler_start());
+        asserteq(metrics_registry.loop[loop_probe_dbus_filter].duration.count, 0);
+
+        loop_profiler_toggle(SIGUSR1, 0, NULL);
+        asserteq(metrics_registry.loop_profiling, true);
+        loop_profiler_end(loop_probe_dbus_filter, loop_profiler_start());
+        // NOTE(marius): a callback that started a second ago is slow
+        loop_profiler_end(loop_probe_dbus_filter, loop_profiler_now() - 1.0);
+        asserteq(metrics_registry.loop[loop_probe_dbus_filter].duration.count, 2);
+        asserteq(metrics_registry.loop[loop_probe_dbus_filter].slow, 1);
+        asserteq(metrics_registry.loop[loop_probe_dbus_filter].max_duration >= 1.0, true);
+
+        double deadline = 0;
+        const struct timeval in_a_second = { .tv_sec = 1, };
+        loop_profiler_arm(&deadline, in_a_second);
+        loop_profiler_timer_fired(loop_probe_queue, deadline - 2.0);
+        asserteq(metrics_registry.loop[loop_probe_queue].lateness.count, 1);
+        asserteq(metrics_registry.loop[loop_probe_queue].lateness.sum >= 1.0, true);
+        // NOTE(marius): a timer that fires early isn't late
+        loop_profiler_timer_fired(loop_probe_queue, deadline);
+        asserteq(metrics_registry.loop[loop_probe_queue].lateness.buckets[0], 1);
+
+        char *text = render(&metrics_registry);
+        assertneq(strstr(text, "mpris_scrobbler_loop_profiling 1\n"), NULL);
+        assertneq(strstr(text, "mpris_scrobbler_loop_slow_callbacks_total{probe=\"dbus_filter\"} 1\n"), NULL);
+        assertneq(strstr(text, "mpris_scrobbler_loop_timer_lateness_seconds_count{probe=\"queue\"} 2\n"), NULL);
+        free(text);
+
+        loop_profiler_toggle(SIGUSR1, 0, NULL);
+        asserteq(metrics_registry.loop_profiling, false);
+    };
+}
+
+snow_main();
@@ -0,0 +1,124 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "structs.h"
+#include "mpris_players.h"
+
+#include <snow/snow.h>
+
+#define PLAYER_COUNT 100
+
+static void player_names(const int i, char mpris_name[MAX_PROPERTY_LENGTH+1], char bus_id[MAX_PROPERTY_LENGTH+1])
+{
+    snprintf(mpris_name, MAX_PROPERTY_LENGTH, "org.mpris.MediaPlayer2.chromium.instance%d", i);
+    snprintf(bus_id, MAX_PROPERTY_LENGTH, ":1.%d", 100 + i);
+}
+
+describe(mpris_players) {
+    it("Adding players past the old limit of 10") {
+        struct mpris_players players = {0};
+        struct mpris_player *added[PLAYER_COUNT] = {0};
+
+        for (int i = 0; i < PLAYER_COUNT; i++) {
+            char mpris_name[MAX_PROPERTY_LENGTH+1] = {0};
+            char bus_id[MAX_PROPERTY_LENGTH+1] = {0};
+            player_names(i, mpris_name, bus_id);
+
+            added[i] = mpris_players_add(&players, mpris_name, bus_id);
+            assertneq(added[i], NULL);
+        }
+        asserteq(mpris_players_count(&players), PLAYER_COUNT);
+
+        for (int i = 0; i < PLAYER_COUNT; i++) {
+            char mpris_name[MAX_PROPERTY_LENGTH+1] = {0};
+            char bus_id[MAX_PROPERTY_LENGTH+1] = {0};
+            player_names(i, mpris_name, bus_id);
+
+            asserteq(mpris_players_find_by_name(&players, mpris_name), added[i]);
+            asserteq(mpris_players_find_by_bus_id(&players, bus_id), added[i]);
+        }
+        asserteq(mpris_players_find_by_bus_id(&players, ":1.1"), NULL);
+
+        for (int i = 0; i < PLAYER_COUNT; i++) {
+            asserteq(mpris_players_remove(&players, added[i]), true);
+            free(added[i]);
+        }
+        mpris_players_clean(&players);
+    };
+
+    it("Adding the same name twice fails") {
+        struct mpris_players players = {0};
+
+        struct mpris_player *first = mpris_players_add(&players, "org.mpris.MediaPlayer2.mpv", NULL);
+        assertneq(first, NULL);
+        asserteq(mpris_players_add(&players, "org.mpris.MediaPlayer2.mpv", ":1.42"), NULL);
+        asserteq(mpris_players_count(&players), 1);
+
+        mpris_players_remove(&players, first);
+        free(first);
+        mpris_players_clean(&players);
+    };
+
+    it("Players keep their address when others are removed") {
+        struct mpris_players players = {0};
+        struct mpris_player *added[PLAYER_COUNT] = {0};
+
+        for (int i = 0; i < PLAYER_COUNT; i++) {
+            char mpris_name[MAX_PROPERTY_LENGTH+1] = {0};
+            char bus_id[MAX_PROPERTY_LENGTH+1] = {0};
+            player_names(i, mpris_name, bus_id);
+            added[i] = mpris_players_add(&players, mpris_name, bus_id);
+        }
+        // NOTE(marius): removing every other player shifts the probe sequences of the ones left
+        for (int i = 0; i < PLAYER_COUNT; i += 2) {
+            asserteq(mpris_players_remove(&players, added[i]), true);
+            free(added[i]);
+            added[i] = NULL;
+        }
+        asserteq(mpris_players_count(&players), PLAYER_COUNT / 2);
+        asserteq(players.by_name.count, PLAYER_COUNT / 2);
+        asserteq(players.by_bus_id.count, PLAYER_COUNT / 2);
+
+        for (int i = 0; i < PLAYER_COUNT; i++) {
+            char mpris_name[MAX_PROPERTY_LENGTH+1] = {0};
+            char bus_id[MAX_PROPERTY_LENGTH+1] = {0};
+            player_names(i, mpris_name, bus_id);
+
+            asserteq(mpris_players_find_by_name(&players, mpris_name), added[i]);
+            asserteq(mpris_players_find_by_bus_id(&players, bus_id), added[i]);
+        }
+
+        for (int i = 1; i < PLAYER_COUNT; i += 2) {
+            mpris_players_remove(&players, added[i]);
+            free(added[i]);
+        }
+        asserteq(mpris_players_count(&players), 0);
+        mpris_players_clean(&players);
+    };
+
+    it("Setting the bus id re-indexes the player") {
+        struct mpris_players players = {0};
+
+        struct mpris_player *player = mpris_players_add(&players, "org.mpris.MediaPlayer2.spotify", NULL);
+        asserteq(mpris_players_find_by_bus_id(&players, ":1.7"), NULL);
+
+        mpris_players_set_bus_id(&players, player, ":1.7");
+        asserteq(mpris_players_find_by_bus_id(&players, ":1.7"), player);
+
+        mpris_players_set_bus_id(&players, player, ":1.8");
+        asserteq(mpris_players_find_by_bus_id(&players, ":1.7"), NULL);
+        asserteq(mpris_players_find_by_bus_id(&players, ":1.8"), player);
+        asserteq(players.by_bus_id.count, 1);
+
+        mpris_players_remove(&players, player);
+        free(player);
+        mpris_players_clean(&players);
+    };
+}
+
+snow_main();
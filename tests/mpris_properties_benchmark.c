@@ -0,0 +1,394 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "structs.h"
+#include "utils.h"
+#include "smpris.h"
+#include "mpris_properties.h"
+
+#define ITERATIONS 20000
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the benchmark doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+#define MPRIS_PLAYER_PATH          "/org/mpris/MediaPlayer2"
+#define MPRIS_PLAYER_INTERFACE     "org.mpris.MediaPlayer2.Player"
+
+static double elapsed_ms(const struct timespec start, const struct timespec end)
+{
+    return (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+// NOTE(marius): the field by field diff the signal handler did after decoding into a zeroed copy of the properties
+#define _copy_if_changed(a, b, whats_loaded, bitflag) \
+    if (whats_loaded & bitflag) { \
+        if (!_eq(a, b)) { \
+            _cpy(a, b); \
+        } else { \
+            _neg(whats_loaded, bitflag); \
+        } \
+    }
+
+static void legacy_load_properties_if_changed(struct mpris_properties *oldp, const struct mpris_properties *newp, struct mpris_event *changed)
+{
+    long int whats_loaded = changed->loaded_state;
+    _copy_if_changed(oldp->can_control, newp->can_control, whats_loaded, mpris_load_property_can_control);
+    _copy_if_changed(oldp->can_go_next, newp->can_go_next, whats_loaded, mpris_load_property_can_go_next);
+    _copy_if_changed(oldp->can_go_previous, newp->can_go_previous, whats_loaded, mpris_load_property_can_go_previous);
+    _copy_if_changed(oldp->can_pause, newp->can_pause, whats_loaded, mpris_load_property_can_pause);
+    _copy_if_changed(oldp->can_play, newp->can_play, whats_loaded, mpris_load_property_can_play);
+    _copy_if_changed(oldp->can_seek, newp->can_seek, whats_loaded, mpris_load_property_can_seek);
+    _copy_if_changed(oldp->loop_status, newp->loop_status, whats_loaded, mpris_load_property_loop_status);
+    _copy_if_changed(oldp->playback_status, newp->playback_status, whats_loaded, mpris_load_property_playback_status);
+    _copy_if_changed(oldp->position, newp->position, whats_loaded, mpris_load_property_position);
+    _copy_if_changed(oldp->shuffle, newp->shuffle, whats_loaded, mpris_load_property_shuffle);
+    _copy_if_changed(oldp->volume, newp->volume, whats_loaded, mpris_load_property_volume);
+    _copy_if_changed(oldp->metadata.bitrate, newp->metadata.bitrate, whats_loaded, mpris_load_metadata_bitrate);
+    _copy_if_changed(oldp->metadata.art_url, newp->metadata.art_url, whats_loaded, mpris_load_metadata_art_url);
+    _copy_if_changed(oldp->metadata.length, newp->metadata.length, whats_loaded, mpris_load_metadata_length);
+    _copy_if_changed(oldp->metadata.track_id, newp->metadata.track_id, whats_loaded, mpris_load_metadata_track_id);
+    _copy_if_changed(oldp->metadata.album, newp->metadata.album, whats_loaded, mpris_load_metadata_album);
+    _copy_if_changed(oldp->metadata.album_artist, newp->metadata.album_artist, whats_loaded, mpris_load_metadata_album_artist);
+    _copy_if_changed(oldp->metadata.artist, newp->metadata.artist, whats_loaded, mpris_load_metadata_artist);
+    _copy_if_changed(oldp->metadata.comment, newp->metadata.comment, whats_loaded, mpris_load_metadata_comment);
+    _copy_if_changed(oldp->metadata.title, newp->metadata.title, whats_loaded, mpris_load_metadata_title);
+    _copy_if_changed(oldp->metadata.track_number, newp->metadata.track_number, whats_loaded, mpris_load_metadata_track_number);
+    _copy_if_changed(oldp->metadata.url, newp->metadata.url, whats_loaded, mpris_load_metadata_url);
+    _copy_if_changed(oldp->metadata.genre, newp->metadata.genre, whats_loaded, mpris_load_metadata_genre);
+    _copy_if_changed(oldp->metadata.mb_track_id, newp->metadata.mb_track_id, whats_loaded, mpris_load_metadata_mb_track_id);
+    _copy_if_changed(oldp->metadata.mb_album_id, newp->metadata.mb_album_id, whats_loaded, mpris_load_metadata_mb_album_id);
+    _copy_if_changed(oldp->metadata.mb_artist_id, newp->metadata.mb_artist_id, whats_loaded, mpris_load_metadata_mb_artist_id);
+    _copy_if_changed(oldp->metadata.mb_album_artist_id, newp->metadata.mb_album_artist_id, whats_loaded, mpris_load_metadata_mb_album_artist_id);
+    changed->loaded_state = whats_loaded;
+}
+
+static void append_variant(DBusMessageIter *dict, const char *key, const int type, const void *value)
+{
+    const char signature[2] = { (char)type, '\0' };
+    DBusMessageIter entry, variant;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+    dbus_message_iter_append_basic(&variant, type, value);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static void append_string(DBusMessageIter *dict, const char *key, const char *value)
+{
+    append_variant(dict, key, DBUS_TYPE_STRING, &value);
+}
+
+static void append_string_array(DBusMessageIter *dict, const char *key, const char *const *values, const int count)
+{
+    DBusMessageIter entry, variant, array;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &variant);
+    dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s", &array);
+    for (int i = 0; i < count; i++) {
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &values[i]);
+    }
+    dbus_message_iter_close_container(&variant, &array);
+    dbus_message_iter_close_container(&entry, &variant);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+struct signal_track {
+    const char *track_id;
+    const char *title;
+    const char *album;
+    const char *url;
+    const char *art_url;
+    const char *artist[MAX_PROPERTY_COUNT + 2];
+    int artist_count;
+    int64_t length;
+    int32_t track_number;
+    bool spotify;
+};
+
+/*
+ * Builds the PropertiesChanged signal and round-trips it through the wire format,
+ * so the decoder reads it the same way as a message received from the bus.
+ */
+static DBusMessage *properties_changed(const struct signal_track *track, const char *playback_status, const double *volume)
+{
+    DBusMessage *msg = dbus_message_new_signal(MPRIS_PLAYER_PATH, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
+    assert(msg);
+
+    DBusMessageIter args, dict, entry, variant, metadata, invalidated;
+    const char *interface = MPRIS_PLAYER_INTERFACE;
+    dbus_message_iter_init_append(msg, &args);
+    dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &interface);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    if (NULL != track) {
+        const char *key = MPRIS_PNAME_METADATA;
+        dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+        dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "a{sv}", &variant);
+        dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "{sv}", &metadata);
+
+        if (track->spotify) {
+            // NOTE(marius): spotify sends the track id as a string and the length as an unsigned value
+            const uint64_t length = (uint64_t)track->length;
+            const double auto_rating = 0.52;
+            const int32_t disc_number = 1;
+            append_string(&metadata, MPRIS_METADATA_TRACKID, track->track_id);
+            append_variant(&metadata, MPRIS_METADATA_LENGTH, DBUS_TYPE_UINT64, &length);
+            append_string(&metadata, MPRIS_METADATA_ART_URL, track->art_url);
+            append_string(&metadata, MPRIS_METADATA_ALBUM, track->album);
+            append_string_array(&metadata, MPRIS_METADATA_ALBUM_ARTIST, track->artist, 1);
+            append_string_array(&metadata, MPRIS_METADATA_ARTIST, track->artist, track->artist_count);
+            append_variant(&metadata, "xesam:autoRating", DBUS_TYPE_DOUBLE, &auto_rating);
+            append_variant(&metadata, "xesam:discNumber", DBUS_TYPE_INT32, &disc_number);
+            append_string(&metadata, MPRIS_METADATA_TITLE, track->title);
+            append_variant(&metadata, MPRIS_METADATA_TRACK_NUMBER, DBUS_TYPE_INT32, &track->track_number);
+            append_string(&metadata, MPRIS_METADATA_URL, track->url);
+        } else {
+            append_variant(&metadata, MPRIS_METADATA_TRACKID, DBUS_TYPE_OBJECT_PATH, &track->track_id);
+            append_variant(&metadata, MPRIS_METADATA_LENGTH, DBUS_TYPE_INT64, &track->length);
+            append_string(&metadata, MPRIS_METADATA_TITLE, track->title);
+            append_string(&metadata, MPRIS_METADATA_ALBUM, track->album);
+            append_string_array(&metadata, MPRIS_METADATA_ARTIST, track->artist, track->artist_count);
+            append_string(&metadata, MPRIS_METADATA_URL, track->url);
+        }
+        dbus_message_iter_close_container(&variant, &metadata);
+        dbus_message_iter_close_container(&entry, &variant);
+        dbus_message_iter_close_container(&dict, &entry);
+    }
+    if (NULL != playback_status) {
+        append_string(&dict, MPRIS_PNAME_PLAYBACKSTATUS, playback_status);
+    }
+    if (NULL != volume) {
+        append_variant(&dict, MPRIS_PNAME_VOLUME, DBUS_TYPE_DOUBLE, volume);
+    }
+    dbus_message_iter_close_container(&args, &dict);
+    dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "s", &invalidated);
+    dbus_message_iter_close_container(&args, &invalidated);
+
+    char *wire = NULL;
+    int wire_len = 0;
+    dbus_message_set_serial(msg, 1);
+    bool marshalled = dbus_message_marshal(msg, &wire, &wire_len);
+    assert(marshalled);
+    dbus_message_unref(msg);
+
+    DBusError err;
+    dbus_error_init(&err);
+    DBusMessage *received = dbus_message_demarshal(wire, wire_len, &err);
+    assert(received);
+    dbus_free(wire);
+    return received;
+}
+
+static bool decode(DBusMessage *msg, struct mpris_properties *properties, struct mpris_event *changes)
+{
+    DBusMessageIter args;
+    if (!dbus_message_iter_init(msg, &args)) { return false; }
+    // NOTE(marius): skip the interface name
+    if (!dbus_message_iter_next(&args)) { return false; }
+    return load_properties(&args, properties, changes);
+}
+
+static const struct signal_track spotify_tracks[] = {
+    {
+        .track_id = "spotify:track:6LgJvl0Xdtc73RJ1mmpotq",
+        .title = "Paranoid Android",
+        .album = "OK Computer",
+        .url = "https://open.spotify.com/track/6LgJvl0Xdtc73RJ1mmpotq",
+        .art_url = "https://i.scdn.co/image/ab67616d0000b273c8b444df094279e70d0ed856",
+        .artist = {"Radiohead"},
+        .artist_count = 1,
+        .length = 387000000,
+        .track_number = 2,
+        .spotify = true,
+    },
+    {
+        .track_id = "spotify:track:3SVAN3BRByDmHOhKyIDxfC",
+        .title = "Get Lucky (feat. Pharrell Williams and Nile Rodgers)",
+        .album = "Random Access Memories",
+        .url = "https://open.spotify.com/track/3SVAN3BRByDmHOhKyIDxfC",
+        .art_url = "https://i.scdn.co/image/ab67616d0000b2739b9b36b0e22870b9f542d937",
+        .artist = {"Daft Punk", "Pharrell Williams", "Nile Rodgers"},
+        .artist_count = 3,
+        .length = 369626000,
+        .track_number = 8,
+        .spotify = true,
+    },
+};
+
+static const struct signal_track mpv_tracks[] = {
+    {
+        .track_id = "/io/mpv",
+        .title = "Paranoid Android",
+        .album = "OK Computer",
+        .url = "file:///music/Radiohead/OK%20Computer/02%20Paranoid%20Android.flac",
+        .artist = {"Radiohead"},
+        .artist_count = 1,
+        .length = 387000000,
+    },
+    {
+        .track_id = "/io/mpv",
+        .title = "Windowlicker",
+        .album = "Windowlicker",
+        .url = "file:///music/Aphex%20Twin/Windowlicker/01%20Windowlicker.flac",
+        .artist = {"Aphex Twin"},
+        .artist_count = 1,
+        .length = 367000000,
+    },
+};
+
+#define SPOTIFY_SIGNALS 8
+#define MPV_SIGNALS 8
+
+/*
+ * Spotify sends the whole metadata again on every playback status change, often twice in a row.
+ * mpv sends the metadata on track changes and one signal per property otherwise, the volume changes being the most frequent.
+ */
+static void load_corpus(DBusMessage *spotify[SPOTIFY_SIGNALS], DBusMessage *mpv[MPV_SIGNALS])
+{
+    const double volumes[] = { 0.8, 0.75, 0.7, 0.65 };
+
+    spotify[0] = properties_changed(&spotify_tracks[0], MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+    spotify[1] = properties_changed(&spotify_tracks[0], MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+    spotify[2] = properties_changed(&spotify_tracks[0], MPRIS_PLAYBACK_STATUS_PAUSED, NULL);
+    spotify[3] = properties_changed(&spotify_tracks[0], MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+    spotify[4] = properties_changed(&spotify_tracks[1], MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+    spotify[5] = properties_changed(&spotify_tracks[1], MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+    spotify[6] = properties_changed(&spotify_tracks[1], MPRIS_PLAYBACK_STATUS_PAUSED, NULL);
+    spotify[7] = properties_changed(&spotify_tracks[1], MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+
+    mpv[0] = properties_changed(&mpv_tracks[0], NULL, NULL);
+    mpv[1] = properties_changed(NULL, MPRIS_PLAYBACK_STATUS_PLAYING, NULL);
+    mpv[2] = properties_changed(NULL, NULL, &volumes[0]);
+    mpv[3] = properties_changed(NULL, NULL, &volumes[1]);
+    mpv[4] = properties_changed(&mpv_tracks[1], NULL, NULL);
+    mpv[5] = properties_changed(NULL, NULL, &volumes[2]);
+    mpv[6] = properties_changed(NULL, MPRIS_PLAYBACK_STATUS_PAUSED, NULL);
+    mpv[7] = properties_changed(NULL, NULL, &volumes[3]);
+}
+
+static void check_decoder(DBusMessage *spotify[SPOTIFY_SIGNALS])
+{
+    struct mpris_properties *properties = calloc(1, sizeof(struct mpris_properties));
+    struct mpris_event changes = {0};
+
+    assert(decode(spotify[0], properties, &changes));
+    assert(changes.track_changed && changes.playback_status_changed);
+    assert(changes.loaded_state & mpris_load_metadata_title);
+    assert(changes.loaded_state & mpris_load_metadata_length);
+    assert(changes.player_state == playing);
+    assert(strcmp(properties->metadata.title, "Paranoid Android") == 0);
+    assert(strcmp(properties->metadata.album_artist[0], "Radiohead") == 0);
+    assert(strcmp(properties->metadata.album, "OK Computer") == 0);
+    assert(properties->metadata.length == 387000000);
+    assert(properties->metadata.track_number == 2);
+
+    // NOTE(marius): a repeated signal decodes to no changes
+    memset(&changes, 0, sizeof(changes));
+    assert(decode(spotify[1], properties, &changes));
+    assert(changes.loaded_state == mpris_load_nothing);
+    assert(!changes.track_changed && !changes.playback_status_changed);
+
+    // NOTE(marius): shorter values leave no trailing bytes from the longer ones they replace
+    struct mpris_properties *expected = calloc(1, sizeof(struct mpris_properties));
+    assert(decode(spotify[4], properties, &changes));
+    assert(decode(spotify[0], properties, &changes));
+    assert(decode(spotify[0], expected, &changes));
+    assert(memcmp(properties, expected, sizeof(struct mpris_properties)) == 0);
+
+    // NOTE(marius): the artists past MAX_PROPERTY_COUNT are dropped
+    struct signal_track crowded = spotify_tracks[0];
+    crowded.artist_count = MAX_PROPERTY_COUNT + 2;
+    for (int i = 0; i < crowded.artist_count; i++) {
+        crowded.artist[i] = "Radiohead";
+    }
+    DBusMessage *msg = properties_changed(&crowded, NULL, NULL);
+    memset(&changes, 0, sizeof(changes));
+    assert(decode(msg, properties, &changes));
+    assert(changes.loaded_state == mpris_load_metadata_artist);
+    assert(strcmp(properties->metadata.artist[MAX_PROPERTY_COUNT-1], "Radiohead") == 0);
+    dbus_message_unref(msg);
+
+    free(expected);
+    free(properties);
+}
+
+struct benchmark_result {
+    double legacy_ms;
+    double in_place_ms;
+    unsigned long changed;
+};
+
+static struct benchmark_result run(DBusMessage *corpus[], const int count)
+{
+    struct benchmark_result result = {0};
+    struct mpris_properties *player = calloc(1, sizeof(struct mpris_properties));
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < count; j++) {
+            struct mpris_properties properties = {0};
+            struct mpris_event changes = {0};
+            decode(corpus[j], &properties, &changes);
+            // NOTE(marius): every value loaded into the zeroed copy was reported as changed
+            changes.loaded_state = mpris_load_all;
+            legacy_load_properties_if_changed(player, &properties, &changes);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result.legacy_ms = elapsed_ms(start, end);
+
+    memset(player, 0, sizeof(struct mpris_properties));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < count; j++) {
+            struct mpris_event changes = {0};
+            decode(corpus[j], player, &changes);
+            result.changed += changes.loaded_state != mpris_load_nothing;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result.in_place_ms = elapsed_ms(start, end);
+
+    free(player);
+    return result;
+}
+
+int main(void)
+{
+    DBusMessage *spotify[SPOTIFY_SIGNALS] = {0};
+    DBusMessage *mpv[MPV_SIGNALS] = {0};
+    load_corpus(spotify, mpv);
+
+    check_decoder(spotify);
+
+    const struct benchmark_result spotify_result = run(spotify, SPOTIFY_SIGNALS);
+    const struct benchmark_result mpv_result = run(mpv, MPV_SIGNALS);
+
+    const double spotify_signals = (double)ITERATIONS * SPOTIFY_SIGNALS;
+    const double mpv_signals = (double)ITERATIONS * MPV_SIGNALS;
+
+    fprintf(stdout, "bytes per signal:      legacy %8zu bytes, in place %8zu bytes\n", sizeof(struct mpris_properties) + sizeof(struct mpris_event), sizeof(struct mpris_event));
+    fprintf(stdout, "spotify signals/s:     legacy %8.0f,       in place %8.0f (%lu/%.0f changed)\n",
+            spotify_signals / spotify_result.legacy_ms * 1000.0, spotify_signals / spotify_result.in_place_ms * 1000.0,
+            spotify_result.changed, spotify_signals);
+    fprintf(stdout, "mpv signals/s:         legacy %8.0f,       in place %8.0f (%lu/%.0f changed)\n",
+            mpv_signals / mpv_result.legacy_ms * 1000.0, mpv_signals / mpv_result.in_place_ms * 1000.0,
+            mpv_result.changed, mpv_signals);
+
+    for (int i = 0; i < SPOTIFY_SIGNALS; i++) {
+        dbus_message_unref(spotify[i]);
+    }
+    for (int i = 0; i < MPV_SIGNALS; i++) {
+        dbus_message_unref(mpv[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "api.h"
+#include "scrobble_arena.h"
+#include "now_playing_cache.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+static bool scrobble_is_empty(const struct scrobble *s)
+{
+    return !scrobble_has_strings(s);
+}
+
+static double min_scrobble_delay_seconds(const struct scrobble *s)
+{
+    return s->length / 2;
+}
+
+// NOTE(marius): the moments are made up, the cache only ever gets the time it's given
+#define T0 1700000000
+
+static struct scrobble track(const char *title, const char *artist, const char *album, const double length)
+{
+    struct scrobble s = {0};
+    s.title = (char*)title;
+    s.album = (char*)album;
+    s.artist[0] = (char*)artist;
+    s.player_name = "mpd";
+    s.length = length;
+    return s;
+}
+
+describe(now_playing_cache) {
+    it("The same track isn't announced again while the service shows it") {
+        struct now_playing_cache cache = {0};
+        const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", 387);
+        asserteq(now_playing_cache_fresh(&cache, &t, T0), false);
+
+        now_playing_cache_put(&cache, &t, T0);
+        asserteq(now_playing_cache_fresh(&cache, &t, T0 + 1), true);
+        asserteq(now_playing_cache_fresh(&cache, &t, T0 + 300), true);
+        // NOTE(marius): the next periodic request would come after the service stopped showing the track
+        asserteq(now_playing_cache_fresh(&cache, &t, T0 + 330), false);
+    };
+
+    it("Another track is always announced") {
+        struct now_playing_cache cache = {0};
+        const struct scrobble first = track("Paranoid Android", "Radiohead", "OK Computer", 387);
+        const struct scrobble second = track("Karma Police", "Radiohead", "OK Computer", 264);
+        now_playing_cache_put(&cache, &first, T0);
+        asserteq(now_playing_cache_fresh(&cache, &second, T0 + 1), false);
+
+        // NOTE(marius): the service shows the last track it was told about, going back to the first one is a change
+        now_playing_cache_put(&cache, &second, T0 + 1);
+        asserteq(now_playing_cache_fresh(&cache, &second, T0 + 2), true);
+        asserteq(now_playing_cache_fresh(&cache, &first, T0 + 2), false);
+    };
+
+    it("The fields don't run into each other") {
+        const struct scrobble one = track("ab", "c", "d", 200);
+        const struct scrobble other = track("a", "bc", "d", 200);
+        asserteq(now_playing_hash(&one) != now_playing_hash(&other), true);
+
+        struct scrobble no_album = track("Paranoid Android", "Radiohead", NULL, 387);
+        const struct scrobble with_album = track("Paranoid Android", "Radiohead", "OK Computer", 387);
+        asserteq(now_playing_hash(&no_album) != now_playing_hash(&with_album), true);
+    };
+
+    it("The tracks without a length use the default expiry") {
+        struct now_playing_cache cache = {0};
+        const struct scrobble t = track("Stream", "Radio", NULL, 0);
+        now_playing_cache_put(&cache, &t, T0);
+        asserteq(cache.expires, T0 + NOW_PLAYING_CACHE_DEFAULT_TTL);
+    };
+
+    it("A failure clears the cache") {
+        struct now_playing_cache cache = {0};
+        const struct scrobble t = track("Paranoid Android", "Radiohead", "OK Computer", 387);
+        now_playing_cache_put(&cache, &t, T0);
+        now_playing_cache_clear(&cache);
+        asserteq(now_playing_cache_fresh(&cache, &t, T0 + 1), false);
+    };
+}
+
+snow_main();
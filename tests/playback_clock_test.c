@@ -0,0 +1,90 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+
+#include "structs.h"
+#include "playback_clock.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the moments are made up, the clock only ever gets the time it's given
+#define T0 1000.0
+
+describe(playback_clock) {
+    it("Time only adds up while playing") {
+        struct playback_clock clock = {0};
+        playback_clock_start_track(&clock, 0, true, T0);
+        asserteq(playback_clock_listened(&clock, T0 + 30), 30.0);
+
+        playback_clock_set_running(&clock, false, T0 + 30);
+        asserteq(playback_clock_listened(&clock, T0 + 600), 30.0);
+        asserteq(playback_clock_until(&clock, 120, T0 + 600), -1.0);
+
+        playback_clock_set_running(&clock, true, T0 + 600);
+        asserteq(playback_clock_listened(&clock, T0 + 610), 40.0);
+        asserteq(playback_clock_until(&clock, 120, T0 + 610), 80.0);
+    };
+
+    it("Seeking moves the position, not the listened time") {
+        struct playback_clock clock = {0};
+        playback_clock_start_track(&clock, 0, true, T0);
+        asserteq(playback_clock_seek(&clock, 200, T0 + 10), false);
+        asserteq(playback_clock_position(&clock, T0 + 20), 210.0);
+        asserteq(playback_clock_listened(&clock, T0 + 20), 20.0);
+        asserteq(playback_clock_until(&clock, 120, T0 + 20), 100.0);
+
+        asserteq(playback_clock_seek(&clock, 0, T0 + 30), false);
+        asserteq(playback_clock_listened(&clock, T0 + 30), 30.0);
+    };
+
+    it("The rate changes the pace of the clock") {
+        struct playback_clock clock = {0};
+        playback_clock_start_track(&clock, 0, true, T0);
+        playback_clock_set_rate(&clock, 2.0, T0 + 10);
+        asserteq(playback_clock_listened(&clock, T0 + 20), 30.0);
+        asserteq(playback_clock_until(&clock, 120, T0 + 20), 45.0);
+
+        // NOTE(marius): a player without a rate plays at normal speed
+        playback_clock_set_rate(&clock, 0, T0 + 20);
+        asserteq(playback_clock_listened(&clock, T0 + 30), 40.0);
+    };
+
+    it("A queued track is only queued again after it restarts") {
+        struct playback_clock clock = {0};
+        playback_clock_start_track(&clock, 0, true, T0);
+        asserteq(playback_clock_until(&clock, 120, T0 + 120), 0.0);
+        clock.queued = true;
+        asserteq(playback_clock_until(&clock, 120, T0 + 121), -1.0);
+
+        // NOTE(marius): seeking around the track is not a restart
+        asserteq(playback_clock_seek(&clock, 60, T0 + 130), false);
+        asserteq(playback_clock_until(&clock, 120, T0 + 131), -1.0);
+
+        asserteq(playback_clock_seek(&clock, 0, T0 + 140), true);
+        asserteq(clock.queued, false);
+        asserteq(playback_clock_listened(&clock, T0 + 140), 0.0);
+        asserteq(playback_clock_until(&clock, 120, T0 + 150), 110.0);
+    };
+
+    it("A track that was already playing counts from its position") {
+        struct playback_clock clock = {0};
+        playback_clock_start_track(&clock, 100, true, T0);
+        asserteq(playback_clock_listened(&clock, T0), 100.0);
+        asserteq(playback_clock_until(&clock, 120, T0), 20.0);
+
+        playback_clock_start_track(&clock, 300, false, T0);
+        asserteq(playback_clock_until(&clock, 120, T0), 0.0);
+    };
+
+    it("The clock doesn't go back") {
+        struct playback_clock clock = {0};
+        const double now = playback_clock_now();
+        playback_clock_start_track(&clock, 0, true, now);
+        asserteq(playback_clock_listened(&clock, playback_clock_now()) >= 0, true);
+        asserteq(playback_clock_listened(&clock, now - 10), 0.0);
+    };
+}
+
+snow_main();
@@ -0,0 +1,159 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "structs.h"
+#include "scrobble_arena.h"
+
+#define ITERATIONS 100000
+
+// NOTE(marius): the layout of struct scrobble before the strings were moved to an arena
+struct fixed_scrobble {
+    double play_time;
+    double position;
+    double length;
+    time_t start_time;
+
+    bool scrobbled;
+    unsigned short track_number;
+
+    char url[MAX_PROPERTY_LENGTH+1];
+    char title[MAX_PROPERTY_LENGTH+1];
+    char album[MAX_PROPERTY_LENGTH+1];
+    char artist[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+
+    char mb_track_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_album_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char mb_album_artist_id[MAX_PROPERTY_COUNT][MAX_PROPERTY_LENGTH+1];
+    char player_name[MAX_PROPERTY_LENGTH+1];
+    char mb_spotify_id[MAX_PROPERTY_LENGTH+1];
+};
+
+static double elapsed_ms(const struct timespec start, const struct timespec end)
+{
+    return (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+static void load_track(struct scrobble *s)
+{
+    struct scrobble values = {0};
+    values.title = "Paranoid Android";
+    values.album = "OK Computer";
+    values.url = "file:///music/Radiohead/OK%20Computer/02%20Paranoid%20Android.flac";
+    values.player_name = "mpd";
+    values.artist[0] = "Radiohead";
+    values.mb_track_id[0] = "8cdc8f4c-4f9a-4c5f-a6f5-e0d5d2a7bf0f";
+    values.mb_album_id[0] = "b1392450-e666-3926-a536-22c65f834433";
+    values.mb_artist_id[0] = "a74b1b7f-71a5-4011-9441-d0b5e4122711";
+    values.mb_album_artist_id[0] = "a74b1b7f-71a5-4011-9441-d0b5e4122711";
+
+    s->length = 387.0;
+    s->track_number = 2;
+    const bool loaded = scrobble_load_strings(s, values.strings);
+    assert(loaded);
+}
+
+static void load_fixed_track(struct fixed_scrobble *s)
+{
+    memset(s, 0, sizeof(*s));
+    strncpy(s->title, "Paranoid Android", MAX_PROPERTY_LENGTH);
+    strncpy(s->album, "OK Computer", MAX_PROPERTY_LENGTH);
+    strncpy(s->url, "file:///music/Radiohead/OK%20Computer/02%20Paranoid%20Android.flac", MAX_PROPERTY_LENGTH);
+    strncpy(s->player_name, "mpd", MAX_PROPERTY_LENGTH);
+    strncpy(s->artist[0], "Radiohead", MAX_PROPERTY_LENGTH);
+    strncpy(s->mb_track_id[0], "8cdc8f4c-4f9a-4c5f-a6f5-e0d5d2a7bf0f", MAX_PROPERTY_LENGTH);
+    strncpy(s->mb_album_id[0], "b1392450-e666-3926-a536-22c65f834433", MAX_PROPERTY_LENGTH);
+    strncpy(s->mb_artist_id[0], "a74b1b7f-71a5-4011-9441-d0b5e4122711", MAX_PROPERTY_LENGTH);
+    strncpy(s->mb_album_artist_id[0], "a74b1b7f-71a5-4011-9441-d0b5e4122711", MAX_PROPERTY_LENGTH);
+    s->length = 387.0;
+    s->track_number = 2;
+}
+
+static void check_arena(void)
+{
+    struct scrobble original = {0};
+    struct scrobble copy = {0};
+    load_track(&original);
+    scrobble_copy(&copy, &original);
+
+    assert(copy.arena != original.arena);
+    assert(copy.arena_size == original.arena_size);
+    for (int i = 0; i < SCROBBLE_STRING_COUNT; i++) {
+        assert(copy.strings[i] >= copy.arena && copy.strings[i] < copy.arena + copy.arena_size);
+        assert(strcmp(copy.strings[i], original.strings[i]) == 0);
+    }
+    // NOTE(marius): identical values are interned and the empty ones share the first byte of the arena
+    assert(copy.mb_artist_id[0] == copy.mb_album_artist_id[0]);
+    assert(copy.mb_spotify_id == copy.arena);
+    assert(copy.artist[1] == copy.arena);
+    assert(scrobble_strings_equal(&copy, &original));
+
+    scrobble_clean(&copy);
+    scrobble_clean(&original);
+    assert(NULL == copy.arena && NULL == copy.title);
+}
+
+/*
+ * On every track change the daemon copies the scrobble into the now playing payload, into the queue payload
+ * and into the queue, then clears the queue entry once it was submitted.
+ */
+#define COPIES_PER_TRACK_CHANGE 3
+
+int main(void)
+{
+    check_arena();
+
+    struct fixed_scrobble *fixed_source = calloc(1, sizeof(struct fixed_scrobble));
+    struct fixed_scrobble *fixed_payloads = calloc(COPIES_PER_TRACK_CHANGE, sizeof(struct fixed_scrobble));
+    struct scrobble source = {0};
+    struct scrobble payloads[COPIES_PER_TRACK_CHANGE] = {0};
+
+    load_fixed_track(fixed_source);
+    load_track(&source);
+
+    const size_t fixed_bytes = COPIES_PER_TRACK_CHANGE * sizeof(struct fixed_scrobble) + sizeof(struct fixed_scrobble);
+    const size_t arena_bytes = COPIES_PER_TRACK_CHANGE * (sizeof(struct scrobble) + source.arena_size) + sizeof(struct scrobble);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < COPIES_PER_TRACK_CHANGE; j++) {
+            memcpy(&fixed_payloads[j], fixed_source, sizeof(struct fixed_scrobble));
+        }
+        memset(&fixed_payloads[COPIES_PER_TRACK_CHANGE-1], 0, sizeof(struct fixed_scrobble));
+        fixed_source->position = (double)i;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double fixed_ms = elapsed_ms(start, end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < COPIES_PER_TRACK_CHANGE; j++) {
+            scrobble_copy(&payloads[j], &source);
+        }
+        scrobble_clean(&payloads[COPIES_PER_TRACK_CHANGE-1]);
+        memset(&payloads[COPIES_PER_TRACK_CHANGE-1], 0, sizeof(struct scrobble));
+        source.position = (double)i;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double arena_ms = elapsed_ms(start, end);
+
+    fprintf(stdout, "scrobble size:        fixed %8zu bytes, arena %8zu + %zu bytes\n", sizeof(struct fixed_scrobble), sizeof(struct scrobble), source.arena_size);
+    fprintf(stdout, "queue size:           fixed %8zu bytes, arena %8zu bytes\n", MAX_QUEUE_LENGTH * sizeof(struct fixed_scrobble), sizeof(struct scrobble_queue));
+    fprintf(stdout, "bytes per track:      fixed %8zu bytes, arena %8zu bytes\n", fixed_bytes, arena_bytes);
+    fprintf(stdout, "%d track changes:  fixed %8.3f ms,    arena %8.3f ms\n", ITERATIONS, fixed_ms, arena_ms);
+
+    for (int j = 0; j < COPIES_PER_TRACK_CHANGE; j++) {
+        scrobble_clean(&payloads[j]);
+    }
+    scrobble_clean(&source);
+    free(fixed_payloads);
+    free(fixed_source);
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define STB_DS_IMPLEMENTATION
+#include "stb_ds.h"
+#include "sstrings.h"
+#include "structs.h"
+#include "utils.h"
+#include "playback_clock.h"
+#include "timer_wheel.h"
+
+#include <snow/snow.h>
+
+// NOTE(marius): the signal handler in utils.h calls into the daemon, which the test doesn't link
+struct configuration_diff reload_state(struct state *s) { (void)s; return (struct configuration_diff){0}; }
+
+struct probe {
+    struct timer_wheel *wheel;
+    struct timer_entry entry;
+    unsigned fired;
+    double again; // adds itself back with this delay, when it's set
+    double now;
+};
+
+static void probe_fired(void *data)
+{
+    struct probe *p = data;
+    p->fired++;
+    if (p->again > 0) {
+        timer_wheel_add(p->wheel, &p->entry, p->again, probe_fired, p, p->now);
+    }
+}
+
+// NOTE(marius): without an event base the wheel only runs when it's told to, at the times the test makes up
+static void wheel_init(struct timer_wheel *wheel)
+{
+    timer_wheel_init(wheel, NULL);
+    wheel->origin = 0;
+}
+
+static double tick_end(const uint64_t tick)
+{
+    return (double)tick * TIMER_WHEEL_TICK_SECONDS;
+}
+
+describe(timer_wheel) {
+    it("Deadlines fire at the end of their tick, never before") {
+        struct timer_wheel wheel = {0};
+        wheel_init(&wheel);
+        struct probe a = {0}, b = {0};
+        timer_wheel_add(&wheel, &a.entry, 0.25, probe_fired, &a, 0);
+        timer_wheel_add(&wheel, &b.entry, 0.21, probe_fired, &b, 0);
+        asserteq(wheel.count, 2);
+
+        timer_wheel_run(&wheel, 2);
+        asserteq(a.fired + b.fired, 0);
+        // NOTE(marius): both deadlines are in the same tick, they fire with the same wakeup
+        asserteq(timer_wheel_next_tick(&wheel), 3);
+        asserteq(timer_wheel_run(&wheel, 3), 2);
+        asserteq(a.fired, 1);
+        asserteq(b.fired, 1);
+        asserteq(wheel.count, 0);
+        asserteq(timer_wheel_next_tick(&wheel), 0);
+    };
+
+    it("Far deadlines move down the levels until they're due") {
+        struct timer_wheel wheel = {0};
+        wheel_init(&wheel);
+        struct probe near = {0}, later = {0}, far = {0}, past_span = {0};
+        const double past_span_delay = tick_end(TIMER_WHEEL_SPAN) + 500;
+        timer_wheel_add(&wheel, &near.entry, 1, probe_fired, &near, 0);
+        timer_wheel_add(&wheel, &later.entry, 65, probe_fired, &later, 0);
+        timer_wheel_add(&wheel, &far.entry, 1000, probe_fired, &far, 0);
+        timer_wheel_add(&wheel, &past_span.entry, past_span_delay, probe_fired, &past_span, 0);
+
+        const uint64_t ticks[] = { 10, 650, 10000, (uint64_t)(past_span_delay / TIMER_WHEEL_TICK_SECONDS + 0.5), };
+        struct probe *probes[] = { &near, &later, &far, &past_span, };
+        for (size_t i = 0; i < array_count(ticks); i++) {
+            timer_wheel_run(&wheel, ticks[i] - 1);
+            asserteq(probes[i]->fired, 0);
+            asserteq(timer_wheel_next_tick(&wheel) <= ticks[i], true);
+            timer_wheel_run(&wheel, ticks[i]);
+            asserteq(probes[i]->fired, 1);
+        }
+        asserteq(wheel.count, 0);
+    };
+
+    it("Adding an entry again moves it, removing it stops it") {
+        struct timer_wheel wheel = {0};
+        wheel_init(&wheel);
+        struct probe p = {0};
+        timer_wheel_add(&wheel, &p.entry, 1, probe_fired, &p, 0);
+        timer_wheel_add(&wheel, &p.entry, 5, probe_fired, &p, 0);
+        asserteq(wheel.count, 1);
+        timer_wheel_run(&wheel, 49);
+        asserteq(p.fired, 0);
+        timer_wheel_run(&wheel, 50);
+        asserteq(p.fired, 1);
+
+        timer_wheel_add(&wheel, &p.entry, 1, probe_fired, &p, tick_end(50));
+        timer_wheel_remove(&wheel, &p.entry);
+        asserteq(timer_entry_pending(&p.entry), false);
+        asserteq(wheel.count, 0);
+        timer_wheel_run(&wheel, 100);
+        asserteq(p.fired, 1);
+    };
+
+    it("A callback can add its entry back") {
+        struct timer_wheel wheel = {0};
+        wheel_init(&wheel);
+        struct probe p = { .wheel = &wheel, .again = 6.5, };
+        timer_wheel_add(&wheel, &p.entry, 6.5, probe_fired, &p, 0);
+        for (uint64_t tick = 65; tick <= 650; tick += 65) {
+            p.now = tick_end(tick);
+            timer_wheel_run(&wheel, tick);
+            asserteq(p.fired, tick / 65);
+        }
+        asserteq(wheel.count, 1);
+        timer_wheel_clean(&wheel);
+        asserteq(timer_entry_pending(&p.entry), false);
+    };
+
+    it("The deadlines of a tick share one wakeup of the event loop") {
+        struct event_base *base = event_base_new();
+        struct timer_wheel wheel = {0};
+        timer_wheel_init(&wheel, base);
+        struct probe a = {0}, b = {0}, c = {0};
+        const double now = wheel.origin;
+        const double deadline_a = timer_wheel_add(&wheel, &a.entry, 0.05, probe_fired, &a, now);
+        const double deadline_b = timer_wheel_add(&wheel, &b.entry, 0.06, probe_fired, &b, now);
+        timer_wheel_add(&wheel, &c.entry, 0.15, probe_fired, &c, now);
+        asserteq(deadline_a, deadline_b);
+
+        unsigned wakeups = 0;
+        while (wheel.count > 0 && wakeups < 10) {
+            event_base_loop(base, EVLOOP_ONCE);
+            wakeups++;
+        }
+        asserteq(a.fired + b.fired + c.fired, 3);
+        asserteq(wakeups, 2);
+        asserteq(playback_clock_now() >= now + 0.15, true);
+
+        timer_wheel_clean(&wheel);
+        event_base_free(base);
+    };
+}
+
+snow_main();